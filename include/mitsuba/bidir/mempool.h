@@ -26,18 +26,39 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Memory pool for path vertices and edges
+ *
+ * The pool can operate in two modes: by default, every vertex and
+ * edge is individually returned to a free list when it is released,
+ * which suits paths that live for an arbitrary amount of time (e.g. the
+ * current state of an MLT chain). In \a arena mode, entries are instead
+ * taken from a contiguous block of memory, \ref release() does nothing,
+ * and all entries are reclaimed at once by \ref reset(). This is faster
+ * when the paths are discarded after every sample, and it causes the
+ * vertices of each subpath to be stored next to each other.
+ */
 class MemoryPool {
 public:
-	/// Create a new memory pool with aninitial set of 128 entries
-	MemoryPool(size_t nEntries = 128)
-		: m_vertexPool(nEntries), m_edgePool(nEntries) { }
+	/**
+	 * \brief Create a new memory pool
+	 *
+	 * \param nEntries
+	 *     Initial number of vertices and edges
+	 * \param arena
+	 *     Should the pool operate in arena mode?
+	 */
+	MemoryPool(size_t nEntries = 128, bool arena = false)
+		: m_vertexPool(arena ? 0 : nEntries), m_edgePool(arena ? 0 : nEntries),
+		  m_vertexArena(arena ? nEntries : 0), m_edgeArena(arena ? nEntries : 0),
+		  m_arena(arena) { }
 
 	/// Destruct the memory pool and release all entries
 	~MemoryPool() { }
 
 	/// Acquire an edge
 	inline PathEdge *allocEdge() {
-		PathEdge *edge = m_edgePool.alloc();
+		PathEdge *edge = m_arena ? m_edgeArena.alloc() : m_edgePool.alloc();
 		#if defined(MTS_BD_DEBUG_HEAVY)
 		memset(edge, 0xFF, sizeof(PathEdge));
 		#endif
@@ -46,51 +67,80 @@ public:
 
 	/// Acquire an vertex
 	inline PathVertex *allocVertex() {
-		PathVertex *vertex = m_vertexPool.alloc();
+		PathVertex *vertex = m_arena ? m_vertexArena.alloc() : m_vertexPool.alloc();
 		#if defined(MTS_BD_DEBUG_HEAVY)
 		memset(vertex, 0xFF, sizeof(PathVertex));
 		#endif
 		return vertex;
 	}
 
-	/// Release an edge
+	/// Release an edge (does nothing in arena mode)
 	inline void release(PathEdge *edge) {
-		m_edgePool.release(edge);
+		if (!m_arena)
+			m_edgePool.release(edge);
 	}
 
-	/// Release an entry
+	/// Release an entry (does nothing in arena mode)
 	inline void release(PathVertex *vertex) {
-		m_vertexPool.release(vertex);
+		if (!m_arena)
+			m_vertexPool.release(vertex);
+	}
+
+	/**
+	 * \brief Release all vertices and edges at once
+	 *
+	 * Only supported in arena mode. Any paths that still refer
+	 * to entries of the pool must not be used afterwards.
+	 */
+	inline void reset() {
+		SAssert(m_arena);
+		m_vertexArena.reset();
+		m_edgeArena.reset();
+	}
+
+	/// Does the memory pool operate in arena mode?
+	inline bool isArena() const {
+		return m_arena;
 	}
 
 	/// Check if every entry has been released
 	bool unused() const {
-		return m_vertexPool.unused() && m_edgePool.unused();
+		if (m_arena)
+			return m_vertexArena.unused() && m_edgeArena.unused();
+		else
+			return m_vertexPool.unused() && m_edgePool.unused();
 	}
 
 	/// Return the currently allocated amount of storage for edges
 	inline size_t edgeSize() {
-		return m_edgePool.size();
+		return m_arena ? m_edgeArena.size() : m_edgePool.size();
 	}
 
 	/// Return the currently allocated amount of storage for vertices
 	inline size_t vertexSize() {
-		return m_vertexPool.size();
+		return m_arena ? m_vertexArena.size() : m_vertexPool.size();
 	}
 
 	/// Return a human-readable description
 	std::string toString() const {
 		std::ostringstream oss;
-		oss << "MemoryPool[" << endl
-			<< "  vertexPool = " << m_vertexPool.toString() << "," << endl
-			<< "  edgePool = " << m_edgePool.toString() << endl
-			<< "]";
+		oss << "MemoryPool[" << endl;
+		if (m_arena)
+			oss << "  vertexArena = " << m_vertexArena.toString() << "," << endl
+				<< "  edgeArena = " << m_edgeArena.toString() << endl;
+		else
+			oss << "  vertexPool = " << m_vertexPool.toString() << "," << endl
+				<< "  edgePool = " << m_edgePool.toString() << endl;
+		oss << "]";
 		return oss.str();
 	}
 
 private:
 	BasicMemoryPool<PathVertex> m_vertexPool;
 	BasicMemoryPool<PathEdge> m_edgePool;
+	BasicMemoryArena<PathVertex> m_vertexArena;
+	BasicMemoryArena<PathEdge> m_edgeArena;
+	bool m_arena;
 };
 
 MTS_NAMESPACE_END
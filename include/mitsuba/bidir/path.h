@@ -475,7 +475,12 @@ public:
 	 */
 	void append(const Path &path, size_t start, size_t end, bool reverse = false);
 
-	/// Clear the path and release all elements to the memory pool
+	/**
+	 * \brief Clear the path and release all elements to the memory pool
+	 *
+	 * When the pool operates in arena mode, the elements are only
+	 * reclaimed by the next call to \ref MemoryPool::reset().
+	 */
 	void release(MemoryPool &pool);
 
 	/// Release a certain subpath [start, end) to the memory pool
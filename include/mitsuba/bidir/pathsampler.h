@@ -185,9 +185,21 @@ public:
 	void reconstructPath(const PathSeed &seed, 
 		const Bitmap *importanceMap, Path &result);
 
-	/// Return the underlying memory pool
+	/**
+	 * \brief Return the underlying memory pool
+	 *
+	 * Paths that are passed to the caller (e.g. by \ref reconstructPath())
+	 * are allocated from this pool.
+	 */
 	inline MemoryPool &getMemoryPool() { return m_pool; }
 
+	/**
+	 * \brief Return the memory arena used for the subpaths of a sample
+	 *
+	 * It is reset at the end of \ref sampleSplats() and \ref samplePaths().
+	 */
+	inline MemoryPool &getMemoryArena() { return m_arena; }
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
@@ -208,6 +220,7 @@ protected:
 	Path m_emitterSubpath, m_sensorSubpath;
 	Path m_connectionSubpath, m_fullPath;
 	MemoryPool m_pool;
+	MemoryPool m_arena;
 };
 
 /**
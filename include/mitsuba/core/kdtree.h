@@ -22,9 +22,20 @@
 
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/thread.h>
+
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
+/// Number of points, from which on \ref PointKDTree builds its hierarchy in parallel
+#define MTS_KD_PARALLEL_THRESHOLD 65536
+
+/// Number of points, from which on a split of \ref PointKDTree partitions its points in parallel
+#define MTS_KD_PARALLEL_PARTITION_THRESHOLD 262144
+
 /**
  * \brief Simple kd-tree node for use with \ref PointKDTree.
  *
@@ -208,6 +219,12 @@ template <typename _PointType, typename _DataRecord> struct LeftBalancedKDNode {
  * have some kind of spatial extent, the classes \ref GenericKDTree and
  * \ref ShapeKDTree will be more appropriate.
  *
+ * When OpenMP is available, large trees are constructed in parallel: the
+ * upper levels are split serially (partitioning their points using all
+ * threads), after which the remaining subtrees are built concurrently.
+ * When all point coordinates are distinct, the resulting hierarchy is
+ * identical to that of a serial build.
+ *
  * \tparam _NodeType Underlying node data structure. See \ref SimpleKDNode as
  * an example for the required public interface
  *
@@ -286,7 +303,8 @@ public:
 	 * number of points
 	 */
 	inline PointKDTree(size_t nodes = 0, EHeuristic heuristic = ESlidingMidpoint)
-		: m_nodes(nodes), m_heuristic(heuristic), m_depth(0) { }
+		: m_nodes(nodes), m_heuristic(heuristic), m_depth(0),
+		  m_parallelBuild(true) { }
 
 	// =============================================================
 	//! @{ \name \c stl::vector-like interface
@@ -321,6 +339,10 @@ public:
 	inline size_t getDepth() const { return m_depth; }
 	/// Set the depth of the constructed KD-tree (be careful with this)
 	inline void setDepth(size_t depth) { m_depth = depth; }
+	/// Specify whether \ref build() may use multiple threads (default: \c true)
+	inline void setParallelBuild(bool parallelBuild) { m_parallelBuild = parallelBuild; }
+	/// Return whether \ref build() may use multiple threads
+	inline bool getParallelBuild() const { return m_parallelBuild; }
 
 	/// Construct the KD-tree hierarchy
 	void build(bool recomputeAABB = false) {
@@ -351,17 +373,35 @@ public:
 		for (size_t i=0; i<m_nodes.size(); ++i)
 			indirection[i] = (IndexType) i;
 
+		/* Large trees are built in two phases: the upper levels are split
+		   serially, while deferring all sufficiently small subtrees to a
+		   task list that is subsequently processed by all threads */
+		BuildQueue queue, *queuePtr = NULL;
+#if defined(MTS_OPENMP)
+		size_t threadCount = (size_t) mts_omp_get_max_threads();
+		if (m_parallelBuild && threadCount > 1 &&
+				m_nodes.size() >= MTS_KD_PARALLEL_THRESHOLD) {
+			queue.taskSize = std::max(m_nodes.size() / (16 * threadCount),
+				(size_t) 4096);
+			queuePtr = &queue;
+		}
+#endif
+
+		AABBType aabb(m_aabb);
 		m_depth = 0;
 		int constructionTime;
 		if (NodeType::leftBalancedLayout) {
 			std::vector<IndexType> permutation(m_nodes.size());
 			buildLB(0, 1, indirection.begin(), indirection.begin(),
-				indirection.end(), permutation);
+				indirection.end(), permutation, aabb, m_depth, queuePtr);
+			runBuildTasks(queue, indirection.begin(), permutation);
 			constructionTime = timer->getMilliseconds();
 			timer->reset();
 			permute_inplace(&m_nodes[0], permutation);
 		} else {
-			build(1, indirection.begin(), indirection.begin(), indirection.end());
+			build(1, indirection.begin(), indirection.begin(),
+				indirection.end(), aabb, m_depth, queuePtr);
+			runBuildTasks(queue, indirection.begin(), indirection);
 			constructionTime = timer->getMilliseconds();
 			timer->reset();
 			permute_inplace(&m_nodes[0], indirection);
@@ -811,6 +851,35 @@ public:
 		}
 	}
 protected:
+	typedef typename std::vector<IndexType>::iterator IndexIterator;
+
+	/// Subtree, whose construction was deferred by a parallel build
+	struct BuildTask {
+		IndexIterator rangeStart, rangeEnd;
+		/// Node index (only used by the left-balanced layout)
+		IndexType idx;
+		/// Depth of the subtree root, and the maximum depth once built
+		size_t depth;
+		AABBType aabb;
+	};
+
+	/// Orders build tasks so that large subtrees are processed first
+	struct LargerBuildTask : public std::binary_function<BuildTask, BuildTask, bool> {
+	public:
+		inline bool operator()(const BuildTask &t1, const BuildTask &t2) const {
+			return (t1.rangeEnd - t1.rangeStart) > (t2.rangeEnd - t2.rangeStart);
+		}
+	};
+
+	/// Subtrees that are still to be built by a parallel build
+	struct BuildQueue {
+		std::vector<BuildTask> tasks;
+		/// Point count, up to which subtrees are deferred
+		size_t taskSize;
+
+		inline BuildQueue() : taskSize(0) { }
+	};
+
 	struct CoordinateOrdering : public std::binary_function<IndexType, IndexType, bool> {
 	public:
 		inline CoordinateOrdering(const std::vector<NodeType> &nodes, int axis)
@@ -873,17 +942,192 @@ protected:
 		return p - 1;
 	}
 
-	/// Left-balanced tree construction routine
+	/**
+	 * \brief Partially sort a range of the indirection table along an axis
+	 *
+	 * This function has the same semantics as \c std::nth_element. When
+	 * \c parallel is set, large ranges are first narrowed down using all
+	 * threads: two pivots that bracket the requested rank are chosen from a
+	 * regular sample of the range, after which the points are partitioned
+	 * into those below, between and above the pivots.
+	 */
+	void nthElement(IndexIterator rangeStart, IndexIterator nth,
+			IndexIterator rangeEnd, int axis, bool parallel) {
+#if defined(MTS_OPENMP)
+		if (parallel && rangeEnd - rangeStart >= MTS_KD_PARALLEL_PARTITION_THRESHOLD) {
+			const int nSamples = 1024, margin = 32, blockSize = 65536;
+			std::vector<IndexType> temp(rangeEnd - rangeStart);
+			std::vector<size_t> offsets;
+			Scalar sample[nSamples];
+
+			while (rangeEnd - rangeStart >= MTS_KD_PARALLEL_PARTITION_THRESHOLD) {
+				size_t count = (size_t) (rangeEnd - rangeStart);
+				for (int i=0; i<nSamples; ++i)
+					sample[i] = m_nodes[rangeStart[(size_t) ((i + 0.5) * count
+						/ nSamples)]].getPosition()[axis];
+				std::sort(sample, sample + nSamples);
+
+				int rank = (int) ((nth - rangeStart) * (double) nSamples / count);
+				Scalar lower = sample[std::max(rank - margin, 0)],
+					   upper = sample[std::min(rank + margin, nSamples - 1)];
+
+				/* Count the points of each class per block */
+				int nBlocks = (int) ((count + blockSize - 1) / blockSize);
+				offsets.resize(3 * nBlocks);
+
+				#pragma omp parallel for schedule(static)
+				for (int block=0; block<nBlocks; ++block) {
+					IndexIterator it = rangeStart + (size_t) block * blockSize,
+						end = rangeStart + std::min((size_t) (block+1) * blockSize, count);
+					size_t *blockCount = &offsets[3*block];
+					blockCount[0] = blockCount[1] = blockCount[2] = 0;
+					for (; it != end; ++it) {
+						Scalar value = m_nodes[*it].getPosition()[axis];
+						++blockCount[value < lower ? 0 : (value <= upper ? 1 : 2)];
+					}
+				}
+
+				/* Turn the counts into output offsets */
+				size_t classStart[3] = { 0, 0, 0 }, classSize[3] = { 0, 0, 0 };
+				for (int block=0; block<nBlocks; ++block)
+					for (int i=0; i<3; ++i)
+						classSize[i] += offsets[3*block+i];
+				classStart[1] = classSize[0];
+				classStart[2] = classSize[0] + classSize[1];
+				for (int block=0; block<nBlocks; ++block) {
+					for (int i=0; i<3; ++i) {
+						size_t blockCount = offsets[3*block+i];
+						offsets[3*block+i] = classStart[i];
+						classStart[i] += blockCount;
+					}
+				}
+
+				/* Scatter the indices into the temporary buffer and copy them back */
+				#pragma omp parallel for schedule(static)
+				for (int block=0; block<nBlocks; ++block) {
+					IndexIterator it = rangeStart + (size_t) block * blockSize,
+						end = rangeStart + std::min((size_t) (block+1) * blockSize, count);
+					size_t *blockOffset = &offsets[3*block];
+					for (; it != end; ++it) {
+						Scalar value = m_nodes[*it].getPosition()[axis];
+						temp[blockOffset[value < lower ? 0 : (value <= upper ? 1 : 2)]++] = *it;
+					}
+				}
+
+				#pragma omp parallel for schedule(static)
+				for (int block=0; block<nBlocks; ++block) {
+					size_t begin = (size_t) block * blockSize,
+						   end = std::min((size_t) (block+1) * blockSize, count);
+					std::copy(temp.begin() + begin, temp.begin() + end, rangeStart + begin);
+				}
+
+				/* Continue with the class that contains the requested rank */
+				size_t pos = (size_t) (nth - rangeStart);
+				if (pos < classSize[0]) {
+					rangeEnd = rangeStart + classSize[0];
+				} else if (pos < classSize[0] + classSize[1]) {
+					rangeStart += classSize[0];
+					rangeEnd = rangeStart + classSize[1];
+				} else {
+					rangeStart += classSize[0] + classSize[1];
+				}
+
+				/* Stop when there was no progress (e.g. many identical coordinates) */
+				if ((size_t) (rangeEnd - rangeStart) == count)
+					break;
+			}
+		}
+#endif
+		std::nth_element(rangeStart, nth, rangeEnd,
+			CoordinateOrdering(m_nodes, axis));
+	}
+
+	/// Count the points of a range, whose coordinate along an axis is <= \c value
+	size_t countLessThanOrEqual(IndexIterator rangeStart, IndexIterator rangeEnd,
+			int axis, Scalar value, bool parallel) const {
+#if defined(MTS_OPENMP)
+		if (parallel && rangeEnd - rangeStart >= MTS_KD_PARALLEL_PARTITION_THRESHOLD) {
+			int count = (int) (rangeEnd - rangeStart);
+			int64_t result = 0;
+
+			#pragma omp parallel for schedule(static) reduction(+:result)
+			for (int i=0; i<count; ++i) {
+				if (m_nodes[rangeStart[i]].getPosition()[axis] <= value)
+					++result;
+			}
+			return (size_t) result;
+		}
+#endif
+		return std::count_if(rangeStart, rangeEnd,
+			LessThanOrEqual(m_nodes, axis, value));
+	}
+
+	/// Build all subtrees that were deferred by a parallel build
+	void runBuildTasks(BuildQueue &queue, IndexIterator base,
+			std::vector<IndexType> &permutation) {
+		std::vector<BuildTask> &tasks = queue.tasks;
+		if (tasks.empty())
+			return;
+
+		std::sort(tasks.begin(), tasks.end(), LargerBuildTask());
+
+		#if defined(MTS_OPENMP)
+		#pragma omp parallel for schedule(dynamic, 1)
+		#endif
+		for (int i=0; i<(int) tasks.size(); ++i) {
+			BuildTask &task = tasks[i];
+			size_t depth = 0;
+			if (NodeType::leftBalancedLayout)
+				buildLB(task.idx, task.depth, base, task.rangeStart,
+					task.rangeEnd, permutation, task.aabb, depth, NULL);
+			else
+				build(task.depth, base, task.rangeStart, task.rangeEnd,
+					task.aabb, depth, NULL);
+			task.depth = depth;
+		}
+
+		for (size_t i=0; i<tasks.size(); ++i)
+			m_depth = std::max(m_depth, tasks[i].depth);
+		tasks.clear();
+	}
+
+	/// Defer the construction of a subtree to \ref runBuildTasks()
+	inline void deferBuild(BuildQueue *queue, IndexType idx, size_t depth,
+			IndexIterator rangeStart, IndexIterator rangeEnd, const AABBType &aabb) {
+		BuildTask task;
+		task.rangeStart = rangeStart;
+		task.rangeEnd = rangeEnd;
+		task.idx = idx;
+		task.depth = depth;
+		task.aabb = aabb;
+		queue->tasks.push_back(task);
+	}
+
+	/**
+	 * \brief Left-balanced tree construction routine
+	 *
+	 * \param aabb
+	 *    Bounds of the subtree; temporarily modified while building its children
+	 * \param maxDepth
+	 *    Updated with the maximum depth of the subtree
+	 * \param queue
+	 *    When non-\c NULL, subtrees with at most <tt>queue->taskSize</tt>
+	 *    points are deferred to the queue instead of being built
+	 */
 	void buildLB(IndexType idx, size_t depth,
-			  typename std::vector<IndexType>::iterator base,
-			  typename std::vector<IndexType>::iterator rangeStart,
-			  typename std::vector<IndexType>::iterator rangeEnd,
-			  typename std::vector<IndexType> &permutation) {
-		m_depth = std::max(depth, m_depth);
+			  IndexIterator base, IndexIterator rangeStart, IndexIterator rangeEnd,
+			  std::vector<IndexType> &permutation, AABBType &aabb,
+			  size_t &maxDepth, BuildQueue *queue) {
+		maxDepth = std::max(depth, maxDepth);
 
 		IndexType count = (IndexType) (rangeEnd-rangeStart);
 		SAssert(count > 0);
 
+		if (queue && count <= queue->taskSize) {
+			deferBuild(queue, idx, depth, rangeStart, rangeEnd, aabb);
+			return;
+		}
+
 		if (count == 1) {
 			/* Create a leaf node */
 			m_nodes[*rangeStart].setLeaf(true);
@@ -891,11 +1135,9 @@ protected:
 			return;
 		}
 
-		typename std::vector<IndexType>::iterator split
-			= rangeStart + leftSubtreeSize(count);
-		int axis = m_aabb.getLargestAxis();
-		std::nth_element(rangeStart, split, rangeEnd,
-			CoordinateOrdering(m_nodes, axis));
+		IndexIterator split = rangeStart + leftSubtreeSize(count);
+		int axis = aabb.getLargestAxis();
+		nthElement(rangeStart, split, rangeEnd, axis, queue != NULL);
 
 		NodeType &splitNode = m_nodes[*split];
 		splitNode.setAxis(axis);
@@ -903,30 +1145,41 @@ protected:
 		permutation[idx] = *split;
 
 		/* Recursively build the children */
-		Scalar temp = m_aabb.max[axis],
+		Scalar temp = aabb.max[axis],
 			splitPos = splitNode.getPosition()[axis];
-		m_aabb.max[axis] = splitPos;
-		buildLB(2*idx+1, depth+1, base, rangeStart, split, permutation);
-		m_aabb.max[axis] = temp;
+		aabb.max[axis] = splitPos;
+		buildLB(2*idx+1, depth+1, base, rangeStart, split,
+			permutation, aabb, maxDepth, queue);
+		aabb.max[axis] = temp;
 
 		if (split+1 != rangeEnd) {
-			temp = m_aabb.min[axis];
-			m_aabb.min[axis] = splitPos;
-			buildLB(2*idx+2, depth+1, base, split+1, rangeEnd, permutation);
-			m_aabb.min[axis] = temp;
+			temp = aabb.min[axis];
+			aabb.min[axis] = splitPos;
+			buildLB(2*idx+2, depth+1, base, split+1, rangeEnd,
+				permutation, aabb, maxDepth, queue);
+			aabb.min[axis] = temp;
 		}
 	}
 
-	/// Default tree construction routine
-	void build(size_t depth,
-			  typename std::vector<IndexType>::iterator base,
-			  typename std::vector<IndexType>::iterator rangeStart,
-			  typename std::vector<IndexType>::iterator rangeEnd) {
-		m_depth = std::max(depth, m_depth);
+	/**
+	 * \brief Default tree construction routine
+	 *
+	 * The parameters \c aabb, \c maxDepth and \c queue have the same
+	 * meaning as in \ref buildLB().
+	 */
+	void build(size_t depth, IndexIterator base, IndexIterator rangeStart,
+			  IndexIterator rangeEnd, AABBType &aabb, size_t &maxDepth,
+			  BuildQueue *queue) {
+		maxDepth = std::max(depth, maxDepth);
 
 		IndexType count = (IndexType) (rangeEnd-rangeStart);
 		SAssert(count > 0);
 
+		if (queue && count <= queue->taskSize) {
+			deferBuild(queue, 0, depth, rangeStart, rangeEnd, aabb);
+			return;
+		}
+
 		if (count == 1) {
 			/* Create a leaf node */
 			m_nodes[*rangeStart].setLeaf(true);
@@ -934,34 +1187,32 @@ protected:
 		}
 
 		int axis = 0;
-		typename std::vector<IndexType>::iterator split;
+		IndexIterator split;
 
 		switch (m_heuristic) {
 			case EBalanced: {
 					split = rangeStart + count/2;
-					axis = m_aabb.getLargestAxis();
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					axis = aabb.getLargestAxis();
+					nthElement(rangeStart, split, rangeEnd, axis, queue != NULL);
 				};
 				break;
 
 			case ELeftBalanced: {
 					split = rangeStart + leftSubtreeSize(count);
-					axis = m_aabb.getLargestAxis();
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					axis = aabb.getLargestAxis();
+					nthElement(rangeStart, split, rangeEnd, axis, queue != NULL);
 				};
 				break;
 
 			case ESlidingMidpoint: {
 					/* Sliding midpoint rule: find a split that is close to the spatial median */
-					axis = m_aabb.getLargestAxis();
+					axis = aabb.getLargestAxis();
 
 					Scalar midpoint = (Scalar) 0.5f
-						* (m_aabb.max[axis]+m_aabb.min[axis]);
+						* (aabb.max[axis]+aabb.min[axis]);
 
-					size_t nLT = std::count_if(rangeStart, rangeEnd,
-							LessThanOrEqual(m_nodes, axis, midpoint));
+					size_t nLT = countLessThanOrEqual(rangeStart, rangeEnd,
+						axis, midpoint, queue != NULL);
 
 					/* Re-adjust the split to pass through a nearby point */
 					split = rangeStart + nLT;
@@ -971,8 +1222,7 @@ protected:
 					else if (split == rangeEnd)
 						--split;
 
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					nthElement(rangeStart, split, rangeEnd, axis, queue != NULL);
 				};
 				break;
 
@@ -984,9 +1234,9 @@ protected:
 							CoordinateOrdering(m_nodes, dim));
 
 						size_t numLeft = 1, numRight = count-2;
-						AABBType leftAABB(m_aabb), rightAABB(m_aabb);
-						Float invVolume = 1.0f / m_aabb.getVolume();
-						for (typename std::vector<IndexType>::iterator it = rangeStart+1;
+						AABBType leftAABB(aabb), rightAABB(aabb);
+						Float invVolume = 1.0f / aabb.getVolume();
+						for (IndexIterator it = rangeStart+1;
 								it != rangeEnd; ++it) {
 							++numLeft; --numRight;
 							Float pos = m_nodes[*it].getPosition()[dim];
@@ -1001,8 +1251,7 @@ protected:
 							}
 						}
 					}
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					nthElement(rangeStart, split, rangeEnd, axis, queue != NULL);
 				};
 				break;
 		}
@@ -1022,17 +1271,17 @@ protected:
 		std::iter_swap(rangeStart, split);
 
 		/* Recursively build the children */
-		Scalar temp = m_aabb.max[axis],
+		Scalar temp = aabb.max[axis],
 			splitPos = splitNode.getPosition()[axis];
-		m_aabb.max[axis] = splitPos;
-		build(depth+1, base, rangeStart+1, split+1);
-		m_aabb.max[axis] = temp;
+		aabb.max[axis] = splitPos;
+		build(depth+1, base, rangeStart+1, split+1, aabb, maxDepth, queue);
+		aabb.max[axis] = temp;
 
 		if (split+1 != rangeEnd) {
-			temp = m_aabb.min[axis];
-			m_aabb.min[axis] = splitPos;
-			build(depth+1, base, split+1, rangeEnd);
-			m_aabb.min[axis] = temp;
+			temp = aabb.min[axis];
+			aabb.min[axis] = splitPos;
+			build(depth+1, base, split+1, rangeEnd, aabb, maxDepth, queue);
+			aabb.min[axis] = temp;
 		}
 	}
 protected:
@@ -1040,6 +1289,7 @@ protected:
 	AABBType m_aabb;
 	EHeuristic m_heuristic;
 	size_t m_depth;
+	bool m_parallelBuild;
 };
 
 MTS_NAMESPACE_END
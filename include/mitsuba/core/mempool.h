@@ -43,7 +43,8 @@ template <typename T> class BasicMemoryPool {
 public:
 	/// Create a new memory pool with an initial set of 128 entries
 	BasicMemoryPool(size_t nEntries = MTS_MEMPOOL_GRANULARITY) : m_size(0) {
-		increaseCapacity(nEntries);
+		if (nEntries > 0)
+			increaseCapacity(nEntries);
 	}
 
 	/// Destruct the memory pool and release all entries
@@ -108,6 +109,83 @@ private:
 	size_t m_size;
 };
 
+/**
+ * \brief Basic arena allocator for objects of the same type
+ *
+ * Entries are handed out from a contiguous block of memory by simply
+ * incrementing an index. Individual entries cannot be released --
+ * instead, \ref reset() reclaims all of them at once. When the block
+ * is exhausted, allocation continues in additional blocks, which are
+ * merged into a single larger block by the next call to \ref reset().
+ *
+ * \ingroup libcore
+ */
+template <typename T> class BasicMemoryArena {
+public:
+	/// Create a new arena with room for the specified number of entries
+	BasicMemoryArena(size_t nEntries = MTS_MEMPOOL_GRANULARITY)
+			: m_used(0), m_allocated(0), m_size(0) {
+		if (nEntries > 0)
+			addBlock(nEntries);
+	}
+
+	/// Destruct the arena and release all entries
+	~BasicMemoryArena() {
+		for (size_t i=0; i<m_blocks.size(); ++i)
+			freeAligned(m_blocks[i].first);
+	}
+
+	/// Acquire an entry
+	inline T *alloc() {
+		if (EXPECT_NOT_TAKEN(m_blocks.empty() || m_used == m_blocks.back().second))
+			addBlock(std::max(m_size, (size_t) MTS_MEMPOOL_GRANULARITY));
+		++m_allocated;
+		return m_blocks.back().first + m_used++;
+	}
+
+	/// Release all entries at once
+	inline void reset() {
+		if (EXPECT_NOT_TAKEN(m_blocks.size() > 1)) {
+			size_t size = m_size;
+			for (size_t i=0; i<m_blocks.size(); ++i)
+				freeAligned(m_blocks[i].first);
+			m_blocks.clear();
+			m_size = 0;
+			addBlock(size);
+		}
+		m_used = m_allocated = 0;
+	}
+
+	/// Return the total size of the arena
+	inline size_t size() const {
+		return m_size;
+	}
+
+	/// Check if every entry has been released
+	bool unused() const {
+		return m_allocated == 0;
+	}
+
+	/// Return a human-readable description
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "BasicMemoryArena[size=" << m_size << ", used=" << m_allocated
+			<< ", blocks=" << m_blocks.size() << "]";
+		return oss.str();
+	}
+private:
+	void addBlock(size_t nEntries) {
+		T *ptr = static_cast<T *>(allocAligned(sizeof(T) * nEntries));
+		m_blocks.push_back(std::make_pair(ptr, nEntries));
+		m_size += nEntries;
+		m_used = 0;
+	}
+private:
+	std::vector<std::pair<T *, size_t> > m_blocks;
+	size_t m_used, m_allocated;
+	size_t m_size;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_MEMPOOL_H_ */
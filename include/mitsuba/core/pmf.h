@@ -24,12 +24,26 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Number of entries, above which the renderer samples emitters
+ * and mesh triangles using alias tables (see
+ * \ref DiscreteDistribution::buildAliasTable()). Smaller distributions
+ * use the CDF, which preserves the stratification of the samples.
+ */
+#define MTS_PMF_ALIAS_THRESHOLD 64
+
 /**
  * \brief Discrete probability distribution
  *
  * This data structure can be used to transform uniformly distributed
  * samples to a stored discrete probability distribution.
  *
+ * By default, samples are generated by a binary search over the
+ * cumulative distribution function, which takes logarithmic time.
+ * After calling \ref buildAliasTable(), the distribution instead uses
+ * the alias method, which runs in constant time but does not preserve
+ * the stratification of the input samples.
+ *
  * \ingroup libcore
  */
 struct DiscreteDistribution {
@@ -44,6 +58,7 @@ public:
 	inline void clear() {
 		m_cdf.clear();
 		m_cdf.push_back(0.0f);
+		m_alias.clear();
 		m_normalized = false;
 	}
 
@@ -55,6 +70,7 @@ public:
 	/// Append an entry with the specified discrete probability
 	inline void append(Float pdfValue) {
 		m_cdf.push_back(m_cdf[m_cdf.size()-1] + pdfValue);
+		m_alias.clear();
 	}
 
 	/// Return the number of entries so far
@@ -72,6 +88,11 @@ public:
 		return m_normalized;
 	}
 
+	/// Is sampling done using an alias table?
+	inline bool hasAliasTable() const {
+		return !m_alias.empty();
+	}
+
 	/**
 	 * \brief Return the original (unnormalized) sum of all PDF entries
 	 *
@@ -110,9 +131,141 @@ public:
 		} else {
 			m_normalization = 0.0f;
 		}
+		m_alias.clear();
 		return m_sum;
 	}
 
+	/**
+	 * \brief Build an alias table, after which samples are
+	 * generated in constant time
+	 *
+	 * This uses Vose's variant of Walker's alias method. Each entry
+	 * of the table takes up 8 bytes (in single precision), hence a
+	 * sample touches at most one cache line of the table and one of
+	 * the CDF (to look up the probability). Note that the mapping from
+	 * samples to entries is no longer monotonic, which destroys the
+	 * stratification of quasi-random sample sequences.
+	 *
+	 * The table is discarded when the distribution is modified. This
+	 * function must be called after \ref normalize() and does nothing
+	 * when the distribution could not be normalized.
+	 */
+	inline void buildAliasTable() {
+		m_alias.clear();
+		if (!m_normalized)
+			return;
+
+		const size_t n = size();
+		std::vector<double> pmf(n);
+		for (size_t i=0; i<n; ++i)
+			pmf[i] = (double) operator[](i);
+
+		m_alias.resize(n);
+		buildAliasTable(&pmf[0], n, &m_alias[0]);
+	}
+
+	/// Entry of an alias table
+	struct AliasEntry {
+		/// Probability of choosing the slot's own entry instead of the alias
+		Float prob;
+		/// Index of the alias entry
+		uint32_t alias;
+	};
+
+	/**
+	 * \brief Build an alias table over an array of nonnegative weights
+	 *
+	 * This is the building block of the non-static \ref buildAliasTable().
+	 * It is also useful for distributions that are not stored in a
+	 * \ref DiscreteDistribution, e.g. many small tables that share one
+	 * array. The weights need not be normalized. When they sum to zero,
+	 * all entries are chosen with equal probability.
+	 *
+	 * \param weights
+	 *     Array of \c n weights
+	 * \param n
+	 *     Number of entries
+	 * \param table
+	 *     Output array of \c n alias table entries
+	 */
+	template <typename T> static void buildAliasTable(const T *weights,
+			size_t n, AliasEntry *table) {
+		SAssert(n <= (size_t) 0xFFFFFFFFU);
+
+		double sum = 0;
+		for (size_t i=0; i<n; ++i)
+			sum += (double) weights[i];
+		double factor = sum > 0 ? n / sum : 0.0;
+
+		/* Partition the entries into ones with less and more
+		   probability mass than the average */
+		std::vector<uint32_t> small, large;
+		small.reserve(n);
+		large.reserve(n);
+		std::vector<double> scaled(n);
+		for (size_t i=0; i<n; ++i) {
+			scaled[i] = sum > 0 ? (double) weights[i] * factor : 1.0;
+			if (scaled[i] < 1)
+				small.push_back((uint32_t) i);
+			else
+				large.push_back((uint32_t) i);
+		}
+
+		/* Fill the slots of the small entries with mass from the large ones */
+		while (!small.empty() && !large.empty()) {
+			uint32_t s = small.back(), l = large.back();
+			small.pop_back();
+			table[s].prob = (Float) scaled[s];
+			table[s].alias = l;
+			scaled[l] -= 1 - scaled[s];
+			if (scaled[l] < 1) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+
+		/* Remaining entries (up to round-off error) fill their own slot */
+		for (size_t i=0; i<large.size(); ++i) {
+			table[large[i]].prob = 1.0f;
+			table[large[i]].alias = large[i];
+		}
+		for (size_t i=0; i<small.size(); ++i) {
+			table[small[i]].prob = 1.0f;
+			table[small[i]].alias = small[i];
+		}
+	}
+
+	/**
+	 * \brief Generate a sample using an alias table created by the
+	 * static \ref buildAliasTable(). The sample value is adjusted so
+	 * that it can be "reused".
+	 *
+	 * \param table
+	 *     Array of \c n alias table entries
+	 * \param n
+	 *     Number of entries
+	 * \param[in,out] sampleValue
+	 *     A uniformly distributed sample on [0,1]
+	 * \return
+	 *     The discrete index associated with the sample
+	 */
+	static inline size_t sampleAlias(const AliasEntry *table, size_t n,
+			Float &sampleValue) {
+		Float scaled = sampleValue * n;
+		size_t slot = std::min((size_t) scaled, n - 1);
+		const AliasEntry &entry = table[slot];
+		Float remainder = scaled - slot;
+
+		if (remainder < entry.prob || entry.prob == 1) {
+			sampleValue = std::min(remainder / entry.prob, ONE_MINUS_EPS);
+			return slot;
+		} else {
+			sampleValue = std::min((remainder - entry.prob)
+				/ (1 - entry.prob), ONE_MINUS_EPS);
+			return entry.alias;
+		}
+	}
+
 	/**
 	 * \brief %Transform a uniformly distributed sample to the stored distribution
 	 *
@@ -122,6 +275,9 @@ public:
 	 *     The discrete index associated with the sample
 	 */
 	inline size_t sample(Float sampleValue) const {
+		if (!m_alias.empty())
+			return sampleAlias(sampleValue);
+
 		std::vector<Float>::const_iterator entry =
 				std::lower_bound(m_cdf.begin(), m_cdf.end(), sampleValue);
 		size_t index = std::min(m_cdf.size()-2,
@@ -162,6 +318,9 @@ public:
 	 *     The discrete index associated with the sample
 	 */
 	inline size_t sampleReuse(Float &sampleValue) const {
+		if (!m_alias.empty())
+			return sampleAlias(sampleValue);
+
 		size_t index = sample(sampleValue);
 		sampleValue = (sampleValue - m_cdf[index])
 			/ (m_cdf[index + 1] - m_cdf[index]);
@@ -181,6 +340,12 @@ public:
 	 *     The discrete index associated with the sample
 	 */
 	inline size_t sampleReuse(Float &sampleValue, Float &pdf) const {
+		if (!m_alias.empty()) {
+			size_t index = sampleAlias(sampleValue);
+			pdf = operator[](index);
+			return index;
+		}
+
 		size_t index = sample(sampleValue, pdf);
 		sampleValue = (sampleValue - m_cdf[index])
 			/ (m_cdf[index + 1] - m_cdf[index]);
@@ -194,7 +359,7 @@ public:
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "DiscreteDistribution[sum=" << m_sum << ", normalized="
-			<< (int) m_normalized << ", cdf={";
+			<< (int) m_normalized << ", alias=" << (int) hasAliasTable() << ", cdf={";
 		for (size_t i=0; i<m_cdf.size(); ++i) {
 			oss << m_cdf[i];
 			if (i != m_cdf.size()-1)
@@ -204,7 +369,16 @@ public:
 		return oss.str();
 	}
 private:
+	/**
+	 * \brief Generate a sample using the alias table. The sample
+	 * value is adjusted so that it can be "reused".
+	 */
+	inline size_t sampleAlias(Float &sampleValue) const {
+		return sampleAlias(&m_alias[0], m_alias.size(), sampleValue);
+	}
+
 	std::vector<Float> m_cdf;
+	std::vector<AliasEntry> m_alias;
 	Float m_sum, m_normalization;
 	bool m_normalized;
 };
@@ -22,6 +22,7 @@
 
 #include <mitsuba/core/serialization.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/atomic.h>
 #include <deque>
 
 /**
@@ -29,6 +30,12 @@
  */
 //#define DEBUG_SCHED 1
 
+/**
+ * Number of work units that a local worker generates at once
+ * (any surplus can be stolen by other workers)
+ */
+#define MTS_SCHED_BATCH_SIZE 4
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -345,6 +352,13 @@ class Worker;
  * units from the scheduler, which are then executed on the current machine
  * or sent to remote nodes over a network connection.
  *
+ * Local workers keep a small queue of work units each. When it runs dry,
+ * a worker first tries to steal work from the other local workers and only
+ * then generates a new batch of \ref MTS_SCHED_BATCH_SIZE work units. Calls
+ * to \ref ParallelProcess::generateWork() are serialized per process rather
+ * than by the scheduler's main lock, and finished work units are usually
+ * released without taking that lock at all.
+ *
  * \ingroup libcore
  * \ingroup libpython
  */
@@ -490,16 +504,21 @@ public:
 	struct ProcessRecord {
 		/* Unique ID value assigned to this process */
 		int id;
-		/* Current number of in-flight work units */
-		int inflight;
+		/* Current number of in-flight work units (including queued
+		   ones and workers that are currently generating work) */
+		volatile int32_t inflight;
 		/* Is the parallel process still generating work */
 		bool morework;
 		/* Was the process cancelled using \c cancel()?*/
 		bool cancelled;
 		/* Is the process currently in the queue? */
 		bool active;
-		/* Signaled every time a work unit arrives */
+		/* May generateWork() be called? (protected by \c genMutex) */
+		bool generate;
+		/* Signaled when the last in-flight work unit arrives */
 		ref<ConditionVariable> cond;
+		/* Serializes calls to generateWork() */
+		ref<Mutex> genMutex;
 		/* Set when the process is done/canceled */
 		ref<WaitFlag> done;
 		/* Log level for events associated with this process */
@@ -507,8 +526,9 @@ public:
 
 		inline ProcessRecord(int id, ELogLevel logLevel, Mutex *mutex)
 		 : id(id), inflight(0), morework(true), cancelled(false),
-		 	active(true), logLevel(logLevel) {
+		 	active(true), generate(true), logLevel(logLevel) {
 			cond = new ConditionVariable(mutex);
+			genMutex = new Mutex();
 			done = new WaitFlag();
 		}
 	};
@@ -528,6 +548,8 @@ public:
 		ref<WorkProcessor> wp;
 		ref<WorkUnit> workUnit;
 		ref<WorkResult> workResult;
+		/* Recycled work units of the current process */
+		std::vector<ref<WorkUnit> > freeUnits;
 		bool stop;
 
 		inline Item() : id(-1), workerIndex(-1), coreOffset(-1),
@@ -601,11 +623,20 @@ protected:
 			cancel(item.proc, true);
 			return;
 		}
+		/* Unless this is the last in-flight work unit, there is no
+		   need to acquire the scheduler lock */
+		int32_t inflight = rec->inflight;
+		while (inflight > 1) {
+			if (atomicCompareAndExchange(&rec->inflight, inflight - 1, inflight))
+				return;
+			inflight = rec->inflight;
+		}
 		LockGuard lock(m_mutex);
-		--rec->inflight;
-		rec->cond->signal();
-		if (rec->inflight == 0 && !rec->morework && !item.stop)
-			signalProcessTermination(item.proc, item.rec);
+		if (atomicAdd(&rec->inflight, -1) == 0) {
+			rec->cond->signal();
+			if (!rec->morework && !item.stop)
+				signalProcessTermination(item.proc, item.rec);
+		}
 	}
 
 	/**
@@ -629,6 +660,7 @@ protected:
 		item.proc = proc;
 		item.id = id;
 		item.rec = m_processes[proc];
+		item.freeUnits.clear();
 		item.wp = proc->createWorkProcessor();
 		const ParallelProcess::ResourceBindings &bindings = item.proc->getResourceBindings();
 		for (ParallelProcess::ResourceBindings::const_iterator it = bindings.begin();
@@ -645,6 +677,38 @@ protected:
 
 	/// Announces the termination of a process
 	void signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec);
+
+	/// Work unit waiting in the queue of a local worker
+	struct Task {
+		int id;
+		ref<WorkUnit> workUnit;
+	};
+
+	/// Per-worker queue of generated work units
+	struct TaskQueue {
+		ref<Mutex> mutex;
+		std::deque<Task> tasks;
+
+		inline TaskQueue() : mutex(new Mutex()) { }
+	};
+
+	/// Acquire a piece of work on behalf of a local worker
+	EStatus acquireLocalWork(Item &item, bool onlyTry);
+
+	/**
+	 * Generate up to \c count work units of the process on top of \c queue.
+	 * Must be called with the scheduler lock held, which is released while
+	 * the process generates work. Returns the number of new work units,
+	 * which have already been added to the process' in-flight count.
+	 */
+	size_t generateWork(UniqueLock &lock, Item &item, std::deque<int> &queue,
+		size_t count, std::vector<ref<WorkUnit> > &units);
+
+	/// Take a work unit from the queue of the given worker (or steal one)
+	bool popTask(int workerIndex, Task &task);
+
+	/// Drop all queued work units of a process and return their number
+	int32_t removeTasks(int id);
 private:
 	/// Global scheduler instance
 	static ref<Scheduler> m_scheduler;
@@ -662,6 +726,12 @@ private:
 	std::map<int, ResourceRecord *> m_resources;
 	/// List of all active workers
 	std::vector<Worker *> m_workers;
+	/// Work unit queues of the local workers (indexed like \c m_workers)
+	std::vector<TaskQueue *> m_taskQueues;
+	/// Total number of work units in \c m_taskQueues
+	volatile int32_t m_queuedTasks;
+	/// Number of local workers waiting for \c m_workAvailable
+	int m_idleWorkers;
 	int m_resourceCounter, m_processCounter;
 	bool m_running;
 };
@@ -45,7 +45,9 @@ public:
 		/// A raw deflate stream
 		EDeflateStream,
 		/// A gzip-compatible stream
-		EGZipStream
+		EGZipStream,
+		/// A deflate stream without header or checksum (as stored in ZIP archives)
+		ERawDeflateStream
 	};
 
 	/// Create a new compression stream
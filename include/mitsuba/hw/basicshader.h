@@ -49,6 +49,12 @@ public:
 		return m_value;
 	}
 
+	inline void evalBatch(const Intersection * const * /* unused */,
+			Spectrum *result, size_t count, bool /* unused */) const {
+		for (size_t i=0; i<count; ++i)
+			result[i] = m_value;
+	}
+
 	inline Spectrum getAverage() const {
 		return m_value;
 	}
@@ -106,6 +112,13 @@ public:
 		return Spectrum(m_value);
 	}
 
+	inline void evalBatch(const Intersection * const * /* unused */,
+			Spectrum *result, size_t count, bool /* unused */) const {
+		Spectrum value(m_value);
+		for (size_t i=0; i<count; ++i)
+			result[i] = value;
+	}
+
 	inline Spectrum getAverage() const {
 		return Spectrum(m_value);
 	}
@@ -440,6 +440,41 @@ public:
 	virtual Float pdf(const BSDFSamplingRecord &bRec,
 		EMeasure measure = ESolidAngle) const = 0;
 
+	/**
+	 * \brief Evaluate the BSDF for an array of query records
+	 *
+	 * This is equivalent to calling \ref eval() for each record, but it
+	 * lets implementations look up their textures for the whole batch
+	 * at once (see \ref Texture::evalBatch()) and avoids a virtual
+	 * function call per record. The default implementation simply
+	 * calls \ref eval().
+	 *
+	 * \param bRecs
+	 *     Array of \c count BSDF query records
+	 * \param result
+	 *     Array with space for \c count BSDF values
+	 * \param measure
+	 *     Specifies the measure of the component (see \ref eval())
+	 */
+	virtual void evalBatch(const BSDFSamplingRecord *bRecs, Spectrum *result,
+		size_t count, EMeasure measure = ESolidAngle) const;
+
+	/**
+	 * \brief Sample the BSDF for an array of query records
+	 *
+	 * This is equivalent to calling \ref sample(BSDFSamplingRecord &, Float &,
+	 * const Point2 &) for each record. As in that function, the entries of
+	 * \c pdf are only written when sampling succeeds. The default
+	 * implementation simply calls \ref sample().
+	 *
+	 * \param bRecs   Array of \c count BSDF query records
+	 * \param pdf     Array with space for \c count probability densities
+	 * \param sample  Array of \c count uniformly distributed samples on \f$[0,1]^2\f$
+	 * \param result  Array with space for \c count sample weights
+	 */
+	virtual void sampleBatch(BSDFSamplingRecord *bRecs, Float *pdf,
+		const Point2 *sample, Spectrum *result, size_t count) const;
+
 	/**
 	 * \brief For transmissive BSDFs: return the material's
 	 * relative index of refraction
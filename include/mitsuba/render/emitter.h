@@ -534,6 +534,21 @@ public:
 	 */
 	inline Float getSamplingWeight() const { return m_samplingWeight; }
 
+	/**
+	 * \brief Bound the directions into which the emitter radiates
+	 *
+	 * This is used by the light hierarchy of \ref Scene (see
+	 * \ref LightTree). Emission is bounded by two nested cones: all
+	 * surface normals (or principal emission directions) of the emitter
+	 * lie within an angle of <tt>acos(cosThetaO)</tt> of \c axis, and light
+	 * leaves the emitter at angles up to <tt>acos(cosThetaE)</tt> from them.
+	 *
+	 * The default implementation returns bounds that contain all
+	 * directions.
+	 */
+	virtual void getEmissionBounds(Vector &axis, Float &cosThetaO,
+		Float &cosThetaE) const;
+
 	/**
 	 * \brief Return a bitmap representation of the emitter
 	 *
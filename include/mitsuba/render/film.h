@@ -51,6 +51,14 @@ public:
 	/// Merge an image block into the film
 	virtual void put(const ImageBlock *block) = 0;
 
+	/**
+	 * \brief May \ref put() be called from several threads at once?
+	 *
+	 * When this returns \c true, concurrent calls are safe as long as
+	 * the merged blocks (including their borders) don't overlap.
+	 */
+	virtual bool supportsConcurrentPut() const { return false; }
+
 	/// Overwrite the film with the given bitmap and optionally multiply it by a scalar
 	virtual void setBitmap(const Bitmap *bitmap, Float multiplier = 1.0f) = 0;
 
@@ -43,6 +43,7 @@ template <typename AABBType> class KDTreeBase;
 template <typename AABBType, typename TreeConstructionHeuristic, typename Derived> class GenericKDTree;
 template <typename Derived> class SAHKDTree3D;
 class ShapeKDTree;
+class LightTree;
 class LocalWorker;
 struct LuminaireSamplingRecord;
 class Medium;
@@ -77,6 +78,9 @@ class SparseMipmap3D;
 class Spiral;
 class Subsurface;
 class Texture;
+class TextureTile;
+class TextureTileCache;
+class TileLookupCache;
 struct TriAccel;
 struct TriAccel4;
 class TriMesh;
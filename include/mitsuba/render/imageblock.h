@@ -26,6 +26,9 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// Number of image rows that share a mutex during a banded \ref ImageBlock::put()
+#define MTS_IMAGEBLOCK_BAND_SIZE 32
+
 /**
  * \brief Storage for an image sub-block (a.k.a render bucket)
  *
@@ -106,6 +109,34 @@ public:
 				- Vector2i(block->getBorderSize() - m_borderSize)));
 	}
 
+	/**
+	 * \brief Accumulate another image block into this one, one band
+	 * of rows at a time
+	 *
+	 * Every band of \ref MTS_IMAGEBLOCK_BAND_SIZE rows is protected by
+	 * its own mutex (see \ref createBandMutexes()), which allows several
+	 * threads to merge blocks into this one at the same time. Merging
+	 * starts at band \c firstBand -- callers should vary it between
+	 * blocks to avoid contention.
+	 */
+	void put(const ImageBlock *block,
+		std::vector<ref<Mutex> > &bandMutexes, int firstBand);
+
+	/// Create one mutex per band of rows for use with the banded \ref put()
+	void createBandMutexes(std::vector<ref<Mutex> > &bandMutexes) const;
+
+	/**
+	 * \brief Acquire all band mutexes, e.g. to read a consistent image
+	 *
+	 * The mutexes are acquired in ascending order, and the banded
+	 * \ref put() never holds more than one of them, hence this cannot
+	 * deadlock.
+	 */
+	static void lockBands(std::vector<ref<Mutex> > &bandMutexes);
+
+	/// Release the mutexes acquired by \ref lockBands()
+	static void unlockBands(std::vector<ref<Mutex> > &bandMutexes);
+
 	/**
 	 * \brief Store a single sample inside the image block
 	 *
@@ -142,65 +173,62 @@ public:
 	 *    NaN or negative. A warning is also printed in this case
 	 */
 	FINLINE bool put(const Point2 &_pos, const Float *value) {
-		const int channels = m_bitmap->getChannelCount();
-
-		/* Check if all sample values are valid */
-		for (int i=0; i<channels; ++i) {
-			if (EXPECT_NOT_TAKEN((!std::isfinite(value[i]) || value[i] < 0) && m_warn))
-				goto bad_sample;
+		if (EXPECT_NOT_TAKEN(m_warn && !isValid(value))) {
+			warnInvalid(value);
+			return false;
 		}
 
-		{
-			const Float filterRadius = m_filter->getRadius();
-			const Vector2i &size = m_bitmap->getSize();
-
-			/* Convert to pixel coordinates within the image block */
-			const Point2 pos(
-				_pos.x - 0.5f - (m_offset.x - m_borderSize),
-				_pos.y - 0.5f - (m_offset.y - m_borderSize));
-
-			/* Determine the affected range of pixels */
-			const Point2i min(std::max((int) std::ceil (pos.x - filterRadius), 0),
-			                  std::max((int) std::ceil (pos.y - filterRadius), 0)),
-			              max(std::min((int) std::floor(pos.x + filterRadius), size.x - 1),
-			                  std::min((int) std::floor(pos.y + filterRadius), size.y - 1));
-
-			/* Lookup values from the pre-rasterized filter */
-			for (int x=min.x, idx = 0; x<=max.x; ++x)
-				m_weightsX[idx++] = m_filter->evalDiscretized(x-pos.x);
-			for (int y=min.y, idx = 0; y<=max.y; ++y)
-				m_weightsY[idx++] = m_filter->evalDiscretized(y-pos.y);
-
-			/* Rasterize the filtered sample into the framebuffer */
-			for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
-				const Float weightY = m_weightsY[yr];
-				Float *dest = m_bitmap->getFloatData()
-					+ (y * (size_t) size.x + min.x) * channels;
-
-				for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
-					const Float weight = m_weightsX[xr] * weightY;
-
-					for (int k=0; k<channels; ++k)
-						*dest++ += weight * value[k];
-				}
-			}
-		}
+		Point2i min, max;
+		computeFootprint(_pos, min, max);
+		splat(min, max, m_weightsX, m_weightsY, value);
 
 		return true;
+	}
 
-		bad_sample:
-		{
-			std::ostringstream oss;
-			oss << "Invalid sample value : [";
-			for (int i=0; i<channels; ++i) {
-				oss << value[i];
-				if (i+1 < channels)
-					oss << ", ";
+	/**
+	 * \brief Store a single sample whose channels are spread over
+	 * several image blocks
+	 *
+	 * This is useful when auxiliary quantities (e.g. features or
+	 * variance estimates) are accumulated next to the radiance: the
+	 * reconstruction filter weights are evaluated only once and then
+	 * used to splat the channels of every block.
+	 *
+	 * \param pos
+	 *    Denotes the sample position in fractional pixel coordinates
+	 * \param blocks
+	 *    Array of image blocks, which must all share the same size,
+	 *    offset and reconstruction filter
+	 * \param values
+	 *    For each block, a pointer to an array containing its channel
+	 *    values for this sample
+	 * \param count
+	 *    Number of entries in \c blocks and \c values
+	 * \return \c false if one of the sample values was \a invalid, e.g.
+	 *    NaN or negative. A warning is also printed in this case, and
+	 *    only the corresponding block is left unmodified.
+	 */
+	static FINLINE bool put(const Point2 &pos, ImageBlock * const *blocks,
+			const Float * const *values, size_t count) {
+		ImageBlock *first = blocks[0];
+		Point2i min, max;
+		first->computeFootprint(pos, min, max);
+
+		bool success = true;
+		for (size_t i=0; i<count; ++i) {
+			SAssert(blocks[i]->m_offset == first->m_offset &&
+				blocks[i]->m_borderSize == first->m_borderSize &&
+				blocks[i]->m_bitmap->getSize() == first->m_bitmap->getSize());
+			if (EXPECT_NOT_TAKEN(blocks[i]->m_warn && !blocks[i]->isValid(values[i]))) {
+				blocks[i]->warnInvalid(values[i]);
+				success = false;
+				continue;
 			}
-			oss << "]";
-			Log(EWarn, "%s", oss.str().c_str());
+			blocks[i]->splat(min, max, first->m_weightsX,
+				first->m_weightsY, values[i]);
 		}
-		return false;
+
+		return success;
 	}
 
 	/// Create a clone of the entire image block
@@ -234,6 +262,65 @@ public:
 protected:
 	/// Virtual destructor
 	virtual ~ImageBlock();
+
+	/// Check that all channels of a sample are finite and nonnegative
+	FINLINE bool isValid(const Float *value) const {
+		const int channels = m_bitmap->getChannelCount();
+		for (int i=0; i<channels; ++i) {
+			if (!std::isfinite(value[i]) || value[i] < 0)
+				return false;
+		}
+		return true;
+	}
+
+	/// Print a warning about an invalid sample value
+	void warnInvalid(const Float *value) const;
+
+	/**
+	 * \brief Determine the range of pixels affected by a sample and
+	 * store the associated filter weights in \c m_weightsX and \c m_weightsY
+	 */
+	FINLINE void computeFootprint(const Point2 &_pos, Point2i &min, Point2i &max) {
+		const Float filterRadius = m_filter->getRadius();
+		const Vector2i &size = m_bitmap->getSize();
+
+		/* Convert to pixel coordinates within the image block */
+		const Point2 pos(
+			_pos.x - 0.5f - (m_offset.x - m_borderSize),
+			_pos.y - 0.5f - (m_offset.y - m_borderSize));
+
+		/* Determine the affected range of pixels */
+		min = Point2i(std::max((int) std::ceil (pos.x - filterRadius), 0),
+		              std::max((int) std::ceil (pos.y - filterRadius), 0));
+		max = Point2i(std::min((int) std::floor(pos.x + filterRadius), size.x - 1),
+		              std::min((int) std::floor(pos.y + filterRadius), size.y - 1));
+
+		/* Lookup values from the pre-rasterized filter */
+		for (int x=min.x, idx = 0; x<=max.x; ++x)
+			m_weightsX[idx++] = m_filter->evalDiscretized(x-pos.x);
+		for (int y=min.y, idx = 0; y<=max.y; ++y)
+			m_weightsY[idx++] = m_filter->evalDiscretized(y-pos.y);
+	}
+
+	/// Rasterize a filtered sample using a previously computed footprint
+	FINLINE void splat(const Point2i &min, const Point2i &max,
+			const Float *weightsX, const Float *weightsY, const Float *value) {
+		const int channels = m_bitmap->getChannelCount();
+		const Vector2i &size = m_bitmap->getSize();
+
+		for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
+			const Float weightY = weightsY[yr];
+			Float *dest = m_bitmap->getFloatData()
+				+ (y * (size_t) size.x + min.x) * channels;
+
+			for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
+				const Float weight = weightsX[xr] * weightY;
+
+				for (int k=0; k<channels; ++k)
+					*dest++ += weight * value[k];
+			}
+		}
+	}
 protected:
 	ref<Bitmap> m_bitmap;
 	Point2i m_offset;
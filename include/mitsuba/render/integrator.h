@@ -358,6 +358,10 @@ public:
 	 * associated rays in a pixel region is then taken as an approximation
 	 * of that pixel's radiance value. For adaptive strategies, have a look at
 	 * the \c adaptive plugin, which is an extension of this class.
+	 *
+	 * When the \c progressive parameter is set, the image is instead
+	 * rendered in a sequence of passes that each take the configured
+	 * number of samples in every pixel (see \ref renderProgressive()).
 	 */
 	bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
 		int sceneResID, int sensorResID, int samplerResID);
@@ -430,9 +434,37 @@ protected:
 
 	/// Virtual destructor
 	virtual ~SamplingIntegrator() { }
+
+	/**
+	 * \brief Render the image in a sequence of passes over the full image
+	 *
+	 * Every pass takes the configured number of samples in each pixel and
+	 * adds them to the film. Rendering stops after \c maxPasses passes,
+	 * when the next pass would exceed the \c timeBudget, or when the
+	 * estimated relative error of the image drops below \c targetError.
+	 * The error is estimated from the variance of the images rendered by
+	 * the individual passes, hence at least two passes are needed.
+	 * When \c writeInterval is nonzero, a background thread periodically
+	 * develops the film to disk while the passes are running.
+	 */
+	bool renderProgressive(Scene *scene, RenderQueue *queue,
+		const RenderJob *job, int sceneResID, int sensorResID,
+		int samplerResID);
 protected:
 	/// Used to temporarily cache a parallel process while it is in operation
 	ref<ParallelProcess> m_process;
+	/// Render in multiple passes? (see \ref renderProgressive())
+	bool m_progressive;
+	/// Maximum number of progressive passes (-1 = unlimited)
+	int m_maxPasses;
+	/// Wall-clock time budget in seconds (0 = unlimited)
+	Float m_timeBudget;
+	/// Relative error at which progressive rendering stops (0 = disabled)
+	Float m_targetError;
+	/// Interval in seconds between intermediate film writes (0 = disabled)
+	Float m_writeInterval;
+	/// Set when \ref cancel() has been called
+	bool m_cancelled;
 };
 
 /*
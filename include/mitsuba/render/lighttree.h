@@ -0,0 +1,162 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_LIGHTTREE_H_)
+#define __MITSUBA_RENDER_LIGHTTREE_H_
+
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/render/emitter.h>
+#include <boost/unordered_map.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of buckets used by the split search of \ref LightTree
+#define MTS_LIGHTTREE_BUCKETS 12
+
+/// Number of emitters, from which on \ref Scene uses a light hierarchy by default
+#define MTS_LIGHTTREE_AUTO_THRESHOLD 8
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene, which
+ * chooses emitters according to their estimated contribution at a
+ * reference point
+ *
+ * Every node stores a bounding box, two cones that bound the directions of
+ * emission and the total power of the emitters below it. An emitter is
+ * chosen by descending the tree from the root, where each step randomly
+ * picks one of the two children proportional to a conservative estimate of
+ * its contribution at the reference point. Emitters without a finite spatial
+ * extent (e.g. environment maps and directional emitters) are not part of
+ * the hierarchy -- they are chosen uniformly with a fixed probability.
+ *
+ * The node bounds, the construction heuristic and the importance function
+ * follow "Importance Sampling of Many Lights with Adaptive Tree Splitting"
+ * by Alejandro Conty Estevez and Christopher Kulla (HPG 2018).
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER LightTree : public Object {
+public:
+	/**
+	 * \brief Build a light hierarchy
+	 *
+	 * \param emitters
+	 *    The emitters of the scene. Indices returned by \ref sample()
+	 *    refer to this list.
+	 */
+	LightTree(const ref_vector<Emitter> &emitters);
+
+	/**
+	 * \brief Randomly choose an emitter for direct illumination
+	 * at a reference point
+	 *
+	 * \param ref
+	 *    The reference point
+	 * \param refN
+	 *    Surface normal at the reference point. A zero vector means that
+	 *    light arriving from all directions is relevant.
+	 * \param sample
+	 *    A uniformly distributed number in [0, 1). It is rescaled
+	 *    so that it can be reused by the caller.
+	 * \param pdf
+	 *    Returns the discrete probability of the choice
+	 * \return
+	 *    The index of the chosen emitter, or \c -1 when no emitter
+	 *    can illuminate the reference point
+	 */
+	int sample(const Point &ref, const Normal &refN,
+		Float &sample, Float &pdf) const;
+
+	/**
+	 * \brief Return the discrete probability of choosing an emitter
+	 * in \ref sample()
+	 */
+	Float pdf(const Point &ref, const Normal &refN,
+		const Emitter *emitter) const;
+
+	/// Return the number of emitters that are part of the hierarchy
+	inline size_t getEmitterCount() const { return m_leafCount; }
+
+	/// Return the number of emitters that are chosen uniformly
+	inline size_t getInfiniteEmitterCount() const { return m_infinite.size(); }
+
+	/// Return the number of nodes of the hierarchy
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Return a human-readable string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Spatial and directional bounds of a set of emitters
+	struct LightBounds {
+		AABB aabb;
+		Vector axis;
+		Float cosThetaO, cosThetaE;
+		Float phi;
+
+		inline LightBounds() : axis(0.0f, 0.0f, 1.0f),
+			cosThetaO(1), cosThetaE(1), phi(0) { }
+
+		/// Expand the bounds so that they contain another set of emitters
+		void expandBy(const LightBounds &bounds);
+
+		/// Conservatively estimate the contribution at a reference point
+		Float importance(const Point &p, const Normal &n) const;
+	};
+
+	struct Node {
+		LightBounds bounds;
+		/// Leaf nodes: emitter index; interior nodes: index of the second child
+		uint32_t index;
+		bool leaf;
+	};
+
+	struct BuildItem {
+		LightBounds bounds;
+		Point centroid;
+		uint32_t emitter;
+	};
+
+	/// Marks the parent of the root node and emitters that are not part of the tree
+	static const uint32_t NoNode = 0xFFFFFFFFu;
+
+	/// Virtual destructor
+	virtual ~LightTree() { }
+
+	/// Recursively build the subtree over a range of emitters
+	uint32_t build(std::vector<BuildItem> &items, size_t start,
+		size_t end, uint32_t parent);
+
+	/// Cost of a candidate child node in the split heuristic
+	static Float evalCost(const LightBounds &bounds,
+		const AABB &parentAABB, int axis);
+private:
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_parents;
+	std::vector<uint32_t> m_infinite;
+	/// Maps emitters to their leaf node (or to \c NoNode if they have no finite extent)
+	boost::unordered_map<const Emitter *, uint32_t> m_emitterNodes;
+	size_t m_leafCount;
+	Float m_infiniteProb;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_LIGHTTREE_H_ */
@@ -26,6 +26,10 @@
 #include <mitsuba/core/mmap.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/render/texcache.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
 #include <boost/filesystem/fstream.hpp>
 
 MTS_NAMESPACE_BEGIN
@@ -37,11 +41,14 @@ MTS_NAMESPACE_BEGIN
 #define MTS_MIPMAP_LUT_SIZE 64
 
 /// MIP map cache file version
-#define MTS_MIPMAP_CACHE_VERSION 0x01
+#define MTS_MIPMAP_CACHE_VERSION 0x02
 
 /// Make sure that the actual cache contents start on a cache line
 #define MTS_MIPMAP_CACHE_ALIGNMENT 64
 
+/// Default tile resolution of tiled MIP map cache files (log2, i.e. 64x64 texels)
+#define MTS_MIPMAP_LOG_TILE_SIZE 6
+
 /* Some statistics counters */
 namespace stats {
 	extern MTS_EXPORT_RENDER StatsCounter avgEWASamples;
@@ -74,7 +81,10 @@ enum EMIPFilterType {
  * anisotropy of texture lookups in UV space.
  *
  * Generating good mip maps is costly, and therefore this class provides
- * the means to cache them on disk if desired.
+ * the means to cache them on disk if desired. Cache files are either
+ * memory-mapped as a whole, or they use a tiled layout (see
+ * \ref writeTiledCacheFile()), whose tiles are paged in on demand
+ * through the process-wide \ref TextureTileCache.
  *
  * \tparam Value
  *    This class can be parameterized to yield MIP map classes for
@@ -165,7 +175,8 @@ public:
 			Float maxValue = 1.0f,
 			Spectrum::EConversionIntent intent = Spectrum::EReflectance)
 		: m_pixelFormat(pixelFormat), m_bcu(bcu), m_bcv(bcv), m_filterType(filterType),
-		  m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy) {
+		  m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy), m_tileFile(0),
+		  m_logTileSize(0), m_tileOffset(NULL), m_tileCount(NULL) {
 
 		/* Keep track of time */
 		ref<Timer> timer = new Timer();
@@ -280,6 +291,7 @@ public:
 			header.bcu = (uint8_t) bcu;
 			header.bcv = (uint8_t) bcv;
 			header.filterType = (uint8_t) m_filterType;
+			header.logTileSize = 0;
 			header.gamma = (float) bitmap_->getGamma();
 			header.width = bitmap_->getWidth();
 			header.height = bitmap_->getHeight();
@@ -317,17 +329,17 @@ public:
 	 *    cache file that was previously created.
 	 */
 	TMIPMap(fs::path cacheFilename, Float maxAnisotropy = 20.0f)
-			: m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy) {
-		m_mmap = new MemoryMappedFile(cacheFilename);
-		uint8_t *mmapPtr = (uint8_t *) m_mmap->getData();
-		Log(EInfo, "Mapped MIP map cache file \"%s\" into memory (%s).", cacheFilename.string().c_str(),
-			memString(m_mmap->getSize()).c_str());
-
-		stats::mipStorage += m_mmap->getSize();
-
+			: m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy), m_tileFile(0),
+			  m_logTileSize(0), m_tileOffset(NULL), m_tileCount(NULL) {
 		/* Load the file header, and run some santity checks */
 		MIPMapHeader header;
-		memcpy(&header, mmapPtr, sizeof(MIPMapHeader));
+		fs::ifstream is(cacheFilename, std::ios::binary);
+		is.read((char *) &header, sizeof(MIPMapHeader));
+		if (is.fail())
+			Log(EError, "Unable to read the MIP map cache file \"%s\"!",
+				cacheFilename.string().c_str());
+		is.close();
+
 		Assert(header.identifier[0] == 'M' && header.identifier[1] == 'I'
 			&& header.identifier[2] == 'P' && header.version == MTS_MIPMAP_CACHE_VERSION);
 		m_pixelFormat = (Bitmap::EPixelFormat) header.pixelFormat;
@@ -335,38 +347,60 @@ public:
 		m_bcu = (EBoundaryCondition) header.bcu;
 		m_bcv = (EBoundaryCondition) header.bcv;
 		m_filterType = (EMIPFilterType) header.filterType;
+		m_logTileSize = (int) header.logTileSize;
 		m_minimum = header.minimum;
 		m_maximum = header.maximum;
 		m_average = header.average;
 
-		/* Move the pointer to the beginning of the MIP map data */
+		/* Determine the beginning of the MIP map data */
 		size_t padding = sizeof(MIPMapHeader) % MTS_MIPMAP_CACHE_ALIGNMENT;
 		if (padding)
 			padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
-		mmapPtr += sizeof(MIPMapHeader) + padding;
+		size_t dataOffset = sizeof(MIPMapHeader) + padding;
+
+		uint8_t *mmapPtr = NULL;
+		if (m_logTileSize == 0) {
+			m_mmap = new MemoryMappedFile(cacheFilename);
+			mmapPtr = (uint8_t *) m_mmap->getData() + dataOffset;
+			Log(EInfo, "Mapped MIP map cache file \"%s\" into memory (%s).", cacheFilename.string().c_str(),
+				memString(m_mmap->getSize()).c_str());
+			stats::mipStorage += m_mmap->getSize();
+		} else {
+			size_t tileSize = sizeof(QuantizedValue) << (2 * m_logTileSize);
+			m_tileFile = TextureTileCache::getInstance()->registerFile(
+				cacheFilename, dataOffset, tileSize);
+			m_tileOffset = new uint32_t[m_levels];
+			m_tileCount = new int[m_levels];
+			Log(EInfo, "Paging in tiles of the MIP map cache file \"%s\" on demand (%s).",
+				cacheFilename.string().c_str(), memString(fs::file_size(cacheFilename)).c_str());
+		}
 
-		/* Map the highest resolution level */
+		/* Map the image pyramid. Tiled levels only record their
+		   size here, the texels are fetched from the tile cache */
 		m_pyramid = new Array2DType[m_levels];
 		m_sizeRatio = new Vector2[m_levels];
 		Vector2i size(header.width, header.height);
-		m_pyramid[0].map(mmapPtr, size);
-		mmapPtr += m_pyramid[0].getBufferSize();
-		m_sizeRatio[0] = Vector2(1, 1);
-
-		if (m_filterType != ENearest && m_filterType != EBilinear) {
-			/* Map the remainder of the image pyramid */
-			int level = 1;
-			while (size.x > 1 || size.y > 1) {
+		uint32_t tileOffset = 0;
+		for (int level = 0; level < m_levels; ++level) {
+			if (level > 0) {
 				size.x = std::max(1, (size.x + 1) / 2);
 				size.y = std::max(1, (size.y + 1) / 2);
-				m_pyramid[level].map(mmapPtr, size);
-				m_sizeRatio[level] = Vector2(
-					(Float) size.x / (Float) m_pyramid[0].getWidth(),
-					(Float) size.y / (Float) m_pyramid[0].getHeight());
-				mmapPtr += m_pyramid[level++].getBufferSize();
 			}
-			Assert(level == m_levels);
+
+			m_pyramid[level].map(mmapPtr, size);
+			m_sizeRatio[level] = Vector2(
+				(Float) size.x / (Float) header.width,
+				(Float) size.y / (Float) header.height);
+
+			if (mmapPtr) {
+				mmapPtr += m_pyramid[level].getBufferSize();
+			} else {
+				m_tileOffset[level] = tileOffset;
+				m_tileCount[level] = (size.x + (1 << m_logTileSize) - 1) >> m_logTileSize;
+				tileOffset += (uint32_t) getTileCount(size, m_logTileSize);
+			}
 		}
+		Assert((size.x == 1 && size.y == 1) || m_filterType == ENearest || m_filterType == EBilinear);
 
 		if (m_filterType == EEWA) {
 			m_weightLut = static_cast<Float *>(allocAligned(sizeof(Float) * MTS_MIPMAP_LUT_SIZE));
@@ -379,8 +413,12 @@ public:
 
 	/// Release all memory
 	~TMIPMap() {
+		if (m_tileFile)
+			TextureTileCache::getInstance()->unregisterFile(m_tileFile);
 		delete[] m_pyramid;
 		delete[] m_sizeRatio;
+		delete[] m_tileOffset;
+		delete[] m_tileCount;
 		if (m_weightLut)
 			freeAligned(m_weightLut);
 	}
@@ -400,11 +438,15 @@ public:
 	 * \param gamma
 	 *    If nonzero, it is verified that the provided gamma value
 	 *    matches that of the cache file.
+	 * \param logTileSize
+	 *    Tile resolution (log2) of a tiled cache file, or zero
+	 *    for a cache file that is mapped into memory as a whole.
 	 * \return \c true if the texture file is good for use
 	 */
 	static bool validateCacheFile(const fs::path &path, uint64_t timestamp,
 			Bitmap::EPixelFormat pixelFormat, EBoundaryCondition bcu,
-			EBoundaryCondition bcv, EMIPFilterType filterType, Float gamma) {
+			EBoundaryCondition bcv, EMIPFilterType filterType, Float gamma,
+			int logTileSize = 0) {
 		fs::ifstream is(path);
 		if (!is.good())
 			return false;
@@ -419,7 +461,8 @@ public:
 			|| header.timestamp != timestamp
 			|| header.bcu != (uint8_t) bcu || header.bcv != (uint8_t) bcv
 			|| header.pixelFormat != (uint8_t) pixelFormat
-			|| header.filterType != (uint8_t) filterType)
+			|| header.filterType != (uint8_t) filterType
+			|| header.logTileSize != (uint8_t) logTileSize)
 			return false;
 
 		if (gamma != 0 && (float) gamma != header.gamma)
@@ -431,20 +474,94 @@ public:
 			padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
 
 		Vector2i size(header.width, header.height);
-		size_t expectedFileSize = sizeof(MIPMapHeader) + padding
-			+ Array2DType::bufferSize(size);
+		size_t tileSize = sizeof(QuantizedValue) << (2 * logTileSize);
+		size_t expectedFileSize = sizeof(MIPMapHeader) + padding + (logTileSize == 0
+			? Array2DType::bufferSize(size) : getTileCount(size, logTileSize) * tileSize);
 
 		if (filterType != ENearest && filterType != EBilinear) {
 			while (size.x > 1 || size.y > 1) {
 				size.x = std::max(1, (size.x + 1) / 2);
 				size.y = std::max(1, (size.y + 1) / 2);
-				expectedFileSize += Array2DType::bufferSize(size);
+				expectedFileSize += logTileSize == 0 ? Array2DType::bufferSize(size)
+					: getTileCount(size, logTileSize) * tileSize;
 			}
 		}
 
 		return fs::file_size(path) == expectedFileSize;
 	}
 
+	/**
+	 * \brief Write the MIP map to a tiled cache file
+	 *
+	 * Every level is split into square tiles that are stored one after
+	 * the other. When the file is later opened using the constructor that
+	 * takes a cache filename, only the tiles that are touched by texture
+	 * lookups are read into the process-wide \ref TextureTileCache, whose
+	 * memory budget is shared by all textures.
+	 *
+	 * \param path
+	 *    File system path of the new cache file
+	 * \param timestamp
+	 *    Timestamp of the original texture file
+	 * \param gamma
+	 *    Gamma value of the original texture file
+	 * \param logTileSize
+	 *    Tile resolution (log2)
+	 */
+	void writeTiledCacheFile(const fs::path &path, uint64_t timestamp,
+			Float gamma, int logTileSize = MTS_MIPMAP_LOG_TILE_SIZE) const {
+		Assert(m_tileFile == 0 && logTileSize > 0);
+		Log(EInfo, "Generating tiled MIP map cache file \"%s\" ..", path.string().c_str());
+
+		MIPMapHeader header;
+		memset(&header, 0, sizeof(MIPMapHeader));
+		memcpy(header.identifier, "MIP", 3);
+		header.version = MTS_MIPMAP_CACHE_VERSION;
+		header.pixelFormat = (uint8_t) m_pixelFormat;
+		header.levels = (uint8_t) m_levels;
+		header.bcu = (uint8_t) m_bcu;
+		header.bcv = (uint8_t) m_bcv;
+		header.filterType = (uint8_t) m_filterType;
+		header.logTileSize = (uint8_t) logTileSize;
+		header.gamma = (float) gamma;
+		header.width = getWidth();
+		header.height = getHeight();
+		header.timestamp = timestamp;
+		header.minimum = m_minimum;
+		header.maximum = m_maximum;
+		header.average = m_average;
+
+		size_t padding = sizeof(MIPMapHeader) % MTS_MIPMAP_CACHE_ALIGNMENT;
+		if (padding)
+			padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
+		uint8_t zero[MTS_MIPMAP_CACHE_ALIGNMENT];
+		memset(zero, 0, sizeof(zero));
+
+		ref<FileStream> fs = new FileStream(path, FileStream::ETruncWrite);
+		fs->write(&header, sizeof(MIPMapHeader));
+		fs->write(zero, padding);
+
+		const int tileRes = 1 << logTileSize;
+		std::vector<QuantizedValue> tile((size_t) tileRes * tileRes);
+		for (int level=0; level<m_levels; ++level) {
+			const Array2DType &array = m_pyramid[level];
+			const Vector2i &size = array.getSize();
+			for (int ty=0; ty<size.y; ty += tileRes) {
+				for (int tx=0; tx<size.x; tx += tileRes) {
+					/* Texels beyond the image boundary are left at zero */
+					memset(&tile[0], 0, tile.size() * sizeof(QuantizedValue));
+					int width = std::min(tileRes, size.x - tx),
+					    height = std::min(tileRes, size.y - ty);
+					for (int y=0; y<height; ++y)
+						for (int x=0; x<width; ++x)
+							tile[y * tileRes + x] = array(tx + x, ty + y);
+					fs->write(&tile[0], tile.size() * sizeof(QuantizedValue));
+				}
+			}
+		}
+		fs->close();
+	}
+
 	/// Return the size of all buffers
 	size_t getBufferSize() const {
 		size_t size = 0;
@@ -477,8 +594,21 @@ public:
 	/// Get the component-wise average
 	inline const Value &getAverage() const { return m_average; }
 
-	/// Return the blocked array used to store a given MIP level
+	/// Is the MIP map data paged in from a tiled cache file?
+	inline bool isTiled() const { return m_tileFile != 0; }
+
+	/// Return the tile lookup cache of the calling thread (\c NULL if not tiled)
+	inline TileLookupCache *getTileCache() const {
+		return m_tileFile ? TextureTileCache::getLocalCache() : NULL;
+	}
+
+	/**
+	 * \brief Return the blocked array used to store a given MIP level
+	 *
+	 * Not available for tiled MIP maps (see \ref isTiled())
+	 */
 	inline const Array2DType &getArray(int level = 0) const {
+		Assert(!isTiled());
 		return m_pyramid[level];
 	}
 
@@ -491,7 +621,15 @@ public:
 			array.getSize()
 		);
 
-		array.copyTo((QuantizedValue *) result->getData());
+		if (isTiled()) {
+			TileLookupCache *cache = getTileCache();
+			QuantizedValue *target = (QuantizedValue *) result->getData();
+			for (int y=0; y<array.getHeight(); ++y)
+				for (int x=0; x<array.getWidth(); ++x)
+					*target++ = fetchTexel(level, x, y, cache);
+		} else {
+			array.copyTo((QuantizedValue *) result->getData());
+		}
 
 		return result;
 	}
@@ -501,6 +639,18 @@ public:
 	 * coordinates, while accounting for boundary conditions
 	 */
 	inline Value evalTexel(int level, int x, int y) const {
+		return evalTexel(level, x, y, getTileCache());
+	}
+
+	/**
+	 * \brief Return the texture value at a texel specified using integer
+	 * coordinates, while accounting for boundary conditions
+	 *
+	 * This version takes the tile lookup cache of the calling thread
+	 * (see \ref getTileCache()), which avoids repeated thread-local
+	 * storage lookups when accessing many texels.
+	 */
+	inline Value evalTexel(int level, int x, int y, TileLookupCache *cache) const {
 		const Vector2i &size = m_pyramid[level].getSize();
 
 		if (x < 0 || x >= size.x) {
@@ -559,7 +709,7 @@ public:
 			}
 		}
 
-		return Value(m_pyramid[level](x, y));
+		return Value(fetchTexel(level, x, y, cache));
 	}
 
 	/// Evaluate the texture at the given resolution using a box filter
@@ -589,10 +739,78 @@ public:
 		Float dx1 = u - xPos, dx2 = 1.0f - dx1,
 		      dy1 = v - yPos, dy2 = 1.0f - dy1;
 
-		return evalTexel(level, xPos, yPos) * dx2 * dy2
-		     + evalTexel(level, xPos, yPos + 1) * dx2 * dy1
-		     + evalTexel(level, xPos + 1, yPos) * dx1 * dy2
-		     + evalTexel(level, xPos + 1, yPos + 1) * dx1 * dy1;
+		TileLookupCache *cache = getTileCache();
+		return evalTexel(level, xPos, yPos, cache) * dx2 * dy2
+		     + evalTexel(level, xPos, yPos + 1, cache) * dx2 * dy1
+		     + evalTexel(level, xPos + 1, yPos, cache) * dx1 * dy2
+		     + evalTexel(level, xPos + 1, yPos + 1, cache) * dx1 * dy1;
+	}
+
+	/**
+	 * \brief Evaluate the texture at many positions on a MIP level using
+	 * bilinear interpolation
+	 *
+	 * Produces the same results as calling \ref evalBilinear() for each
+	 * position. The texel coordinates and interpolation weights are
+	 * computed for four lookups at a time when SSE2 is available.
+	 */
+	void evalBilinearBatch(int level, const Point2 *uv, Value *result, size_t count) const {
+		if (EXPECT_NOT_TAKEN(level >= m_levels)) {
+			for (size_t i=0; i<count; ++i)
+				result[i] = evalBilinear(level, uv[i]);
+			return;
+		}
+
+		const Vector2i &size = m_pyramid[level].getSize();
+		TileLookupCache *cache = getTileCache();
+		size_t i = 0;
+
+#if defined(MTS_SSE)
+		const __m128 sizeX = _mm_set1_ps((float) size.x), sizeY = _mm_set1_ps((float) size.y),
+			half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f),
+			absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)),
+			limit = _mm_set1_ps((float) (1 << 30));
+		MM_ALIGN16 int xPos[4], yPos[4];
+		MM_ALIGN16 float dx1[4], dx2[4], dy1[4], dy2[4];
+
+		for (; i + 4 <= count; i += 4) {
+			__m128 u = _mm_sub_ps(_mm_mul_ps(_mm_set_ps(uv[i+3].x, uv[i+2].x,
+				uv[i+1].x, uv[i].x), sizeX), half);
+			__m128 v = _mm_sub_ps(_mm_mul_ps(_mm_set_ps(uv[i+3].y, uv[i+2].y,
+				uv[i+1].y, uv[i].y), sizeY), half);
+
+			/* Lanes with NaNs or huge coordinates take the scalar path */
+			int valid = _mm_movemask_ps(_mm_and_ps(
+				_mm_cmplt_ps(_mm_and_ps(u, absMask), limit),
+				_mm_cmplt_ps(_mm_and_ps(v, absMask), limit)));
+
+			/* Round towards negative infinity (SSE2 only truncates) */
+			__m128i xi = _mm_cvttps_epi32(u), yi = _mm_cvttps_epi32(v);
+			xi = _mm_add_epi32(xi, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(xi), u)));
+			yi = _mm_add_epi32(yi, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(yi), v)));
+
+			__m128 fx = _mm_sub_ps(u, _mm_cvtepi32_ps(xi)),
+			       fy = _mm_sub_ps(v, _mm_cvtepi32_ps(yi));
+			_mm_store_si128((__m128i *) xPos, xi);
+			_mm_store_si128((__m128i *) yPos, yi);
+			_mm_store_ps(dx1, fx); _mm_store_ps(dx2, _mm_sub_ps(one, fx));
+			_mm_store_ps(dy1, fy); _mm_store_ps(dy2, _mm_sub_ps(one, fy));
+
+			for (int j=0; j<4; ++j) {
+				if (EXPECT_NOT_TAKEN(!(valid & (1 << j)))) {
+					result[i+j] = evalBilinear(level, uv[i+j]);
+					continue;
+				}
+				result[i+j] = evalTexel(level, xPos[j], yPos[j], cache) * dx2[j] * dy2[j]
+				            + evalTexel(level, xPos[j], yPos[j] + 1, cache) * dx2[j] * dy1[j]
+				            + evalTexel(level, xPos[j] + 1, yPos[j], cache) * dx1[j] * dy2[j]
+				            + evalTexel(level, xPos[j] + 1, yPos[j] + 1, cache) * dx1[j] * dy1[j];
+			}
+		}
+#endif
+
+		for (; i < count; ++i)
+			result[i] = evalBilinear(level, uv[i]);
 	}
 
 	/**
@@ -615,10 +833,11 @@ public:
 		int xPos = math::floorToInt(u), yPos = math::floorToInt(v);
 		Float dx = u - xPos, dy = v - yPos;
 
-		const Value p00 = evalTexel(level, xPos,   yPos);
-		const Value p10 = evalTexel(level, xPos+1, yPos);
-		const Value p01 = evalTexel(level, xPos,   yPos+1);
-		const Value p11 = evalTexel(level, xPos+1, yPos+1);
+		TileLookupCache *cache = getTileCache();
+		const Value p00 = evalTexel(level, xPos,   yPos,   cache);
+		const Value p10 = evalTexel(level, xPos+1, yPos,   cache);
+		const Value p01 = evalTexel(level, xPos,   yPos+1, cache);
+		const Value p11 = evalTexel(level, xPos+1, yPos+1, cache);
 		Value tmp = p01 + p10 - p11;
 
 		gradient[0] = (p10 + p00*(dy-1) - tmp*dy) * static_cast<Float> (size.x);
@@ -721,7 +940,7 @@ public:
 			<< "   pixelFormat = " << m_pixelFormat << "," << endl
 			<< "   size = " << memString(getBufferSize()) << "," << endl
 			<< "   levels = " << m_levels << "," << endl
-			<< "   cached = " << (m_mmap.get() ? "yes" : "no") << "," << endl
+			<< "   cached = " << (m_mmap.get() ? "yes" : (isTiled() ? "tiled" : "no")) << "," << endl
 			<< "   filterType = ";
 
 		switch (m_filterType) {
@@ -750,6 +969,7 @@ protected:
 		uint8_t bcu:4;
 		uint8_t bcv:4;
 		uint8_t filterType;
+		uint8_t logTileSize;
 		float gamma;
 		int width;
 		int height;
@@ -760,6 +980,29 @@ protected:
 	};
 
 
+	/// Return the number of tiles needed to cover an image of the given size
+	static inline size_t getTileCount(const Vector2i &size, int logTileSize) {
+		const int tileRes = 1 << logTileSize;
+		return (size_t) ((size.x + tileRes - 1) >> logTileSize)
+			* (size_t) ((size.y + tileRes - 1) >> logTileSize);
+	}
+
+	/// Fetch a texel within the bounds of a MIP level
+	inline const QuantizedValue &fetchTexel(int level, int x, int y,
+			TileLookupCache *cache) const {
+		if (EXPECT_TAKEN(m_tileFile == 0))
+			return m_pyramid[level](x, y);
+		else if (EXPECT_NOT_TAKEN(cache == NULL))
+			cache = TextureTileCache::getLocalCache();
+
+		const int mask = (1 << m_logTileSize) - 1;
+		uint32_t index = m_tileOffset[level] + (uint32_t) ((y >> m_logTileSize)
+			* m_tileCount[level] + (x >> m_logTileSize));
+		const QuantizedValue *tile = reinterpret_cast<const QuantizedValue *>(
+			cache->lookup(m_tileFile, index));
+		return tile[((y & mask) << m_logTileSize) + (x & mask)];
+	}
+
 	/// Calculate the elliptically weighted average of a sample and associated Jacobian
 	Value evalEWA(int level, const Point2 &uv, Float A, Float B, Float C) const {
 		Assert(A > 0);
@@ -798,6 +1041,7 @@ protected:
 		Float denominator = 0.0f;
 		Float ddq = 2*As, uu0 = (Float) u0 - u;
 		int nSamples = 0;
+		TileLookupCache *cache = getTileCache();
 
 		for (int vt = v0; vt <= v1; ++vt) {
 			const Float vv = (Float) vt - v;
@@ -810,7 +1054,7 @@ protected:
 					uint32_t qi = (uint32_t) q;
 					if (qi < MTS_MIPMAP_LUT_SIZE) {
 						const Float weight = m_weightLut[(int) q];
-						result += evalTexel(level, ut, vt) * weight;
+						result += evalTexel(level, ut, vt, cache) * weight;
 						denominator += weight;
 						++nSamples;
 					}
@@ -845,6 +1089,10 @@ private:
 	Value m_minimum;
 	Value m_maximum;
 	Value m_average;
+	uint32_t m_tileFile;
+	int m_logTileSize;
+	uint32_t *m_tileOffset;
+	int *m_tileCount;
 };
 
 template <typename Value, typename QuantizedValue>
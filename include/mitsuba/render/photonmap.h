@@ -21,14 +21,30 @@
 #define __MITSUBA_RENDER_PHOTONMAP_H_
 
 #include <mitsuba/render/photon.h>
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+# include <mitsuba/core/sse.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Number of photons, up to which a subtree of the photon map
+ * is searched by testing all of its photons
+ */
+#define MTS_PHOTONMAP_BUCKET_SIZE 16
+
 /** \brief Implementation of the photon map data structure
  *
  * Based on Henrik Wann Jensen's book "Realistic Image Synthesis
  * Using Photon Mapping".
  *
+ * Besides the kd-tree, the photon map keeps a copy of all photon
+ * positions in a structure-of-arrays layout. Since every subtree occupies
+ * a contiguous range of the kd-tree's node array, queries stop descending
+ * once a subtree contains at most \ref MTS_PHOTONMAP_BUCKET_SIZE photons
+ * and test their positions four at a time using SSE. The photon records
+ * themselves are only accessed for photons within the search radius.
+ *
  * \ingroup librender
  */
 class MTS_EXPORT_RENDER PhotonMap : public SerializableObject {
@@ -130,16 +146,23 @@ public:
 		Float searchRadius, Spectrum &result, int maxDepth) const;
 
 	/// Perform a nearest-neighbor query, see \ref PointKDTree for details
-	inline size_t nnSearch(const Point &p, Float &sqrSearchRadius,
-		size_t k, SearchResult *results) const {
-		return m_kdtree.nnSearch(p, sqrSearchRadius, k, results);
-	}
+	size_t nnSearch(const Point &p, Float &sqrSearchRadius,
+		size_t k, SearchResult *results) const;
 
 	/// Perform a nearest-neighbor query, see \ref PointKDTree for details
 	inline size_t nnSearch(const Point &p,
 		size_t k, SearchResult *results) const {
-		return m_kdtree.nnSearch(p, k, results);
+		Float sqrSearchRadius = std::numeric_limits<Float>::infinity();
+		return nnSearch(p, sqrSearchRadius, k, results);
 	}
+
+	/**
+	 * \brief Call a functor for every photon within the specified radius
+	 *
+	 * \return The number of photons within the radius
+	 */
+	template <typename Functor> size_t executeQuery(const Point &p,
+		Float searchRadius, Functor &functor) const;
 	//! @}
 	// =============================================================
 
@@ -170,7 +193,7 @@ public:
 	 * This has to be done once after all photons have been stored,
 	 * but prior to executing any queries.
 	 */
-	inline void build(bool recomputeAABB = false) { m_kdtree.build(recomputeAABB); }
+	void build(bool recomputeAABB = false);
 
 	/// Return the depth of the constructed KD-tree
 	inline size_t getDepth() const { return m_kdtree.getDepth(); }
@@ -193,11 +216,187 @@ public:
 protected:
 	/// Virtual destructor
 	virtual ~PhotonMap();
+
+	/// Copy the photon positions of the built kd-tree into \c m_positions
+	void copyPositions();
+
+	/**
+	 * \brief Call <tt>functor(index, distSquared)</tt> for every photon
+	 * in the index range <tt>[start, end)</tt> that lies within the
+	 * (squared) search radius
+	 */
+	template <typename Functor> void searchRange(IndexType start, IndexType end,
+		const Point &p, const Float &sqrSearchRadius, Functor &functor) const;
+
+	/**
+	 * \brief Traverse the kd-tree and pass all photons within the search
+	 * radius to \ref searchRange()-style functors
+	 *
+	 * The search radius is re-read after every step, hence the functor may
+	 * reduce it while the traversal is in progress.
+	 */
+	template <typename Functor> void traverse(const Point &p,
+		const Float &sqrSearchRadius, Functor &functor) const;
 protected:
 	PhotonTree m_kdtree;
 	Float m_scale;
+	/// Photon positions in kd-tree order (separate x, y and z arrays)
+	Float *m_positions[3];
+};
+
+template <typename Functor> void PhotonMap::searchRange(IndexType start,
+		IndexType end, const Point &p, const Float &sqrSearchRadius,
+		Functor &functor) const {
+	const Float *x = m_positions[0], *y = m_positions[1], *z = m_positions[2];
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+	/* The position arrays are padded, hence it is safe to read past the end */
+	const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+	for (IndexType i=start; i<end; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px),
+		       dy = _mm_sub_ps(_mm_loadu_ps(y + i), py),
+		       dz = _mm_sub_ps(_mm_loadu_ps(z + i), pz);
+		__m128 distSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+			_mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(distSquared,
+			_mm_set1_ps(sqrSearchRadius)));
+		if (end - i < 4)
+			mask &= (1 << (end - i)) - 1;
+		if (!mask)
+			continue;
+
+		MM_ALIGN16 float dist[4];
+		_mm_store_ps(dist, distSquared);
+		for (int j=0; j<4; ++j) {
+			if (mask & (1 << j))
+				functor(i + j, dist[j]);
+		}
+	}
+#else
+	for (IndexType i=start; i<end; ++i) {
+		Float dx = x[i] - p.x, dy = y[i] - p.y, dz = z[i] - p.z;
+		Float distSquared = dx*dx + dy*dy + dz*dz;
+		if (distSquared < sqrSearchRadius)
+			functor(i, distSquared);
+	}
+#endif
+}
+
+template <typename Functor> void PhotonMap::traverse(const Point &p,
+		const Float &sqrSearchRadius, Functor &functor) const {
+	IndexType size = (IndexType) m_kdtree.size();
+	if (size == 0)
+		return;
+
+#if MTS_PHOTONMAP_LEFT_BALANCED == 0
+	/* Every subtree covers a contiguous index range. Store
+	   them on the stack in the form of (start, end) pairs */
+	IndexType *stack = (IndexType *) alloca(2 * (m_kdtree.getDepth() + 1) * sizeof(IndexType));
+	IndexType start = 0, end = size, stackPos = 0;
+
+	while (true) {
+		if (end - start <= MTS_PHOTONMAP_BUCKET_SIZE) {
+			/* Test all photons of small subtrees at once */
+			searchRange(start, end, p, sqrSearchRadius, functor);
+			if (stackPos == 0)
+				break;
+			stackPos -= 2;
+			start = stack[stackPos];
+			end = stack[stackPos + 1];
+			continue;
+		}
+
+		const Photon &node = m_kdtree[start];
+		searchRange(start, start + 1, p, sqrSearchRadius, functor);
+
+		int axis = node.getAxis();
+		Float distToPlane = p[axis] - node.getPosition()[axis];
+		bool searchBoth = distToPlane*distToPlane <= sqrSearchRadius;
+		IndexType split = m_kdtree.hasRightChild(start)
+			? node.getRightIndex(start) : end;
+
+		/* Visit the side containing the query first */
+		IndexType nearStart = start + 1, nearEnd = split,
+		          farStart = split, farEnd = end;
+		if (distToPlane > 0) {
+			std::swap(nearStart, farStart);
+			std::swap(nearEnd, farEnd);
+		}
+
+		if (searchBoth && farStart != farEnd) {
+			if (nearStart != nearEnd) {
+				stack[stackPos++] = farStart;
+				stack[stackPos++] = farEnd;
+			} else {
+				nearStart = farStart;
+				nearEnd = farEnd;
+			}
+		}
+
+		if (nearStart != nearEnd) {
+			start = nearStart;
+			end = nearEnd;
+		} else if (stackPos > 0) {
+			stackPos -= 2;
+			start = stack[stackPos];
+			end = stack[stackPos + 1];
+		} else {
+			break;
+		}
+	}
+#else
+	/* Subtrees are not contiguous in the left-balanced layout */
+	IndexType *stack = (IndexType *) alloca((m_kdtree.getDepth() + 1) * sizeof(IndexType));
+	IndexType stackPos = 0;
+	stack[stackPos++] = 0;
+
+	while (stackPos > 0) {
+		IndexType index = stack[--stackPos];
+		const Photon &node = m_kdtree[index];
+		searchRange(index, index + 1, p, sqrSearchRadius, functor);
+		if (node.isLeaf())
+			continue;
+
+		int axis = node.getAxis();
+		Float distToPlane = p[axis] - node.getPosition()[axis];
+		bool searchBoth = distToPlane*distToPlane <= sqrSearchRadius;
+		bool hasRight = m_kdtree.hasRightChild(index);
+
+		if (distToPlane > 0) {
+			if (searchBoth)
+				stack[stackPos++] = node.getLeftIndex(index);
+			if (hasRight)
+				stack[stackPos++] = node.getRightIndex(index);
+		} else {
+			if (searchBoth && hasRight)
+				stack[stackPos++] = node.getRightIndex(index);
+			stack[stackPos++] = node.getLeftIndex(index);
+		}
+	}
+#endif
+}
+
+/// Adapter that forwards the photons found by \ref PhotonMap::traverse()
+template <typename Functor> struct PhotonRangeQuery {
+	inline PhotonRangeQuery(const PhotonMap::PhotonTree &kdtree, Functor &functor)
+		: kdtree(kdtree), functor(functor), count(0) { }
+
+	inline void operator()(PhotonMap::IndexType index, Float) {
+		functor(kdtree[index]);
+		++count;
+	}
+
+	const PhotonMap::PhotonTree &kdtree;
+	Functor &functor;
+	size_t count;
 };
 
+template <typename Functor> size_t PhotonMap::executeQuery(const Point &p,
+		Float searchRadius, Functor &functor) const {
+	PhotonRangeQuery<Functor> query(m_kdtree, functor);
+	traverse(p, searchRadius * searchRadius, query);
+	return query.count;
+}
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_PHOTONMAP_H_ */
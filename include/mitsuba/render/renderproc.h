@@ -62,6 +62,18 @@ public:
 	void setPixelFormat(Bitmap::EPixelFormat pixelFormat,
 		int channelCount = -1, bool warnInvalid = false);
 
+	/**
+	 * \brief Prevent any further blocks from being merged into the film
+	 *
+	 * This acquires all tile mutexes (or the result mutex when the film
+	 * doesn't support concurrent merging), which makes it safe to read
+	 * the film from another thread until \ref unlockFilm() is called.
+	 */
+	void lockFilm();
+
+	/// Release the mutexes acquired by \ref lockFilm()
+	void unlockFilm();
+
 	// ======================================================================
 	//! @{ \name Implementation of the ParallelProcess interface
 	// ======================================================================
@@ -78,6 +90,23 @@ public:
 protected:
 	/// Virtual destructor
 	virtual ~BlockedRenderProcess();
+
+	/**
+	 * \brief Lock all image tiles overlapped by the given block
+	 * (including its border)
+	 *
+	 * The image is divided into tiles of the block size, each of which
+	 * has its own mutex. Blocks that don't share any tiles can then be
+	 * merged at the same time. The mutexes are always acquired in the
+	 * same order, hence this cannot deadlock.
+	 */
+	void lockTiles(const ImageBlock *block);
+
+	/// Release the mutexes acquired by \ref lockTiles()
+	void unlockTiles(const ImageBlock *block);
+
+	/// Compute the range of tiles overlapped by a block
+	void getTileRange(const ImageBlock *block, Point2i &min, Point2i &max) const;
 protected:
 	ref<RenderQueue> m_queue;
 	ref<Scene> m_scene;
@@ -85,6 +114,7 @@ protected:
 	const RenderJob *m_parent;
 	int m_resultCount;
 	ref<Mutex> m_resultMutex;
+	std::vector<ref<Mutex> > m_tileMutexes;
 	ProgressReporter *m_progress;
 	int m_borderSize;
 	Bitmap::EPixelFormat m_pixelFormat;
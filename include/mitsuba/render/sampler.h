@@ -158,6 +158,16 @@ public:
 	/// Return the current sample index
 	inline size_t getSampleIndex() const { return m_sampleIndex; }
 
+	/**
+	 * \brief Does this sampler return the same samples every time that
+	 * \ref generate() is called for a given pixel?
+	 *
+	 * This is the case for the quasi-Monte Carlo sequences, which can
+	 * therefore not be used to render an image in several independent
+	 * passes. The default implementation returns \c false.
+	 */
+	virtual bool isDeterministic() const;
+
 	/// Serialize this sampler to a binary data stream
 	virtual void serialize(Stream *stream, InstanceManager *manager) const;
 
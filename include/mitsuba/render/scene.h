@@ -25,6 +25,8 @@
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/shapebvh.h>
+#include <mitsuba/render/lighttree.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
@@ -48,6 +50,16 @@ MTS_NAMESPACE_BEGIN
  */
 class MTS_EXPORT_RENDER Scene : public NetworkedObject {
 public:
+	/// Strategies for choosing an emitter in \ref sampleEmitterDirect()
+	enum EEmitterSampling {
+		/// Proportional to the sampling weights of the emitters
+		EPowerEmitterSampling = 0,
+		/// Using a light hierarchy (see \ref LightTree)
+		ETreeEmitterSampling,
+		/// Using a light hierarchy when the scene contains many emitters
+		EAutoEmitterSampling
+	};
+
 	// =============================================================
 	//! @{ \name Initialization and rendering
 	// =============================================================
@@ -80,6 +92,21 @@ public:
 	 */
 	void invalidate();
 
+	/**
+	 * \brief Update the BVH after the vertex positions of the scene's
+	 * triangle meshes have changed, e.g. between the frames of an animation
+	 *
+	 * The meshes must keep their triangles. Instead of building the
+	 * BVH from scratch, this refits its bounding boxes and only rebuilds
+	 * it once its quality has degraded (see \ref ShapeBVH::update()).
+	 * The bounding boxes and area sampling tables of the meshes, the power
+	 * of their area emitters, the light hierarchy and the scene's bounding
+	 * box are updated as well. Emitters that depend on the scene's bounds
+	 * (e.g. environment maps) are not reconfigured. Only scenes that use a
+	 * BVH support this function.
+	 */
+	void updateGeometry();
+
 	/**
 	 * \brief Initialize the scene for bidirectional rendering algorithms.
 	 *
@@ -185,6 +212,8 @@ public:
 	 * \return \c true if an intersection was found
 	 */
 	inline bool rayIntersect(const Ray &ray, Intersection &its) const {
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray, its);
 		return m_kdtree->rayIntersect(ray, its);
 	}
 
@@ -219,6 +248,8 @@ public:
 	 */
 	inline bool rayIntersect(const Ray &ray, Float &t,
 			ConstShapePtr &shape, Normal &n, Point2 &uv) const {
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray, t, shape, n, uv);
 		return m_kdtree->rayIntersect(ray, t, shape, n, uv);
 	}
 
@@ -239,6 +270,8 @@ public:
 	 * \return \c true if an intersection was found
 	 */
 	inline bool rayIntersect(const Ray &ray) const {
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray);
 		return m_kdtree->rayIntersect(ray);
 	}
 
@@ -844,6 +877,10 @@ public:
 	/**
 	 * \brief Return the discrete probability of choosing a
 	 * certain emitter in <tt>sampleEmitter*</tt>
+	 *
+	 * When the scene uses a light hierarchy (see \ref getLightTree()),
+	 * this does not apply to the direct illumination sampling methods,
+	 * whose choice depends on the reference point.
 	 */
 	inline Float pdfEmitterDiscrete(const Emitter *emitter) const {
 		return emitter->getSamplingWeight() * m_emitterPDF.getNormalization();
@@ -941,6 +978,15 @@ public:
 		return m_aabb;
 	}
 
+	/**
+	 * \brief Return a bounding box containing the scene's geometry
+	 *
+	 * Unlike \ref getAABB(), this does not account for the sensor.
+	 */
+	inline const AABB &getGeometryAABB() const {
+		return m_bvh.get() ? m_bvh->getAABB() : m_kdtree->getAABB();
+	}
+
 	/**
 	 * \brief Is the main scene sensor degenerate?  (i.e. has it
 	 * collapsed to a point or line)
@@ -1066,11 +1112,55 @@ public:
 	/// Return the scene's film
 	inline const Film *getFilm() const { return m_sensor->getFilm(); }
 
-	/// Return the scene's kd-tree accelerator
+	/**
+	 * \brief Return the scene's kd-tree accelerator
+	 *
+	 * When the scene uses a BVH (see \ref getBVH()), the kd-tree
+	 * remains empty and is never built.
+	 */
 	inline ShapeKDTree *getKDTree() { return m_kdtree; }
 	/// Return the scene's kd-tree accelerator
 	inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
 
+	/**
+	 * \brief Return the scene's BVH accelerator
+	 *
+	 * This is \c NULL unless the scene was created with
+	 * <tt>accel="bvh"</tt>, in which case it replaces the kd-tree
+	 * for all ray intersection queries.
+	 */
+	inline ShapeBVH *getBVH() { return m_bvh; }
+	/// Return the scene's BVH accelerator
+	inline const ShapeBVH *getBVH() const { return m_bvh.get(); }
+
+	/**
+	 * \brief Use a BVH instead of the kd-tree for ray intersection
+	 * queries (passing \c NULL reverts to the kd-tree)
+	 *
+	 * This must be called before \ref initialize().
+	 */
+	inline void setBVH(ShapeBVH *bvh) { m_bvh = bvh; }
+
+	/**
+	 * \brief Return the light hierarchy, which chooses emitters in
+	 * \ref sampleEmitterDirect() and related methods
+	 *
+	 * This is \c NULL when emitters are chosen proportional to
+	 * their sampling weight (see \ref EEmitterSampling).
+	 */
+	inline const LightTree *getLightTree() const { return m_lightTree.get(); }
+
+	/// Return the strategy for choosing emitters in direct illumination sampling
+	inline EEmitterSampling getEmitterSampling() const { return m_emitterSampling; }
+
+	/**
+	 * \brief Set the strategy for choosing emitters in direct
+	 * illumination sampling
+	 *
+	 * This must be called before \ref initialize().
+	 */
+	inline void setEmitterSampling(EEmitterSampling strategy) { m_emitterSampling = strategy; }
+
 	/// Return the a list of all subsurface integrators
 	inline ref_vector<Subsurface> &getSubsurfaceIntegrators() { return m_ssIntegrators; }
 	/// Return the a list of all subsurface integrators
@@ -1143,8 +1233,19 @@ protected:
 	/// Add a shape to the scene
 	void addShape(Shape *shape);
 	/// \endcond
+
+	/**
+	 * \brief Randomly choose an emitter for direct illumination
+	 * sampling at the reference point of \c dRec
+	 *
+	 * Returns \c NULL if no emitter can illuminate the reference point.
+	 * The sample is rescaled so that it can be reused.
+	 */
+	const Emitter *sampleEmitterDiscrete(const DirectSamplingRecord &dRec,
+		Float &sample, Float &pdf) const;
 private:
 	ref<ShapeKDTree> m_kdtree;
+	ref<ShapeBVH> m_bvh;
 	ref<Sensor> m_sensor;
 	ref<Integrator> m_integrator;
 	ref<Sampler> m_sampler;
@@ -1161,8 +1262,10 @@ private:
 	fs::path *m_sourceFile;
 	fs::path *m_destinationFile;
 	DiscreteDistribution m_emitterPDF;
+	ref<LightTree> m_lightTree;
 	AABB m_aabb;
 	uint32_t m_blockSize;
+	EEmitterSampling m_emitterSampling;
 	bool m_degenerateSensor;
 	bool m_degenerateEmitters;
 };
@@ -209,6 +209,20 @@ public:
 	/// Return a bounding box containing the shape
 	virtual AABB getAABB() const = 0;
 
+	/**
+	 * \brief Return a cone that bounds the surface normals of the shape
+	 *
+	 * This is used by the light hierarchy of \ref Scene to skip area
+	 * emitters that face away from a shading point. The default
+	 * implementation returns a cone containing all directions.
+	 *
+	 * \param axis
+	 *    Central axis of the cone
+	 * \param cosTheta
+	 *    Cosine of the cone's half-angle
+	 */
+	virtual void getNormalCone(Vector &axis, Float &cosTheta) const;
+
 	/**
 	 * \brief Returns the minimal axis-aligned bounding box
 	 * of this shape when clipped to another bounding box.
@@ -0,0 +1,459 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_SHAPEBVH_H_)
+#define __MITSUBA_RENDER_SHAPEBVH_H_
+
+#include <mitsuba/render/skdtree.h>
+
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
+
+/// Number of children per BVH node
+#define MTS_BVH_WIDTH 4
+
+/// Maximum depth of the BVH (deeper subtrees are split at the object median)
+#define MTS_BVH_MAXDEPTH 64
+
+/// Relative SAH cost increase, at which \ref ShapeBVH::update() rebuilds the tree
+#define MTS_BVH_REBUILD_THRESHOLD 1.5f
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Four-wide bounding volume hierarchy for fast ray-triangle
+ * intersections
+ *
+ * This is an alternative to \ref ShapeKDTree, which trades some traversal
+ * performance for a much faster and leaner construction. It is selected
+ * using the \c accel parameter of the scene and is mainly intended for
+ * very large scenes and for interactive workflows, where the scene is
+ * reloaded frequently.
+ *
+ * The tree is built top-down using the binned surface area heuristic
+ * and four-way splits (each inner node is created by repeatedly splitting
+ * the child with the largest surface area). Once the upper levels are in
+ * place, the remaining subtrees are built in parallel.
+ *
+ * Each node stores the bounding boxes of its four children in single
+ * precision and SoA order, so that a ray can be tested against all of
+ * them using a few SSE instructions. Primitives are never duplicated, and
+ * triangles are intersected directly from the vertex data of their
+ * meshes using the Moeller-Trumbore test, which requires only 8 bytes
+ * of storage per triangle (compared to 48 bytes of \c TriAccel data
+ * and the index lists of the kd-tree leaves).
+ *
+ * The query interface matches that of \ref ShapeKDTree.
+ *
+ * When the vertices of the stored meshes move but their topology stays
+ * the same (e.g. between the frames of a cloth or character animation),
+ * the tree need not be built again: \ref update() refits the node bounds
+ * in linear time and only rebuilds the tree once its quality has
+ * degraded too much. The static node-level functions are also used by
+ * shapes that maintain their own hierarchies (e.g. the \c deformable
+ * shape plugin).
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ShapeBVH : public Object {
+public:
+	// =============================================================
+	//! @{ \name Initialization and tree construction
+	// =============================================================
+
+	/// Create an empty BVH
+	ShapeBVH();
+
+	/// Add a shape to the BVH
+	void addShape(const Shape *shape);
+
+	/// Return the list of stored shapes
+	inline const std::vector<const Shape *> &getShapes() const { return m_shapes; }
+
+	/**
+	 * \brief Return the total number of low-level primitives (triangles
+	 * and other low-level primitives)
+	 */
+	inline size_t getPrimitiveCount() const { return m_primitiveCount; }
+
+	/// Return an axis-aligned bounding box containing all primitives
+	inline const AABB &getAABB() const { return m_aabb; }
+
+	/// Set the maximum number of primitives per leaf node (default: 4)
+	inline void setLeafSize(int leafSize) { m_leafSize = leafSize; }
+
+	/// Return the maximum number of primitives per leaf node
+	inline int getLeafSize() const { return m_leafSize; }
+
+	/// Set the number of bins used by the SAH split search (default: 16)
+	inline void setBinCount(int binCount) { m_binCount = binCount; }
+
+	/// Return the number of bins used by the SAH split search
+	inline int getBinCount() const { return m_binCount; }
+
+	/// Use multiple cores to build the BVH? (default: true)
+	inline void setParallelBuild(bool parallel) { m_parallelBuild = parallel; }
+
+	/// Return whether the BVH is built using multiple cores
+	inline bool getParallelBuild() const { return m_parallelBuild; }
+
+	/**
+	 * \brief Set the relative SAH cost increase, at which \ref update()
+	 * rebuilds the tree instead of refitting it (default: 1.5)
+	 */
+	inline void setRebuildThreshold(Float threshold) { m_rebuildThreshold = threshold; }
+
+	/// Return the relative SAH cost increase that triggers a rebuild
+	inline Float getRebuildThreshold() const { return m_rebuildThreshold; }
+
+	/// Has the BVH been built?
+	inline bool isBuilt() const { return m_nodes != NULL; }
+
+	/// Build the BVH (needs to be called before tracing any rays)
+	void build();
+
+	/**
+	 * \brief Recompute the node bounds after the vertex positions of
+	 * the stored meshes have changed
+	 *
+	 * The hierarchy itself is left as it is, hence the meshes must keep
+	 * their triangles (only the vertex positions may change). Other
+	 * shapes are refitted using their current bounding boxes.
+	 *
+	 * \return The SAH cost of the refitted tree relative to its cost
+	 *    right after it was built
+	 */
+	Float refit();
+
+	/**
+	 * \brief Refit the BVH and rebuild it if its SAH cost grew by more
+	 * than the rebuild threshold since it was last built
+	 *
+	 * \return \c true if the tree was rebuilt
+	 */
+	bool update();
+
+	//! @}
+	// =============================================================
+
+	// =============================================================
+	//! @{ \name Ray tracing routines
+	// =============================================================
+
+	/**
+	 * \brief Intersect a ray against all primitives stored in the BVH
+	 * and return detailed intersection information
+	 *
+	 * \sa ShapeKDTree::rayIntersect(const Ray &, Intersection &)
+	 */
+	bool rayIntersect(const Ray &ray, Intersection &its) const;
+
+	/**
+	 * \brief Intersect a ray against all primitives stored in the BVH
+	 * and return the traveled distance and intersected shape
+	 *
+	 * \sa ShapeKDTree::rayIntersect(const Ray &, Float &, ConstShapePtr &, Normal &, Point2 &)
+	 */
+	bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+		Normal &n, Point2 &uv) const;
+
+	/**
+	 * \brief Test a ray for occlusion with respect to all primitives
+	 *    stored in the BVH.
+	 *
+	 * \sa ShapeKDTree::rayIntersect(const Ray &)
+	 */
+	bool rayIntersect(const Ray &ray) const;
+
+	//! @}
+	// =============================================================
+
+	/// Return a string representation
+	std::string toString() const;
+
+	// =============================================================
+	//! @{ \name Node-level interface
+	// =============================================================
+
+	/**
+	 * \brief Inner node of the BVH
+	 *
+	 * Stores the bounds of up to four children in SoA layout. A child
+	 * with a nonzero primitive count is a leaf, which references the
+	 * entries <tt>child .. child+count-1</tt> of the primitive order. Otherwise,
+	 * \c child refers to another node, which always has a larger index
+	 * than its parent. Unused slots have empty bounds and a
+	 * zero child index.
+	 */
+	struct Node {
+		/// Child bounds: min x, min y, min z, max x, max y, max z
+		float bounds[6][MTS_BVH_WIDTH];
+		/// Node or primitive index of each child
+		uint32_t child[MTS_BVH_WIDTH];
+		/// Primitive count of leaf children (zero for inner nodes)
+		uint32_t count[MTS_BVH_WIDTH];
+	};
+
+	/**
+	 * \brief Build a hierarchy over a set of primitive bounding boxes
+	 *
+	 * \param primBounds
+	 *    Bounding boxes of the primitives
+	 * \param primCount
+	 *    Number of primitives
+	 * \param order
+	 *    Output array of \c primCount entries, which receives the
+	 *    primitive indices in leaf order
+	 * \param nodeCount
+	 *    Returns the number of nodes
+	 * \return
+	 *    The nodes (root first), which must be released using \ref freeAligned()
+	 */
+	static Node *buildNodes(const AABB *primBounds, uint32_t primCount,
+		uint32_t *order, int leafSize, int binCount, bool parallel,
+		size_t &nodeCount);
+
+	/**
+	 * \brief Recompute the bounds of all nodes of a hierarchy
+	 *
+	 * \param leafBounds
+	 *    Bounding boxes of the primitives in leaf order
+	 * \param aabb
+	 *    Returns the bounding box of the whole hierarchy
+	 * \return
+	 *    The SAH cost of the hierarchy (see \ref computeCost())
+	 */
+	static Float refitNodes(Node *nodes, size_t nodeCount,
+		const AABB *leafBounds, AABB &aabb);
+
+	/**
+	 * \brief Return the SAH cost of a hierarchy, i.e. the expected number
+	 * of node visits and primitive tests of a random ray
+	 */
+	static Float computeCost(const Node *nodes, size_t nodeCount);
+
+	/**
+	 * \brief Traverse a hierarchy in front-to-back order
+	 *
+	 * \param leaf
+	 *    Functor with the signature <tt>bool leaf(uint32_t start,
+	 *    uint32_t count, Float mint, Float &maxt)</tt>, which intersects
+	 *    the primitives of a leaf. It returns \c true and shortens
+	 *    \c maxt when the ray hits one of them.
+	 * \return
+	 *    \c true if any leaf reported an intersection. In this case,
+	 *    \c maxt contains the distance of the closest one.
+	 */
+	template <bool shadowRay, typename LeafFunctor> static bool traverse(
+		const Node *nodes, const Ray &ray, Float mint, Float &maxt,
+		LeafFunctor &leaf);
+
+	//! @}
+	// =============================================================
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~ShapeBVH();
+
+	/**
+	 * \brief Reference to a primitive
+	 *
+	 * \c primIndex is the triangle index within the mesh, or
+	 * \c KNoTriangleFlag for shapes other than triangle meshes
+	 */
+	struct Primitive {
+		uint32_t shapeIndex;
+		uint32_t primIndex;
+	};
+
+	/// Hit information stored in the temporary buffer of a query
+	struct IntersectionCache {
+		uint32_t shapeIndex;
+		uint32_t primIndex;
+		Float u, v;
+	};
+
+	/// Traverse the BVH and find the closest (or any) intersection
+	template <bool shadowRay> bool rayIntersectInternal(const Ray &ray,
+		Float mint, Float maxt, Float &t, void *temp) const;
+
+	/// Intersect the ray against the primitives of a leaf
+	template <bool shadowRay> bool intersectLeaf(const Ray &ray,
+		uint32_t start, uint32_t count, Float mint, Float &maxt, void *temp) const;
+
+	/// Leaf functor of \ref traverse(), which forwards to \ref intersectLeaf()
+	template <bool shadowRay> struct LeafIntersector;
+
+	/// Release the nodes and primitives
+	void clear();
+
+	/// Compute a detailed intersection record from a query's temporary buffer
+	void fillIntersectionRecord(const Ray &ray, const void *temp,
+		Intersection &its) const;
+
+	class BVHBuilder;
+	friend class BVHBuilder;
+private:
+	std::vector<const Shape *> m_shapes;
+	Node *m_nodes;
+	Primitive *m_primitives;
+	size_t m_nodeCount;
+	size_t m_primitiveCount;
+	AABB m_aabb;
+	Float m_buildCost;
+	Float m_rebuildThreshold;
+	int m_leafSize;
+	int m_binCount;
+	bool m_parallelBuild;
+};
+
+namespace detail {
+	/// Single precision version of a ray used to test the node bounds
+	struct BVHRay {
+		float o[3], dRcp[3];
+		int nearIdx[3], farIdx[3];
+#if defined(MTS_SSE)
+		__m128 o4[3], dRcp4[3];
+#endif
+
+		inline BVHRay(const Ray &ray) {
+			for (int i=0; i<3; ++i) {
+				Float d = ray.d[i];
+				/* Avoid infinities, which produce NaNs when a ray origin
+				   lies exactly on a bounding box plane */
+				if (std::abs(d) < (Float) 1e-20f)
+					d = d < 0 ? (Float) -1e-20f : (Float) 1e-20f;
+				o[i] = (float) ray.o[i];
+				dRcp[i] = (float) (1 / d);
+				nearIdx[i] = dRcp[i] >= 0 ? i : i + 3;
+				farIdx[i] = dRcp[i] >= 0 ? i + 3 : i;
+#if defined(MTS_SSE)
+				o4[i] = _mm_set1_ps(o[i]);
+				dRcp4[i] = _mm_set1_ps(dRcp[i]);
+#endif
+			}
+		}
+	};
+
+	/// Traversal stack entry
+	struct BVHStackEntry {
+		uint32_t child;
+		uint32_t count;
+		float t;
+	};
+};
+
+template <bool shadowRay, typename LeafFunctor> bool ShapeBVH::traverse(
+		const Node *nodes, const Ray &ray, Float mint, Float &maxt,
+		LeafFunctor &leaf) {
+	/* Scale factor for the exit distances, which makes the box
+	   test robust against rounding errors */
+	const float farScale = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+
+	detail::BVHStackEntry stack[3 * MTS_BVH_MAXDEPTH + 1];
+	const detail::BVHRay r(ray);
+	float maxtf = (float) maxt * farScale;
+	bool foundIntersection = false;
+	int stackIndex = 0;
+
+	stack[stackIndex].child = 0;
+	stack[stackIndex].count = 0;
+	stack[stackIndex++].t = 0;
+
+	while (stackIndex > 0) {
+		const detail::BVHStackEntry &entry = stack[--stackIndex];
+		if (entry.t > maxtf)
+			continue;
+
+		if (entry.count > 0) {
+			if (leaf(entry.child, entry.count, mint, maxt)) {
+				if (shadowRay)
+					return true;
+				foundIntersection = true;
+				maxtf = (float) maxt * farScale;
+			}
+			continue;
+		}
+
+		const Node &node = nodes[entry.child];
+		float MM_ALIGN16 tNear[MTS_BVH_WIDTH];
+		int mask;
+
+#if defined(MTS_SSE)
+		const __m128
+			t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.nearIdx[0]]), r.o4[0]), r.dRcp4[0]),
+			t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.nearIdx[1]]), r.o4[1]), r.dRcp4[1]),
+			t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.nearIdx[2]]), r.o4[2]), r.dRcp4[2]),
+			t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.farIdx[0]]), r.o4[0]), r.dRcp4[0]),
+			t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.farIdx[1]]), r.o4[1]), r.dRcp4[1]),
+			t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.farIdx[2]]), r.o4[2]), r.dRcp4[2]);
+
+		const __m128
+			near = _mm_max_ps(_mm_max_ps(t0x, t0y), _mm_max_ps(t0z, _mm_setzero_ps())),
+			far = _mm_mul_ps(_mm_min_ps(_mm_min_ps(t1x, t1y),
+				_mm_min_ps(t1z, _mm_set1_ps(maxtf))), _mm_set1_ps(farScale));
+
+		_mm_store_ps(tNear, near);
+		mask = _mm_movemask_ps(_mm_cmple_ps(near, far));
+#else
+		mask = 0;
+		for (int i=0; i<MTS_BVH_WIDTH; ++i) {
+			float near = 0, far = maxtf;
+			for (int dim=0; dim<3; ++dim) {
+				near = std::max(near, (node.bounds[r.nearIdx[dim]][i] - r.o[dim]) * r.dRcp[dim]);
+				far = std::min(far, (node.bounds[r.farIdx[dim]][i] - r.o[dim]) * r.dRcp[dim]);
+			}
+			tNear[i] = near;
+			if (near <= far * farScale)
+				mask |= 1 << i;
+		}
+#endif
+
+		if (mask == 0)
+			continue;
+
+		/* Push the children so that the closest one is visited first */
+		int order[MTS_BVH_WIDTH], hitCount = 0;
+		for (int i=0; i<MTS_BVH_WIDTH; ++i) {
+			if (!(mask & (1 << i)))
+				continue;
+			int j = hitCount++;
+			while (j > 0 && tNear[order[j-1]] < tNear[i]) {
+				order[j] = order[j-1];
+				--j;
+			}
+			order[j] = i;
+		}
+
+		for (int i=0; i<hitCount; ++i) {
+			detail::BVHStackEntry &target = stack[stackIndex++];
+			target.child = node.child[order[i]];
+			target.count = node.count[order[i]];
+			target.t = tNear[order[i]];
+		}
+	}
+
+	return foundIntersection;
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_SHAPEBVH_H_ */
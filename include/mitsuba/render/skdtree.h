@@ -97,6 +97,24 @@ public:
 	/// Return an axis-aligned bounding box containing all primitives
 	inline const AABB &getAABB() const { return m_aabb; }
 
+	/**
+	 * \brief Set a directory, in which built kd-trees are cached
+	 *
+	 * When set, \ref build() first computes a hash of the geometry and
+	 * of the construction parameters and looks for a matching tree in
+	 * this directory. If there is one, it is memory-mapped instead of
+	 * being rebuilt. Otherwise, the newly built tree is stored there.
+	 * An empty path (the default) disables the cache.
+	 *
+	 * Trees that clip shapes other than triangle meshes against their
+	 * nodes (see \ref setClip()) are never cached, since the hash cannot
+	 * capture the exact geometry of such shapes.
+	 */
+	void setCacheDirectory(const fs::path &path);
+
+	/// Return the directory, in which built kd-trees are cached
+	fs::path getCacheDirectory() const;
+
 	/// Build the kd-tree (needs to be called before tracing any rays)
 	void build();
 
@@ -189,6 +207,28 @@ public:
 	 */
 	void rayIntersectPacketIncoherent(const RayPacket4 &packet,
 		const RayInterval4 &interval, Intersection4 &its, void *temp) const;
+
+	/**
+	 * \brief Intersect four rays at once and fill in detailed
+	 * intersection records
+	 *
+	 * This is the packet equivalent of
+	 * \ref rayIntersect(const Ray &, Intersection &). When the directions
+	 * of the four rays have the same signs, they are traversed as a
+	 * coherent packet. Otherwise, they are traced one at a time.
+	 *
+	 * \return A bit mask of the rays that hit something
+	 */
+	int rayIntersectPacket(const Ray *rays, Intersection *its) const;
+
+	/**
+	 * \brief Test four shadow rays for occlusion at once
+	 *
+	 * This is the packet equivalent of \ref rayIntersect(const Ray &).
+	 *
+	 * \return A bit mask of the occluded rays
+	 */
+	int rayIntersectPacket(const Ray *rays) const;
 #endif
 	//! @}
 	// =============================================================
@@ -345,79 +385,8 @@ protected:
 		const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
 		const Shape *shape = m_shapes[cache->shapeIndex];
 		if (m_triangleFlag[cache->shapeIndex]) {
-			const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
-			const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
-			const Point *vertexPositions = trimesh->getVertexPositions();
-			const Normal *vertexNormals = trimesh->getVertexNormals();
-			const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
-			const Color3 *vertexColors = trimesh->getVertexColors();
-			const TangentSpace *vertexTangents = trimesh->getUVTangents();
-			const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-
-			const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
-			const Point &p0 = vertexPositions[idx0];
-			const Point &p1 = vertexPositions[idx1];
-			const Point &p2 = vertexPositions[idx2];
-
-			if (BarycentricPos)
-				its.p = p0 * b.x + p1 * b.y + p2 * b.z;
-			else
-				its.p = ray(its.t);
-
-			Vector side1(p1-p0), side2(p2-p0);
-			Normal faceNormal(cross(side1, side2));
-			Float length = faceNormal.length();
-			if (!faceNormal.isZero())
-				faceNormal /= length;
-
-			if (EXPECT_NOT_TAKEN(vertexTangents)) {
-				const TangentSpace &ts = vertexTangents[cache->primIndex];
-				its.dpdu = ts.dpdu;
-				its.dpdv = ts.dpdv;
-			} else {
-				its.dpdu = side1;
-				its.dpdv = side2;
-			}
-
-			if (EXPECT_TAKEN(vertexNormals)) {
-				const Normal
-					&n0 = vertexNormals[idx0],
-					&n1 = vertexNormals[idx1],
-					&n2 = vertexNormals[idx2];
-
-				its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
-
-				/* Ensure that the geometric & shading normals face the same direction */
-				if (dot(faceNormal, its.shFrame.n) < 0)
-					faceNormal = -faceNormal;
-			} else {
-				its.shFrame.n = faceNormal;
-			}
-			its.geoFrame = Frame(faceNormal);
-
-			if (EXPECT_TAKEN(vertexTexcoords)) {
-				const Point2 &t0 = vertexTexcoords[idx0];
-				const Point2 &t1 = vertexTexcoords[idx1];
-				const Point2 &t2 = vertexTexcoords[idx2];
-				its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
-			} else {
-				its.uv = Point2(b.y, b.z);
-			}
-
-			if (EXPECT_NOT_TAKEN(vertexColors)) {
-				const Color3 &c0 = vertexColors[idx0],
-							 &c1 = vertexColors[idx1],
-							 &c2 = vertexColors[idx2];
-				Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
-				its.color.fromLinearRGB(result[0], result[1],
-					result[2], Spectrum::EReflectance);
-			}
-
-			its.shape = trimesh;
-			its.hasUVPartials = false;
-			its.primIndex = cache->primIndex;
-			its.instance = NULL;
-			its.time = ray.time;
+			static_cast<const TriMesh *>(shape)->fillTriangleIntersection<BarycentricPos>(
+				ray, cache->primIndex, cache->u, cache->v, its);
 		} else {
 			shape->fillIntersectionRecord(ray,
 				reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
@@ -457,6 +426,15 @@ protected:
 		return false;
 	}
 
+	/// Compute a hash of the geometry and the construction parameters
+	uint64_t computeHash() const;
+
+	/// Try to map a previously built tree from the cache
+	bool loadFromCache(const fs::path &path, uint64_t hash);
+
+	/// Store the built tree in the cache
+	void saveToCache(const fs::path &path, uint64_t hash) const;
+
 	/// Virtual destructor
 	virtual ~ShapeKDTree();
 private:
@@ -466,6 +444,8 @@ private:
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	TriAccel *m_triAccel;
 #endif
+	std::string m_cacheDirectory;
+	ref<MemoryMappedFile> m_cacheFile;
 };
 
 MTS_NAMESPACE_END
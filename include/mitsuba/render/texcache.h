@@ -0,0 +1,194 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TEXCACHE_H_)
+#define __MITSUBA_RENDER_TEXCACHE_H_
+
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/lock.h>
+#include <boost/unordered_map.hpp>
+#include <list>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of slots of the per-thread tile lookup cache (must be a power of two)
+#define MTS_TEXCACHE_LOCAL_SLOTS 64
+
+/**
+ * \brief Texture tile that was paged in by the \ref TextureTileCache
+ *
+ * Tiles are reference counted, hence a tile that is evicted from the
+ * cache stays valid for as long as some thread is still using it.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TextureTile : public Object {
+public:
+	/// Allocate a tile with the given size in bytes
+	TextureTile(size_t size);
+
+	/// Return a pointer to the tile contents
+	inline uint8_t *getData() { return m_data; }
+
+	/// Return a pointer to the tile contents (const version)
+	inline const uint8_t *getData() const { return m_data; }
+
+	/// Return the size of the tile in bytes
+	inline size_t getSize() const { return m_size; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~TextureTile();
+private:
+	uint8_t *m_data;
+	size_t m_size;
+};
+
+/**
+ * \brief Small direct-mapped cache of recently used texture tiles,
+ * which is kept separately by every thread
+ *
+ * Most lookups are served from here without touching the lock of
+ * the process-wide \ref TextureTileCache.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TileLookupCache : public Object {
+public:
+	/// Create an empty lookup cache
+	TileLookupCache();
+
+	/// Return the contents of a tile, paging it in if necessary
+	inline const uint8_t *lookup(uint32_t file, uint32_t index) {
+		uint64_t key = ((uint64_t) file << 32) | index;
+		Slot &slot = m_slots[(index ^ (file * 0x9E3779B1u))
+			& (MTS_TEXCACHE_LOCAL_SLOTS - 1)];
+		if (EXPECT_NOT_TAKEN(slot.key != key))
+			fetch(slot, key);
+		return slot.tile->getData();
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~TileLookupCache() { }
+private:
+	struct Slot {
+		uint64_t key;
+		ref<TextureTile> tile;
+	};
+
+	/// Request a tile from the process-wide cache
+	void fetch(Slot &slot, uint64_t key);
+private:
+	Slot m_slots[MTS_TEXCACHE_LOCAL_SLOTS];
+};
+
+/**
+ * \brief Process-wide cache of texture tiles that are paged in
+ * from disk on demand
+ *
+ * Tiled texture files (e.g. tiled MIP map cache files, see \ref TMIPMap)
+ * are registered with this class, after which their tiles can be
+ * requested by index. Tiles are read from disk on the first access
+ * and are evicted in least-recently-used order when the total size of
+ * the cached tiles exceeds a fixed memory budget, which is shared by
+ * all textures. Rendering threads access the cache through their own
+ * \ref TileLookupCache instances to avoid lock contention.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TextureTileCache : public Object {
+public:
+	/// Return the process-wide tile cache
+	static TextureTileCache *getInstance();
+
+	/// Return the tile lookup cache of the calling thread
+	static TileLookupCache *getLocalCache();
+
+	/// Set the memory budget in bytes (evicts tiles if necessary)
+	void setCapacity(size_t capacity);
+
+	/// Return the memory budget in bytes
+	inline size_t getCapacity() const { return m_capacity; }
+
+	/// Return the total size of the currently cached tiles in bytes
+	inline size_t getUsage() const { return m_usage; }
+
+	/**
+	 * \brief Register a tiled file with the cache
+	 *
+	 * \param path
+	 *    Path of the file
+	 * \param offset
+	 *    Offset of the first tile in bytes
+	 * \param tileSize
+	 *    Size of a tile in bytes. Tiles are stored consecutively
+	 *    and identified by their index
+	 * \return An identifier, which is never reused
+	 */
+	uint32_t registerFile(const fs::path &path, size_t offset, size_t tileSize);
+
+	/// Unregister a file and evict all of its tiles
+	void unregisterFile(uint32_t file);
+
+	/// Return a tile of a registered file, paging it in if necessary
+	ref<TextureTile> getTile(uint32_t file, uint32_t index);
+
+	/// Return a human-readable string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Create an empty cache
+	TextureTileCache();
+
+	/// Virtual destructor
+	virtual ~TextureTileCache() { }
+
+	/// Evict tiles until the budget is met. Expects \c m_mutex to be held.
+	void evict();
+private:
+	struct File {
+		ref<FileStream> stream;
+		ref<Mutex> mutex;
+		size_t offset, tileSize;
+	};
+
+	struct Entry {
+		ref<TextureTile> tile;
+		std::list<uint64_t>::iterator lruPos;
+	};
+
+	typedef boost::unordered_map<uint32_t, File> FileMap;
+	typedef boost::unordered_map<uint64_t, Entry> TileMap;
+
+	static ref<TextureTileCache> m_instance;
+	ref<Mutex> m_mutex;
+	FileMap m_files;
+	TileMap m_tiles;
+	std::list<uint64_t> m_lru;
+	size_t m_capacity, m_usage;
+	uint32_t m_fileCounter;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TEXCACHE_H_ */
@@ -26,6 +26,13 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Number of records, which batched shading routines (such as
+ * \ref Texture::evalBatch() and \ref BSDF::evalBatch()) process at
+ * a time using fixed-size arrays on the stack
+ */
+#define MTS_SHADING_BATCH_SIZE 64
+
 /**
  * \brief Base class of all textures. Computes values for an arbitrary surface
  * point. \ref Texture2D is a specialization to UV-based textures.
@@ -41,6 +48,24 @@ public:
 	 */
 	virtual Spectrum eval(const Intersection &its, bool filter = true) const;
 
+	/**
+	 * \brief Evaluate the texture at many surface points at once
+	 *
+	 * This is equivalent to calling \ref eval() for each intersection,
+	 * but it avoids a virtual function call per lookup and lets
+	 * implementations amortize their setup cost over the whole batch.
+	 * The default implementation simply calls \ref eval().
+	 *
+	 * \param its
+	 *    Array of \c count pointers to intersection records
+	 * \param result
+	 *    Array with space for \c count texture values
+	 * \param filter
+	 *    Specifies whether filtered texture lookups are desired
+	 */
+	virtual void evalBatch(const Intersection * const *its, Spectrum *result,
+		size_t count, bool filter = true) const;
+
 	/**
 	 * \brief Return the texture gradient at \c its
 	 *
@@ -126,6 +151,15 @@ public:
 	 */
 	Spectrum eval(const Intersection &its, bool filter = true) const;
 
+	/**
+	 * \brief Evaluate the texture at many surface points at once
+	 *
+	 * Computes the UV coordinates of all intersections and forwards them
+	 * to the batched UV-space lookup below.
+	 */
+	void evalBatch(const Intersection * const *its, Spectrum *result,
+		size_t count, bool filter = true) const;
+
 	/**
 	 * \brief Return the texture gradient at \c its
 	 *
@@ -146,6 +180,16 @@ public:
 	virtual Spectrum eval(const Point2 &uv, const Vector2 &d0,
 			const Vector2 &d1) const = 0;
 
+	/**
+	 * \brief Batched texture lookup -- Texture2D subclasses can optionally
+	 * provide this function
+	 *
+	 * When \c d0 and \c d1 are \c NULL, all lookups are unfiltered.
+	 * The default implementation calls \ref eval() for each entry.
+	 */
+	virtual void evalBatch(const Point2 *uv, const Vector2 *d0,
+		const Vector2 *d1, Spectrum *result, size_t count) const;
+
 	/// Unfiltered radient lookup lookup -- Texture2D subclasses can optionally provide this function
 	virtual void evalGradient(const Point2 &uv, Spectrum *gradient) const;
 
@@ -22,6 +22,7 @@
 
 #include <mitsuba/core/triangle.h>
 #include <mitsuba/core/pmf.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/shape.h>
 
 MTS_NAMESPACE_BEGIN
@@ -100,6 +101,9 @@ public:
 	/// Return a bounding box containing the mesh
 	AABB getAABB() const;
 
+	/// Return a cone that bounds the (shading) normals of the mesh
+	void getNormalCone(Vector &axis, Float &cosTheta) const;
+
 	/// Return a bounding box containing the mesh
 	inline AABB &getAABB() { return m_aabb; }
 
@@ -164,6 +168,101 @@ public:
 	//! @}
 	// =============================================================
 
+	// =============================================================
+	//! @{ \name Ray tracing support
+	// =============================================================
+
+	/**
+	 * \brief Fill in an intersection record for a hit on a triangle
+	 *
+	 * This is used by the scene-level acceleration data structures,
+	 * which intersect the triangles of a mesh directly. The shading
+	 * frame and \c its.wi are left for the caller to compute.
+	 *
+	 * \param index
+	 *    Index of the intersected triangle
+	 * \param u
+	 *    'U' component of the hit in barycentric coordinates
+	 * \param v
+	 *    'V' component of the hit in barycentric coordinates
+	 * \tparam BarycentricPos
+	 *    Interpolate the vertex positions instead of evaluating
+	 *    the ray at \c its.t
+	 */
+	template <bool BarycentricPos> FINLINE void fillTriangleIntersection(
+			const Ray &ray, uint32_t index, Float u, Float v, Intersection &its) const {
+		const Triangle &tri = m_triangles[index];
+		const Vector b(1 - u - v, u, v);
+
+		const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+		const Point &p0 = m_positions[idx0];
+		const Point &p1 = m_positions[idx1];
+		const Point &p2 = m_positions[idx2];
+
+		if (BarycentricPos)
+			its.p = p0 * b.x + p1 * b.y + p2 * b.z;
+		else
+			its.p = ray(its.t);
+
+		Vector side1(p1-p0), side2(p2-p0);
+		Normal faceNormal(cross(side1, side2));
+		Float length = faceNormal.length();
+		if (!faceNormal.isZero())
+			faceNormal /= length;
+
+		if (EXPECT_NOT_TAKEN(m_tangents)) {
+			const TangentSpace &ts = m_tangents[index];
+			its.dpdu = ts.dpdu;
+			its.dpdv = ts.dpdv;
+		} else {
+			its.dpdu = side1;
+			its.dpdv = side2;
+		}
+
+		if (EXPECT_TAKEN(m_normals)) {
+			const Normal
+				&n0 = m_normals[idx0],
+				&n1 = m_normals[idx1],
+				&n2 = m_normals[idx2];
+
+			its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
+
+			/* Ensure that the geometric & shading normals face the same direction */
+			if (dot(faceNormal, its.shFrame.n) < 0)
+				faceNormal = -faceNormal;
+		} else {
+			its.shFrame.n = faceNormal;
+		}
+		its.geoFrame = Frame(faceNormal);
+
+		if (EXPECT_TAKEN(m_texcoords)) {
+			const Point2 &t0 = m_texcoords[idx0];
+			const Point2 &t1 = m_texcoords[idx1];
+			const Point2 &t2 = m_texcoords[idx2];
+			its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
+		} else {
+			its.uv = Point2(b.y, b.z);
+		}
+
+		if (EXPECT_NOT_TAKEN(m_colors)) {
+			const Color3 &c0 = m_colors[idx0],
+						 &c1 = m_colors[idx1],
+						 &c2 = m_colors[idx2];
+			Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
+			its.color.fromLinearRGB(result[0], result[1],
+				result[2], Spectrum::EReflectance);
+		}
+
+		its.shape = this;
+		its.hasUVPartials = false;
+		its.primIndex = index;
+		its.instance = NULL;
+		its.time = ray.time;
+	}
+
+	//! @}
+	// =============================================================
+
 	// =============================================================
 	//! @{ \name Sampling routines
 	// =============================================================
@@ -239,6 +338,15 @@ public:
 	 */
 	void rebuildTopology(Float maxAngle);
 
+	/**
+	 * \brief Update the bounding box and the area sampling table
+	 * after the vertex positions have been modified in place
+	 *
+	 * The sampling table is rebuilt on demand. Vertex normals and
+	 * tangents are not touched.
+	 */
+	void updateGeometry();
+
 	/// Serialize to a file/network stream
 	void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -251,6 +359,20 @@ public:
 	 */
 	void serialize(Stream *stream) const;
 
+	/**
+	 * \brief Store the mesh in an uncompressed, page-aligned file
+	 *
+	 * In contrast to \ref serialize(Stream *), the vertex and index
+	 * arrays are written exactly as they are laid out in memory, each
+	 * starting on a page boundary. Such files can later be mapped into
+	 * memory by \ref loadMapped() without any decoding. The data is
+	 * stored in the precision of the current build.
+	 */
+	void writeMapped(const fs::path &path) const;
+
+	/// Are the vertex and index arrays mapped from a file?
+	inline bool isMapped() const { return m_mappedFile.get() != NULL; }
+
 	/**
 	 * \brief Build a discrete probability distribution
 	 * for sampling.
@@ -350,6 +472,26 @@ protected:
 	 static int readOffsetDictionary(Stream *stream, short version,
 		 std::vector<size_t>& outOffsets);
 
+	/**
+	 * \brief Map a mesh that was previously stored using \ref writeMapped()
+	 *
+	 * The arrays reference the read-only mapping, which is shared with
+	 * all other processes that map the same file. Returns \c false when
+	 * the file is invalid or was written by a build with a different
+	 * floating point precision.
+	 */
+	bool loadMapped(const fs::path &path);
+
+	/**
+	 * \brief Replace mapped arrays by private copies
+	 *
+	 * Called before the mesh data is modified in place
+	 */
+	void copyMappedData();
+
+	/// Does the given array reference the mapped file?
+	bool isMappedData(const void *ptr) const;
+
 	/// Prepare internal tables for sampling uniformly wrt. area
 	void prepareSamplingTable();
 protected:
@@ -364,6 +506,7 @@ protected:
 	size_t m_vertexCount;
 	bool m_flipNormals;
 	bool m_faceNormals;
+	ref<MemoryMappedFile> m_mappedFile;
 
 	/* Surface and distribution -- generated on demand */
 	DiscreteDistribution m_areaDistr;
@@ -71,6 +71,17 @@ public:
 	 */
 	virtual Float getMaximumFloatValue() const = 0;
 
+	/**
+	 * \brief Conservatively bound the floating point values that
+	 * could be returned by \ref lookupFloat for positions within the
+	 * given world-space bounding box.
+	 *
+	 * This is used to build local majorants for Woodcock-Tracking.
+	 * The default implementation returns the range
+	 * <tt>[0, getMaximumFloatValue()]</tt>.
+	 */
+	virtual void getFloatRange(const AABB &aabb, Float &min, Float &max) const;
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
@@ -149,6 +149,65 @@ public:
 		return m_reflectance->eval(bRec.its);
 	}
 
+	void evalBatch(const BSDFSamplingRecord *bRecs, Spectrum *result,
+			size_t count, EMeasure measure) const {
+		const Intersection *its[MTS_SHADING_BATCH_SIZE];
+		Spectrum reflectance[MTS_SHADING_BATCH_SIZE];
+		size_t index[MTS_SHADING_BATCH_SIZE];
+
+		for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+			size_t end = std::min(count, start + MTS_SHADING_BATCH_SIZE), active = 0;
+			for (size_t i=start; i<end; ++i) {
+				const BSDFSamplingRecord &bRec = bRecs[i];
+				if (!(bRec.typeMask & EDiffuseReflection) || measure != ESolidAngle
+					|| Frame::cosTheta(bRec.wi) <= 0
+					|| Frame::cosTheta(bRec.wo) <= 0) {
+					result[i] = Spectrum(0.0f);
+					continue;
+				}
+				its[active] = &bRec.its;
+				index[active++] = i;
+			}
+
+			m_reflectance->evalBatch(its, reflectance, active);
+
+			for (size_t j=0; j<active; ++j)
+				result[index[j]] = reflectance[j]
+					* (INV_PI * Frame::cosTheta(bRecs[index[j]].wo));
+		}
+	}
+
+	void sampleBatch(BSDFSamplingRecord *bRecs, Float *pdf,
+			const Point2 *sample, Spectrum *result, size_t count) const {
+		const Intersection *its[MTS_SHADING_BATCH_SIZE];
+		Spectrum reflectance[MTS_SHADING_BATCH_SIZE];
+		size_t index[MTS_SHADING_BATCH_SIZE];
+
+		for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+			size_t end = std::min(count, start + MTS_SHADING_BATCH_SIZE), active = 0;
+			for (size_t i=start; i<end; ++i) {
+				BSDFSamplingRecord &bRec = bRecs[i];
+				if (!(bRec.typeMask & EDiffuseReflection) || Frame::cosTheta(bRec.wi) <= 0) {
+					result[i] = Spectrum(0.0f);
+					continue;
+				}
+
+				bRec.wo = warp::squareToCosineHemisphere(sample[i]);
+				bRec.eta = 1.0f;
+				bRec.sampledComponent = 0;
+				bRec.sampledType = EDiffuseReflection;
+				pdf[i] = warp::squareToCosineHemispherePdf(bRec.wo);
+				its[active] = &bRec.its;
+				index[active++] = i;
+			}
+
+			/* The sample weight is simply the reflectance */
+			m_reflectance->evalBatch(its, reflectance, active);
+			for (size_t j=0; j<active; ++j)
+				result[index[j]] = reflectance[j];
+		}
+	}
+
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(Texture))
 				&& (name == "reflectance" || name == "diffuseReflectance")) {
@@ -293,6 +293,61 @@ public:
 		return F * model;
 	}
 
+	void evalBatch(const BSDFSamplingRecord *bRecs, Spectrum *result,
+			size_t count, EMeasure measure) const {
+		const Intersection *its[MTS_SHADING_BATCH_SIZE];
+		Spectrum alphaU[MTS_SHADING_BATCH_SIZE], alphaV[MTS_SHADING_BATCH_SIZE],
+			specularReflectance[MTS_SHADING_BATCH_SIZE];
+		size_t index[MTS_SHADING_BATCH_SIZE];
+		bool isotropic = m_alphaU == m_alphaV;
+
+		for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+			size_t end = std::min(count, start + MTS_SHADING_BATCH_SIZE), active = 0;
+			for (size_t i=start; i<end; ++i) {
+				const BSDFSamplingRecord &bRec = bRecs[i];
+				/* Stop if this component was not requested */
+				if (measure != ESolidAngle ||
+					Frame::cosTheta(bRec.wi) <= 0 ||
+					Frame::cosTheta(bRec.wo) <= 0 ||
+					((bRec.component != -1 && bRec.component != 0) ||
+					!(bRec.typeMask & EGlossyReflection))) {
+					result[i] = Spectrum(0.0f);
+					continue;
+				}
+				its[active] = &bRec.its;
+				index[active++] = i;
+			}
+
+			/* Look up the textures of all remaining records at once */
+			m_alphaU->evalBatch(its, alphaU, active);
+			if (!isotropic)
+				m_alphaV->evalBatch(its, alphaV, active);
+			m_specularReflectance->evalBatch(its, specularReflectance, active);
+
+			for (size_t j=0; j<active; ++j) {
+				const BSDFSamplingRecord &bRec = bRecs[index[j]];
+				Vector H = normalize(bRec.wo+bRec.wi);
+
+				Float aU = alphaU[j].average(),
+				      aV = isotropic ? aU : alphaV[j].average();
+				MicrofacetDistribution distr(m_type, aU, aV, m_sampleVisible);
+
+				const Float D = distr.eval(H);
+				if (D == 0) {
+					result[index[j]] = Spectrum(0.0f);
+					continue;
+				}
+
+				const Spectrum F = fresnelConductorExact(dot(bRec.wi, H), m_eta, m_k) *
+					specularReflectance[j];
+				const Float G = distr.G(bRec.wi, bRec.wo, H);
+				Float model = D * G / (4.0f * Frame::cosTheta(bRec.wi));
+
+				result[index[j]] = F * model;
+			}
+		}
+	}
+
 	Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
 		if (measure != ESolidAngle ||
 			Frame::cosTheta(bRec.wi) <= 0 ||
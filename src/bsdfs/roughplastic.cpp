@@ -381,6 +381,78 @@ public:
 		return result;
 	}
 
+	void evalBatch(const BSDFSamplingRecord *bRecs, Spectrum *result,
+			size_t count, EMeasure measure) const {
+		const Intersection *its[MTS_SHADING_BATCH_SIZE];
+		Spectrum alpha[MTS_SHADING_BATCH_SIZE], specularReflectance[MTS_SHADING_BATCH_SIZE],
+			diffuseReflectance[MTS_SHADING_BATCH_SIZE];
+		size_t index[MTS_SHADING_BATCH_SIZE];
+
+		for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+			size_t end = std::min(count, start + MTS_SHADING_BATCH_SIZE), active = 0;
+			for (size_t i=start; i<end; ++i) {
+				const BSDFSamplingRecord &bRec = bRecs[i];
+				bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
+					(bRec.component == -1 || bRec.component == 0);
+				bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
+					(bRec.component == -1 || bRec.component == 1);
+
+				if (measure != ESolidAngle ||
+					Frame::cosTheta(bRec.wi) <= 0 ||
+					Frame::cosTheta(bRec.wo) <= 0 ||
+					(!hasSpecular && !hasDiffuse)) {
+					result[i] = Spectrum(0.0f);
+					continue;
+				}
+				its[active] = &bRec.its;
+				index[active++] = i;
+			}
+
+			/* Look up the textures of all remaining records at once */
+			m_alpha->evalBatch(its, alpha, active);
+			m_specularReflectance->evalBatch(its, specularReflectance, active);
+			m_diffuseReflectance->evalBatch(its, diffuseReflectance, active);
+
+			for (size_t j=0; j<active; ++j) {
+				const BSDFSamplingRecord &bRec = bRecs[index[j]];
+				bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
+					(bRec.component == -1 || bRec.component == 0);
+				bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
+					(bRec.component == -1 || bRec.component == 1);
+
+				MicrofacetDistribution distr(m_type, alpha[j].average(), m_sampleVisible);
+
+				Spectrum value(0.0f);
+				if (hasSpecular) {
+					const Vector H = normalize(bRec.wo+bRec.wi);
+					const Float D = distr.eval(H);
+					const Float F = fresnelDielectricExt(dot(bRec.wi, H), m_eta);
+					const Float G = distr.G(bRec.wi, bRec.wo, H);
+					Float specular = F * D * G /
+						(4.0f * Frame::cosTheta(bRec.wi));
+
+					value += specularReflectance[j] * specular;
+				}
+
+				if (hasDiffuse) {
+					Spectrum diff = diffuseReflectance[j];
+					Float T12 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wi), distr.getAlpha());
+					Float T21 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wo), distr.getAlpha());
+					Float Fdr = 1-m_internalRoughTransmittance->evalDiffuse(distr.getAlpha());
+
+					if (m_nonlinear)
+						diff /= Spectrum(1.0f) - diff * Fdr;
+					else
+						diff /= 1-Fdr;
+
+					value += diff * (INV_PI * Frame::cosTheta(bRec.wo) * T12 * T21 * m_invEta2);
+				}
+
+				result[index[j]] = value;
+			}
+		}
+	}
+
 	Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
 		bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
 			(bRec.component == -1 || bRec.component == 0);
@@ -182,6 +182,14 @@ public:
 		}
 	}
 
+	void configure() {
+		Emitter::configure();
+
+		/* Called again when the shape has been deformed */
+		if (m_shape != NULL)
+			m_power = m_radiance * M_PI * m_shape->getSurfaceArea();
+	}
+
 	void setParent(ConfigurableObject *parent) {
 		Emitter::setParent(parent);
 
@@ -205,6 +213,12 @@ public:
 		return m_shape->getAABB();
 	}
 
+	void getEmissionBounds(Vector &axis, Float &cosThetaO, Float &cosThetaE) const {
+		/* Radiance is emitted into the hemisphere around the normal */
+		m_shape->getNormalCone(axis, cosThetaO);
+		cosThetaE = 0;
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "AreaLight[" << endl
@@ -215,6 +215,16 @@ public:
 		return m_worldTransform->getTranslationBounds();
 	}
 
+	void getEmissionBounds(Vector &axis, Float &cosThetaO, Float &cosThetaE) const {
+		if (!m_worldTransform->isStatic()) {
+			Emitter::getEmissionBounds(axis, cosThetaO, cosThetaE);
+			return;
+		}
+		axis = normalize(m_worldTransform->eval(0)(Vector(0, 0, 1)));
+		cosThetaO = 1;
+		cosThetaE = m_cosCutoffAngle;
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "SpotEmitter[" << std::endl
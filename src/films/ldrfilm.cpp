@@ -227,6 +227,10 @@ public:
 		m_storage->put(block);
 	}
 
+	bool supportsConcurrentPut() const {
+		return true;
+	}
+
 	void setBitmap(const Bitmap *bitmap, Float multiplier) {
 		bitmap->convert(m_storage->getBitmap(), multiplier);
 	}
@@ -18,11 +18,12 @@
 
 #include <mitsuba/render/film.h>
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/zstream.h>
 #include <mitsuba/core/plugin.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <iomanip>
-#include "cnpy.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -40,7 +41,9 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{fileFormat}{\String}{
  *       Specifies the desired output format; must be one of
- *       \code{matlab}, \code{mathematica}, or \code{numpy}. \default{\code{matlab}}
+ *       \code{matlab}, \code{mathematica}, \code{numpy} (a single \code{.npy}
+ *       array), or \code{npz} (a \code{.npz} archive with one array per
+ *       pixel format). \default{\code{matlab}}
  *     }
  *     \parameter{digits}{\Integer}{
  *       Number of significant digits to be written \default{4}
@@ -54,7 +57,33 @@ MTS_NAMESPACE_BEGIN
  *         and \code{spectrumAlpha}. In the latter two cases,
  *         the number of written channels depends on the value assigned to
  *         \code{SPECTRUM\_SAMPLES} during compilation (see Section~\ref{sec:compiling}
- *         for details) \default{\code{luminance}}
+ *         for details). When writing \code{npz} archives, a comma-separated
+ *         list of formats can be given to store the output of the
+ *         \pluginref{multichannel} integrator \default{\code{luminance}}
+ *     }
+ *     \parameter{channelNames}{\String}{
+ *       Comma-separated list of array names, one per pixel format. Only
+ *       used for \code{npz} archives with several pixel formats.
+ *     }
+ *     \parameter{componentFormat}{\String}{
+ *       Component format of NumPy output; must be either \code{float32}
+ *       or \code{float16} \default{\code{float32}}
+ *     }
+ *     \parameter{compress}{\Boolean}{
+ *       Deflate-compress the arrays of \code{npz} archives
+ *       \default{\code{false}}
+ *     }
+ *     \parameter{writeWeights}{\Boolean}{
+ *       Additionally store the accumulated reconstruction filter weight
+ *       of every pixel as an array named \code{weight} in \code{npz}
+ *       archives. With the default box filter, this is the number of
+ *       samples per pixel. \default{\code{false}}
+ *     }
+ *     \parameter{asyncWrite}{\Boolean}{
+ *       Convert and write NumPy output on a background thread, so that
+ *       the next rendering can start right away. The file is complete once
+ *       the film is destroyed or develops the next image.
+ *       \default{\code{false}}
  *     }
  *     \parameter{highQualityEdges}{\Boolean}{
  *        If set to \code{true}, regions slightly outside of the film
@@ -77,48 +106,267 @@ MTS_NAMESPACE_BEGIN
  * This is useful when running Mitsuba as simulation step as part of a
  * larger virtual experiment. It can also come in handy when
  * verifying parts of the renderer using an automated test suite.
+ *
+ * The \code{npz} format is geared towards generating training data: all
+ * channels of a frame end up in a single (optionally compressed)
+ * archive that can be opened using \code{numpy.load()}.
+ */
+
+/// NumPy output settings (copied over to the background writer)
+struct NumPyOutput {
+	std::vector<Bitmap::EPixelFormat> pixelFormats;
+	std::vector<std::string> arrayNames;
+	Bitmap::EComponentFormat componentFormat;
+	bool archive;
+	bool compress;
+	bool writeWeights;
+};
+
+/// Return the number of channels associated with a pixel format
+static int getChannelCount(Bitmap::EPixelFormat pixelFormat) {
+	switch (pixelFormat) {
+		case Bitmap::ELuminance: return 1;
+		case Bitmap::ELuminanceAlpha: return 2;
+		case Bitmap::ERGB:
+		case Bitmap::EXYZ: return 3;
+		case Bitmap::ERGBA:
+		case Bitmap::EXYZA: return 4;
+		case Bitmap::ESpectrum: return SPECTRUM_SAMPLES;
+		case Bitmap::ESpectrumAlpha: return SPECTRUM_SAMPLES + 1;
+		default:
+			SLog(EError, "Unsupported pixel format!");
+			return 0;
+	}
+}
+
+/// Create the header of a NumPy (.npy) array storing the given bitmap
+static std::string getNumPyHeader(const Bitmap *bitmap) {
+	std::ostringstream oss;
+	oss << "{'descr': '"
+		<< (Stream::getHostByteOrder() == Stream::ELittleEndian ? '<' : '>')
+		<< 'f' << bitmap->getBytesPerComponent()
+		<< "', 'fortran_order': False, 'shape': ("
+		<< bitmap->getHeight() << ", " << bitmap->getWidth();
+	if (bitmap->getChannelCount() > 1)
+		oss << ", " << bitmap->getChannelCount();
+	oss << "), }";
+
+	/* Pad with spaces so that the array data is 16-byte aligned */
+	std::string dict = oss.str();
+	dict.append(15 - (10 + dict.length()) % 16, ' ');
+	dict += '\n';
+
+	std::string header("\x93NUMPY\x01\x00", 8);
+	header += (char) (dict.length() & 0xFF);
+	header += (char) (dict.length() >> 8);
+	return header + dict;
+}
+
+/**
+ * \brief Streaming writer for NumPy archives (\c .npz files)
+ *
+ * An \c .npz file is a ZIP archive containing one \c .npy file per
+ * array. Each array is written (and optionally deflate-compressed)
+ * straight into the output file; the CRC and size fields of its local
+ * header are patched once the array has been written.
  */
+class NumPyArchive {
+public:
+	NumPyArchive(const fs::path &filename, bool compress) : m_compress(compress) {
+		m_stream = new FileStream(filename, FileStream::ETruncWrite);
+		m_stream->setByteOrder(Stream::ELittleEndian);
+	}
+
+	/// Append a bitmap as an array with the given name
+	void write(const std::string &name, const Bitmap *bitmap) {
+		Entry entry;
+		entry.name = name + ".npy";
+		entry.offset = m_stream->getPos();
+
+		std::string header = getNumPyHeader(bitmap);
+		const uint8_t *data = bitmap->getUInt8Data();
+		size_t dataSize = bitmap->getBufferSize();
+		size_t uncompressedSize = header.length() + dataSize;
+		if (uncompressedSize > 0xFFFFFFFFu)
+			SLog(EError, "NumPyArchive: array \"%s\" exceeds the 4 GiB limit!",
+				name.c_str());
+
+		entry.crc = (uint32_t) crc32(0L, (const Bytef *) header.data(), (uInt) header.length());
+		entry.crc = (uint32_t) crc32(entry.crc, (const Bytef *) data, (uInt) dataSize);
+		entry.uncompressedSize = (uint32_t) uncompressedSize;
+
+		/* Local file header -- sizes are filled in below */
+		writeHeader(0x04034b50, entry, false);
+
+		size_t dataStart = m_stream->getPos();
+		if (m_compress) {
+			ref<ZStream> zstream = new ZStream(m_stream, ZStream::ERawDeflateStream);
+			zstream->write(header.data(), header.length());
+			zstream->write(data, dataSize);
+			zstream = NULL; /* Flushes the remaining compressed data */
+		} else {
+			m_stream->write(header.data(), header.length());
+			m_stream->write(data, dataSize);
+		}
+		size_t dataEnd = m_stream->getPos();
+		if (dataEnd - dataStart > 0xFFFFFFFFu)
+			SLog(EError, "NumPyArchive: array \"%s\" exceeds the 4 GiB limit!",
+				name.c_str());
+		entry.compressedSize = (uint32_t) (dataEnd - dataStart);
+
+		m_stream->seek(entry.offset);
+		writeHeader(0x04034b50, entry, false);
+		m_stream->seek(dataEnd);
+
+		m_entries.push_back(entry);
+	}
+
+	/// Write the central directory and close the file
+	void close() {
+		size_t directoryStart = m_stream->getPos();
+		for (size_t i=0; i<m_entries.size(); ++i)
+			writeHeader(0x02014b50, m_entries[i], true);
+		size_t directoryEnd = m_stream->getPos();
+
+		m_stream->writeUInt(0x06054b50);
+		m_stream->writeUShort(0); /* Number of this disk */
+		m_stream->writeUShort(0); /* Disk with the central directory */
+		m_stream->writeUShort((uint16_t) m_entries.size());
+		m_stream->writeUShort((uint16_t) m_entries.size());
+		m_stream->writeUInt((uint32_t) (directoryEnd - directoryStart));
+		m_stream->writeUInt((uint32_t) directoryStart);
+		m_stream->writeUShort(0); /* Comment length */
+		m_stream->close();
+	}
+
+private:
+	struct Entry {
+		std::string name;
+		size_t offset;
+		uint32_t crc;
+		uint32_t compressedSize;
+		uint32_t uncompressedSize;
+	};
+
+	/// Write a local file header or a central directory record
+	void writeHeader(uint32_t signature, const Entry &entry, bool central) {
+		m_stream->writeUInt(signature);
+		if (central)
+			m_stream->writeUShort(20); /* Version made by */
+		m_stream->writeUShort(20); /* Version needed to extract */
+		m_stream->writeUShort(0); /* Flags */
+		m_stream->writeUShort(m_compress ? 8 : 0); /* Deflate or store */
+		m_stream->writeUShort(0); /* Modification time */
+		m_stream->writeUShort(0x21); /* Modification date (1980-01-01) */
+		m_stream->writeUInt(entry.crc);
+		m_stream->writeUInt(entry.compressedSize);
+		m_stream->writeUInt(entry.uncompressedSize);
+		m_stream->writeUShort((uint16_t) entry.name.length());
+		m_stream->writeUShort(0); /* Extra field length */
+		if (central) {
+			m_stream->writeUShort(0); /* Comment length */
+			m_stream->writeUShort(0); /* Disk number */
+			m_stream->writeUShort(0); /* Internal attributes */
+			m_stream->writeUInt(0); /* External attributes */
+			if (entry.offset > 0xFFFFFFFFu)
+				SLog(EError, "NumPyArchive: the archive exceeds the 4 GiB limit!");
+			m_stream->writeUInt((uint32_t) entry.offset);
+		}
+		m_stream->write(entry.name.c_str(), entry.name.length());
+	}
+
+	ref<FileStream> m_stream;
+	std::vector<Entry> m_entries;
+	bool m_compress;
+};
+
+/// Convert the film storage and write it to a \c .npy or \c .npz file
+static void writeNumPy(const fs::path &filename, Bitmap *storage,
+		const NumPyOutput &output) {
+	if (!output.archive) {
+		ref<Bitmap> bitmap = storage->convert(output.pixelFormats[0],
+			output.componentFormat);
+		ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
+		std::string header = getNumPyHeader(bitmap);
+		stream->write(header.data(), header.length());
+		stream->write(bitmap->getUInt8Data(), bitmap->getBufferSize());
+		return;
+	}
+
+	NumPyArchive archive(filename, output.compress);
+
+	if (output.pixelFormats.size() == 1) {
+		archive.write(output.arrayNames[0], storage->convert(
+			output.pixelFormats[0], output.componentFormat));
+	} else {
+		/* Convert all sub-images at once and then split them into arrays */
+		std::vector<std::string> channelNames;
+		for (size_t i=0; i<output.pixelFormats.size(); ++i) {
+			int channels = getChannelCount(output.pixelFormats[i]);
+			for (int j=0; j<channels; ++j)
+				channelNames.push_back(formatString("%s.%i", output.arrayNames[i].c_str(), j));
+		}
+
+		ref<Bitmap> bitmap = storage->convertMultiSpectrumAlphaWeight(
+			output.pixelFormats, output.componentFormat, channelNames);
+
+		int offset = 0;
+		for (size_t i=0; i<output.pixelFormats.size(); ++i) {
+			std::vector<int> channels(getChannelCount(output.pixelFormats[i]));
+			for (size_t j=0; j<channels.size(); ++j)
+				channels[j] = offset++;
+			archive.write(output.arrayNames[i], bitmap->extractChannels(
+				output.pixelFormats[i], channels));
+		}
+	}
+
+	if (output.writeWeights) {
+		ref<Bitmap> weights = storage->extractChannel(storage->getChannelCount() - 1);
+		archive.write("weight", weights->convert(Bitmap::ELuminance, Bitmap::EFloat32));
+	}
+
+	archive.close();
+}
+
+/// Background thread that converts and writes a snapshot of the film
+class NumPyWriter : public Thread {
+public:
+	NumPyWriter(const fs::path &filename, Bitmap *storage,
+		const NumPyOutput &output) : Thread("npyw"), m_filename(filename),
+		m_storage(storage), m_output(output) { }
+
+	void run() {
+		writeNumPy(m_filename, m_storage, m_output);
+		Log(EDebug, "Finished writing \"%s\"", m_filename.filename().string().c_str());
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~NumPyWriter() { }
+private:
+	fs::path m_filename;
+	ref<Bitmap> m_storage;
+	NumPyOutput m_output;
+};
+
 class MFilm : public Film {
 public:
 	enum EMode {
 		EMATLAB = 0,
 		EMathematica,
-		ENumPy
+		ENumPy,
+		ENumPyArchive
 	};
 
 	MFilm(const Properties &props) : Film(props) {
-		std::string pixelFormat = boost::to_lower_copy(
-			props.getString("pixelFormat", "luminance"));
-
+		std::vector<std::string> pixelFormats = tokenize(boost::to_lower_copy(
+			props.getString("pixelFormat", "luminance")), " ,");
+		std::vector<std::string> channelNames = tokenize(
+			props.getString("channelNames", ""), ", ");
 		std::string fileFormat = boost::to_lower_copy(
 			props.getString("fileFormat", "matlab"));
-
-		if (pixelFormat == "luminance") {
-			m_pixelFormat = Bitmap::ELuminance;
-		} else if (pixelFormat == "luminancealpha") {
-			m_pixelFormat = Bitmap::ELuminanceAlpha;
-		} else if (pixelFormat == "rgb") {
-			m_pixelFormat = Bitmap::ERGB;
-		} else if (pixelFormat == "rgba") {
-			m_pixelFormat = Bitmap::ERGBA;
-		} else if (pixelFormat == "xyz") {
-			m_pixelFormat = Bitmap::EXYZ;
-		} else if (pixelFormat == "xyza") {
-			m_pixelFormat = Bitmap::EXYZA;
-		} else if (pixelFormat == "spectrum") {
-			m_pixelFormat = Bitmap::ESpectrum;
-		} else if (pixelFormat == "spectrumalpha") {
-			m_pixelFormat = Bitmap::ESpectrumAlpha;
-		} else {
-			Log(EError, "The \"pixelFormat\" parameter must either be equal to "
-				"\"luminance\", \"luminanceAlpha\", \"rgb\", \"rgba\", \"xyz\", \"xyza\", "
-				"\"spectrum\", or \"spectrumAlpha\"!");
-		}
-
-		if (SPECTRUM_SAMPLES == 3 && (m_pixelFormat == Bitmap::ESpectrum || m_pixelFormat == Bitmap::ESpectrumAlpha))
-			Log(EError, "You requested to render a spectral image, but Mitsuba is currently "
-				"configured for a RGB flow (i.e. SPECTRUM_SAMPLES = 3). You will need to recompile "
-				"it with a different configuration. Please see the documentation for details.");
+		std::string componentFormat = boost::to_lower_copy(
+			props.getString("componentFormat", "float32"));
 
 		if (fileFormat == "matlab") {
 			m_fileFormat = EMATLAB;
@@ -126,31 +374,118 @@ public:
 			m_fileFormat = EMathematica;
 		} else if (fileFormat == "numpy") {
 			m_fileFormat = ENumPy;
+		} else if (fileFormat == "npz") {
+			m_fileFormat = ENumPyArchive;
 		} else {
 			Log(EError, "The \"fileFormat\" parameter must either be equal to "
-				"\"matlab\" or \"mathematica\" or \"numpy\" or \"numpycompressed\"!");
+				"\"matlab\", \"mathematica\", \"numpy\", or \"npz\"!");
+		}
+
+		if (pixelFormats.empty())
+			Log(EError, "At least one pixel format must be specified!");
+
+		if (pixelFormats.size() != 1 && m_fileFormat != ENumPyArchive)
+			Log(EError, "General multi-channel output is only supported when writing \"npz\" archives!");
+
+		if ((pixelFormats.size() != 1 && channelNames.size() != pixelFormats.size()) ||
+			(pixelFormats.size() == 1 && channelNames.size() > 1))
+			Log(EError, "Number of channel names must match the number of specified pixel formats!");
+
+		for (size_t i=0; i<pixelFormats.size(); ++i) {
+			std::string pixelFormat = pixelFormats[i];
+			if (pixelFormat == "luminance") {
+				m_pixelFormats.push_back(Bitmap::ELuminance);
+			} else if (pixelFormat == "luminancealpha") {
+				m_pixelFormats.push_back(Bitmap::ELuminanceAlpha);
+			} else if (pixelFormat == "rgb") {
+				m_pixelFormats.push_back(Bitmap::ERGB);
+			} else if (pixelFormat == "rgba") {
+				m_pixelFormats.push_back(Bitmap::ERGBA);
+			} else if (pixelFormat == "xyz") {
+				m_pixelFormats.push_back(Bitmap::EXYZ);
+			} else if (pixelFormat == "xyza") {
+				m_pixelFormats.push_back(Bitmap::EXYZA);
+			} else if (pixelFormat == "spectrum") {
+				m_pixelFormats.push_back(Bitmap::ESpectrum);
+			} else if (pixelFormat == "spectrumalpha") {
+				m_pixelFormats.push_back(Bitmap::ESpectrumAlpha);
+			} else {
+				Log(EError, "The \"pixelFormat\" parameter must either be equal to "
+					"\"luminance\", \"luminanceAlpha\", \"rgb\", \"rgba\", \"xyz\", \"xyza\", "
+					"\"spectrum\", or \"spectrumAlpha\"!");
+			}
+
+			if (SPECTRUM_SAMPLES == 3 && (m_pixelFormats[i] == Bitmap::ESpectrum || m_pixelFormats[i] == Bitmap::ESpectrumAlpha))
+				Log(EError, "You requested to render a spectral image, but Mitsuba is currently "
+					"configured for a RGB flow (i.e. SPECTRUM_SAMPLES = 3). You will need to recompile "
+					"it with a different configuration. Please see the documentation for details.");
+		}
+
+		if (pixelFormats.size() == 1)
+			m_arrayNames.push_back(channelNames.empty() ? std::string("data") : channelNames[0]);
+		else
+			m_arrayNames = channelNames;
+
+		for (size_t i=0; i<m_arrayNames.size(); ++i) {
+			if (m_arrayNames[i] == "weight")
+				Log(EError, "The array name \"weight\" is reserved for the accumulated filter weights!");
+		}
+
+		if (componentFormat == "float32") {
+			m_componentFormat = Bitmap::EFloat32;
+		} else if (componentFormat == "float16") {
+			m_componentFormat = Bitmap::EFloat16;
+		} else {
+			Log(EError, "The \"componentFormat\" parameter must either be "
+				"equal to \"float32\" or \"float16\"!");
 		}
 
 		m_digits = props.getInteger("digits", 4);
 		m_variable = props.getString("variable", "data");
+		m_compress = props.getBoolean("compress", false);
+		m_writeWeights = props.getBoolean("writeWeights", false);
+		m_asyncWrite = props.getBoolean("asyncWrite", false);
+
+		if (m_fileFormat != ENumPyArchive && (m_compress || m_writeWeights))
+			Log(EWarn, "The \"compress\" and \"writeWeights\" parameters are "
+				"only supported when writing \"npz\" archives!");
 
-		m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
+		createStorage();
 	}
 
 	MFilm(Stream *stream, InstanceManager *manager)
 		: Film(stream, manager) {
-		m_pixelFormat = (Bitmap::EPixelFormat) stream->readUInt();
+		m_pixelFormats.resize((size_t) stream->readUInt());
+		for (size_t i=0; i<m_pixelFormats.size(); ++i)
+			m_pixelFormats[i] = (Bitmap::EPixelFormat) stream->readUInt();
+		m_arrayNames.resize((size_t) stream->readUInt());
+		for (size_t i=0; i<m_arrayNames.size(); ++i)
+			m_arrayNames[i] = stream->readString();
 		m_fileFormat = (EMode) stream->readUInt();
+		m_componentFormat = (Bitmap::EComponentFormat) stream->readUInt();
 		m_digits = stream->readInt();
 		m_variable = stream->readString();
+		m_compress = stream->readBool();
+		m_writeWeights = stream->readBool();
+		m_asyncWrite = stream->readBool();
+		createStorage();
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Film::serialize(stream, manager);
-		stream->writeUInt(m_pixelFormat);
+		stream->writeUInt((uint32_t) m_pixelFormats.size());
+		for (size_t i=0; i<m_pixelFormats.size(); ++i)
+			stream->writeUInt(m_pixelFormats[i]);
+		stream->writeUInt((uint32_t) m_arrayNames.size());
+		for (size_t i=0; i<m_arrayNames.size(); ++i)
+			stream->writeString(m_arrayNames[i]);
 		stream->writeUInt(m_fileFormat);
+		stream->writeUInt(m_componentFormat);
 		stream->writeInt(m_digits);
 		stream->writeString(m_variable);
+		stream->writeBool(m_compress);
+		stream->writeBool(m_writeWeights);
+		stream->writeBool(m_asyncWrite);
 	}
 
 	void configure() {
@@ -172,6 +507,10 @@ public:
 		m_storage->put(block);
 	}
 
+	bool supportsConcurrentPut() const {
+		return true;
+	}
+
 	void setBitmap(const Bitmap *bitmap, Float multiplier) {
 		bitmap->convert(m_storage->getBitmap(), multiplier);
 	}
@@ -185,7 +524,8 @@ public:
 		if (bitmap->getPixelFormat() != Bitmap::ESpectrum ||
 			bitmap->getComponentFormat() != Bitmap::EFloat ||
 			bitmap->getGamma() != 1.0f ||
-			size != m_storage->getSize()) {
+			size != m_storage->getSize() ||
+			m_pixelFormats.size() != 1) {
 			Log(EError, "addBitmap(): Unsupported bitmap format!");
 		}
 
@@ -218,7 +558,21 @@ public:
 		uint8_t *targetData = target->getUInt8Data()
 			+ (targetOffset.x + targetOffset.y * target->getWidth()) * targetBpp;
 
-		if (size.x == m_cropSize.x && target->getWidth() == m_storage->getWidth()) {
+		if (EXPECT_NOT_TAKEN(m_pixelFormats.size() != 1)) {
+			/* Special case for general multi-channel images -- just develop the first component(s) */
+			for (int i=0; i<size.y; ++i) {
+				for (int j=0; j<size.x; ++j) {
+					Float weight = *((Float *) (sourceData + (j+1)*sourceBpp - sizeof(Float)));
+					Float invWeight = weight != 0 ? ((Float) 1 / weight) : (Float) 0;
+					cvt->convert(Bitmap::ESpectrum, 1.0f, sourceData + j*sourceBpp,
+						target->getPixelFormat(), target->getGamma(), targetData + j * targetBpp,
+						1, invWeight);
+				}
+
+				sourceData += source->getWidth() * sourceBpp;
+				targetData += target->getWidth() * targetBpp;
+			}
+		} else if (size.x == m_cropSize.x && target->getWidth() == m_storage->getWidth()) {
 			/* Develop a connected part of the underlying buffer */
 			cvt->convert(source->getPixelFormat(), 1.0f, sourceData,
 				target->getPixelFormat(), target->getGamma(), targetData,
@@ -243,6 +597,9 @@ public:
 	}
 
 	void develop(const Scene *scene, Float renderTime) {
+		/* Don't start a new write before the previous one has finished */
+		waitForWriter();
+
 		if (m_destFile.empty())
 			return;
 
@@ -250,132 +607,137 @@ public:
 
 		fs::path filename = m_destFile;
 		std::string extension = boost::to_lower_copy(filename.extension().string());
-		std::string expectedExtension;
-		if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
-			expectedExtension = ".m";
-		} else if (m_fileFormat == ENumPy) {
-			expectedExtension = ".npy";
-		} else {
-			Log(EError, "Invalid file format!");
-		}
+		std::string expectedExtension = getExtension();
 		if (extension != expectedExtension)
 			filename.replace_extension(expectedExtension);
 
+		Log(EInfo, "Writing image to \"%s\" ..", filename.filename().string().c_str());
+
+		if (m_fileFormat == ENumPy || m_fileFormat == ENumPyArchive) {
+			NumPyOutput output;
+			output.pixelFormats = m_pixelFormats;
+			output.arrayNames = m_arrayNames;
+			output.componentFormat = m_componentFormat;
+			output.archive = m_fileFormat == ENumPyArchive;
+			output.compress = m_compress;
+			output.writeWeights = m_writeWeights;
+
+			if (m_asyncWrite) {
+				/* Hand a snapshot of the accumulated image to a background thread */
+				m_writer = new NumPyWriter(filename, m_storage->getBitmap()->clone(), output);
+				m_writer->start();
+			} else {
+				writeNumPy(filename, m_storage->getBitmap(), output);
+			}
+			return;
+		}
+
 		ref<Bitmap> bitmap = m_storage->getBitmap()->convert(
-			m_pixelFormat, Bitmap::EFloat);
+			m_pixelFormats[0], Bitmap::EFloat);
 
-		Log(EInfo, "Writing image to \"%s\" ..", filename.filename().string().c_str());
+		fs::ofstream os(filename);
+		if (!os.good() || os.fail())
+			Log(EError, "Output file cannot be created!");
 
-		if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
-			fs::ofstream os(filename);
-			if (!os.good() || os.fail())
-				Log(EError, "Output file cannot be created!");
+		os << std::setprecision(m_digits);
 
-			os << std::setprecision(m_digits);
+		int rowSize = bitmap->getWidth();
 
-			int rowSize = bitmap->getWidth();
+		for (int ch=0; ch<bitmap->getChannelCount(); ++ch) {
+			if (m_fileFormat == EMATLAB) {
+				if (ch == 0) {
+					os << m_variable << " = [";
+				} else {
+					os << endl << m_variable << "(:, :, " << ch + 1 << ") = [";
+				}
+			} else {
+				if (ch == 0) {
+					if (bitmap->getChannelCount() == 1)
+						os << m_variable << " = {{";
+					else
+						os << m_variable << " = Transpose[{{{";
+				}
+			}
+			Float *ptr = bitmap->getFloatData();
+			ptr += ch;
 
-			for (int ch=0; ch<bitmap->getChannelCount(); ++ch) {
-				if (m_fileFormat == EMATLAB) {
-					if (ch == 0) {
-						os << m_variable << " = [";
+			for (int y=0; y < bitmap->getHeight(); y++) {
+				for (int x=0; x < rowSize; x++) {
+					if (m_fileFormat == EMATLAB) {
+						os << *ptr;
 					} else {
-						os << endl << m_variable << "(:, :, " << ch + 1 << ") = [";
+						/* Mathematica uses the peculiar '*^' notation rather than the standard 'e' notation. */
+						std::ostringstream oss;
+						oss << std::setprecision(m_digits);
+						oss << *ptr;
+						std::string str = oss.str();
+						boost::replace_first(str, "e", "*^");
+						os << str;
 					}
-				} else {
-					if (ch == 0) {
-						if (bitmap->getChannelCount() == 1)
-							os << m_variable << " = {{";
-						else
-							os << m_variable << " = Transpose[{{{";
-					}
-				}
-				Float *ptr = bitmap->getFloatData();
-				ptr += ch;
 
-				for (int y=0; y < bitmap->getHeight(); y++) {
-					for (int x=0; x < rowSize; x++) {
+					ptr += bitmap->getChannelCount();
+					if (x + 1 < rowSize) {
+						os << ", ";
+					} else {
 						if (m_fileFormat == EMATLAB) {
-							os << *ptr;
-						} else {
-							/* Mathematica uses the peculiar '*^' notation rather than the standard 'e' notation. */
-							std::ostringstream oss;
-							oss << std::setprecision(m_digits);
-							oss << *ptr;
-							std::string str = oss.str();
-							boost::replace_first(str, "e", "*^");
-							os << str;
-						}
-
-						ptr += bitmap->getChannelCount();
-						if (x + 1 < rowSize) {
-							os << ", ";
+							if (y + 1 < bitmap->getHeight())
+								os << ";" << endl << "\t";
+							else
+								os << "];" << endl;
 						} else {
-							if (m_fileFormat == EMATLAB) {
-								if (y + 1 < bitmap->getHeight())
-									os << ";" << endl << "\t";
+							if (y + 1 < bitmap->getHeight()) {
+								os << "}," << endl << "\t{";
+							} else if (ch + 1 == bitmap->getChannelCount()){
+								if (bitmap->getChannelCount() == 1)
+									os << "}};" << endl;
 								else
-									os << "];" << endl;
+									os << "}}}, {3,1,2}];" << endl;
 							} else {
-								if (y + 1 < bitmap->getHeight()) {
-									os << "}," << endl << "\t{";
-								} else if (ch + 1 == bitmap->getChannelCount()){
-									if (bitmap->getChannelCount() == 1)
-										os << "}};" << endl;
-									else
-										os << "}}}, {3,1,2}];" << endl;
-								} else {
-									os << "}}," << endl << endl << "\t{{";
-								}
+								os << "}}," << endl << endl << "\t{{";
 							}
 						}
 					}
 				}
 			}
-		} else {
-			unsigned int shape[] = {
-				(unsigned int) bitmap->getHeight(),
-				(unsigned int) bitmap->getWidth(),
-				(unsigned int) bitmap->getChannelCount()
-			};
-			unsigned int N = 3, *shape_ptr = shape;
-
-			if (bitmap->getChannelCount() == 1)
-				N = 2;
-
-			const Float *data = bitmap->getFloatData();
-			cnpy::npy_save(filename.string(), data, shape_ptr, N, "w");
 		}
 	}
 
 	bool destinationExists(const fs::path &baseName) const {
 		fs::path filename = baseName;
-		std::string expectedExtension;
-		if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
-			expectedExtension = ".m";
-		} else if (m_fileFormat == ENumPy) {
-			expectedExtension = ".npy";
-		} else {
-			Log(EError, "Invalid file format!");
-		}
+		std::string expectedExtension = getExtension();
 		if (boost::to_lower_copy(filename.extension().string()) != expectedExtension)
 			filename.replace_extension(expectedExtension);
 		return fs::exists(filename);
 	}
 
 	bool hasAlpha() const {
-		return
-			m_pixelFormat == Bitmap::ELuminanceAlpha ||
-			m_pixelFormat == Bitmap::ERGBA ||
-			m_pixelFormat == Bitmap::EXYZA ||
-			m_pixelFormat == Bitmap::ESpectrumAlpha;
+		for (size_t i=0; i<m_pixelFormats.size(); ++i) {
+			if (m_pixelFormats[i] == Bitmap::ELuminanceAlpha ||
+				m_pixelFormats[i] == Bitmap::ERGBA ||
+				m_pixelFormats[i] == Bitmap::EXYZA ||
+				m_pixelFormats[i] == Bitmap::ESpectrumAlpha)
+				return true;
+		}
+		return false;
 	}
 
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "MFilm[" << endl
 			<< "  size = " << m_size.toString() << "," << endl
-			<< "  pixelFormat = " << m_pixelFormat << "," << endl
+			<< "  fileFormat = " << m_fileFormat << "," << endl
+			<< "  pixelFormat = ";
+		for (size_t i=0; i<m_pixelFormats.size(); ++i)
+			oss << m_pixelFormats[i] << ", ";
+		oss << endl
+			<< "  arrayNames = ";
+		for (size_t i=0; i<m_arrayNames.size(); ++i)
+			oss << "\"" << m_arrayNames[i] << "\"" << ", ";
+		oss << endl
+			<< "  componentFormat = " << m_componentFormat << "," << endl
+			<< "  compress = " << m_compress << "," << endl
+			<< "  writeWeights = " << m_writeWeights << "," << endl
+			<< "  asyncWrite = " << m_asyncWrite << "," << endl
 			<< "  digits = " << m_digits << "," << endl
 			<< "  variable = \"" << m_variable << "\"," << endl
 			<< "  cropOffset = " << m_cropOffset.toString() << "," << endl
@@ -387,14 +749,55 @@ public:
 
 	MTS_DECLARE_CLASS()
 protected:
-	Bitmap::EPixelFormat m_pixelFormat;
+	virtual ~MFilm() {
+		waitForWriter();
+	}
+
+	void createStorage() {
+		if (m_pixelFormats.size() == 1) {
+			m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
+		} else {
+			m_storage = new ImageBlock(Bitmap::EMultiSpectrumAlphaWeight, m_cropSize,
+				NULL, (int) (SPECTRUM_SAMPLES * m_pixelFormats.size() + 2));
+		}
+	}
+
+	std::string getExtension() const {
+		switch (m_fileFormat) {
+			case EMATLAB:
+			case EMathematica: return ".m";
+			case ENumPy: return ".npy";
+			case ENumPyArchive: return ".npz";
+			default:
+				Log(EError, "Invalid file format!");
+				return "";
+		}
+	}
+
+	/// Wait until a pending background write has finished
+	void waitForWriter() {
+		if (m_writer) {
+			m_writer->join();
+			m_writer = NULL;
+		}
+	}
+
+protected:
+	std::vector<Bitmap::EPixelFormat> m_pixelFormats;
+	std::vector<std::string> m_arrayNames;
+	Bitmap::EComponentFormat m_componentFormat;
 	EMode m_fileFormat;
 	fs::path m_destFile;
 	ref<ImageBlock> m_storage;
+	ref<NumPyWriter> m_writer;
 	std::string m_variable;
 	int m_digits;
+	bool m_compress;
+	bool m_writeWeights;
+	bool m_asyncWrite;
 };
 
+MTS_IMPLEMENT_CLASS(NumPyWriter, false, Thread)
 MTS_IMPLEMENT_CLASS_S(MFilm, false, Film)
 MTS_EXPORT_PLUGIN(MFilm, "MATLAB / Mathematica / NumPy film");
 MTS_NAMESPACE_END
@@ -29,10 +29,12 @@ MTS_NAMESPACE_BEGIN
 
 class BDPTRenderer : public WorkProcessor {
 public:
-	BDPTRenderer(const BDPTConfiguration &config) : m_config(config) { }
+	BDPTRenderer(const BDPTConfiguration &config)
+		: m_pool(MTS_MEMPOOL_GRANULARITY, true), m_config(config) { }
 
 	BDPTRenderer(Stream *stream, InstanceManager *manager)
-		: WorkProcessor(stream, manager), m_config(stream) { }
+		: WorkProcessor(stream, manager), m_pool(MTS_MEMPOOL_GRANULARITY, true),
+		  m_config(stream) { }
 
 	virtual ~BDPTRenderer() { }
 
@@ -116,8 +118,10 @@ public:
 
 				evaluate(result, emitterSubpath, sensorSubpath);
 
+				/* Reclaim all vertices and edges of this sample at once */
 				emitterSubpath.release(m_pool);
 				sensorSubpath.release(m_pool);
+				m_pool.reset();
 
 				m_sampler->advance();
 			}
@@ -18,7 +18,9 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 #include <boost/math/distributions/normal.hpp>
+#include "adaptive_proc.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -40,6 +42,31 @@ MTS_NAMESPACE_BEGIN
  *         the \code{sampler}, this means that the adaptive integrator
  *         will give up after 32*64=2048 samples}
  *     }
+ *     \parameter{strategy}{\String}{
+ *         Specifies how samples are distributed over the image:
+ *         \begin{enumerate}[(i)]
+ *             \item \code{pixel}: Each pixel independently decides when to
+ *             stop sampling (see below).
+ *             \item \code{global}: Render in multiple passes that redistribute
+ *             the samples over the whole image based on an error map.
+ *         \end{enumerate}
+ *         \default{\code{pixel}}
+ *     }
+ *     \parameter{initialSamples}{\Integer}{
+ *         Number of samples per pixel taken by the first pass of the
+ *         \code{global} strategy \default{number of configured pixel samples}
+ *     }
+ *     \parameter{passSamples}{\Integer}{
+ *         Average number of samples per pixel that one subsequent pass
+ *         of the \code{global} strategy may distribute
+ *         \default{same as \code{initialSamples}}
+ *     }
+ *     \parameter{timeBudget}{\Float}{
+ *         Wall-clock time budget in seconds for the \code{global}
+ *         strategy. Passes are sized to fit into the remaining time, and
+ *         no further passes are started once it is used up.
+ *         A value of zero disables the budget. \default{0}
+ *     }
  * }
  *
  * This ``meta-integrator'' repeatedly invokes a provided sub-integrator
@@ -56,6 +83,26 @@ MTS_NAMESPACE_BEGIN
  * </integrator>
  * \end{xml}
  *
+ * The default \code{pixel} strategy makes this decision for every pixel in
+ * isolation and cannot move samples from easy to difficult parts of the image.
+ * The \code{global} strategy instead first renders the whole image using
+ * \code{initialSamples} samples per pixel while recording the luminance
+ * variance of every pixel. Each following pass estimates how many additional
+ * samples every pixel needs to satisfy the error bound and distributes up
+ * to \code{passSamples} samples per pixel (on average) proportionally to
+ * these estimates. Rendering stops when all pixels have converged or
+ * reached the \code{maxSampleFactor} limit, or when the \code{timeBudget}
+ * is exhausted.
+ *
+ * \begin{xml}[caption={Distributing a time budget of ten minutes over the image}]
+ * <integrator type="adaptive">
+ *     <string name="strategy" value="global"/>
+ *     <float name="timeBudget" value="600"/>
+ *     <integer name="maxSampleFactor" value="64"/>
+ *     <integrator type="path"/>
+ * </integrator>
+ * \end{xml}
+ *
  * \remarks{
  *    \item The adaptive integrator needs a variance estimate to work
  *     correctly. Hence, the underlying sample generator should be set to a reasonably
@@ -63,6 +110,9 @@ MTS_NAMESPACE_BEGIN
  *    \item This plugin uses a relatively simplistic error heuristic that does not
  *    share information between pixels and only reasons about variance in image space.
  *    In the future, it will likely be replaced with something more robust.
+ *    \item With the \code{global} strategy, pixels that received many samples
+ *    contribute proportionally more to their neighbors through the image
+ *    reconstruction filter. A narrow filter (e.g. \code{box}) avoids this.
  * }
  */
 class AdaptiveIntegrator : public SamplingIntegrator {
@@ -78,6 +128,21 @@ public:
 		/* Required P-value to accept a sample. */
 		m_pValue = props.getFloat("pValue", 0.05f);
 		m_verbose = props.getBoolean("verbose", false);
+
+		std::string strategy = props.getString("strategy", "pixel");
+		if (strategy == "pixel")
+			m_globalStrategy = false;
+		else if (strategy == "global")
+			m_globalStrategy = true;
+		else
+			Log(EError, "Unknown sampling strategy \"%s\" (must be \"pixel\" "
+				"or \"global\")", strategy.c_str());
+
+		/* Samples per pixel of the first pass (the global strategy only).
+		   Zero means: use the sample count of the sampler */
+		m_initialSamples = props.getInteger("initialSamples", 0);
+		/* Average number of samples per pixel of the following passes */
+		m_passSamples = props.getInteger("passSamples", 0);
 	}
 
 	AdaptiveIntegrator(Stream *stream, InstanceManager *manager)
@@ -88,6 +153,9 @@ public:
 		m_quantile = stream->readFloat();
 		m_averageLuminance = stream->readFloat();
 		m_pValue = stream->readFloat();
+		m_globalStrategy = stream->readBool();
+		m_initialSamples = stream->readInt();
+		m_passSamples = stream->readInt();
 		m_verbose = false;
 	}
 
@@ -165,6 +233,166 @@ public:
 		return true;
 	}
 
+	bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int sensorResID, int samplerResID) {
+		if (!m_globalStrategy)
+			return SamplingIntegrator::render(scene, queue, job,
+				sceneResID, sensorResID, samplerResID);
+
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+		const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+		size_t sampleCount = sampler->getSampleCount();
+		int initialSamples = m_initialSamples > 0 ? m_initialSamples : (int) sampleCount;
+		int passSamples = m_passSamples > 0 ? m_passSamples : initialSamples;
+		Float maxSamples = m_maxSampleFactor >= 0 ? (Float) (m_maxSampleFactor * sampleCount)
+			: std::numeric_limits<Float>::infinity();
+
+		if (initialSamples < 8)
+			Log(EError, "Starting the adaptive integrator with less than 8 "
+				"samples per pixel does not make much sense -- giving up.");
+
+		Log(EInfo, "Starting adaptive render job (%ix%i, %i initial samples, "
+			"%i samples per pass, " SIZE_T_FMT " %s, " SSE_STR ") ..",
+			sensor->getFilm()->getCropSize().x, sensor->getFilm()->getCropSize().y,
+			initialSamples, passSamples, sched->getCoreCount(),
+			sched->getCoreCount() == 1 ? "core" : "cores");
+
+		std::vector<PixelStatistics> stats;
+		ref<Bitmap> budget;
+		ref<Timer> timer = new Timer();
+		Float samplesPerSecond = 0;
+		uint64_t totalSamples = 0;
+		bool success = true;
+
+		m_cancelled = false;
+		int integratorResID = sched->registerResource(this);
+
+		for (int pass=0; !m_cancelled; ++pass) {
+			ref<AdaptivePassProcess> proc = new AdaptivePassProcess(job,
+				queue, scene->getBlockSize(), pass);
+			proc->bindResource("integrator", integratorResID);
+			proc->bindResource("scene", sceneResID);
+			proc->bindResource("sensor", sensorResID);
+			proc->bindResource("sampler", samplerResID);
+			scene->bindUsedResources(proc);
+			bindUsedResources(proc);
+
+			uint64_t passSampleCount;
+			if (pass == 0) {
+				const Vector2i &size = proc->getImageSize();
+				stats.resize((size_t) size.x * (size_t) size.y);
+				budget = new Bitmap(Bitmap::ELuminance, Bitmap::EUInt32, size);
+				uint32_t *data = budget->getUInt32Data();
+				std::fill(data, data + stats.size(), (uint32_t) initialSamples);
+				passSampleCount = (uint64_t) initialSamples * stats.size();
+			} else {
+				/* Limit the pass so that it fits into the remaining time */
+				Float passBudget = (Float) passSamples * stats.size();
+				if (m_timeBudget > 0) {
+					Float remaining = m_timeBudget - timer->getSeconds();
+					passBudget = std::min(passBudget, remaining * samplesPerSecond);
+					if (passBudget < 1) {
+						Log(EInfo, "The time budget has been used up.");
+						break;
+					}
+				}
+				passSampleCount = computeBudget(stats, maxSamples, passBudget, budget);
+				if (passSampleCount == 0) {
+					Log(EInfo, "All pixels have converged.");
+					break;
+				}
+			}
+
+			proc->setBudget(budget, &stats[0]);
+
+			ref<Timer> passTimer = new Timer();
+			sched->schedule(proc);
+			m_process = proc;
+			sched->wait(proc);
+			m_process = NULL;
+
+			if (proc->getReturnStatus() != ParallelProcess::ESuccess) {
+				success = false;
+				break;
+			}
+
+			totalSamples += passSampleCount;
+			samplesPerSecond = passSampleCount / std::max(passTimer->getSeconds(), (Float) 1e-3f);
+			Log(EInfo, "Pass %i: " SIZE_T_FMT " samples (%.1f per pixel) in %s",
+				pass + 1, (size_t) passSampleCount, passSampleCount / (Float) stats.size(),
+				timeString(passTimer->getSeconds()).c_str());
+		}
+
+		sched->unregisterResource(integratorResID);
+		Log(EInfo, "Took an average of %.1f samples per pixel",
+			totalSamples / (Float) std::max(stats.size(), (size_t) 1));
+		return success && !m_cancelled;
+	}
+
+	/**
+	 * \brief Determine how many samples each pixel receives in the next pass
+	 *
+	 * Based on the current variance estimate, this computes the number of
+	 * samples each pixel needs to reach the error bound. When these add up
+	 * to more than \c passBudget, they are scaled down proportionally.
+	 * Returns the total number of samples of the pass.
+	 */
+	uint64_t computeBudget(const std::vector<PixelStatistics> &stats,
+			Float maxSamples, Float passBudget, Bitmap *budget) const {
+		std::vector<Float> deficit(stats.size());
+		Float totalDeficit = 0;
+		size_t converged = 0;
+
+		for (size_t i=0; i<stats.size(); ++i) {
+			const PixelStatistics &s = stats[i];
+
+			/* Half width of the confidence interval */
+			Float ciWidth = std::sqrt(s.getVariance() / s.count) * m_quantile;
+
+			/* Relative error heuristic */
+			Float allowed = m_maxError * std::max(s.mean, m_averageLuminance * 0.01f);
+
+			/* The width shrinks with the square root of the sample count */
+			Float required = ciWidth <= allowed ? 0.0f :
+				s.count * (ciWidth / allowed) * (ciWidth / allowed);
+			required = std::min(required, maxSamples) - s.count;
+
+			if (required > 0) {
+				/* Grow by at least 25% to avoid a long tail of tiny passes */
+				deficit[i] = std::max(required, std::min((Float) s.count * 0.25f,
+					maxSamples - s.count));
+				deficit[i] = std::max(deficit[i], (Float) 1.0f);
+				totalDeficit += deficit[i];
+			} else {
+				deficit[i] = 0;
+				++converged;
+			}
+		}
+
+		Log(EInfo, "%.1f%% of the pixels have converged",
+			100 * converged / (Float) stats.size());
+
+		/* Scale down (if necessary) and round the sample counts while
+		   carrying the rounding error over to the next pixel */
+		Float scale = totalDeficit > passBudget ? passBudget / totalDeficit : 1.0f;
+		uint32_t *data = budget->getUInt32Data();
+		uint64_t total = 0;
+		Float carry = 0;
+		for (size_t i=0; i<stats.size(); ++i) {
+			if (deficit[i] == 0) {
+				data[i] = 0;
+				continue;
+			}
+			Float value = deficit[i] * scale + carry;
+			uint32_t count = (uint32_t) std::min(value, (Float) 0xFFFFFFFFu);
+			carry = value - count;
+			data[i] = count;
+			total += count;
+		}
+		return total;
+	}
+
 	void renderBlock(const Scene *scene, const Sensor *sensor,
 			Sampler *sampler, ImageBlock *block, const bool &stop,
 			const std::vector< TPoint2<uint8_t> > &points) const {
@@ -303,6 +531,9 @@ public:
 		stream->writeFloat(m_quantile);
 		stream->writeFloat(m_averageLuminance);
 		stream->writeFloat(m_pValue);
+		stream->writeBool(m_globalStrategy);
+		stream->writeInt(m_initialSamples);
+		stream->writeInt(m_passSamples);
 	}
 
 	void bindUsedResources(ParallelProcess *proc) const {
@@ -332,6 +563,10 @@ public:
 			<< "  maxError = " << m_maxError << "," << endl
 			<< "  quantile = " << m_quantile << "," << endl
 			<< "  pvalue = " << m_pValue << "," << endl
+			<< "  strategy = " << (m_globalStrategy ? "global" : "pixel") << "," << endl
+			<< "  initialSamples = " << m_initialSamples << "," << endl
+			<< "  passSamples = " << m_passSamples << "," << endl
+			<< "  timeBudget = " << m_timeBudget << "," << endl
 			<< "  subIntegrator = " << indent(m_subIntegrator->toString()) << endl
 			<< "]";
 		return oss.str();
@@ -342,6 +577,8 @@ private:
 	ref<SamplingIntegrator> m_subIntegrator;
 	Float m_maxError, m_quantile, m_pValue, m_averageLuminance;
 	int m_maxSampleFactor;
+	int m_initialSamples, m_passSamples;
+	bool m_globalStrategy;
 	bool m_verbose;
 };
 
@@ -0,0 +1,340 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/sfcurve.h>
+#include "adaptive_proc.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                              Work unit                               */
+/* ==================================================================== */
+
+AdaptiveWorkUnit::AdaptiveWorkUnit(int blockSize) : m_blockSize(blockSize) {
+	m_sampleCounts.resize(blockSize * blockSize);
+}
+
+void AdaptiveWorkUnit::set(const WorkUnit *workUnit) {
+	const AdaptiveWorkUnit *wu = static_cast<const AdaptiveWorkUnit *>(workUnit);
+	RectangularWorkUnit::set(wu);
+	m_sampleCounts = wu->m_sampleCounts;
+	m_blockSize = wu->m_blockSize;
+}
+
+void AdaptiveWorkUnit::load(Stream *stream) {
+	RectangularWorkUnit::load(stream);
+	const Vector2i &size = getSize();
+	for (int y=0; y<size.y; ++y)
+		stream->readUIntArray(&m_sampleCounts[y * m_blockSize], size.x);
+}
+
+void AdaptiveWorkUnit::save(Stream *stream) const {
+	RectangularWorkUnit::save(stream);
+	const Vector2i &size = getSize();
+	for (int y=0; y<size.y; ++y)
+		stream->writeUIntArray(&m_sampleCounts[y * m_blockSize], size.x);
+}
+
+std::string AdaptiveWorkUnit::toString() const {
+	std::ostringstream oss;
+	oss << "AdaptiveWorkUnit[offset=" << getOffset().toString()
+		<< ", size=" << getSize().toString() << "]";
+	return oss.str();
+}
+
+/* ==================================================================== */
+/*                             Work result                              */
+/* ==================================================================== */
+
+AdaptiveWorkResult::AdaptiveWorkResult(const ReconstructionFilter *filter,
+		int blockSize) : m_blockSize(blockSize) {
+	m_block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+		Vector2i(blockSize), filter);
+	m_stats.resize(blockSize * blockSize);
+}
+
+void AdaptiveWorkResult::clear() {
+	m_block->clear();
+	std::fill(m_stats.begin(), m_stats.end(), PixelStatistics());
+}
+
+void AdaptiveWorkResult::load(Stream *stream) {
+	m_block->load(stream);
+	const Vector2i &size = m_block->getSize();
+	for (int y=0; y<size.y; ++y) {
+		for (int x=0; x<size.x; ++x) {
+			PixelStatistics &stats = getStatistics(Point2i(x, y));
+			stats.mean = stream->readFloat();
+			stats.m2 = stream->readFloat();
+			stats.count = stream->readUInt();
+		}
+	}
+}
+
+void AdaptiveWorkResult::save(Stream *stream) const {
+	m_block->save(stream);
+	const Vector2i &size = m_block->getSize();
+	for (int y=0; y<size.y; ++y) {
+		for (int x=0; x<size.x; ++x) {
+			const PixelStatistics &stats = getStatistics(Point2i(x, y));
+			stream->writeFloat(stats.mean);
+			stream->writeFloat(stats.m2);
+			stream->writeUInt(stats.count);
+		}
+	}
+}
+
+std::string AdaptiveWorkResult::toString() const {
+	std::ostringstream oss;
+	oss << "AdaptiveWorkResult[" << endl
+		<< "  block = " << indent(m_block->toString()) << endl
+		<< "]";
+	return oss.str();
+}
+
+/* ==================================================================== */
+/*                           Work processor                             */
+/* ==================================================================== */
+
+class AdaptivePassRenderer : public WorkProcessor {
+public:
+	AdaptivePassRenderer(int blockSize) : m_blockSize(blockSize) { }
+
+	AdaptivePassRenderer(Stream *stream, InstanceManager *manager) {
+		m_blockSize = stream->readInt();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		stream->writeInt(m_blockSize);
+	}
+
+	ref<WorkUnit> createWorkUnit() const {
+		return new AdaptiveWorkUnit(m_blockSize);
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new AdaptiveWorkResult(
+			m_sensor->getFilm()->getReconstructionFilter(), m_blockSize);
+	}
+
+	void prepare() {
+		Scene *scene = static_cast<Scene *>(getResource("scene"));
+		m_scene = new Scene(scene);
+		m_sampler = static_cast<Sampler *>(getResource("sampler"));
+		m_sensor = static_cast<Sensor *>(getResource("sensor"));
+		m_integrator = static_cast<SamplingIntegrator *>(getResource("integrator"));
+		m_scene->removeSensor(scene->getSensor());
+		m_scene->addSensor(m_sensor);
+		m_scene->setSensor(m_sensor);
+		m_scene->setSampler(m_sampler);
+		m_scene->setIntegrator(m_integrator);
+		m_integrator->wakeup(m_scene, m_resources);
+		m_scene->wakeup(m_scene, m_resources);
+		m_scene->initializeBidirectional();
+	}
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const AdaptiveWorkUnit *rect = static_cast<const AdaptiveWorkUnit *>(workUnit);
+		AdaptiveWorkResult *result = static_cast<AdaptiveWorkResult *>(workResult);
+		ImageBlock *block = result->getImageBlock();
+
+		result->setOffset(rect->getOffset());
+		result->setSize(rect->getSize());
+		result->clear();
+		m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
+		const std::vector<TPoint2<uint8_t> > &points = m_hilbertCurve.getPoints();
+
+		bool needsApertureSample = m_sensor->needsApertureSample();
+		bool needsTimeSample = m_sensor->needsTimeSample();
+		Float diffScaleFactor = 1.0f /
+			std::sqrt((Float) m_sampler->getSampleCount());
+
+		RadianceQueryRecord rRec(m_scene, m_sampler);
+		Point2 apertureSample(0.5f);
+		Float timeSample = 0.5f;
+		RayDifferential eyeRay;
+
+		for (size_t i=0; i<points.size(); ++i) {
+			uint32_t sampleCount = rect->getSampleCount(Point2i(points[i]));
+			if (sampleCount == 0)
+				continue;
+
+			Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+
+			PixelStatistics &stats = result->getStatistics(Point2i(points[i]));
+			m_sampler->generate(offset);
+
+			for (uint32_t j=0; j<sampleCount; ++j) {
+				if (stop)
+					return;
+
+				rRec.newQuery(RadianceQueryRecord::ESensorRay, m_sensor->getMedium());
+				rRec.extra = RadianceQueryRecord::EAdaptiveQuery;
+
+				Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+				if (needsApertureSample)
+					apertureSample = rRec.nextSample2D();
+				if (needsTimeSample)
+					timeSample = rRec.nextSample1D();
+
+				Spectrum sampleValue = m_sensor->sampleRayDifferential(
+					eyeRay, samplePos, apertureSample, timeSample);
+				eyeRay.scaleDifferential(diffScaleFactor);
+
+				sampleValue *= m_integrator->Li(eyeRay, rRec);
+
+				if (block->put(samplePos, sampleValue, rRec.alpha))
+					stats.put(sampleValue.getLuminance());
+				else
+					stats.put(0.0f);
+				m_sampler->advance();
+			}
+		}
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new AdaptivePassRenderer(m_blockSize);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~AdaptivePassRenderer() { }
+private:
+	ref<Scene> m_scene;
+	ref<Sensor> m_sensor;
+	ref<Sampler> m_sampler;
+	ref<SamplingIntegrator> m_integrator;
+	int m_blockSize;
+	HilbertCurve2D<uint8_t> m_hilbertCurve;
+};
+
+/* ==================================================================== */
+/*                           Parallel process                           */
+/* ==================================================================== */
+
+AdaptivePassProcess::AdaptivePassProcess(const RenderJob *parent,
+		RenderQueue *queue, int blockSize, int pass)
+	: BlockedRenderProcess(parent, queue, blockSize), m_stats(NULL), m_pass(pass) { }
+
+/// Orders blocks by decreasing cost
+struct BlockCostOrder {
+	inline bool operator()(const std::pair<uint64_t, Point2i> &a,
+			const std::pair<uint64_t, Point2i> &b) const {
+		return a.first > b.first;
+	}
+};
+
+void AdaptivePassProcess::setBudget(const Bitmap *budget, PixelStatistics *stats) {
+	Assert(budget->getSize() == m_size);
+	m_budget = budget;
+	m_stats = stats;
+
+	/* Determine the total number of samples of each block */
+	std::vector<std::pair<uint64_t, Point2i> > blocks;
+	const uint32_t *data = budget->getUInt32Data();
+	for (int by=0; by<m_numBlocks.y; ++by) {
+		for (int bx=0; bx<m_numBlocks.x; ++bx) {
+			Point2i start(bx * m_blockSize, by * m_blockSize);
+			Point2i end(std::min(start.x + m_blockSize, m_size.x),
+				std::min(start.y + m_blockSize, m_size.y));
+			uint64_t cost = 0;
+			for (int y=start.y; y<end.y; ++y)
+				for (int x=start.x; x<end.x; ++x)
+					cost += data[x + y * m_size.x];
+			if (cost > 0)
+				blocks.push_back(std::make_pair(cost, start));
+		}
+	}
+
+	/* Start with the most expensive blocks, which improves the load
+	   balance towards the end of the pass */
+	std::stable_sort(blocks.begin(), blocks.end(), BlockCostOrder());
+
+	m_blocks.resize(blocks.size());
+	for (size_t i=0; i<blocks.size(); ++i)
+		m_blocks[i] = blocks[i].second;
+	m_numBlocksGenerated = 0;
+
+	if (m_progress)
+		delete m_progress;
+	m_progress = new ProgressReporter(formatString("Rendering (pass %i)", m_pass + 1),
+		(long long) m_blocks.size(), m_parent);
+}
+
+ref<WorkProcessor> AdaptivePassProcess::createWorkProcessor() const {
+	return new AdaptivePassRenderer(m_blockSize);
+}
+
+
+ParallelProcess::EStatus AdaptivePassProcess::generateWork(WorkUnit *unit, int worker) {
+	if (m_numBlocksGenerated == (int) m_blocks.size())
+		return EFailure;
+
+	AdaptiveWorkUnit *rect = static_cast<AdaptiveWorkUnit *>(unit);
+	const Point2i &pos = m_blocks[m_numBlocksGenerated++];
+	Vector2i size(
+		std::min(m_size.x - pos.x, m_blockSize),
+		std::min(m_size.y - pos.y, m_blockSize));
+	rect->setOffset(pos + m_offset);
+	rect->setSize(size);
+
+	const uint32_t *budget = m_budget->getUInt32Data();
+	for (int y=0; y<size.y; ++y)
+		for (int x=0; x<size.x; ++x)
+			rect->getSampleCount(Point2i(x, y)) =
+				budget[pos.x + x + (pos.y + y) * m_size.x];
+
+	m_queue->signalWorkBegin(m_parent, rect, worker);
+	return ESuccess;
+}
+
+void AdaptivePassProcess::processResult(const WorkResult *wr, bool cancelled) {
+	const AdaptiveWorkResult *result = static_cast<const AdaptiveWorkResult *>(wr);
+	const ImageBlock *block = result->getImageBlock();
+
+	if (m_film->supportsConcurrentPut()) {
+		lockTiles(block);
+		m_film->put(block);
+		unlockTiles(block);
+	} else {
+		LockGuard lock(m_resultMutex);
+		m_film->put(block);
+	}
+
+	/* Blocks of the same pass never overlap -- no locking needed */
+	const Vector2i rel = block->getOffset() - m_offset;
+	const Vector2i &size = block->getSize();
+	for (int y=0; y<size.y; ++y) {
+		PixelStatistics *target = m_stats + rel.x + (rel.y + y) * m_size.x;
+		for (int x=0; x<size.x; ++x)
+			target[x].put(result->getStatistics(Point2i(x, y)));
+	}
+
+	UniqueLock lock(m_resultMutex);
+	m_progress->update(++m_resultCount);
+	lock.unlock();
+	m_queue->signalWorkEnd(m_parent, block, cancelled);
+}
+
+MTS_IMPLEMENT_CLASS(AdaptiveWorkUnit, false, RectangularWorkUnit)
+MTS_IMPLEMENT_CLASS(AdaptiveWorkResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(AdaptivePassRenderer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(AdaptivePassProcess, false, BlockedRenderProcess)
+MTS_NAMESPACE_END
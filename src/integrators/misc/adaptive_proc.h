@@ -0,0 +1,188 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__ADAPTIVE_PROC_H)
+#define __ADAPTIVE_PROC_H
+
+#include <mitsuba/render/renderproc.h>
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/render/rectwu.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Running mean and variance of the luminance of
+ * the samples taken within a pixel
+ */
+struct PixelStatistics {
+	Float mean, m2;
+	uint32_t count;
+
+	inline PixelStatistics() : mean(0.0f), m2(0.0f), count(0) { }
+
+	/**
+	 * \brief Add a sample using the numerically robust online algorithm
+	 * by Donald Knuth (TAOCP vol.2, 3rd ed., p.232)
+	 */
+	inline void put(Float value) {
+		++count;
+		const Float delta = value - mean;
+		mean += delta / count;
+		m2 += delta * (value - mean);
+	}
+
+	/// Merge the statistics of another set of samples (Chan et al.)
+	inline void put(const PixelStatistics &other) {
+		if (other.count == 0)
+			return;
+		const uint32_t total = count + other.count;
+		const Float delta = other.mean - mean;
+		mean += delta * other.count / total;
+		m2 += other.m2 + delta * delta * ((Float) count * other.count / total);
+		count = total;
+	}
+
+	/// Return the sample variance of the luminance
+	inline Float getVariance() const {
+		return count > 1 ? m2 / (count - 1) : 0.0f;
+	}
+};
+
+/**
+ * \brief Rectangular image region along with the number
+ * of samples to be taken in each of its pixels
+ */
+class AdaptiveWorkUnit : public RectangularWorkUnit {
+public:
+	AdaptiveWorkUnit(int blockSize);
+
+	/// Return the sample count of a pixel (relative to the block offset)
+	inline uint32_t &getSampleCount(const Point2i &p) {
+		return m_sampleCounts[p.x + p.y * m_blockSize];
+	}
+
+	/// Return the sample count of a pixel (relative to the block offset)
+	inline uint32_t getSampleCount(const Point2i &p) const {
+		return m_sampleCounts[p.x + p.y * m_blockSize];
+	}
+
+	/* WorkUnit interface */
+	void set(const WorkUnit *workUnit);
+	void load(Stream *stream);
+	void save(Stream *stream) const;
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~AdaptiveWorkUnit() { }
+private:
+	std::vector<uint32_t> m_sampleCounts;
+	int m_blockSize;
+};
+
+/**
+ * \brief Image block along with the luminance statistics
+ * of each of its pixels
+ */
+class AdaptiveWorkResult : public WorkResult {
+public:
+	AdaptiveWorkResult(const ReconstructionFilter *filter, int blockSize);
+
+	/// Clear the contents of the work result
+	void clear();
+
+	inline void setOffset(const Point2i &offset) { m_block->setOffset(offset); }
+	inline void setSize(const Vector2i &size) { m_block->setSize(size); }
+
+	inline ImageBlock *getImageBlock() { return m_block.get(); }
+	inline const ImageBlock *getImageBlock() const { return m_block.get(); }
+
+	/// Return the statistics of a pixel (relative to the block offset)
+	inline PixelStatistics &getStatistics(const Point2i &p) {
+		return m_stats[p.x + p.y * m_blockSize];
+	}
+
+	/// Return the statistics of a pixel (relative to the block offset)
+	inline const PixelStatistics &getStatistics(const Point2i &p) const {
+		return m_stats[p.x + p.y * m_blockSize];
+	}
+
+	/* WorkResult interface */
+	void load(Stream *stream);
+	void save(Stream *stream) const;
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~AdaptiveWorkResult() { }
+private:
+	ref<ImageBlock> m_block;
+	std::vector<PixelStatistics> m_stats;
+	int m_blockSize;
+};
+
+/**
+ * \brief Renders one pass of the global adaptive sampling scheme
+ *
+ * Each pixel receives the number of samples stored in a single-channel
+ * \c uint32 bitmap covering the image region, which reaches the workers
+ * as part of the work units. Blocks without any samples are skipped, and
+ * the remaining ones are issued in order of decreasing cost. The resulting samples are added
+ * to the film, and their luminance statistics are merged into a
+ * per-pixel table that persists across passes.
+ */
+class AdaptivePassProcess : public BlockedRenderProcess {
+public:
+	AdaptivePassProcess(const RenderJob *parent, RenderQueue *queue,
+		int blockSize, int pass);
+
+	/// Return the offset of the rendered image region (after binding the sensor)
+	inline const Point2i &getImageOffset() const { return m_offset; }
+
+	/// Return the size of the rendered image region (after binding the sensor)
+	inline const Vector2i &getImageSize() const { return m_size; }
+
+	/**
+	 * \brief Specify the per-pixel sample budget of this pass and
+	 * the table that accumulates the per-pixel statistics
+	 *
+	 * Must be called after binding the sensor.
+	 */
+	void setBudget(const Bitmap *budget, PixelStatistics *stats);
+
+	/* ParallelProcess impl. */
+	ref<WorkProcessor> createWorkProcessor() const;
+	void processResult(const WorkResult *result, bool cancelled);
+	EStatus generateWork(WorkUnit *unit, int worker);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~AdaptivePassProcess() { }
+private:
+	std::vector<Point2i> m_blocks;
+	ref<const Bitmap> m_budget;
+	PixelStatistics *m_stats;
+	int m_pass;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __ADAPTIVE_PROC_H */
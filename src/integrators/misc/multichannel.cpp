@@ -256,15 +256,20 @@ public:
 					}
 				}
 
+				temp[offset] = rRec.alpha;
+				temp[offset + 1] = 1.0f;
+
 				if (j >= 1) {
 					variance[offset] = rRec.alpha;
 					variance[offset + 1] = 1.0f;
-					varianceBlock->put(samplePos, variance);
-					// block->put(samplePos, variance);
+
+					/* Splat the sample and its variance using a single filter evaluation */
+					ImageBlock *blocks[] = { block, varianceBlock.get() };
+					const Float *values[] = { temp, variance };
+					ImageBlock::put(samplePos, blocks, values, 2);
+				} else {
+					block->put(samplePos, temp);
 				}
-				temp[offset] = rRec.alpha;
-				temp[offset + 1] = 1.0f;
-				block->put(samplePos, temp);
 
 				sampler->advance();
 			}
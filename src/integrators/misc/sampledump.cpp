@@ -0,0 +1,343 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/renderproc.h>
+#include <mitsuba/core/mmap.h>
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{sampledump}{Per-sample dump integrator}
+ * \order{18}
+ * \parameters{
+ *     \parameter{\Unnamed}{\Integrator}{Sub-integrator that computes the
+ *     radiance of each sample}
+ *     \parameter{filename}{\String}{Name of the NumPy (\code{.npy}) file that
+ *     receives the samples}
+ * }
+ *
+ * This integrator renders an image using the nested integrator just like
+ * the film would normally see it, but additionally records every individual
+ * sample \emph{before} it is passed through the reconstruction filter. This
+ * is useful to generate training data for sample-based denoisers without
+ * having to render one image per sample.
+ *
+ * The samples are stored in a memory-mapped single precision tensor of shape
+ * \code{[H, W, spp, 14]} (where \code{H} and \code{W} refer to the crop window
+ * of the film), which can be opened using \code{numpy.load(filename, mmap\_mode='r')}.
+ * The channels of each sample are
+ * \begin{enumerate}[(i)]
+ *     \item film position (2),
+ *     \item linear RGB radiance (3),
+ *     \item alpha (1),
+ *     \item distance to the first hit (1, zero when the ray escapes),
+ *     \item face-forwarded shading normal of the first hit (3),
+ *     \item diffuse albedo of the first hit (3),
+ *     \item path depth reported by the nested integrator (1).
+ * \end{enumerate}
+ *
+ * \vspace{2mm}
+ * \begin{xml}
+ * <integrator type="sampledump">
+ *     <string name="filename" value="samples.npy"/>
+ *     <integrator type="path"/>
+ * </integrator>
+ * \end{xml}
+ *
+ * \remarks{
+ * \item The samples are written by the rendering threads straight into the
+ * mapped file, hence this integrator does not support network rendering.
+ * \item The nested integrator must conform to Mitsuba's basic
+ * \emph{SamplingIntegrator} interface (see \pluginref{multichannel}).
+ * \item Samples of blocks that were not rendered (e.g. due to a cancelled
+ * render job) remain zero.
+ * }
+ */
+
+class SampleDumpIntegrator : public SamplingIntegrator {
+public:
+	/// Channel layout of a single record in the sample tensor
+	enum ESampleChannel {
+		EFilmPosition  = 0,
+		ERadiance      = 2,
+		EAlpha         = 5,
+		EDistance      = 6,
+		EShadingNormal = 7,
+		EAlbedo        = 10,
+		EPathDepth     = 13,
+		EChannelCount  = 14
+	};
+
+	SampleDumpIntegrator(const Properties &props) : SamplingIntegrator(props) {
+		m_filename = props.getString("filename");
+		m_data = NULL;
+	}
+
+	SampleDumpIntegrator(Stream *stream, InstanceManager *manager)
+	 : SamplingIntegrator(stream, manager) {
+		m_subIntegrator = static_cast<SamplingIntegrator *>(manager->getInstance(stream));
+		m_filename = stream->readString();
+		m_data = NULL;
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		SamplingIntegrator::serialize(stream, manager);
+		manager->serialize(stream, m_subIntegrator.get());
+		stream->writeString(m_filename.string());
+	}
+
+	void configure() {
+		SamplingIntegrator::configure();
+		if (!m_subIntegrator)
+			Log(EError, "No sub-integrator was supplied to the sample dump integrator!");
+	}
+
+	bool preprocess(const Scene *scene, RenderQueue *queue,
+		const RenderJob *job, int sceneResID, int sensorResID,
+		int samplerResID) {
+		if (!SamplingIntegrator::preprocess(scene, queue, job, sceneResID,
+				sensorResID, samplerResID))
+			return false;
+		return m_subIntegrator->preprocess(scene, queue, job, sceneResID,
+				sensorResID, samplerResID);
+	}
+
+	bool render(Scene *scene,
+			RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int sensorResID, int samplerResID) {
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+		ref<Film> film = sensor->getFilm();
+		const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+
+		if (sched->getWorkerCount() != sched->getLocalWorkerCount())
+			Log(EError, "The sample dump integrator does not support network rendering!");
+
+		m_cropSize = film->getCropSize();
+		m_sampleCount = sampler->getSampleCount();
+
+		/* Create the output file and reserve space for all samples */
+		std::string header = getHeader();
+		size_t dataSize = (size_t) m_cropSize.x * (size_t) m_cropSize.y
+			* m_sampleCount * EChannelCount * sizeof(float);
+
+		Log(EInfo, "Dumping samples to \"%s\" (%s) ..",
+			m_filename.filename().string().c_str(),
+			memString(header.length() + dataSize).c_str());
+
+		m_mmap = new MemoryMappedFile(m_filename, header.length() + dataSize);
+		uint8_t *ptr = (uint8_t *) m_mmap->getData();
+		memcpy(ptr, header.data(), header.length());
+		m_data = (float *) (ptr + header.length());
+
+		bool success = SamplingIntegrator::render(scene, queue, job,
+			sceneResID, sensorResID, samplerResID);
+
+		/* Unmapping flushes the samples to disk */
+		m_data = NULL;
+		m_mmap = NULL;
+
+		return success;
+	}
+
+	void renderBlock(const Scene *scene,
+			const Sensor *sensor, Sampler *sampler, ImageBlock *block,
+			const bool &stop, const std::vector< TPoint2<uint8_t> > &points) const {
+
+		Float diffScaleFactor = 1.0f /
+			std::sqrt((Float) sampler->getSampleCount());
+
+		bool needsApertureSample = sensor->needsApertureSample();
+		bool needsTimeSample = sensor->needsTimeSample();
+
+		RadianceQueryRecord rRec(scene, sampler);
+		Point2 apertureSample(0.5f);
+		Float timeSample = 0.5f;
+		RayDifferential sensorRay;
+
+		block->clear();
+
+		uint32_t queryType = RadianceQueryRecord::ESensorRay;
+
+		for (size_t i = 0; i<points.size(); ++i) {
+			Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+			if (stop)
+				break;
+
+			/* Block offsets are relative to the crop window. Pixels in the
+			   border of high-quality edge films are not dumped */
+			float *target = NULL;
+			if (offset.x >= 0 && offset.y >= 0 && offset.x < m_cropSize.x && offset.y < m_cropSize.y)
+				target = m_data + ((size_t) offset.y * (size_t) m_cropSize.x + (size_t) offset.x)
+					* m_sampleCount * EChannelCount;
+
+			sampler->generate(offset);
+
+			for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+				rRec.newQuery(queryType, sensor->getMedium());
+				Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+
+				if (needsApertureSample)
+					apertureSample = rRec.nextSample2D();
+				if (needsTimeSample)
+					timeSample = rRec.nextSample1D();
+
+				Spectrum spec = sensor->sampleRayDifferential(
+					sensorRay, samplePos, apertureSample, timeSample);
+
+				sensorRay.scaleDifferential(diffScaleFactor);
+
+				/* Find the first hit here so that its features can be recorded;
+				   the nested integrator will then skip the intersection query */
+				rRec.rayIntersect(sensorRay);
+
+				if (target) {
+					fetchFeatures(sensorRay, rRec.its, target);
+					target[EFilmPosition]     = (float) samplePos.x;
+					target[EFilmPosition + 1] = (float) samplePos.y;
+				}
+
+				spec *= m_subIntegrator->Li(sensorRay, rRec);
+				block->put(samplePos, spec, rRec.alpha);
+
+				if (target) {
+					Float r, g, b;
+					spec.toLinearRGB(r, g, b);
+					target[ERadiance]     = (float) r;
+					target[ERadiance + 1] = (float) g;
+					target[ERadiance + 2] = (float) b;
+					target[EAlpha]        = (float) rRec.alpha;
+					target[EPathDepth]    = (float) rRec.depth;
+					target += EChannelCount;
+				}
+
+				sampler->advance();
+			}
+		}
+	}
+
+	Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
+		return m_subIntegrator->Li(ray, rRec);
+	}
+
+	void postprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+		int sceneResID, int sensorResID, int samplerResID) {
+		SamplingIntegrator::postprocess(scene, queue, job, sceneResID,
+			sensorResID, samplerResID);
+		m_subIntegrator->postprocess(scene, queue, job, sceneResID,
+			sensorResID, samplerResID);
+	}
+
+	void bindUsedResources(ParallelProcess *proc) const {
+		SamplingIntegrator::bindUsedResources(proc);
+		m_subIntegrator->bindUsedResources(proc);
+	}
+
+	void wakeup(ConfigurableObject *parent, std::map<std::string, SerializableObject *> &params) {
+		SamplingIntegrator::wakeup(parent, params);
+		m_subIntegrator->wakeup(parent, params);
+	}
+
+	void configureSampler(const Scene *scene, Sampler *sampler) {
+		SamplingIntegrator::configureSampler(scene, sampler);
+		m_subIntegrator->configureSampler(scene, sampler);
+	}
+
+	void addChild(const std::string &name, ConfigurableObject *child) {
+		if (child->getClass()->derivesFrom(MTS_CLASS(SamplingIntegrator))) {
+			if (m_subIntegrator)
+				Log(EError, "The sample dump integrator accepts only one sub-integrator!");
+			m_subIntegrator = static_cast<SamplingIntegrator *>(child);
+		} else {
+			SamplingIntegrator::addChild(name, child);
+		}
+	}
+
+	const Integrator *getSubIntegrator(int idx) const {
+		if (idx != 0)
+			return NULL;
+		return m_subIntegrator.get();
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "SampleDumpIntegrator[" << endl
+			<< "  filename = \"" << m_filename.string() << "\"," << endl
+			<< "  subIntegrator = " << indent(m_subIntegrator->toString()) << endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Record the first-hit distance, shading normal and albedo of a sample
+	inline void fetchFeatures(const RayDifferential &ray,
+			Intersection &its, float *target) const {
+		if (!its.isValid()) {
+			for (int k = EDistance; k<EPathDepth; ++k)
+				target[k] = 0.0f;
+			return;
+		}
+
+		Normal n = its.shFrame.n;
+		if (dot(n, ray.d) > 0)
+			n = -n;
+
+		Float r, g, b;
+		its.getBSDF(ray)->getDiffuseReflectance(its).toLinearRGB(r, g, b);
+
+		target[EDistance] = (float) its.t;
+		target[EShadingNormal]     = (float) n.x;
+		target[EShadingNormal + 1] = (float) n.y;
+		target[EShadingNormal + 2] = (float) n.z;
+		target[EAlbedo]     = (float) r;
+		target[EAlbedo + 1] = (float) g;
+		target[EAlbedo + 2] = (float) b;
+	}
+
+	/// Create the header of the NumPy file (padded to a multiple of 16 bytes)
+	std::string getHeader() const {
+		std::ostringstream oss;
+		oss << "{'descr': '"
+			<< (Stream::getHostByteOrder() == Stream::ELittleEndian ? '<' : '>')
+			<< "f4', 'fortran_order': False, 'shape': ("
+			<< m_cropSize.y << ", " << m_cropSize.x << ", "
+			<< m_sampleCount << ", " << (int) EChannelCount << "), }";
+
+		std::string dict = oss.str();
+		dict.append(15 - (10 + dict.length()) % 16, ' ');
+		dict += '\n';
+
+		std::string header("\x93NUMPY\x01\x00", 8);
+		header += (char) (dict.length() & 0xFF);
+		header += (char) (dict.length() >> 8);
+		return header + dict;
+	}
+
+private:
+	ref<SamplingIntegrator> m_subIntegrator;
+	fs::path m_filename;
+	ref<MemoryMappedFile> m_mmap;
+	float *m_data;
+	Vector2i m_cropSize;
+	size_t m_sampleCount;
+};
+
+MTS_IMPLEMENT_CLASS_S(SampleDumpIntegrator, false, SamplingIntegrator)
+MTS_EXPORT_PLUGIN(SampleDumpIntegrator, "Per-sample dump integrator");
+MTS_NAMESPACE_END
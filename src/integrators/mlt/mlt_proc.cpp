@@ -22,6 +22,7 @@
 #include <mitsuba/bidir/mut_mchain.h>
 #include <mitsuba/bidir/mut_manifold.h>
 #include <mitsuba/bidir/util.h>
+#include <mitsuba/core/atomic.h>
 #include "mlt_proc.h"
 
 MTS_NAMESPACE_BEGIN
@@ -334,6 +335,7 @@ MLTProcess::MLTProcess(const RenderJob *parent, RenderQueue *queue,
 	m_resultMutex = new Mutex();
 	m_resultCounter = 0;
 	m_workCounter = 0;
+	m_mergeCounter = 0;
 	m_refreshTimeout = 1;
 }
 
@@ -343,6 +345,9 @@ ref<WorkProcessor> MLTProcess::createWorkProcessor() const {
 
 void MLTProcess::develop() {
 	LockGuard lock(m_resultMutex);
+
+	/* Don't normalize partially merged results */
+	ImageBlock::lockBands(m_bandMutexes);
 	size_t pixelCount = m_accum->getBitmap()->getPixelCount();
 	const Spectrum *accum = (Spectrum *) m_accum->getBitmap()->getData();
 	const Spectrum *direct = m_directImage != NULL ?
@@ -373,6 +378,7 @@ void MLTProcess::develop() {
 			value += direct[i];
 		target[i] = value;
 	}
+	ImageBlock::unlockBands(m_bandMutexes);
 
 	m_film->setBitmap(m_developBuffer);
 	m_refreshTimer->reset();
@@ -381,9 +387,15 @@ void MLTProcess::develop() {
 }
 
 void MLTProcess::processResult(const WorkResult *wr, bool cancelled) {
-	LockGuard lock(m_resultMutex);
 	const ImageBlock *result = static_cast<const ImageBlock *>(wr);
-	m_accum->put(result);
+
+	/* Merge the image one band of rows at a time, so that several
+	   results can be accumulated at once. Successive results start
+	   at different bands to avoid contention. */
+	m_accum->put(result, m_bandMutexes,
+		atomicAdd(&m_mergeCounter, 1) % (int) m_bandMutexes.size());
+
+	LockGuard lock(m_resultMutex);
 	m_progress->update(++m_resultCounter);
 	m_refreshTimeout = std::min(2000U, m_refreshTimeout * 2);
 
@@ -419,6 +431,7 @@ void MLTProcess::bindResource(const std::string &name, int id) {
 		m_progress = new ProgressReporter("Rendering", m_config.workUnits, m_job);
 		m_accum = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize());
 		m_accum->clear();
+		m_accum->createBandMutexes(m_bandMutexes);
 		m_developBuffer = new Bitmap(Bitmap::ESpectrum, Bitmap::EFloat, m_film->getCropSize());
 	}
 }
@@ -0,0 +1,566 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/statistics.h>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter avgPathLength("Wavefront path tracer", "Average path length", EAverage);
+
+/*! \plugin{wavepath}{Wavefront path tracer}
+ * \order{19}
+ * \parameters{
+ *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
+ *         in the generated output image (where \code{-1} corresponds to $\infty$).
+ *	       A value of \code{1} will only render directly visible light sources.
+ *	       \code{2} will lead to single-bounce (direct-only) illumination,
+ *	       and so on. \default{\code{-1}}
+ *	   }
+ *	   \parameter{rrDepth}{\Integer}{Specifies the minimum path depth, after
+ *	      which the implementation will start to use the ``russian roulette''
+ *	      path termination criterion. \default{\code{5}}
+ *	   }
+ *     \parameter{strictNormals}{\Boolean}{Be strict about potential
+ *        inconsistencies involving shading normals? See
+ *        page~\pageref{sec:strictnormals} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{hideEmitters}{\Boolean}{Hide directly visible emitters?
+ *        See page~\pageref{sec:hideemitters} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{waveSize}{\Integer}{Maximum number of paths that
+ *        are traced together \default{4096}
+ *     }
+ * }
+ *
+ * This integrator computes the same estimate as the \pluginref{path}
+ * plugin, but it processes the paths of an image block in \emph{waves}:
+ * instead of following one path until it terminates, it extends all
+ * paths of a wave by one bounce before moving on to the next one.
+ *
+ * Before each bounce, the rays are binned by the octant of their
+ * direction, and groups of four are intersected with the scene as coherent
+ * ray packets (when Mitsuba was compiled with \code{MTS_HAS_COHERENT_RT}).
+ * The intersections are then shaded in the order of their BSDFs, and
+ * the shadow rays of the direct illumination estimates are collected
+ * and traced in packets as well. This keeps the kd-tree nodes, BSDFs
+ * and textures that are needed at the same time in the cache, which
+ * is mainly beneficial for large scenes.
+ *
+ * The wave consists of the samples of as many neighboring pixels as
+ * fit into \code{waveSize} paths. Since the sample generators produce
+ * the samples of one pixel at a time, the sampler is only used for the
+ * sensor rays (pixel, aperture and time samples); the path vertices use
+ * an independent random number generator.
+ *
+ * \remarks{
+ *    \item This integrator does not handle participating media
+ *    \item When invoked one sample at a time by another integrator
+ *    (e.g. \pluginref{adaptive}), paths are traced individually
+ * }
+ */
+class WavefrontPathTracer : public MonteCarloIntegrator {
+public:
+	/// State of a path that is traced as part of a wave
+	struct WavePath {
+		/* Current ray and the associated intersection */
+		RayDifferential ray;
+		Intersection its;
+		/* Sensor importance of the path */
+		Spectrum weight;
+		Spectrum throughput;
+		Spectrum Li;
+		Point2 samplePos;
+		Float alpha;
+		Float eta;
+		/* Density of the BSDF sample that generated \c ray */
+		Float bsdfPdf;
+		/* Reference normal of the vertex that generated \c ray */
+		Normal refN;
+		int type;
+		int depth;
+		/* Was \c ray generated by a delta BSDF component? */
+		bool delta;
+		bool scattered;
+		/* Is \c ray the sensor ray? */
+		bool primary;
+	};
+
+	/// Shadow ray of a direct illumination estimate
+	struct ShadowRay {
+		Ray ray;
+		/* Contribution if the ray is unoccluded */
+		Spectrum value;
+		uint32_t index;
+	};
+
+	/// Draws the samples of the path vertices from a random number generator
+	struct RandomSampleSource {
+		Random *random;
+
+		inline RandomSampleSource(Random *random) : random(random) { }
+
+		inline Float next1D() { return random->nextFloat(); }
+
+		inline Point2 next2D() {
+			Float value = random->nextFloat();
+			return Point2(value, random->nextFloat());
+		}
+	};
+
+	WavefrontPathTracer(const Properties &props)
+		: MonteCarloIntegrator(props) {
+		m_waveSize = props.getSize("waveSize", 4096);
+		if (m_waveSize == 0)
+			Log(EError, "The 'waveSize' parameter must be positive!");
+	}
+
+	/// Unserialize from a binary data stream
+	WavefrontPathTracer(Stream *stream, InstanceManager *manager)
+		: MonteCarloIntegrator(stream, manager) {
+		m_waveSize = stream->readSize();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		MonteCarloIntegrator::serialize(stream, manager);
+		stream->writeSize(m_waveSize);
+	}
+
+	void renderBlock(const Scene *scene, const Sensor *sensor,
+		Sampler *sampler, ImageBlock *block, const bool &stop,
+		const std::vector< TPoint2<uint8_t> > &points) const {
+
+		Float diffScaleFactor = 1.0f /
+			std::sqrt((Float) sampler->getSampleCount());
+
+		bool needsApertureSample = sensor->needsApertureSample();
+		bool needsTimeSample = sensor->needsTimeSample();
+
+		Point2 apertureSample(0.5f);
+		Float timeSample = 0.5f;
+
+		block->clear();
+
+		int queryType = RadianceQueryRecord::ESensorRay;
+
+		if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+			queryType &= ~RadianceQueryRecord::EOpacity;
+
+		/* Seed the generator of the path vertex samples using the sampler,
+		   which differs between workers */
+		sampler->generate(block->getOffset());
+		uint64_t seed = ((uint64_t) (sampler->next1D() * 4294967296.0) << 32)
+			| (uint64_t) (sampler->next1D() * 4294967296.0);
+		ref<Random> random = new Random(seed);
+		RandomSampleSource source(random);
+
+		const size_t sampleCount = sampler->getSampleCount();
+		std::vector<WavePath> paths;
+		paths.reserve(std::max(m_waveSize, sampleCount));
+
+		size_t i = 0;
+		while (i < points.size() && !stop) {
+			/* Fill the wave with the samples of as many pixels as possible */
+			paths.clear();
+			do {
+				Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+				sampler->generate(offset);
+
+				for (size_t j = 0; j<sampleCount; j++) {
+					paths.push_back(WavePath());
+					WavePath &path = paths.back();
+
+					Point2 samplePos(Point2(offset) + Vector2(sampler->next2D()));
+
+					if (needsApertureSample)
+						apertureSample = sampler->next2D();
+					if (needsTimeSample)
+						timeSample = sampler->next1D();
+
+					path.weight = sensor->sampleRayDifferential(
+						path.ray, samplePos, apertureSample, timeSample);
+					path.ray.scaleDifferential(diffScaleFactor);
+					path.samplePos = samplePos;
+					initialize(path, queryType);
+
+					sampler->advance();
+				}
+			} while (++i < points.size() && paths.size() + sampleCount <= m_waveSize);
+
+			traceWave(scene, sampler, source, paths, stop);
+
+			for (size_t j = 0; j<paths.size(); ++j) {
+				const WavePath &path = paths[j];
+				block->put(path.samplePos, path.weight * path.Li, path.alpha);
+
+				/* Store statistics */
+				avgPathLength.incrementBase();
+				avgPathLength += path.depth;
+			}
+		}
+	}
+
+	Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
+		/* Follow a single path through the same stages (without packets) */
+		const Scene *scene = rRec.scene;
+		WavePath path;
+		path.ray = r;
+		rRec.rayIntersect(path.ray);
+		initialize(path, rRec.type);
+		path.its = rRec.its;
+		path.depth = rRec.depth;
+
+		std::vector<ShadowRay> shadowRays;
+		while (shade(scene, rRec.sampler, *rRec.sampler, path, 0, shadowRays))
+			scene->rayIntersect(path.ray, path.its);
+
+		for (size_t i=0; i<shadowRays.size(); ++i) {
+			if (!scene->rayIntersect(shadowRays[i].ray))
+				path.Li += shadowRays[i].value;
+		}
+
+		rRec.depth = path.depth;
+
+		/* Store statistics */
+		avgPathLength.incrementBase();
+		avgPathLength += path.depth;
+
+		return path.Li;
+	}
+
+	inline void initialize(WavePath &path, int type) const {
+		path.throughput = Spectrum(1.0f);
+		path.Li = Spectrum(0.0f);
+		path.alpha = 1.0f;
+		path.eta = 1.0f;
+		path.bsdfPdf = 0.0f;
+		path.refN = Normal(0.0f);
+		path.type = type;
+		path.depth = 1;
+		path.delta = false;
+		path.scattered = false;
+		path.primary = true;
+	}
+
+	/// Extend all paths of a wave until they have terminated
+	void traceWave(const Scene *scene, Sampler *sampler, RandomSampleSource &source,
+			std::vector<WavePath> &paths, const bool &stop) const {
+		std::vector<uint32_t> active(paths.size()), temp;
+		std::vector<std::pair<const BSDF *, uint32_t> > keys;
+		std::vector<ShadowRay> shadowRays;
+
+		for (size_t i=0; i<paths.size(); ++i)
+			active[i] = (uint32_t) i;
+
+		while (!active.empty() && !stop) {
+			/* Intersect the rays in groups with matching direction signs */
+			sortByOctant(paths, active, temp);
+			intersect(scene, paths, active);
+
+			/* Shade the intersections in the order of their BSDFs */
+			keys.resize(active.size());
+			for (size_t i=0; i<active.size(); ++i) {
+				const Intersection &its = paths[active[i]].its;
+				keys[i] = std::make_pair(its.isValid() ?
+					its.shape->getBSDF() : NULL, active[i]);
+			}
+			std::sort(keys.begin(), keys.end());
+
+			active.clear();
+			shadowRays.clear();
+			for (size_t i=0; i<keys.size(); ++i) {
+				uint32_t index = keys[i].second;
+				if (shade(scene, sampler, source, paths[index], index, shadowRays))
+					active.push_back(index);
+			}
+
+			traceShadowRays(scene, paths, shadowRays, temp);
+		}
+	}
+
+	/**
+	 * \brief Stably reorder a list of indices so that the rays with the
+	 * same direction octant become adjacent
+	 */
+	template <typename T> static void sortByOctant(const std::vector<T> &items,
+			std::vector<uint32_t> &indices, std::vector<uint32_t> &temp) {
+		size_t offsets[9] = { 0 };
+		for (size_t i=0; i<indices.size(); ++i)
+			++offsets[getOctant(items[indices[i]].ray.d) + 1];
+		for (int i=0; i<8; ++i)
+			offsets[i+1] += offsets[i];
+
+		temp.resize(indices.size());
+		for (size_t i=0; i<indices.size(); ++i)
+			temp[offsets[getOctant(items[indices[i]].ray.d)]++] = indices[i];
+		indices.swap(temp);
+	}
+
+	static inline int getOctant(const Vector &d) {
+		return (d.x < 0 ? 1 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 4 : 0);
+	}
+
+	/// Find the intersections of all active paths
+	void intersect(const Scene *scene, std::vector<WavePath> &paths,
+			const std::vector<uint32_t> &active) const {
+		size_t i = 0;
+#if defined(MTS_HAS_COHERENT_RT)
+		/* Packet queries are only supported by the kd-tree */
+		const ShapeKDTree *kdtree = scene->getKDTree();
+		Ray rays[4];
+		Intersection its[4];
+		for (; kdtree->isBuilt() && i+4 <= active.size(); i += 4) {
+			for (int j=0; j<4; ++j)
+				rays[j] = paths[active[i+j]].ray;
+			kdtree->rayIntersectPacket(rays, its);
+			for (int j=0; j<4; ++j)
+				paths[active[i+j]].its = its[j];
+		}
+#endif
+		for (; i<active.size(); ++i) {
+			WavePath &path = paths[active[i]];
+			scene->rayIntersect(path.ray, path.its);
+		}
+	}
+
+	/// Trace the shadow rays and add the contributions of the unoccluded ones
+	void traceShadowRays(const Scene *scene, std::vector<WavePath> &paths,
+			const std::vector<ShadowRay> &shadowRays, std::vector<uint32_t> &temp) const {
+		std::vector<uint32_t> order(shadowRays.size());
+		for (size_t i=0; i<order.size(); ++i)
+			order[i] = (uint32_t) i;
+		sortByOctant(shadowRays, order, temp);
+
+		size_t i = 0;
+#if defined(MTS_HAS_COHERENT_RT)
+		const ShapeKDTree *kdtree = scene->getKDTree();
+		Ray rays[4];
+		for (; kdtree->isBuilt() && i+4 <= order.size(); i += 4) {
+			for (int j=0; j<4; ++j)
+				rays[j] = shadowRays[order[i+j]].ray;
+			int occluded = kdtree->rayIntersectPacket(rays);
+			for (int j=0; j<4; ++j) {
+				const ShadowRay &shadowRay = shadowRays[order[i+j]];
+				if (!(occluded & (1 << j)))
+					paths[shadowRay.index].Li += shadowRay.value;
+			}
+		}
+#endif
+		for (; i<order.size(); ++i) {
+			const ShadowRay &shadowRay = shadowRays[order[i]];
+			if (!scene->rayIntersect(shadowRay.ray))
+				paths[shadowRay.index].Li += shadowRay.value;
+		}
+	}
+
+	/**
+	 * \brief Process the intersection of a path with the scene and
+	 * generate its next ray
+	 *
+	 * This corresponds to one iteration of the loop in the \c path
+	 * plugin, except that the visibility of the direct illumination
+	 * sample is tested later on (the shadow ray is appended to
+	 * \c shadowRays).
+	 *
+	 * \return \c false when the path has terminated
+	 */
+	template <typename SampleSource> bool shade(const Scene *scene,
+			Sampler *sampler, SampleSource &source, WavePath &path,
+			uint32_t index, std::vector<ShadowRay> &shadowRays) const {
+		Intersection &its = path.its;
+		const RayDifferential &ray = path.ray;
+
+		if (path.primary) {
+			path.primary = false;
+			if (path.type & RadianceQueryRecord::EOpacity)
+				path.alpha = its.isValid() ? 1.0f : 0.0f;
+		} else {
+			/* The ray was generated by BSDF sampling at the previous vertex */
+			DirectSamplingRecord dRec(ray.o, ray.time);
+			dRec.refN = path.refN;
+			bool hitEmitter = false;
+			Spectrum value;
+
+			if (its.isValid()) {
+				/* Intersected something - check if it was a luminaire */
+				if (its.isEmitter()) {
+					value = its.Le(-ray.d);
+					dRec.setQuery(ray, its);
+					hitEmitter = true;
+				}
+			} else {
+				/* Intersected nothing -- perhaps there is an environment map? */
+				const Emitter *env = scene->getEnvironmentEmitter();
+
+				if (!env || (m_hideEmitters && !path.scattered))
+					return false;
+
+				value = env->evalEnvironment(ray);
+				if (!env->fillDirectSamplingRecord(dRec, ray))
+					return false;
+				hitEmitter = true;
+			}
+
+			/* If a luminaire was hit, estimate the local illumination and
+			   weight using the power heuristic */
+			if (hitEmitter &&
+				(path.type & RadianceQueryRecord::EDirectSurfaceRadiance)) {
+				const Float lumPdf = !path.delta ? scene->pdfEmitterDirect(dRec) : 0;
+				path.Li += path.throughput * value * miWeight(path.bsdfPdf, lumPdf);
+			}
+
+			/* Stop if no surface was hit by the BSDF sample or if
+			   indirect illumination was not requested */
+			if (!its.isValid() || !(path.type & RadianceQueryRecord::EIndirectSurfaceRadiance))
+				return false;
+			path.type = RadianceQueryRecord::ERadianceNoEmission;
+
+			if (path.depth++ >= m_rrDepth) {
+				/* Russian roulette (see the \\c path plugin) */
+				Float q = std::min(path.throughput.max() * path.eta * path.eta, (Float) 0.95f);
+				if (source.next1D() >= q)
+					return false;
+				path.throughput /= q;
+			}
+		}
+
+		if (path.depth > m_maxDepth && m_maxDepth >= 0)
+			return false;
+
+		if (!its.isValid()) {
+			/* If no intersection could be found, potentially return
+			   radiance from a environment luminaire if it exists */
+			if ((path.type & RadianceQueryRecord::EEmittedRadiance)
+				&& (!m_hideEmitters || path.scattered))
+				path.Li += path.throughput * scene->evalEnvironment(ray);
+			return false;
+		}
+
+		const BSDF *bsdf = its.getBSDF(ray);
+
+		/* Possibly include emitted radiance if requested */
+		if (its.isEmitter() && (path.type & RadianceQueryRecord::EEmittedRadiance)
+			&& (!m_hideEmitters || path.scattered))
+			path.Li += path.throughput * its.Le(-ray.d);
+
+		/* Include radiance from a subsurface scattering model if requested */
+		if (its.hasSubsurface() && (path.type & RadianceQueryRecord::ESubsurfaceRadiance))
+			path.Li += path.throughput * its.LoSub(scene, sampler, -ray.d, path.depth);
+
+		if ((path.depth >= m_maxDepth && m_maxDepth > 0)
+			|| (m_strictNormals && dot(ray.d, its.geoFrame.n)
+				* Frame::cosTheta(its.wi) >= 0))
+			return false;
+
+		/* ==================================================================== */
+		/*                     Direct illumination sampling                     */
+		/* ==================================================================== */
+
+		DirectSamplingRecord dRec(its);
+
+		if (path.type & RadianceQueryRecord::EDirectSurfaceRadiance &&
+			(bsdf->getType() & BSDF::ESmooth)) {
+			Spectrum value = scene->sampleEmitterDirect(dRec, source.next2D(), false);
+			if (!value.isZero()) {
+				const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+
+				/* Allocate a record for querying the BSDF */
+				BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), ERadiance);
+
+				/* Evaluate BSDF * cos(theta) */
+				const Spectrum bsdfVal = bsdf->eval(bRec);
+
+				/* Prevent light leaks due to the use of shading normals */
+				if (!bsdfVal.isZero() && (!m_strictNormals
+						|| dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
+
+					/* Calculate prob. of having generated that direction
+					   using BSDF sampling */
+					Float bsdfPdf = (emitter->isOnSurface() && dRec.measure == ESolidAngle)
+						? bsdf->pdf(bRec) : 0;
+
+					/* Weight using the power heuristic; the visibility is tested later */
+					ShadowRay shadowRay;
+					shadowRay.ray = Ray(dRec.ref, dRec.d, Epsilon,
+						dRec.dist * (1 - ShadowEpsilon), dRec.time);
+					shadowRay.value = path.throughput * value * bsdfVal
+						* miWeight(dRec.pdf, bsdfPdf);
+					shadowRay.index = index;
+					shadowRays.push_back(shadowRay);
+				}
+			}
+		}
+
+		/* ==================================================================== */
+		/*                            BSDF sampling                             */
+		/* ==================================================================== */
+
+		/* Sample BSDF * cos(theta) */
+		Float bsdfPdf;
+		BSDFSamplingRecord bRec(its, sampler, ERadiance);
+		Spectrum bsdfWeight = bsdf->sample(bRec, bsdfPdf, source.next2D());
+		if (bsdfWeight.isZero())
+			return false;
+
+		path.scattered |= bRec.sampledType != BSDF::ENull;
+
+		/* Prevent light leaks due to the use of shading normals */
+		const Vector wo = its.toWorld(bRec.wo);
+		Float woDotGeoN = dot(its.geoFrame.n, wo);
+		if (m_strictNormals && woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
+			return false;
+
+		/* Keep track of the throughput and relative
+		   refractive index along the path */
+		path.throughput *= bsdfWeight;
+		path.eta *= bRec.eta;
+		path.bsdfPdf = bsdfPdf;
+		path.delta = (bRec.sampledType & BSDF::EDelta) != 0;
+		path.refN = dRec.refN;
+		path.ray = Ray(its.p, wo, ray.time);
+
+		return true;
+	}
+
+	inline Float miWeight(Float pdfA, Float pdfB) const {
+		pdfA *= pdfA;
+		pdfB *= pdfB;
+		return pdfA / (pdfA + pdfB);
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "WavefrontPathTracer[" << endl
+			<< "  maxDepth = " << m_maxDepth << "," << endl
+			<< "  rrDepth = " << m_rrDepth << "," << endl
+			<< "  strictNormals = " << m_strictNormals << "," << endl
+			<< "  waveSize = " << m_waveSize << endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+private:
+	size_t m_waveSize;
+};
+
+MTS_IMPLEMENT_CLASS_S(WavefrontPathTracer, false, MonteCarloIntegrator)
+MTS_EXPORT_PLUGIN(WavefrontPathTracer, "Wavefront path tracer");
+MTS_NAMESPACE_END
@@ -20,6 +20,7 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/render/gatherproc.h>
 #include <mitsuba/render/renderqueue.h>
+#include "sppm_proc.h"
 
 #if defined(MTS_OPENMP)
 # include <omp.h>
@@ -50,6 +51,9 @@ MTS_NAMESPACE_BEGIN
  *	   }
  *     \parameter{maxPasses}{\Integer}{Maximum number of passes to render (where \code{-1}
  *        corresponds to rendering until stopped manually). \default{\code{-1}}}
+ *     \parameter{hashGrid}{\Boolean}{Deposit photons directly into a hashed grid
+ *        of gather points instead of storing them in a photon map (see below).
+ *        \default{\code{false}}}
  * }
  * This plugin implements stochastic progressive photon mapping by Hachisuka et al.
  * \cite{Hachisuka2009Stochastic}. This algorithm is an extension of progressive photon
@@ -61,6 +65,14 @@ MTS_NAMESPACE_BEGIN
  * number of samples per pixel are not necessary. As with \pluginref{ppm}, once started,
  * the rendering process continues indefinitely until it is manually stopped.
  *
+ * By default, every pass stores its photons in a photon map, which is then queried
+ * at each gather point. When \code{hashGrid} is set to \code{true}, the gather points
+ * are instead inserted into a spatial hash grid whose cells are sized by the
+ * largest current radius, and photons are splatted into all gather points
+ * containing them as soon as they are traced. This avoids storing the photons
+ * and building a kd-tree in every pass, so that the memory usage only depends on the
+ * number of gather points and \code{photonCount} can be set much higher.
+ *
  * \remarks{
  *    \item Due to the data dependencies of this algorithm, the parallelization is
  *    limited to the local machine (i.e. cluster-wide renderings are not implemented)
@@ -71,20 +83,6 @@ MTS_NAMESPACE_BEGIN
  */
 class SPPMIntegrator : public Integrator {
 public:
-	/// Represents one individual PPM gather point including relevant statistics
-	struct GatherPoint {
-		Intersection its;
-		Float radius;
-		Spectrum weight;
-		Spectrum flux;
-		Spectrum emission;
-		Float N;
-		int depth;
-		Point2i pos;
-
-		inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f) { }
-	};
-
 	SPPMIntegrator(const Properties &props) : Integrator(props) {
 		/* Initial photon query radius (0 = infer based on scene size and sensor resolution) */
 		m_initialRadius = props.getFloat("initialRadius", 0);
@@ -105,6 +103,8 @@ public:
 		m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
 		/* Maximum number of passes to render. -1 renders until the process is stopped. */
 		m_maxPasses = props.getInteger("maxPasses", -1);
+		/* Deposit photons into a hashed grid of gather points instead of building a photon map */
+		m_hashGrid = props.getBoolean("hashGrid", false);
 		m_mutex = new Mutex();
 		if (m_maxDepth <= 1 && m_maxDepth != -1)
 			Log(EError, "Maximum depth must be set to \"2\" or higher!");
@@ -314,28 +314,52 @@ public:
 		Log(EInfo, "Performing a photon mapping pass %i (" SIZE_T_FMT " photons so far)",
 				it, m_totalPhotons);
 		ref<Scheduler> sched = Scheduler::getInstance();
-
-		/* Generate the global photon map */
-		ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
-			GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
-			m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1, m_rrDepth, true,
-			m_autoCancelGathering, job);
-
-		proc->bindResource("scene", sceneResID);
-		proc->bindResource("sensor", sensorResID);
-		proc->bindResource("sampler", samplerResID);
-
-		sched->schedule(proc);
-		sched->wait(proc);
-
-		ref<PhotonMap> photonMap = proc->getPhotonMap();
-		photonMap->build();
-		Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
-			SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+		ref<PhotonMap> photonMap;
+		size_t shotParticles;
+
+		if (m_hashGrid) {
+			/* Splat photons into the gather points while tracing them */
+			ref<GatherPointGrid> grid = new GatherPointGrid(m_gatherBlocks, m_maxDepth);
+			ref<PhotonSplatProcess> proc = new PhotonSplatProcess(grid,
+				m_photonCount, m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1,
+				m_rrDepth, m_autoCancelGathering, job);
+
+			proc->bindResource("scene", sceneResID);
+			proc->bindResource("sensor", sensorResID);
+			proc->bindResource("sampler", samplerResID);
+
+			sched->schedule(proc);
+			sched->wait(proc);
+
+			Log(EDebug, "Deposited " SIZE_T_FMT " photons into " SIZE_T_FMT
+				" gather points. Shot " SIZE_T_FMT " particles", proc->getPhotonCount(),
+				grid->getGatherPointCount(), proc->getShotParticles());
+			shotParticles = proc->getShotParticles();
+			m_totalPhotons += proc->getPhotonCount();
+		} else {
+			/* Generate the global photon map */
+			ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
+				GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
+				m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1, m_rrDepth, true,
+				m_autoCancelGathering, job);
+
+			proc->bindResource("scene", sceneResID);
+			proc->bindResource("sensor", sensorResID);
+			proc->bindResource("sampler", samplerResID);
+
+			sched->schedule(proc);
+			sched->wait(proc);
+
+			photonMap = proc->getPhotonMap();
+			photonMap->build();
+			Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
+				SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+			shotParticles = proc->getShotParticles();
+			m_totalPhotons += photonMap->size();
+		}
 
 		Log(EInfo, "Gathering ..");
-		m_totalEmitted += proc->getShotParticles();
-		m_totalPhotons += photonMap->size();
+		m_totalEmitted += shotParticles;
 		film->clear();
 		#if defined(MTS_OPENMP)
 			#pragma omp parallel for schedule(dynamic)
@@ -349,9 +373,14 @@ public:
 				Float M, N = gp.N;
 				Spectrum flux, contrib;
 
-				if (gp.depth != -1) {
+				if (gp.depth != -1 && photonMap) {
 					M = (Float) photonMap->estimateRadianceRaw(
 						gp.its, gp.radius, flux, m_maxDepth == -1 ? INT_MAX : m_maxDepth-gp.depth);
+				} else if (gp.depth != -1) {
+					M = (Float) gp.passPhotons;
+					flux = gp.passFlux;
+					gp.passPhotons = 0;
+					gp.passFlux = Spectrum(0.0f);
 				} else {
 					M = 0;
 					flux = Spectrum(0.0f);
@@ -368,7 +397,7 @@ public:
 
 					gp.flux = (gp.flux +
 							gp.weight * flux +
-							gp.emission * (Float) proc->getShotParticles() * M_PI * gp.radius*gp.radius) * ratio;
+							gp.emission * (Float) shotParticles * M_PI * gp.radius*gp.radius) * ratio;
 					gp.N = N + m_alpha * M;
 					contrib = gp.flux / ((Float) m_totalEmitted * gp.radius*gp.radius * M_PI);
 				}
@@ -389,7 +418,8 @@ public:
 			<< "  alpha = " << m_alpha << "," << endl
 			<< "  photonCount = " << m_photonCount << "," << endl
 			<< "  granularity = " << m_granularity << "," << endl
-			<< "  maxPasses = " << m_maxPasses << endl
+			<< "  maxPasses = " << m_maxPasses << "," << endl
+			<< "  hashGrid = " << m_hashGrid << endl
 			<< "]";
 		return oss.str();
 	}
@@ -407,6 +437,7 @@ private:
 	bool m_running;
 	bool m_autoCancelGathering;
 	int m_maxPasses;
+	bool m_hashGrid;
 };
 
 MTS_IMPLEMENT_CLASS_S(SPPMIntegrator, false, Integrator)
@@ -0,0 +1,264 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/atomic.h>
+#include "sppm_proc.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                        Gather point grid impl.                       */
+/* ==================================================================== */
+
+GatherPointGrid::GatherPointGrid(std::vector<std::vector<GatherPoint> > &gatherBlocks,
+		int maxDepth) : m_res(1, 1, 1), m_invCellSize(0), m_gatherPointCount(0),
+		m_maxDepth(maxDepth) {
+	/* Determine the bounds and the largest radius of all valid gather points */
+	std::vector<GatherPoint *> gatherPoints;
+	Float maxRadius = 0;
+	for (size_t i=0; i<gatherBlocks.size(); ++i) {
+		std::vector<GatherPoint> &block = gatherBlocks[i];
+		for (size_t j=0; j<block.size(); ++j) {
+			GatherPoint &gp = block[j];
+			if (gp.depth == -1)
+				continue;
+			gatherPoints.push_back(&gp);
+			m_aabb.expandBy(gp.its.p);
+			maxRadius = std::max(maxRadius, gp.radius);
+		}
+	}
+
+	m_gatherPointCount = gatherPoints.size();
+	m_bucketCount = (uint32_t) std::max(m_gatherPointCount, (size_t) 1);
+	m_bucketStart.resize(m_bucketCount + 1, 0);
+	if (gatherPoints.empty())
+		return;
+
+	/* Cells have twice the size of the largest radius */
+	m_aabb.min -= Vector(maxRadius);
+	m_aabb.max += Vector(maxRadius);
+	m_invCellSize = 1.0f / (2 * maxRadius);
+	Vector extents = m_aabb.getExtents();
+	for (int i=0; i<3; ++i)
+		m_res[i] = (int) std::max((Float) 1, std::min((Float) (1 << 20),
+			std::ceil(extents[i] * m_invCellSize)));
+
+	/* Register every gather point with the buckets of all cells that it
+	   overlaps, using two passes (count & fill) over the gather points */
+	for (int pass=0; pass<2; ++pass) {
+		std::vector<uint32_t> offsets;
+		if (pass == 1) {
+			for (uint32_t i=0; i<m_bucketCount; ++i)
+				m_bucketStart[i+1] += m_bucketStart[i];
+			m_entries.resize(m_bucketStart[m_bucketCount]);
+			offsets.assign(m_bucketStart.begin(), m_bucketStart.end() - 1);
+		}
+
+		for (size_t i=0; i<gatherPoints.size(); ++i) {
+			GatherPoint *gp = gatherPoints[i];
+			Vector r(gp->radius);
+			Point3i min = getCell(gp->its.p - r), max = getCell(gp->its.p + r);
+
+			/* Usually at most 2x2x2 cells, but rounding can stretch
+			   the range to three cells along each axis */
+			uint32_t buckets[27];
+			int bucketCount = 0;
+
+			for (int z=min.z; z<=max.z; ++z) {
+				for (int y=min.y; y<=max.y; ++y) {
+					for (int x=min.x; x<=max.x; ++x) {
+						/* Don't register a gather point twice with the
+						   same bucket when two of its cells collide */
+						uint32_t bucket = hash(x, y, z);
+						bool duplicate = false;
+						for (int k=0; k<bucketCount; ++k)
+							duplicate |= buckets[k] == bucket;
+						if (duplicate)
+							continue;
+						buckets[bucketCount++] = bucket;
+
+						if (pass == 0)
+							++m_bucketStart[bucket + 1];
+						else
+							m_entries[offsets[bucket]++] = gp;
+					}
+				}
+			}
+		}
+	}
+}
+
+void GatherPointGrid::deposit(const Intersection &its,
+		const Spectrum &weight, int depth) const {
+	if (m_entries.empty() || !m_aabb.contains(its.p))
+		return;
+
+	Point3i cell = getCell(its.p);
+	uint32_t bucket = hash(cell.x, cell.y, cell.z);
+
+	Normal photonNormal(its.geoFrame.n);
+	Vector wi = its.toWorld(its.wi);
+	Float wiDotGeoN = absDot(photonNormal, wi);
+
+	for (uint32_t i=m_bucketStart[bucket]; i<m_bucketStart[bucket+1]; ++i) {
+		GatherPoint &gp = *m_entries[i];
+		if ((gp.its.p - its.p).lengthSquared() >= gp.radius * gp.radius)
+			continue;
+
+		atomicAdd(&gp.passPhotons, 1);
+
+		/* The remainder matches PhotonMap::estimateRadianceRaw() */
+		if ((m_maxDepth != -1 && depth > m_maxDepth - gp.depth)
+			|| dot(photonNormal, gp.its.shFrame.n) < 1e-1f
+			|| wiDotGeoN < 1e-2f)
+			continue;
+
+		BSDFSamplingRecord bRec(gp.its, gp.its.toLocal(wi), gp.its.wi, EImportance);
+		Spectrum value = weight * gp.its.getBSDF()->eval(bRec);
+		if (value.isZero())
+			continue;
+
+		/* Account for non-symmetry due to shading normals */
+		value *= std::abs(Frame::cosTheta(bRec.wi) /
+			(wiDotGeoN * Frame::cosTheta(bRec.wo)));
+
+		for (int k=0; k<SPECTRUM_SAMPLES; ++k)
+			atomicAdd(&gp.passFlux[k], value[k]);
+	}
+}
+
+std::string GatherPointGrid::toString() const {
+	std::ostringstream oss;
+	oss << "GatherPointGrid[" << endl
+		<< "  gatherPoints = " << m_gatherPointCount << "," << endl
+		<< "  resolution = " << m_res.toString() << "," << endl
+		<< "  entries = " << m_entries.size() << endl
+		<< "]";
+	return oss.str();
+}
+
+/* ==================================================================== */
+/*                           Work result impl.                          */
+/* ==================================================================== */
+
+void PhotonSplatResult::load(Stream *stream) {
+	m_particleCount = stream->readSize();
+	m_photonCount = stream->readSize();
+}
+
+void PhotonSplatResult::save(Stream *stream) const {
+	stream->writeSize(m_particleCount);
+	stream->writeSize(m_photonCount);
+}
+
+std::string PhotonSplatResult::toString() const {
+	std::ostringstream oss;
+	oss << "PhotonSplatResult[particles=" << m_particleCount
+		<< ", photons=" << m_photonCount << "]";
+	return oss.str();
+}
+
+/* ==================================================================== */
+/*                         Work processor impl.                         */
+/* ==================================================================== */
+
+void PhotonSplatWorker::serialize(Stream *stream, InstanceManager *manager) const {
+	Log(EError, "Network rendering is not supported!");
+}
+
+ref<WorkProcessor> PhotonSplatWorker::clone() const {
+	return new PhotonSplatWorker(m_grid.get(), m_maxDepth, m_rrDepth);
+}
+
+ref<WorkResult> PhotonSplatWorker::createWorkResult() const {
+	return new PhotonSplatResult();
+}
+
+void PhotonSplatWorker::process(const WorkUnit *workUnit, WorkResult *workResult,
+	const bool &stop) {
+	m_workResult = static_cast<PhotonSplatResult *>(workResult);
+	m_workResult->clear();
+	ParticleTracer::process(workUnit, workResult, stop);
+	m_workResult = NULL;
+}
+
+void PhotonSplatWorker::handleNewParticle() {
+	m_workResult->nextParticle();
+}
+
+void PhotonSplatWorker::handleSurfaceInteraction(int depth, int nullInteractions,
+		bool delta, const Intersection &its, const Medium *medium,
+		const Spectrum &weight) {
+	int bsdfType = its.getBSDF()->getType();
+	if (!(bsdfType & BSDF::EDiffuseReflection) && !(bsdfType & BSDF::EGlossyReflection))
+		return;
+
+	m_grid->deposit(its, weight, depth - nullInteractions);
+	m_workResult->nextPhoton();
+}
+
+/* ==================================================================== */
+/*                         Parallel process impl.                       */
+/* ==================================================================== */
+
+PhotonSplatProcess::PhotonSplatProcess(const GatherPointGrid *grid,
+	size_t photonCount, size_t granularity, int maxDepth, int rrDepth,
+	bool autoCancel, const void *progressReporterPayload)
+	: ParticleProcess(ParticleProcess::EGather, photonCount, granularity,
+	  "Gathering photons", progressReporterPayload), m_grid(grid),
+	  m_photonCount(photonCount), m_maxDepth(maxDepth), m_rrDepth(rrDepth),
+	  m_autoCancel(autoCancel), m_numShot(0), m_numPhotons(0) { }
+
+bool PhotonSplatProcess::isLocal() const {
+	return true;
+}
+
+ref<WorkProcessor> PhotonSplatProcess::createWorkProcessor() const {
+	return new PhotonSplatWorker(m_grid.get(), m_maxDepth, m_rrDepth);
+}
+
+void PhotonSplatProcess::processResult(const WorkResult *wr, bool cancelled) {
+	if (cancelled)
+		return;
+	const PhotonSplatResult *result = static_cast<const PhotonSplatResult *>(wr);
+	LockGuard lock(m_resultMutex);
+
+	/* The photons have already been deposited, hence none of them can
+	   be discarded -- instead, all particles of the work unit are counted */
+	m_numShot += result->getParticleCount();
+	m_numPhotons += result->getPhotonCount();
+	increaseResultCount(result->getPhotonCount());
+}
+
+ParallelProcess::EStatus PhotonSplatProcess::generateWork(WorkUnit *unit, int worker) {
+	/* Use the same approach as PBRT for auto canceling */
+	LockGuard lock(m_resultMutex);
+	if (m_autoCancel && m_numShot > 100000 && m_numPhotons < m_photonCount
+			&& (m_numPhotons == 0 || m_numPhotons < m_numShot/1024)) {
+		Log(EInfo, "Not enough photons could be collected, giving up");
+		return EFailure;
+	}
+
+	return ParticleProcess::generateWork(unit, worker);
+}
+
+MTS_IMPLEMENT_CLASS(GatherPointGrid, false, Object)
+MTS_IMPLEMENT_CLASS(PhotonSplatResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(PhotonSplatWorker, false, ParticleTracer)
+MTS_IMPLEMENT_CLASS(PhotonSplatProcess, false, ParticleProcess)
+MTS_NAMESPACE_END
@@ -0,0 +1,218 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__SPPM_PROC_H)
+#define __SPPM_PROC_H
+
+#include <mitsuba/render/particleproc.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Represents one individual SPPM gather point including relevant statistics
+struct GatherPoint {
+	Intersection its;
+	Float radius;
+	Spectrum weight;
+	Spectrum flux;
+	Spectrum emission;
+	Float N;
+	int depth;
+	Point2i pos;
+
+	/// Flux deposited by \ref PhotonSplatProcess during the current pass
+	Spectrum passFlux;
+	/// Number of photons deposited by \ref PhotonSplatProcess during the current pass
+	int32_t passPhotons;
+
+	inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f),
+		passFlux(0.0f), passPhotons(0) { }
+};
+
+/* ==================================================================== */
+/*                          Gather point grid                           */
+/* ==================================================================== */
+
+/**
+ * \brief Hashed uniform grid over the gather points of an SPPM pass
+ *
+ * The grid cells have twice the size of the largest gather point radius,
+ * hence every gather point overlaps at most eight cells (up to 27 when
+ * its bounds lie on cell boundaries and are rounded across). Photons are
+ * deposited into all gather points registered with the cell that contains
+ * them, using atomic operations to accumulate their flux.
+ */
+class GatherPointGrid : public Object {
+public:
+	/**
+	 * \brief Build the grid over all valid gather points
+	 *
+	 * \param maxDepth
+	 *    Longest visualized path length (<tt>-1</tt>=infinite)
+	 */
+	GatherPointGrid(std::vector<std::vector<GatherPoint> > &gatherBlocks,
+		int maxDepth);
+
+	/// Deposit a photon into all gather points that contain it
+	void deposit(const Intersection &its, const Spectrum &weight, int depth) const;
+
+	/// Return the number of gather points that are part of the grid
+	inline size_t getGatherPointCount() const { return m_gatherPointCount; }
+
+	/// Return a human-readable string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~GatherPointGrid() { }
+
+	/// Compute the grid cell containing a position
+	inline Point3i getCell(const Point &p) const {
+		Vector rel = (p - m_aabb.min) * m_invCellSize;
+		return Point3i(
+			std::max(0, std::min((int) rel.x, m_res.x - 1)),
+			std::max(0, std::min((int) rel.y, m_res.y - 1)),
+			std::max(0, std::min((int) rel.z, m_res.z - 1)));
+	}
+
+	/// Map a grid cell to its hash table bucket
+	inline uint32_t hash(int x, int y, int z) const {
+		return (uint32_t) (((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u)
+			^ ((uint32_t) z * 83492791u)) % m_bucketCount;
+	}
+private:
+	AABB m_aabb;
+	Vector3i m_res;
+	Float m_invCellSize;
+	uint32_t m_bucketCount;
+	/// Offsets of the buckets into \c m_entries (with one extra entry at the end)
+	std::vector<uint32_t> m_bucketStart;
+	std::vector<GatherPoint *> m_entries;
+	size_t m_gatherPointCount;
+	int m_maxDepth;
+};
+
+/* ==================================================================== */
+/*                             Work result                              */
+/* ==================================================================== */
+
+/**
+ * \brief Records how many particles were traced by a work unit of
+ * \ref PhotonSplatProcess, and how many photons they deposited
+ */
+class PhotonSplatResult : public WorkResult {
+public:
+	inline PhotonSplatResult() : m_particleCount(0), m_photonCount(0) { }
+
+	inline void clear() { m_particleCount = m_photonCount = 0; }
+	inline void nextParticle() { ++m_particleCount; }
+	inline void nextPhoton() { ++m_photonCount; }
+	inline size_t getParticleCount() const { return m_particleCount; }
+	inline size_t getPhotonCount() const { return m_photonCount; }
+
+	void load(Stream *stream);
+	void save(Stream *stream) const;
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~PhotonSplatResult() { }
+private:
+	size_t m_particleCount;
+	size_t m_photonCount;
+};
+
+/* ==================================================================== */
+/*                             Work processor                           */
+/* ==================================================================== */
+
+/**
+ * \brief Particle tracing worker, which deposits surface photons
+ * directly into a \ref GatherPointGrid instead of storing them
+ */
+class PhotonSplatWorker : public ParticleTracer {
+public:
+	inline PhotonSplatWorker(const GatherPointGrid *grid, int maxDepth,
+		int rrDepth) : ParticleTracer(maxDepth, rrDepth, false), m_grid(grid) { }
+
+	void serialize(Stream *stream, InstanceManager *manager) const;
+	ref<WorkProcessor> clone() const;
+	ref<WorkResult> createWorkResult() const;
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop);
+
+	void handleNewParticle();
+	void handleSurfaceInteraction(int depth, int nullInteractions, bool delta,
+		const Intersection &its, const Medium *medium,
+		const Spectrum &weight);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~PhotonSplatWorker() { }
+private:
+	ref<const GatherPointGrid> m_grid;
+	ref<PhotonSplatResult> m_workResult;
+};
+
+/* ==================================================================== */
+/*                           Parallel process                           */
+/* ==================================================================== */
+
+/**
+ * \brief Traces particles until a certain number of photons has been
+ * deposited into a \ref GatherPointGrid
+ *
+ * Since the gather points are accessed directly, this process can
+ * only run on the local machine.
+ */
+class PhotonSplatProcess : public ParticleProcess {
+public:
+	PhotonSplatProcess(const GatherPointGrid *grid, size_t photonCount,
+		size_t granularity, int maxDepth, int rrDepth, bool autoCancel,
+		const void *progressReporterPayload);
+
+	/// Return the number of particles that were traced
+	inline size_t getShotParticles() const { return m_numShot; }
+
+	/// Return the number of photons that were deposited
+	inline size_t getPhotonCount() const { return m_numPhotons; }
+
+	/* ParallelProcess impl. */
+	bool isLocal() const;
+	ref<WorkProcessor> createWorkProcessor() const;
+	void processResult(const WorkResult *wr, bool cancelled);
+	EStatus generateWork(WorkUnit *unit, int worker);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~PhotonSplatProcess() { }
+private:
+	ref<const GatherPointGrid> m_grid;
+	size_t m_photonCount;
+	int m_maxDepth;
+	int m_rrDepth;
+	bool m_autoCancel;
+	size_t m_numShot, m_numPhotons;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __SPPM_PROC_H */
@@ -72,6 +72,15 @@ MTS_NAMESPACE_BEGIN
  *	     with a completely new one. Usually, there is little need to change
  *	     this. \default{0.3}
  *	   }
+ *	   \parameter{replicas}{\Integer}{
+ *	     Number of Markov chains that each work unit runs at different
+ *	     temperatures, exchanging their states from time to time (see below).
+ *	     \default{1, i.e. replica exchange is disabled}
+ *	   }
+ *	   \parameter{maxTemperature}{\Float}{
+ *	     Temperature of the hottest chain when replica exchange is
+ *	     used. \default{8}
+ *	   }
  * }
  * Primary Sample Space Metropolis Light Transport (PSSMLT) is a rendering
  * technique developed by Kelemen et al. \cite{Kelemen2002Simple} which is
@@ -145,6 +154,18 @@ MTS_NAMESPACE_BEGIN
  * it is preferable to disable this separation so that PSSMLT is responsible
  * for everything. This can be accomplished by setting
  * \code{directSamples=-1}.
+ *
+ * \paragraph{Replica exchange:}
+ * A single Markov chain can remain stuck in a small region of
+ * path space for a long time. When \code{replicas} is larger than one,
+ * every work unit runs that many chains in lockstep, which target the
+ * path contributions raised to the powers $1/T_i$, where the temperatures
+ * $T_i$ are spaced geometrically between 1 and \code{maxTemperature}.
+ * Hotter chains see a flattened version of the integrand and therefore
+ * move around more freely. After every round of mutations, two chains
+ * of neighboring temperatures attempt to swap their states
+ * \cite{Kitaoka2009Replica}. Only the chain at temperature 1 contributes
+ * to the image, and the number of mutations per work unit stays the same.
  */
 
 class PSSMLT : public Integrator {
@@ -244,6 +265,15 @@ public:
 
 		/* Stop MLT after X seconds -- useful for equal-time comparisons */
 		m_config.timeout = props.getInteger("timeout", 0);
+
+		/* Number of chains at different temperatures that are run
+		   by every work unit and which exchange their states */
+		m_config.replicas = props.getInteger("replicas", 1);
+
+		/* Temperature of the hottest of these chains */
+		m_config.maxTemperature = props.getFloat("maxTemperature", 8.0f);
+		if (m_config.replicas < 1 || m_config.maxTemperature < 1)
+			Log(EError, "'replicas' and 'maxTemperature' must be at least 1!");
 	}
 
 	/// Unserialize from a binary data stream
@@ -54,6 +54,8 @@ struct PSSMLTConfiguration {
 	bool firstStage;
 	int firstStageSizeReduction;
 	size_t timeout;
+	int replicas;
+	Float maxTemperature;
 	ref<Bitmap> importanceMap;
 
 	inline PSSMLTConfiguration() { }
@@ -85,6 +87,9 @@ struct PSSMLTConfiguration {
 		SLog(EDebug, "   Mutations per work unit     : " SIZE_T_FMT, nMutations);
 		if (timeout)
 			SLog(EDebug, "   Timeout                     : " SIZE_T_FMT,  timeout);
+		if (replicas > 1)
+			SLog(EDebug, "   Replica exchange            : %i chains, max. temperature %f",
+				replicas, maxTemperature);
 	}
 
 	inline PSSMLTConfiguration(Stream *stream) {
@@ -112,6 +117,8 @@ struct PSSMLTConfiguration {
 				(size_t) size.x * (size_t) size.y);
 		}
 		timeout = stream->readSize();
+		replicas = stream->readInt();
+		maxTemperature = stream->readFloat();
 	}
 
 	inline void serialize(Stream *stream) const {
@@ -140,6 +147,8 @@ struct PSSMLTConfiguration {
 			Vector2i(0, 0).serialize(stream);
 		}
 		stream->writeSize(timeout);
+		stream->writeInt(replicas);
+		stream->writeFloat(maxTemperature);
 	}
 };
 
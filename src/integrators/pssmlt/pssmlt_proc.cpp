@@ -17,6 +17,7 @@
 */
 
 #include <mitsuba/bidir/util.h>
+#include <mitsuba/core/atomic.h>
 #include <mitsuba/bidir/path.h>
 #include "pssmlt_proc.h"
 #include "pssmlt_sampler.h"
@@ -35,6 +36,8 @@ StatsCounter acceptanceRate("Primary sample space MLT",
 	"Overall acceptance rate", EPercentage);
 StatsCounter forcedAcceptance("Primary sample space MLT",
 	"Number of forced acceptances");
+StatsCounter replicaExchanges("Primary sample space MLT",
+	"Accepted replica exchanges", EPercentage);
 
 class PSSMLTRenderer : public WorkProcessor {
 public:
@@ -76,123 +79,245 @@ public:
 
 		m_rplSampler = static_cast<ReplayableSampler*>(
 			static_cast<Sampler *>(getResource("rplSampler"))->clone().get());
-		m_sensorSampler = new PSSMLTSampler(m_origSampler);
-		m_emitterSampler = new PSSMLTSampler(m_origSampler);
-		m_directSampler = new PSSMLTSampler(m_origSampler);
 
-		m_pathSampler = new PathSampler(m_config.technique, m_scene,
-			m_emitterSampler, m_sensorSampler, m_directSampler, m_config.maxDepth,
-			m_config.rrDepth, m_config.separateDirect, m_config.directSampling);
+		/* Every chain needs its own set of primary sample space samplers.
+		   The inverse temperatures are spaced geometrically */
+		m_replicas.resize(m_config.replicas);
+		m_invTemperatures.resize(m_config.replicas);
+		for (int i=0; i<m_config.replicas; ++i) {
+			Replica &replica = m_replicas[i];
+			replica.sensorSampler = new PSSMLTSampler(m_origSampler);
+			replica.emitterSampler = new PSSMLTSampler(m_origSampler);
+			replica.directSampler = new PSSMLTSampler(m_origSampler);
+			replica.pathSampler = new PathSampler(m_config.technique, m_scene,
+				replica.emitterSampler, replica.sensorSampler, replica.directSampler,
+				m_config.maxDepth, m_config.rrDepth, m_config.separateDirect,
+				m_config.directSampling);
+
+			m_invTemperatures[i] = m_config.replicas == 1 ? (Float) 1 :
+				std::pow(m_config.maxTemperature, -i / (Float) (m_config.replicas - 1));
+		}
 	}
 
 	void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
 		ImageBlock *result = static_cast<ImageBlock *>(workResult);
 		const SeedWorkUnit *wu = static_cast<const SeedWorkUnit *>(workUnit);
 		const PathSeed &seed = wu->getSeed();
-		SplatList *current = new SplatList(), *proposed = new SplatList();
-
-		m_emitterSampler->reset();
-		m_sensorSampler->reset();
-		m_directSampler->reset();
-		m_sensorSampler->setRandom(m_rplSampler->getRandom());
-		m_emitterSampler->setRandom(m_rplSampler->getRandom());
-		m_directSampler->setRandom(m_rplSampler->getRandom());
-
-		/* Generate the initial sample by replaying the seeding random
-		   number stream at the appropriate position. Afterwards, revert
-		   back to this worker's own source of random numbers */
-		m_rplSampler->setSampleIndex(seed.sampleIndex);
-
-		m_pathSampler->sampleSplats(Point2i(-1), *current);
+		ref<Random> random = m_origSampler->getRandom();
 		result->clear();
 
-		ref<Random> random = m_origSampler->getRandom();
-		m_sensorSampler->setRandom(random);
-		m_emitterSampler->setRandom(random);
-		m_directSampler->setRandom(random);
-		m_rplSampler->updateSampleIndex(m_rplSampler->getSampleIndex()
-			+ m_sensorSampler->getSampleIndex()
-			+ m_emitterSampler->getSampleIndex()
-			+ m_directSampler->getSampleIndex());
-
-		m_sensorSampler->accept();
-		m_emitterSampler->accept();
-		m_directSampler->accept();
-
-		/* Sanity check -- the luminance should match the one from
-		   the warmup phase - an error here would indicate inconsistencies
-		   regarding the use of random numbers during sample generation */
-		if (std::abs((current->luminance - seed.luminance)
-				/ seed.luminance) > Epsilon)
-			Log(EError, "Error when reconstructing a seed path: luminance "
-				"= %f, but expected luminance = %f", current->luminance, seed.luminance);
+		for (size_t i=0; i<m_replicas.size(); ++i) {
+			Replica &replica = m_replicas[i];
+			replica.current = new SplatList();
+			replica.proposed = new SplatList();
+			replica.cumulativeWeight = 0;
+			replica.level = (int) i;
+
+			replica.emitterSampler->reset();
+			replica.sensorSampler->reset();
+			replica.directSampler->reset();
+			replica.setRandom(m_rplSampler->getRandom());
+
+			/* Generate the initial sample by replaying the seeding random
+			   number stream at the appropriate position. Afterwards, revert
+			   back to this worker's own source of random numbers. All
+			   chains start from the same path. */
+			m_rplSampler->setSampleIndex(seed.sampleIndex);
+
+			replica.pathSampler->sampleSplats(Point2i(-1), *replica.current);
+
+			replica.setRandom(random);
+			m_rplSampler->updateSampleIndex(m_rplSampler->getSampleIndex()
+				+ replica.sensorSampler->getSampleIndex()
+				+ replica.emitterSampler->getSampleIndex()
+				+ replica.directSampler->getSampleIndex());
+			replica.accept();
+
+			/* Sanity check -- the luminance should match the one from
+			   the warmup phase - an error here would indicate inconsistencies
+			   regarding the use of random numbers during sample generation */
+			if (std::abs((replica.current->luminance - seed.luminance)
+					/ seed.luminance) > Epsilon)
+				Log(EError, "Error when reconstructing a seed path: luminance "
+					"= %f, but expected luminance = %f", replica.current->luminance,
+					seed.luminance);
+
+			replica.current->normalize(m_config.importanceMap);
+		}
 
 		ref<Timer> timer = new Timer();
 
-		/* MLT main loop */
-		Float cumulativeWeight = 0;
-		current->normalize(m_config.importanceMap);
-		for (uint64_t mutationCtr=0; mutationCtr<m_config.nMutations && !stop; ++mutationCtr) {
-			if (wu->getTimeout() > 0 && (mutationCtr % 8192) == 0
+		/* MLT main loop. Every round performs one mutation per chain,
+		   hence the total number of mutations stays the same */
+		const size_t replicaCount = m_replicas.size();
+		Replica *cold = &m_replicas[0];
+		for (uint64_t mutationCtr=0; mutationCtr<m_config.nMutations && !stop;
+				mutationCtr += replicaCount) {
+			if (wu->getTimeout() > 0 && (mutationCtr % 8192) < replicaCount
 					&& (int) timer->getMilliseconds() > wu->getTimeout())
 				break;
 
-			bool largeStep = random->nextFloat() < m_config.pLarge;
-			m_sensorSampler->setLargeStep(largeStep);
-			m_emitterSampler->setLargeStep(largeStep);
-			m_directSampler->setLargeStep(largeStep);
+			for (size_t i=0; i<replicaCount; ++i)
+				mutate(m_replicas[i], random, m_replicas[i].level == 0 ? result : NULL);
+
+			if (replicaCount == 1)
+				continue;
+
+			/* Try to exchange the states of two chains with neighboring
+			   temperatures. This is implemented by exchanging their
+			   temperature levels instead of copying the sampler states */
+			int level = std::min((int) (random->nextFloat() * (replicaCount - 1)),
+				(int) replicaCount - 2);
+			Replica *first = NULL, *second = NULL;
+			for (size_t i=0; i<replicaCount; ++i) {
+				if (m_replicas[i].level == level)
+					first = &m_replicas[i];
+				else if (m_replicas[i].level == level + 1)
+					second = &m_replicas[i];
+			}
 
-			m_pathSampler->sampleSplats(Point2i(-1), *proposed);
-			proposed->normalize(m_config.importanceMap);
+			Float a = std::pow(second->current->luminance / first->current->luminance,
+				m_invTemperatures[level] - m_invTemperatures[level+1]);
+			replicaExchanges.incrementBase(1);
+			if (a < 1 && random->nextFloat() >= a)
+				continue;
+			++replicaExchanges;
+
+			if (level == 0) {
+				/* The chain at temperature 1 changes -- record the
+				   contribution of its current state */
+				splat(result, first->current, first->cumulativeWeight);
+				second->cumulativeWeight = 0;
+				cold = second;
+			}
+			std::swap(first->level, second->level);
+		}
 
-			Float a = std::min((Float) 1.0f, proposed->luminance / current->luminance);
+		/* Perform the last splat */
+		splat(result, cold->current, cold->cumulativeWeight);
 
-			if (std::isnan(proposed->luminance) || proposed->luminance < 0) {
-				Log(EWarn, "Encountered a sample with luminance = %f, ignoring!",
-						proposed->luminance);
-				a = 0;
-			}
+		for (size_t i=0; i<replicaCount; ++i) {
+			delete m_replicas[i].current;
+			delete m_replicas[i].proposed;
+		}
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new PSSMLTRenderer(m_config);
+	}
 
-			bool accept;
-			Float currentWeight, proposedWeight;
+	MTS_DECLARE_CLASS()
+protected:
+	/// State of one of the Markov chains run by a work unit
+	struct Replica {
+		ref<PathSampler> pathSampler;
+		ref<PSSMLTSampler> sensorSampler;
+		ref<PSSMLTSampler> emitterSampler;
+		ref<PSSMLTSampler> directSampler;
+		SplatList *current, *proposed;
+		Float cumulativeWeight;
+		/// Index of the chain's temperature (0 refers to the target distribution)
+		int level;
+
+		inline void setRandom(Random *random) {
+			sensorSampler->setRandom(random);
+			emitterSampler->setRandom(random);
+			directSampler->setRandom(random);
+		}
 
-			if (a > 0) {
-				if (m_config.kelemenStyleWeights && !m_config.importanceMap) {
-					/* Kelemen-style MLT weights (these don't work for 2-stage MLT) */
-					currentWeight = (1 - a) * current->luminance
-						/ (current->luminance/m_config.luminance + m_config.pLarge);
-					proposedWeight = (a + (largeStep ? 1 : 0)) * proposed->luminance
-						/ (proposed->luminance/m_config.luminance + m_config.pLarge);
-				} else {
-					/* Veach-style use of expectations */
-					currentWeight = 1-a;
-					proposedWeight = a;
-				}
-				accept = (a == 1) || (random->nextFloat() < a);
+		inline void setLargeStep(bool largeStep) {
+			sensorSampler->setLargeStep(largeStep);
+			emitterSampler->setLargeStep(largeStep);
+			directSampler->setLargeStep(largeStep);
+		}
+
+		inline void accept() {
+			sensorSampler->accept();
+			emitterSampler->accept();
+			directSampler->accept();
+		}
+
+		inline void reject() {
+			sensorSampler->reject();
+			emitterSampler->reject();
+			directSampler->reject();
+		}
+	};
+
+	/// Splat a weighted list of contributions into the work result
+	inline void splat(ImageBlock *result, const SplatList *list, Float weight) {
+		for (size_t k=0; k<list->size(); ++k) {
+			Spectrum value = list->getValue(k) * weight;
+			if (!value.isZero())
+				result->put(list->getPosition(k), &value[0]);
+		}
+	}
+
+	/**
+	 * \brief Perform one Metropolis-Hastings step of a chain
+	 *
+	 * \param result
+	 *    Target for the contributions of the chain, or \c NULL
+	 *    when it does not run at temperature 1
+	 */
+	void mutate(Replica &replica, Random *random, ImageBlock *result) {
+		SplatList *&current = replica.current, *&proposed = replica.proposed;
+		Float invTemperature = m_invTemperatures[replica.level];
+
+		bool largeStep = random->nextFloat() < m_config.pLarge;
+		replica.setLargeStep(largeStep);
+
+		replica.pathSampler->sampleSplats(Point2i(-1), *proposed);
+		proposed->normalize(m_config.importanceMap);
+
+		Float a = std::min((Float) 1.0f, proposed->luminance / current->luminance);
+		if (invTemperature != 1 && a < 1)
+			a = std::pow(a, invTemperature);
+
+		if (std::isnan(proposed->luminance) || proposed->luminance < 0) {
+			Log(EWarn, "Encountered a sample with luminance = %f, ignoring!",
+					proposed->luminance);
+			a = 0;
+		}
+
+		bool accept;
+		Float currentWeight, proposedWeight;
+
+		if (a > 0) {
+			if (m_config.kelemenStyleWeights && !m_config.importanceMap) {
+				/* Kelemen-style MLT weights (these don't work for 2-stage MLT) */
+				currentWeight = (1 - a) * current->luminance
+					/ (current->luminance/m_config.luminance + m_config.pLarge);
+				proposedWeight = (a + (largeStep ? 1 : 0)) * proposed->luminance
+					/ (proposed->luminance/m_config.luminance + m_config.pLarge);
 			} else {
-				if (m_config.kelemenStyleWeights)
-					currentWeight = current->luminance
-						/ (current->luminance/m_config.luminance + m_config.pLarge);
-				else
-					currentWeight = 1;
-				proposedWeight = 0;
-				accept = false;
+				/* Veach-style use of expectations */
+				currentWeight = 1-a;
+				proposedWeight = a;
 			}
+			accept = (a == 1) || (random->nextFloat() < a);
+		} else {
+			if (m_config.kelemenStyleWeights)
+				currentWeight = current->luminance
+					/ (current->luminance/m_config.luminance + m_config.pLarge);
+			else
+				currentWeight = 1;
+			proposedWeight = 0;
+			accept = false;
+		}
 
-			cumulativeWeight += currentWeight;
-			if (accept) {
-				for (size_t k=0; k<current->size(); ++k) {
-					Spectrum value = current->getValue(k) * cumulativeWeight;
-					if (!value.isZero())
-						result->put(current->getPosition(k), &value[0]);
-				}
+		/* Only the chain at temperature 1 records statistics and contributions */
+		bool record = result != NULL;
+		replica.cumulativeWeight += currentWeight;
+		if (accept) {
+			if (record)
+				splat(result, current, replica.cumulativeWeight);
 
-				cumulativeWeight = proposedWeight;
-				std::swap(proposed, current);
+			replica.cumulativeWeight = proposedWeight;
+			std::swap(proposed, current);
+			replica.accept();
 
-				m_sensorSampler->accept();
-				m_emitterSampler->accept();
-				m_directSampler->accept();
+			if (record) {
 				if (largeStep) {
 					largeStepRatio.incrementBase(1);
 					++largeStepRatio;
@@ -202,52 +327,28 @@ public:
 				}
 				acceptanceRate.incrementBase(1);
 				++acceptanceRate;
-			} else {
-				for (size_t k=0; k<proposed->size(); ++k) {
-					Spectrum value = proposed->getValue(k) * proposedWeight;
-					if (!value.isZero())
-						result->put(proposed->getPosition(k), &value[0]);
-				}
-
-				m_sensorSampler->reject();
-				m_emitterSampler->reject();
-				m_directSampler->reject();
+			}
+		} else {
+			if (record) {
+				splat(result, proposed, proposedWeight);
 				acceptanceRate.incrementBase(1);
 				if (largeStep)
 					largeStepRatio.incrementBase(1);
 				else
 					smallStepRatio.incrementBase(1);
 			}
+			replica.reject();
 		}
-
-		/* Perform the last splat */
-		for (size_t k=0; k<current->size(); ++k) {
-			Spectrum value = current->getValue(k) * cumulativeWeight;
-			if (!value.isZero())
-				result->put(current->getPosition(k), &value[0]);
-		}
-
-
-		delete current;
-		delete proposed;
-	}
-
-	ref<WorkProcessor> clone() const {
-		return new PSSMLTRenderer(m_config);
 	}
-
-	MTS_DECLARE_CLASS()
 private:
 	PSSMLTConfiguration m_config;
 	ref<Scene> m_scene;
 	ref<Sensor> m_sensor;
 	ref<Film> m_film;
-	ref<PathSampler> m_pathSampler;
 	ref<PSSMLTSampler> m_origSampler;
-	ref<PSSMLTSampler> m_sensorSampler;
-	ref<PSSMLTSampler> m_emitterSampler;
-	ref<PSSMLTSampler> m_directSampler;
 	ref<ReplayableSampler> m_rplSampler;
+	std::vector<Replica> m_replicas;
+	std::vector<Float> m_invTemperatures;
 };
 
 /* ==================================================================== */
@@ -264,6 +365,7 @@ PSSMLTProcess::PSSMLTProcess(const RenderJob *parent, RenderQueue *queue,
 	m_resultMutex = new Mutex();
 	m_resultCounter = 0;
 	m_workCounter = 0;
+	m_mergeCounter = 0;
 	m_refreshTimeout = 1;
 }
 
@@ -273,6 +375,9 @@ ref<WorkProcessor> PSSMLTProcess::createWorkProcessor() const {
 
 void PSSMLTProcess::develop() {
 	LockGuard lock(m_resultMutex);
+
+	/* Don't normalize partially merged results */
+	ImageBlock::lockBands(m_bandMutexes);
 	size_t pixelCount = m_accum->getBitmap()->getPixelCount();
 	const Spectrum *accum = (Spectrum *) m_accum->getBitmap()->getData();
 	const Spectrum *direct = m_directImage != NULL ?
@@ -303,6 +408,7 @@ void PSSMLTProcess::develop() {
 			value += direct[i];
 		target[i] = value;
 	}
+	ImageBlock::unlockBands(m_bandMutexes);
 	m_film->setBitmap(m_developBuffer);
 	m_refreshTimer->reset();
 
@@ -310,9 +416,15 @@ void PSSMLTProcess::develop() {
 }
 
 void PSSMLTProcess::processResult(const WorkResult *wr, bool cancelled) {
-	LockGuard lock(m_resultMutex);
 	const ImageBlock *result = static_cast<const ImageBlock *>(wr);
-	m_accum->put(result);
+
+	/* Merge the image one band of rows at a time, so that several
+	   results can be accumulated at once. Successive results start
+	   at different bands to avoid contention. */
+	m_accum->put(result, m_bandMutexes,
+		atomicAdd(&m_mergeCounter, 1) % (int) m_bandMutexes.size());
+
+	LockGuard lock(m_resultMutex);
 	m_progress->update(++m_resultCounter);
 	m_refreshTimeout = std::min(2000U, m_refreshTimeout * 2);
 
@@ -347,6 +459,7 @@ void PSSMLTProcess::bindResource(const std::string &name, int id) {
 		m_progress = new ProgressReporter("Rendering", m_config.workUnits, m_job);
 		m_accum = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize());
 		m_accum->clear();
+		m_accum->createBandMutexes(m_bandMutexes);
 		m_developBuffer = new Bitmap(Bitmap::ESpectrum, Bitmap::EFloat, m_film->getCropSize());
 	}
 }
@@ -60,7 +60,9 @@ private:
 	const std::vector<PathSeed> &m_seeds;
 	ref<Mutex> m_resultMutex;
 	ref<Film> m_film;
+	std::vector<ref<Mutex> > m_bandMutexes;
 	int m_resultCounter, m_workCounter;
+	int32_t m_mergeCounter;
 	unsigned int m_refreshTimeout;
 	ref<Timer> m_timeoutTimer, m_refreshTimer;
 };
@@ -200,7 +200,11 @@ void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteracti
 void CaptureParticleProcess::develop() {
 	Float weight = (m_accum->getWidth() * m_accum->getHeight())
 		/ (Float) m_receivedResultCount;
+
+	/* Don't develop partially merged results */
+	ImageBlock::lockBands(m_bandMutexes);
 	m_film->setBitmap(m_accum->getBitmap(), weight);
+	ImageBlock::unlockBands(m_bandMutexes);
 	m_queue->signalRefresh(m_job);
 }
 
@@ -211,9 +215,15 @@ void CaptureParticleProcess::processResult(const WorkResult *wr, bool cancelled)
 	if (cancelled)
 		return;
 
+	/* Merge the image one band of rows at a time, so that several
+	   results can be accumulated at once. Each result starts at a
+	   different band to avoid contention. */
+	const int firstBand = (int) ((range->getRangeStart()
+		/ std::max(range->getSize(), (size_t) 1)) % m_bandMutexes.size());
+	m_accum->put(result, m_bandMutexes, firstBand);
+
 	LockGuard lock(m_resultMutex);
 	increaseResultCount(range->getSize());
-	m_accum->put(result);
 	if (m_job->isInteractive() || m_receivedResultCount == m_workCount)
 		develop();
 }
@@ -224,6 +234,7 @@ void CaptureParticleProcess::bindResource(const std::string &name, int id) {
 		m_film = sensor->getFilm();
 		m_accum = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(), NULL);
 		m_accum->clear();
+		m_accum->createBandMutexes(m_bandMutexes);
 	}
 	ParticleProcess::bindResource(name, id);
 }
@@ -132,6 +132,7 @@ private:
 /* ==================================================================== */
 /*                           Parallel process                           */
 /* ==================================================================== */
+
 /**
  * Parallel particle tracing process - used to run this over
  * a group of machines
@@ -163,6 +164,7 @@ private:
 	ref<RenderQueue> m_queue;
 	ref<Film> m_film;
 	ref<ImageBlock> m_accum;
+	std::vector<ref<Mutex> > m_bandMutexes;
 	int m_maxDepth;
 	int m_maxPathDepth;
 	int m_rrDepth;
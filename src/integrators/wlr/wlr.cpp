@@ -0,0 +1,161 @@
+#include <mitsuba/core/matrix.h>
+#include "wlr.h"
+
+MTS_NAMESPACE_BEGIN
+
+/// Dimension of the local linear model (intercept + feature gradients)
+#define WLR_MODEL_DIM (WLR_FEATURE_DIM + 1)
+
+/// Normalized statistics of a single pixel of the feature block
+struct WLRPixel {
+	Float color[SPECTRUM_SAMPLES];
+	Float alpha;
+	Float mean[WLR_FEATURE_DIM];
+	Float var[WLR_FEATURE_DIM];
+	bool valid;
+};
+
+WeightedLocalRegression::WeightedLocalRegression(int radius, Float featureScale,
+		Float featureFloor, size_t sampleCount) : m_radius(std::max(radius, 0)),
+		m_featureScale(featureScale), m_featureFloor(featureFloor) {
+	m_invSampleCount = 1.0f / (Float) std::max(sampleCount, (size_t) 1);
+	Float spatialSigma = std::max((Float) m_radius * 0.5f, (Float) 1.0f);
+	m_invSpatialSigma2 = 1.0f / (spatialSigma * spatialSigma);
+}
+
+void WeightedLocalRegression::reconstruct(const ImageBlock *features,
+		const Point2i &offset, const Vector2i &size, ImageBlock *target) const {
+	const Bitmap *bitmap = features->getBitmap();
+	const Vector2i &imageSize = bitmap->getSize();
+	const int channels = bitmap->getChannelCount();
+	const Float *data = bitmap->getFloatData();
+
+	if (channels != EWLRChannelCount)
+		SLog(EError, "WeightedLocalRegression: feature block has an invalid channel count!");
+
+	/* Normalize all pixels of the tile and its surrounding apron once */
+	const Point2i apronMin(
+		std::max(offset.x - m_radius, 0),
+		std::max(offset.y - m_radius, 0));
+	const Point2i apronMax(
+		std::min(offset.x + size.x + m_radius, imageSize.x),
+		std::min(offset.y + size.y + m_radius, imageSize.y));
+	const Vector2i apronSize = apronMax - apronMin;
+
+	std::vector<WLRPixel> pixels((size_t) apronSize.x * (size_t) apronSize.y);
+	for (int y=0; y<apronSize.y; ++y) {
+		const Float *src = data + ((size_t) (y + apronMin.y) * imageSize.x
+			+ apronMin.x) * channels;
+		for (int x=0; x<apronSize.x; ++x, src += channels) {
+			WLRPixel &pixel = pixels[y * apronSize.x + x];
+			Float weight = src[EWLRWeight];
+			pixel.valid = weight > 0;
+			if (!pixel.valid)
+				continue;
+
+			Float invWeight = 1.0f / weight;
+			for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+				pixel.color[i] = src[i] * invWeight;
+			pixel.alpha = src[EWLRAlpha] * invWeight;
+			for (int k=0; k<WLR_FEATURE_DIM; ++k) {
+				Float mean = src[EWLRFeatures + k] * invWeight;
+				Float meanSqr = src[EWLRFeaturesSqr + k] * invWeight;
+				pixel.mean[k] = mean;
+				/* Variance of the pixel mean rather than of a single sample */
+				pixel.var[k] = std::max(meanSqr - mean * mean, (Float) 0)
+					* m_invSampleCount;
+			}
+		}
+	}
+
+	const Float featureScale2 = m_featureScale * m_featureScale;
+	const Float featureFloor2 = m_featureFloor * m_featureFloor;
+
+	/* Small ridge term that keeps the normal equations well-conditioned
+	   in regions where a feature is constant */
+	const Float ridge = 1e-3f;
+
+	Bitmap *targetBitmap = target->getBitmap();
+	const int targetChannels = targetBitmap->getChannelCount();
+	target->clear();
+
+	for (int y=0; y<size.y; ++y) {
+		for (int x=0; x<size.x; ++x) {
+			const int cx = x + offset.x - apronMin.x,
+			          cy = y + offset.y - apronMin.y;
+			const WLRPixel &center = pixels[cy * apronSize.x + cx];
+			if (!center.valid)
+				continue;
+
+			Matrix<WLR_MODEL_DIM, WLR_MODEL_DIM, Float> A(0.0f), L;
+			Matrix<WLR_MODEL_DIM, SPECTRUM_SAMPLES, Float> B(0.0f), X;
+			Float weightSum = 0, alphaSum = 0;
+			Float design[WLR_MODEL_DIM];
+			design[0] = 1.0f;
+
+			const int minY = std::max(cy - m_radius, 0),
+			          maxY = std::min(cy + m_radius, apronSize.y - 1),
+			          minX = std::max(cx - m_radius, 0),
+			          maxX = std::min(cx + m_radius, apronSize.x - 1);
+
+			for (int ny=minY; ny<=maxY; ++ny) {
+				for (int nx=minX; nx<=maxX; ++nx) {
+					const WLRPixel &neighbor = pixels[ny * apronSize.x + nx];
+					if (!neighbor.valid)
+						continue;
+
+					const Float dx = (Float) (nx - cx), dy = (Float) (ny - cy);
+					Float exponent = -0.5f * (dx*dx + dy*dy) * m_invSpatialSigma2;
+
+					for (int k=0; k<WLR_FEATURE_DIM; ++k) {
+						Float diff = neighbor.mean[k] - center.mean[k];
+						Float bandwidth2 = featureScale2
+							* (center.var[k] + neighbor.var[k]) + featureFloor2;
+						exponent -= 0.5f * diff * diff / bandwidth2;
+						design[k+1] = diff;
+					}
+
+					const Float weight = std::exp(exponent);
+					if (weight < 1e-6f)
+						continue;
+
+					for (int i=0; i<WLR_MODEL_DIM; ++i) {
+						const Float wi = weight * design[i];
+						for (int j=0; j<=i; ++j)
+							A.m[i][j] += wi * design[j];
+						for (int l=0; l<SPECTRUM_SAMPLES; ++l)
+							B.m[i][l] += wi * neighbor.color[l];
+					}
+
+					weightSum += weight;
+					alphaSum += weight * neighbor.alpha;
+				}
+			}
+
+			for (int i=0; i<WLR_MODEL_DIM; ++i)
+				for (int j=0; j<i; ++j)
+					A.m[j][i] = A.m[i][j];
+			for (int i=1; i<WLR_MODEL_DIM; ++i)
+				A.m[i][i] += ridge * weightSum;
+
+			Float *dest = targetBitmap->getFloatData()
+				+ ((size_t) y * targetBitmap->getWidth() + x) * targetChannels;
+
+			if (A.chol(L)) {
+				/* The intercept of the local model is the estimate at the center */
+				L.cholSolve(B, X);
+				for (int l=0; l<SPECTRUM_SAMPLES; ++l)
+					dest[l] = std::max(X.m[0][l], (Float) 0);
+			} else {
+				/* Degenerate system -- fall back to the weighted mean */
+				for (int l=0; l<SPECTRUM_SAMPLES; ++l)
+					dest[l] = B.m[0][l] / weightSum;
+			}
+
+			dest[SPECTRUM_SAMPLES] = alphaSum / weightSum;
+			dest[SPECTRUM_SAMPLES + 1] = 1.0f;
+		}
+	}
+}
+
+MTS_NAMESPACE_END
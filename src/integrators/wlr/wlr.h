@@ -0,0 +1,84 @@
+#pragma once
+#if !defined(__WLR_H)
+#define __WLR_H
+
+#include <mitsuba/render/imageblock.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of first-hit feature dimensions: depth (1), normal (3), albedo (3)
+#define WLR_FEATURE_DIM 7
+
+/**
+ * \brief Channel layout of the feature blocks produced by the
+ * weighted local regression integrator.
+ *
+ * Every sample contributes its radiance, alpha, the first-hit features
+ * and their squares (to estimate the per-pixel feature variance). The
+ * last channel stores the accumulated reconstruction filter weight.
+ */
+enum EWLRChannel {
+	EWLRAlpha       = SPECTRUM_SAMPLES,
+	EWLRFeatures    = SPECTRUM_SAMPLES + 1,
+	EWLRFeaturesSqr = EWLRFeatures + WLR_FEATURE_DIM,
+	EWLRWeight      = EWLRFeaturesSqr + WLR_FEATURE_DIM,
+	EWLRChannelCount
+};
+
+/**
+ * \brief Weighted local regression filter
+ *
+ * Reconstructs each pixel by fitting a first-order model of the radiance
+ * as a function of the auxiliary features (depth, normal, albedo) over a
+ * square window. Neighbors are weighted by their spatial distance and by
+ * their feature distance relative to the estimated feature variance,
+ * which preserves geometric and texture edges while removing noise.
+ *
+ * The filter only reads from the accumulated feature block and is thus
+ * safe to apply to independent tiles in parallel.
+ */
+class WeightedLocalRegression {
+public:
+	/**
+	 * \param radius
+	 *    Half-width of the regression window in pixels
+	 * \param featureScale
+	 *    Multiplier applied to the feature standard deviation when
+	 *    computing the feature bandwidth
+	 * \param featureFloor
+	 *    Lower bound on the feature bandwidth (features are normalized
+	 *    to roughly unit range)
+	 * \param sampleCount
+	 *    Number of samples per pixel, used to turn the per-sample
+	 *    feature variance into the variance of the pixel mean
+	 */
+	WeightedLocalRegression(int radius, Float featureScale,
+		Float featureFloor, size_t sampleCount);
+
+	/**
+	 * \brief Reconstruct a rectangular region of the image
+	 *
+	 * \param features
+	 *    Full-frame block with the \ref EWLRChannel layout
+	 * \param offset
+	 *    Offset of the region within \c features
+	 * \param size
+	 *    Size of the region
+	 * \param target
+	 *    Block in \ref Bitmap::ESpectrumAlphaWeight format (without
+	 *    border) that receives the reconstructed pixels
+	 */
+	void reconstruct(const ImageBlock *features, const Point2i &offset,
+		const Vector2i &size, ImageBlock *target) const;
+
+private:
+	int m_radius;
+	Float m_featureScale;
+	Float m_featureFloor;
+	Float m_invSampleCount;
+	Float m_invSpatialSigma2;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __WLR_H */
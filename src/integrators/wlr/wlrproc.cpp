@@ -1,89 +1,159 @@
-///m_film_depth
-
 #include <mitsuba/core/statistics.h>
-#include <mitsuba/core/sfcurve.h>
-#include "wlrproc.h"
 #include <mitsuba/render/rectwu.h>
+#include "wlrproc.h"
 
 MTS_NAMESPACE_BEGIN
-/// WorkUnit = RectangularWorkUnit
 
-/// WorkResult = ImageBlock
+/* ==================================================================== */
+/*                        Feature accumulation                          */
+/* ==================================================================== */
+
+BlockedWLRProcess::BlockedWLRProcess(const RenderJob *parent, RenderQueue *queue,
+		int blockSize) : BlockedRenderProcess(parent, queue, blockSize) {
+	/* Feature values (e.g. normals) may be negative -- don't warn */
+	setPixelFormat(Bitmap::EMultiChannel, EWLRChannelCount, false);
+}
+
+void BlockedWLRProcess::processResult(const WorkResult *result, bool cancelled) {
+	const ImageBlock *block = static_cast<const ImageBlock *>(result);
+	lockTiles(block);
+	m_features->put(block);
+	unlockTiles(block);
+
+	UniqueLock lock(m_resultMutex);
+	m_progress->update(++m_resultCount);
+	lock.unlock();
+	m_queue->signalWorkEnd(m_parent, block, cancelled);
+}
+
+void BlockedWLRProcess::bindResource(const std::string &name, int id) {
+	BlockedRenderProcess::bindResource(name, id);
+	if (name == "sensor") {
+		m_features = new ImageBlock(Bitmap::EMultiChannel,
+			m_film->getCropSize(), NULL, EWLRChannelCount, false);
+		m_features->clear();
+	}
+}
+
+/* ==================================================================== */
+/*                      Regression reconstruction                       */
+/* ==================================================================== */
 
-/// WorkProcessor
-/// we need a class, which does the actual work of turning 
-/// a work unit into a work result
-class BlockWLRRenderer : public WorkProcessor {
+class WLRReconstructor : public WorkProcessor {
 public:
-	BlockWLRRenderer(Bitmap::EPixelFormat pixelFormat, int channelCount, int blockSize,
-		int borderSize, bool warnInvalid) : m_pixelFormat(pixelFormat),
-		m_channelCount(channelCount), m_blockSize(blockSize),
-		m_borderSize(borderSize), m_warnInvalid(warnInvalid) { }
+	WLRReconstructor(const ImageBlock *features, int blockSize, int radius,
+		Float featureScale, Float featureFloor, size_t sampleCount)
+		: m_features(features), m_filter(NULL), m_blockSize(blockSize), m_radius(radius),
+		  m_featureScale(featureScale), m_featureFloor(featureFloor),
+		  m_sampleCount(sampleCount) { }
+
+	WLRReconstructor(Stream *stream, InstanceManager *manager) : m_filter(NULL) {
+		m_blockSize = stream->readInt();
+		m_radius = stream->readInt();
+		m_featureScale = stream->readFloat();
+		m_featureFloor = stream->readFloat();
+		m_sampleCount = stream->readSize();
+		Vector2i size(stream);
+		ref<ImageBlock> features = new ImageBlock(Bitmap::EMultiChannel,
+			size, NULL, EWLRChannelCount, false);
+		features->load(stream);
+		m_features = features;
+	}
 
-	void process(/*....*/) {
-		///  μ renderBlock Ѵ.
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		stream->writeInt(m_blockSize);
+		stream->writeInt(m_radius);
+		stream->writeFloat(m_featureScale);
+		stream->writeFloat(m_featureFloor);
+		stream->writeSize(m_sampleCount);
+		m_features->getSize().serialize(stream);
+		m_features->save(stream);
 	}
 
-private:
-	ref<Scene> m_scene;
-	ref<Sensor> m_sensor;
-	ref<Sampler> m_sampler;
-	ref<SamplingIntegrator> m_integrator;
-	Bitmap::EPixelFormat m_pixelFormat;
-	int m_channelCount;
-	int m_featureChannelCount; // Edited
-	int m_blockSize;
-	int m_borderSize;
-	bool m_warnInvalid;
-	HilbertCurve2D<uint8_t> m_hilbertCurve;
-};
+	ref<WorkUnit> createWorkUnit() const {
+		return new RectangularWorkUnit();
+	}
 
+	ref<WorkResult> createWorkResult() const {
+		return new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+			Vector2i(m_blockSize), NULL);
+	}
 
+	void prepare() {
+		m_filter = new WeightedLocalRegression(m_radius,
+			m_featureScale, m_featureFloor, m_sampleCount);
+	}
 
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const RectangularWorkUnit *rect = static_cast<const RectangularWorkUnit *>(workUnit);
+		ImageBlock *block = static_cast<ImageBlock *>(workResult);
 
+		block->setOffset(rect->getOffset());
+		block->setSize(rect->getSize());
+		m_filter->reconstruct(m_features.get(), rect->getOffset(),
+			rect->getSize(), block);
+	}
 
+	ref<WorkProcessor> clone() const {
+		return new WLRReconstructor(m_features.get(), m_blockSize, m_radius,
+			m_featureScale, m_featureFloor, m_sampleCount);
+	}
 
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~WLRReconstructor() {
+		if (m_filter)
+			delete m_filter;
+	}
+private:
+	ref<const ImageBlock> m_features;
+	WeightedLocalRegression *m_filter;
+	int m_blockSize;
+	int m_radius;
+	Float m_featureScale;
+	Float m_featureFloor;
+	size_t m_sampleCount;
+};
 
-/// ParallelProcess = BlockedWLRProcess wlrproc.h
-BlockedWLRProcess::BlockedWLRProcess(const RenderJob *parent, RenderQueue *queue,
-	int blockSize) : m_queue(queue), m_parent(parent), m_resultCount(0), m_progress(NULL) {
-	m_blockSize = blockSize;
+WLRReconstructionProcess::WLRReconstructionProcess(const RenderJob *parent,
+		RenderQueue *queue, Film *film, const ImageBlock *features, int blockSize,
+		int radius, Float featureScale, Float featureFloor, size_t sampleCount)
+		: m_queue(queue), m_film(film), m_features(features), m_parent(parent),
+		  m_resultCount(0), m_radius(radius), m_featureScale(featureScale),
+		  m_featureFloor(featureFloor), m_sampleCount(sampleCount) {
 	m_resultMutex = new Mutex();
-	m_pixelFormat = Bitmap::ESpectrumAlphaWeightDepth;
-	m_channelCount = -1;
-	m_warnInvalid = true;
+	BlockedImageProcess::init(Point2i(0), film->getCropSize(), blockSize);
+	m_progress = new ProgressReporter("Reconstructing", m_numBlocksTotal, m_parent);
 }
 
-BlockedWLRProcess::~BlockedWLRProcess() {
+WLRReconstructionProcess::~WLRReconstructionProcess() {
 	if (m_progress)
 		delete m_progress;
 }
 
-void BlockedWLRProcess::setPixelFormat(Bitmap::EPixelFormat pixelFormat, int channelCount, bool warnInvalid) {
-	m_pixelFormat = pixelFormat;
-	m_channelCount = channelCount;
-	m_warnInvalid = warnInvalid;
+ref<WorkProcessor> WLRReconstructionProcess::createWorkProcessor() const {
+	return new WLRReconstructor(m_features.get(), m_blockSize, m_radius,
+		m_featureScale, m_featureFloor, m_sampleCount);
 }
 
-ref<WorkProcessor> BlockedWLRProcess::createWorkProcessor() const {
-	return new BlockWLRRenderer(m_pixelFormat, m_channelCount,
-		m_blockSize, m_borderSize, m_warnInvalid);
-}
-
-//  process   ü   
-void BlockedWLRProcess::processResult(const WorkResult *result, bool cancelled) {
+void WLRReconstructionProcess::processResult(const WorkResult *result, bool cancelled) {
 	const ImageBlock *block = static_cast<const ImageBlock *>(result);
 	UniqueLock lock(m_resultMutex);
-	/// ü film block  Ѵ (block index blockȿ Ǿִ .)
-	
 	m_film->put(block);
-
 	m_progress->update(++m_resultCount);
 	lock.unlock();
 	m_queue->signalWorkEnd(m_parent, block, cancelled);
 }
 
+ParallelProcess::EStatus WLRReconstructionProcess::generateWork(WorkUnit *unit, int worker) {
+	EStatus status = BlockedImageProcess::generateWork(unit, worker);
+	if (status == ESuccess)
+		m_queue->signalWorkBegin(m_parent, static_cast<RectangularWorkUnit *>(unit), worker);
+	return status;
+}
 
-//MTS_IMPLEMENT_CLASS(BlockedWLRProcess, false, BlockedImageProcess)
-//MTS_IMPLEMENT_CLASS_S(BlockWLRRenderer, false, WorkProcessor)
-MTS_NAMESPACE_END
\ No newline at end of file
+MTS_IMPLEMENT_CLASS(BlockedWLRProcess, false, BlockedRenderProcess)
+MTS_IMPLEMENT_CLASS(WLRReconstructionProcess, false, BlockedImageProcess)
+MTS_IMPLEMENT_CLASS_S(WLRReconstructor, false, WorkProcessor)
+MTS_NAMESPACE_END
@@ -1,28 +1,66 @@
 #pragma once
-#if !defined(__MITSUBA_RENDER_WLRPROC_H_)
-#define __MITSUBA_RENDER_WLRPROC_H_
+#if !defined(__WLR_PROC_H)
+#define __WLR_PROC_H
 
-#include <mitsuba/render/scene.h>
-#include <mitsuba/render/imageproc.h>
-#include <mitsuba/render/renderqueue.h>
+#include <mitsuba/render/renderproc.h>
+#include "wlr.h"
 
 MTS_NAMESPACE_BEGIN
 
-class MTS_EXPORT_RENDER BlockedWLRProcess : public BlockedImageProcess {
+/**
+ * \brief Render process of the weighted local regression integrator
+ *
+ * Works just like \ref BlockedRenderProcess, except that the finished
+ * blocks (which store radiance together with the first-hit feature
+ * buffers, see \ref EWLRChannel) are accumulated into a full-frame
+ * feature block instead of the film. The film is only written by the
+ * subsequent \ref WLRReconstructionProcess.
+ */
+class BlockedWLRProcess : public BlockedRenderProcess {
 public:
 	BlockedWLRProcess(const RenderJob *parent, RenderQueue *queue,
 		int blockSize);
 
-	void setPixelFormat(Bitmap::EPixelFormat pixelFormat,
-		int channelCount = -1, bool warnInvalid = false);
+	/// Return the accumulated feature block (valid after the process has finished)
+	inline const ImageBlock *getFeatures() const { return m_features.get(); }
 
 	// ======================================================================
 	//! @{ \name Implementation of the ParallelProcess interface
 	// ======================================================================
 
-	ref<WorkProcessor> createWorkProcessor() const;
 	void processResult(const WorkResult *result, bool cancelled);
 	void bindResource(const std::string &name, int id);
+
+	//! @}
+	// ======================================================================
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~BlockedWLRProcess() { }
+protected:
+	ref<ImageBlock> m_features;
+};
+
+/**
+ * \brief Parallel reconstruction pass of the weighted local regression
+ * integrator
+ *
+ * Splits the film into tiles, applies \ref WeightedLocalRegression to
+ * each of them and writes the result into the film.
+ */
+class WLRReconstructionProcess : public BlockedImageProcess {
+public:
+	WLRReconstructionProcess(const RenderJob *parent, RenderQueue *queue,
+		Film *film, const ImageBlock *features, int blockSize, int radius,
+		Float featureScale, Float featureFloor, size_t sampleCount);
+
+	// ======================================================================
+	//! @{ \name Implementation of the ParallelProcess interface
+	// ======================================================================
+
+	ref<WorkProcessor> createWorkProcessor() const;
+	void processResult(const WorkResult *result, bool cancelled);
 	EStatus generateWork(WorkUnit *unit, int worker);
 
 	//! @}
@@ -31,22 +69,21 @@ public:
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
-	virtual ~BlockedWLRProcess();
+	virtual ~WLRReconstructionProcess();
 protected:
 	ref<RenderQueue> m_queue;
-	ref<Scene> m_scene;
 	ref<Film> m_film;
-	ref<Film> m_film_depth;
+	ref<const ImageBlock> m_features;
 	const RenderJob *m_parent;
 	int m_resultCount;
 	ref<Mutex> m_resultMutex;
 	ProgressReporter *m_progress;
-	int m_borderSize;
-	Bitmap::EPixelFormat m_pixelFormat;
-	int m_channelCount;
-	bool m_warnInvalid;
+	int m_radius;
+	Float m_featureScale;
+	Float m_featureFloor;
+	size_t m_sampleCount;
 };
 
 MTS_NAMESPACE_END
 
-#endif /* __MITSUBA_RENDER_WLRPROC_H_ */
\ No newline at end of file
+#endif /* __WLR_PROC_H */
@@ -1,87 +1,150 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
-#include <boost/math/distributions/normal.hpp>
+#include "wlrproc.h"
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage);
 
-class LocalRegressionIntegrator : public SamplingIntegrator {
+/*! \plugin{wlr}{Weighted local regression path tracer}
+ * \order{17}
+ * \parameters{
+ *     \parameter{maxDepth, rrDepth, strictNormals, hideEmitters}{}{
+ *         Path tracing parameters, see the \pluginref{path} plugin
+ *     }
+ *     \parameter{radius}{\Integer}{Half-width of the square regression
+ *         window in pixels \default{5}
+ *     }
+ *     \parameter{featureScale}{\Float}{Multiplier applied to the estimated
+ *         feature standard deviation when weighting neighboring pixels.
+ *         Larger values blur more across noisy features (e.g. due to depth
+ *         of field or motion blur) \default{2}
+ *     }
+ *     \parameter{featureFloor}{\Float}{Minimal feature bandwidth. Smaller
+ *         values preserve more detail across edges of the feature
+ *         buffers \default{0.1}
+ *     }
+ * }
+ *
+ * This integrator traces the same paths as the \pluginref{path} plugin,
+ * but additionally records first-hit depth, shading normal and diffuse
+ * albedo of every sample (along with their variance) next to the radiance.
+ * Once all blocks are rendered, a second parallel pass reconstructs each
+ * pixel by fitting a local linear model of the radiance as a function of
+ * these features, weighted by spatial and feature distance. This removes
+ * most of the Monte Carlo noise while preserving geometric and texture
+ * edges, which makes low sample counts (e.g. 8--16 spp) usable for previews.
+ *
+ * \remarks{
+ *    \item This integrator does not handle participating media
+ *    \item The reconstruction assumes that all pixels receive the same
+ *    number of samples
+ * }
+ */
+class LocalRegressionIntegrator : public MonteCarloIntegrator {
 public:
-	LocalRegressionIntegrator(const Properties &props) : SamplingIntegrator(props) {
+	LocalRegressionIntegrator(const Properties &props) : MonteCarloIntegrator(props) {
+		m_radius = props.getInteger("radius", 5);
+		m_featureScale = props.getFloat("featureScale", 2.0f);
+		m_featureFloor = props.getFloat("featureFloor", 0.1f);
+
+		if (m_radius < 0)
+			Log(EError, "The 'radius' parameter must be nonnegative!");
+		if (m_featureFloor <= 0)
+			Log(EError, "The 'featureFloor' parameter must be positive!");
 	}
 
-	/// Unserialize
+	/// Unserialize from a binary data stream
 	LocalRegressionIntegrator(Stream *stream, InstanceManager *manager)
-		: SamplingIntegrator(stream, manager) {
-		m_film_depth = static_cast<Film *>(manager->getInstance(stream));
-
-		m_rrDepth = stream->readInt();
-		m_maxDepth = stream->readInt();
-		m_strictNormals = stream->readBool();
-		m_hideEmitters = stream->readBool();
+		: MonteCarloIntegrator(stream, manager) {
+		m_radius = stream->readInt();
+		m_featureScale = stream->readFloat();
+		m_featureFloor = stream->readFloat();
 		m_maxDist = stream->readFloat();
 	}
 
-	/// Serialize
 	void serialize(Stream *stream, InstanceManager *manager) const {
-		SamplingIntegrator::serialize(stream, manager);
-		manager->serialize(stream, m_film_depth.get());
-
-		stream->writeInt(m_rrDepth);
-		stream->writeInt(m_maxDepth);
-		stream->writeBool(m_strictNormals);
-		stream->writeBool(m_hideEmitters);
+		MonteCarloIntegrator::serialize(stream, manager);
+		stream->writeInt(m_radius);
+		stream->writeFloat(m_featureScale);
+		stream->writeFloat(m_featureFloor);
 		stream->writeFloat(m_maxDist);
 	}
 
-	/// Preprocess
 	bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
 		int sceneResID, int sensorResID, int samplerResID) {
-
-		if (!SamplingIntegrator::preprocess(scene, queue, job, sceneResID, sensorResID, samplerResID))
+		if (!MonteCarloIntegrator::preprocess(scene, queue, job, sceneResID,
+				sensorResID, samplerResID))
 			return false;
-		
-		Sampler *sampler = static_cast<Sampler *>(Scheduler::getInstance()->getResource(samplerResID, 0));
-		Sensor *sensor = static_cast<Sensor *>(Scheduler::getInstance()->getResource(sensorResID));
-		if (sampler->getClass()->getName() != "IndependentSampler")
-			Log(EError, "The error-controlling integrator should only be "
-			"used in conjunction with the independent sampler");
-
-		/// m_film_depth ʱȭ
-		Vector2i filmSize = sensor->getFilm()->getSize();
 
+		/* Normalize depth values by the largest distance to the scene bounds */
 		const AABB &sceneAABB = scene->getAABB();
-
 		Point cameraPosition = scene->getSensor()->getWorldTransform()->eval(0)
 			.transformAffine(Point(0.0f));
 		m_maxDist = -std::numeric_limits<Float>::infinity();
 
-		for (int i = 0; i < 8; ++i) {
+		for (int i = 0; i < 8; ++i)
 			m_maxDist = std::max(m_maxDist,
 				(cameraPosition - sceneAABB.getCorner(i)).length());
-		}
 
 		return true;
 	}
 
-	/// Li ڷ Spectrum depth  ־ְ (renderBlock ʱȭ)
-	/// ο depth ä 
-	/// renderBlock  depthBlock->put(samplePos, [depth]) 
-	/// renderBlock for   ٱ film->put(depthBlock)  ϸ  ?
+	bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int sensorResID, int samplerResID) {
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+		ref<Film> film = sensor->getFilm();
+
+		size_t nCores = sched->getCoreCount();
+		const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+		size_t sampleCount = sampler->getSampleCount();
+
+		Log(EInfo, "Starting render job (%ix%i, " SIZE_T_FMT " %s, " SIZE_T_FMT
+			" %s, " SSE_STR ") ..", film->getCropSize().x, film->getCropSize().y,
+			sampleCount, sampleCount == 1 ? "sample" : "samples", nCores,
+			nCores == 1 ? "core" : "cores");
+
+		/* Pass 1: render radiance and feature buffers */
+		ref<BlockedWLRProcess> proc = new BlockedWLRProcess(job,
+			queue, scene->getBlockSize());
+		int integratorResID = sched->registerResource(this);
+		proc->bindResource("integrator", integratorResID);
+		proc->bindResource("scene", sceneResID);
+		proc->bindResource("sensor", sensorResID);
+		proc->bindResource("sampler", samplerResID);
+		scene->bindUsedResources(proc);
+		bindUsedResources(proc);
+		sched->schedule(proc);
+
+		m_process = proc;
+		sched->wait(proc);
+		m_process = NULL;
+		sched->unregisterResource(integratorResID);
+
+		if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+			return false;
+
+		/* Pass 2: reconstruct the film using weighted local regression */
+		ref<WLRReconstructionProcess> recon = new WLRReconstructionProcess(
+			job, queue, film, proc->getFeatures(), scene->getBlockSize(),
+			m_radius, m_featureScale, m_featureFloor, sampleCount);
+		film->clear();
+		sched->schedule(recon);
+
+		m_process = recon;
+		sched->wait(recon);
+		m_process = NULL;
+
+		return recon->getReturnStatus() == ParallelProcess::ESuccess;
+	}
+
 	void renderBlock(const Scene *scene, const Sensor *sensor,
 		Sampler *sampler, ImageBlock *block, const bool &stop,
 		const std::vector< TPoint2<uint8_t> > &points) const {
-		
-		/*
-		depthBlock ʱȭ 
-		*/
-		
-		ref<ImageBlock> depthBlock = new ImageBlock(Bitmap::ELuminance, block->getSize(), NULL, 1, true);
-		
 
 		Float diffScaleFactor = 1.0f /
-			std::sqrt((Float)sampler->getSampleCount());
+			std::sqrt((Float) sampler->getSampleCount());
 
 		bool needsApertureSample = sensor->needsApertureSample();
 		bool needsTimeSample = sensor->needsTimeSample();
@@ -90,6 +153,7 @@ public:
 		Point2 apertureSample(0.5f);
 		Float timeSample = 0.5f;
 		RayDifferential sensorRay;
+		Float temp[EWLRChannelCount];
 
 		block->clear();
 
@@ -119,20 +183,49 @@ public:
 
 				sensorRay.scaleDifferential(diffScaleFactor);
 
+				/* Find the first hit here so that its features can be recorded;
+				   Li() will then skip the intersection query */
+				rRec.rayIntersect(sensorRay);
+				Float *features = temp + EWLRFeatures;
+				fetchFeatures(sensorRay, rRec.its, features);
+
 				spec *= Li(sensorRay, rRec);
-				block->put(samplePos, spec, rRec.alpha);
+
+				for (int k = 0; k<SPECTRUM_SAMPLES; ++k)
+					temp[k] = spec[k];
+				temp[EWLRAlpha] = rRec.alpha;
+				for (int k = 0; k<WLR_FEATURE_DIM; ++k)
+					temp[EWLRFeaturesSqr + k] = features[k] * features[k];
+				temp[EWLRWeight] = 1.0f;
+
+				block->put(samplePos, temp);
 				sampler->advance();
 			}
 		}
+	}
+
+	/// Record the first-hit depth, shading normal and albedo of a sample
+	inline void fetchFeatures(const RayDifferential &ray,
+			Intersection &its, Float *features) const {
+		if (!its.isValid()) {
+			for (int k = 0; k<WLR_FEATURE_DIM; ++k)
+				features[k] = 0.0f;
+			return;
+		}
+
+		Normal n = its.shFrame.n;
+		if (dot(n, ray.d) > 0)
+			n = -n;
 
-		/*
-		feature film update
-		*/
-		//m_block_depth->put(depthBlock);
+		Float r, g, b;
+		its.getBSDF(ray)->getDiffuseReflectance(its).toLinearRGB(r, g, b);
+
+		features[0] = 1.0f - its.t / m_maxDist;
+		features[1] = n.x; features[2] = n.y; features[3] = n.z;
+		features[4] = r; features[5] = g; features[6] = b;
 	}
 
-	/// How to compute first-bounce radiance
-	Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec, Float &depth) const {
+	Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
 		/* Some aliases and local variables */
 		const Scene *scene = rRec.scene;
 		Intersection &its = rRec.its;
@@ -145,8 +238,6 @@ public:
 		rRec.rayIntersect(ray);
 		ray.mint = Epsilon;
 
-		depth = 1.0f - rRec.its.t / m_maxDist; /// Depth visualization
-
 		Spectrum throughput(1.0f);
 		Float eta = 1.0f;
 
@@ -319,47 +410,27 @@ public:
 		return pdfA / (pdfA + pdfB);
 	}
 
-	/*
-	 Ʒδ ׳ ⺻ Լ
-	*/
-	Spectrum E(const Scene *scene, const Intersection &its, const Medium *medium,
-		Sampler *sampler, int nSamples, bool includeIndirect) const {
-		return SamplingIntegrator::E(scene, its, medium,
-			sampler, nSamples, includeIndirect);
-	}
-
-	void bindUsedResources(ParallelProcess *proc) const {
-		SamplingIntegrator::bindUsedResources(proc);
-	}
-
-	void wakeup(ConfigurableObject *parent,
-		std::map<std::string, SerializableObject *> &params) {
-		SamplingIntegrator::wakeup(this, params);
-	}
-
-	void cancel() {
-		SamplingIntegrator::cancel();
-	}
-
 	std::string toString() const {
 		std::ostringstream oss;
-		oss << "AdaptiveIntegrator[" << endl
-			<< "  maxSamples = " << m_maxSampleFactor << "," << endl
+		oss << "LocalRegressionIntegrator[" << endl
+			<< "  maxDepth = " << m_maxDepth << "," << endl
+			<< "  rrDepth = " << m_rrDepth << "," << endl
+			<< "  strictNormals = " << m_strictNormals << "," << endl
+			<< "  radius = " << m_radius << "," << endl
+			<< "  featureScale = " << m_featureScale << "," << endl
+			<< "  featureFloor = " << m_featureFloor << endl
 			<< "]";
 		return oss.str();
 	}
 
-	MTS_DECLARE_CLASS();
+	MTS_DECLARE_CLASS()
 private:
-	ref<Film> m_film_depth;
-	ref<ImageBlock> m_block_depth;
-	int m_maxDepth;
-	int m_rrDepth;
-	bool m_strictNormals;
-	bool m_hideEmitters;
+	int m_radius;
+	Float m_featureScale;
+	Float m_featureFloor;
 	Float m_maxDist;
 };
 
-MTS_IMPLEMENT_CLASS_S(LocalRegressionIntegrator, false, SamplingIntegrator)
+MTS_IMPLEMENT_CLASS_S(LocalRegressionIntegrator, false, MonteCarloIntegrator)
 MTS_EXPORT_PLUGIN(LocalRegressionIntegrator, "Weighted local regression integrator");
-MTS_NAMESPACE_END
\ No newline at end of file
+MTS_NAMESPACE_END
@@ -203,10 +203,13 @@ void Path::reverse() {
 }
 
 void Path::release(MemoryPool &pool) {
-	for (size_t i=0; i<m_vertices.size(); ++i)
-		pool.release(m_vertices[i]);
-	for (size_t i=0; i<m_edges.size(); ++i)
-		pool.release(m_edges[i]);
+	/* Arenas reclaim their entries all at once */
+	if (!pool.isArena()) {
+		for (size_t i=0; i<m_vertices.size(); ++i)
+			pool.release(m_vertices[i]);
+		for (size_t i=0; i<m_edges.size(); ++i)
+			pool.release(m_edges[i]);
+	}
 	m_vertices.clear();
 	m_edges.clear();
 }
@@ -243,6 +246,8 @@ void Path::append(const Path &path, size_t start, size_t end, bool reverse) {
 }
 
 void Path::release(size_t start, size_t end, MemoryPool &pool) {
+	if (pool.isArena())
+		return;
 	for (size_t i=start; i<end; ++i) {
 		pool.release(m_vertices[i]);
 		if (i+1 < end)
@@ -31,7 +31,7 @@ PathSampler::PathSampler(ETechnique technique, const Scene *scene, Sampler *sens
 	: m_technique(technique), m_scene(scene), m_emitterSampler(emitterSampler),
 	  m_sensorSampler(sensorSampler), m_directSampler(directSampler), m_maxDepth(maxDepth),
 	  m_rrDepth(rrDepth), m_excludeDirectIllum(excludeDirectIllum), m_sampleDirect(sampleDirect),
-      m_lightImage(lightImage) {
+      m_lightImage(lightImage), m_arena(MTS_MEMPOOL_GRANULARITY, true) {
 
 	if (technique == EUnidirectional) {
 		/* Instantiate a volumetric path tracer */
@@ -71,19 +71,19 @@ void PathSampler::sampleSplats(const Point2i &offset, SplatList &list) {
 					time = sensor->sampleTime(m_sensorSampler->next1D());
 
 				/* Initialize the path endpoints */
-				m_emitterSubpath.initialize(m_scene, time, EImportance, m_pool);
-				m_sensorSubpath.initialize(m_scene, time, ERadiance, m_pool);
+				m_emitterSubpath.initialize(m_scene, time, EImportance, m_arena);
+				m_sensorSubpath.initialize(m_scene, time, ERadiance, m_arena);
 
 				/* Perform two random walks from the sensor and emitter side */
 				m_emitterSubpath.randomWalk(m_scene, m_emitterSampler, m_emitterDepth,
-						m_rrDepth, EImportance, m_pool);
+						m_rrDepth, EImportance, m_arena);
 
 				if (offset == Point2i(-1))
 					m_sensorSubpath.randomWalk(m_scene, m_sensorSampler,
-						m_sensorDepth, m_rrDepth, ERadiance, m_pool);
+						m_sensorDepth, m_rrDepth, ERadiance, m_arena);
 				else
 					m_sensorSubpath.randomWalkFromPixel(m_scene, m_sensorSampler,
-						m_sensorDepth, offset, m_rrDepth, m_pool);
+						m_sensorDepth, offset, m_rrDepth, m_arena);
 
 				/* Compute the combined weights along the two subpaths */
 				Spectrum *importanceWeights = (Spectrum *) alloca(m_emitterSubpath.vertexCount() * sizeof(Spectrum)),
@@ -266,9 +266,10 @@ void PathSampler::sampleSplats(const Point2i &offset, SplatList &list) {
 					}
 				}
 
-				/* Release any used edges and vertices back to the memory pool */
-				m_sensorSubpath.release(m_pool);
-				m_emitterSubpath.release(m_pool);
+				/* Release any used edges and vertices back to the memory arena */
+				m_sensorSubpath.release(m_arena);
+				m_emitterSubpath.release(m_arena);
+				m_arena.reset();
 			}
 			break;
 
@@ -321,19 +322,19 @@ void PathSampler::samplePaths(const Point2i &offset, PathCallback &callback) {
 		time = sensor->sampleTime(m_sensorSampler->next1D());
 
 	/* Initialize the path endpoints */
-	m_emitterSubpath.initialize(m_scene, time, EImportance, m_pool);
-	m_sensorSubpath.initialize(m_scene, time, ERadiance, m_pool);
+	m_emitterSubpath.initialize(m_scene, time, EImportance, m_arena);
+	m_sensorSubpath.initialize(m_scene, time, ERadiance, m_arena);
 
 	/* Perform two random walks from the sensor and emitter side */
 	m_emitterSubpath.randomWalk(m_scene, m_emitterSampler, m_emitterDepth,
-			m_rrDepth, EImportance, m_pool);
+			m_rrDepth, EImportance, m_arena);
 
 	if (offset == Point2i(-1))
 		m_sensorSubpath.randomWalk(m_scene, m_sensorSampler,
-			m_sensorDepth, m_rrDepth, ERadiance, m_pool);
+			m_sensorDepth, m_rrDepth, ERadiance, m_arena);
 	else
 		m_sensorSubpath.randomWalkFromPixel(m_scene, m_sensorSampler,
-			m_sensorDepth, offset, m_rrDepth, m_pool);
+			m_sensorDepth, offset, m_rrDepth, m_arena);
 
 	/* Compute the combined weights along the two subpaths */
 	Spectrum *importanceWeights = (Spectrum *) alloca(m_emitterSubpath.vertexCount() * sizeof(Spectrum)),
@@ -461,9 +462,9 @@ void PathSampler::samplePaths(const Point2i &offset, PathCallback &callback) {
 
 			/* Attempt to connect the two endpoints, which could result in
 			   the creation of additional vertices (index-matched boundaries etc.) */
-			m_connectionSubpath.release(m_pool);
+			m_connectionSubpath.release(m_arena);
 			if (value.isZero() || !PathEdge::pathConnect(m_scene, vsEdge,
-					vs, m_connectionSubpath, vt, vtEdge, remaining, m_pool))
+					vs, m_connectionSubpath, vt, vtEdge, remaining, m_arena))
 				continue;
 
 			depth += (int) m_connectionSubpath.vertexCount();
@@ -531,10 +532,11 @@ void PathSampler::samplePaths(const Point2i &offset, PathCallback &callback) {
 		}
 	}
 
-	/* Release any used edges and vertices back to the memory pool */
-	m_sensorSubpath.release(m_pool);
-	m_emitterSubpath.release(m_pool);
-	m_connectionSubpath.release(m_pool);
+	/* Release any used edges and vertices back to the memory arena */
+	m_sensorSubpath.release(m_arena);
+	m_emitterSubpath.release(m_arena);
+	m_connectionSubpath.release(m_arena);
+	m_arena.reset();
 }
 
 /**
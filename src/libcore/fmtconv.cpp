@@ -20,6 +20,9 @@
 #define BOOST_MPL_LIMIT_VECTOR_SIZE 40
 
 #include <mitsuba/core/bitmap.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
 #include <boost/mpl/vector.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/mpl/fold.hpp>
@@ -38,8 +41,10 @@ namespace mpl = boost::mpl;
 /*  formats. The switch() and Boost MPL craziness below does exactly this:  */
 /*  it produces code for each possible pair                                 */
 /****************************************************************************/
-/*  Note that some cases in this file really scream for SSE optimization    */
-/*  (in case they ever become a bottleneck, that is..)                      */
+/*  The most frequent conversions from float32 data (e.g. when a film is    */
+/*  developed or an image is written to an 8 bit or half precision file)   */
+/*  additionally have SSE2 implementations, which produce exactly the same */
+/*  output as the generic code path.                                        */
 /****************************************************************************/
 
 namespace detail {
@@ -77,6 +82,335 @@ namespace detail {
 	template <> inline half safe_cast(double a) {
 		return static_cast<half>(static_cast<float>(a));
 	}
+
+	inline Float undoGamma(Float value, Float gamma) {
+		if (gamma == -1) {
+			if (value <= (Float) 0.04045)
+				return value * (Float) (1.0 / 12.92);
+			else
+				return std::pow((Float) ((value + (Float) 0.055) * (Float) (1.0 / 1.055)), (Float) 2.4);
+		} else {
+			return std::pow(value, gamma);
+		}
+	}
+
+	inline Float applyGamma(Float value, Float invGamma) {
+		if (invGamma == -1) {
+			return (value <= (Float) 0.0031308) ? ((Float) 12.92 * value)
+				: ((Float) 1.055 * std::pow(value, (Float) (1.0/2.4)) - (Float) 0.055);
+		} else {
+			return std::pow(value, invGamma);
+		}
+	}
+
+#if defined(MTS_SSE)
+	/* ==================================================================== */
+	/*                      SSE2 conversion fast paths                      */
+	/* ==================================================================== */
+
+	/* The sRGB encoding table splits the values in [2^-13, 1] into buckets
+	   of 2^14 consecutive floats (i.e. 512 buckets per power of two). Each
+	   bucket is much narrower than the distance between two successive
+	   8-bit codes, hence the lookup needs at most one or two comparisons */
+	#define MTS_SRGB_TABLE_OFFSET 0x39000000u
+	#define MTS_SRGB_TABLE_SHIFT  14
+	#define MTS_SRGB_TABLE_SIZE   (((0x3f800000u - MTS_SRGB_TABLE_OFFSET) >> MTS_SRGB_TABLE_SHIFT) + 2)
+
+	static struct SRGBEncodingTable {
+		/// Smallest 8-bit code within each bucket
+		uint8_t start[MTS_SRGB_TABLE_SIZE];
+		/// Smallest value that is encoded as a given 8-bit code
+		float threshold[257];
+	} srgbEncodingTable;
+
+	union FloatBits {
+		float f;
+		uint32_t i;
+	};
+
+	/// sRGB-encode a value and round it to 8 bit (exactly like \c convertScalar)
+	inline uint8_t encodeSRGB8Scalar(float value) {
+		return safe_cast<uint8_t>(std::min((Float) 255, std::max((Float) 0,
+			applyGamma(value, -1) * (Float) 255 + (Float) 0.5f)));
+	}
+
+	/// Table-based version of \ref encodeSRGB8Scalar() for values in [0, 1]
+	inline uint8_t encodeSRGB8(float value) {
+		FloatBits bits;
+		bits.f = value;
+		size_t index = bits.i < MTS_SRGB_TABLE_OFFSET ? 0 :
+			((bits.i - MTS_SRGB_TABLE_OFFSET) >> MTS_SRGB_TABLE_SHIFT) + 1;
+		int code = srgbEncodingTable.start[index];
+		while (value >= srgbEncodingTable.threshold[code + 1])
+			++code;
+		return (uint8_t) code;
+	}
+
+	static void initSRGBEncodingTable() {
+		FloatBits bits;
+		for (int code=0; code<256; ++code) {
+			/* Binary search for the smallest value with this code */
+			uint32_t lo = 0, hi = 0x3f800000u;
+			while (lo < hi) {
+				uint32_t mid = lo + (hi - lo) / 2;
+				bits.i = mid;
+				if (encodeSRGB8Scalar(bits.f) >= code)
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+			bits.i = lo;
+			srgbEncodingTable.threshold[code] = bits.f;
+		}
+		srgbEncodingTable.threshold[256] = std::numeric_limits<float>::infinity();
+
+		srgbEncodingTable.start[0] = encodeSRGB8Scalar(0.0f);
+		for (size_t i=1; i<MTS_SRGB_TABLE_SIZE; ++i) {
+			bits.i = MTS_SRGB_TABLE_OFFSET + (uint32_t) ((i-1) << MTS_SRGB_TABLE_SHIFT);
+			srgbEncodingTable.start[i] = encodeSRGB8Scalar(bits.f);
+		}
+	}
+
+	/**
+	 * \brief Convert four single precision values to half precision
+	 *
+	 * Rounds to the nearest representable value (ties to even) and
+	 * handles overflow, denormals and NaNs like the \ref half class.
+	 */
+	inline __m128i floatToHalf(__m128 value) {
+		const __m128i signMask   = _mm_set1_epi32((int) 0x80000000u);
+		const __m128i overflow   = _mm_set1_epi32((127 + 16) << 23);
+		const __m128i minNormal  = _mm_set1_epi32((127 - 14) << 23);
+		const __m128i denormBias = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+		__m128 sign = _mm_and_ps(value, _mm_castsi128_ps(signMask));
+		__m128 absValue = _mm_xor_ps(value, sign);
+		__m128i absBits = _mm_castps_si128(absValue);
+
+		/* Infinities and NaNs (the latter keep a mantissa bit) */
+		__m128i isRegular = _mm_cmpgt_epi32(overflow, absBits);
+		__m128i special = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(
+			_mm_castps_si128(_mm_cmpunord_ps(absValue, absValue)), _mm_set1_epi32(0x200)));
+
+		/* Denormals: let the floating point unit do the rounding */
+		__m128i isDenormal = _mm_cmpgt_epi32(minNormal, absBits);
+		__m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absValue,
+			_mm_castsi128_ps(denormBias))), denormBias);
+
+		/* Normalized values: rebias the exponent and round the mantissa */
+		__m128i oddMantissa = _mm_srai_epi32(_mm_slli_epi32(absBits, 31 - 13), 31);
+		__m128i normal = _mm_srli_epi32(_mm_sub_epi32(
+			_mm_add_epi32(absBits, normalBias), oddMantissa), 13);
+
+		__m128i result = mux_epi32(isDenormal, denormal, normal);
+		result = mux_epi32(isRegular, result, special);
+		return _mm_or_si128(result, _mm_srli_epi32(_mm_castps_si128(sign), 16));
+	}
+
+	/**
+	 * \brief Stores four values (which already include the multiplier)
+	 * in a destination component format
+	 *
+	 * Lanes that are set in \c srgbMask are sRGB-encoded. The generic
+	 * version is used by formats without an SSE2 implementation.
+	 */
+	template <typename DestFmt> struct SSEStore {
+		static inline bool supportsGamma(Float) { return false; }
+		static inline void store(DestFmt *, __m128, int) { }
+	};
+
+	template <> struct SSEStore<float> {
+		static inline bool supportsGamma(Float invGamma) { return invGamma == 1; }
+
+		static inline void store(float *dest, __m128 value, int) {
+			_mm_storeu_ps(dest, value);
+		}
+	};
+
+	template <> struct SSEStore<half> {
+		static inline bool supportsGamma(Float invGamma) { return invGamma == 1; }
+
+		static inline void store(half *dest, __m128 value, int) {
+			/* Sign-extend so that the saturating pack keeps all 16 bits */
+			__m128i result = _mm_srai_epi32(_mm_slli_epi32(floatToHalf(value), 16), 16);
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(dest), _mm_packs_epi32(result, result));
+		}
+	};
+
+	template <> struct SSEStore<uint8_t> {
+		static inline bool supportsGamma(Float invGamma) { return invGamma == 1 || invGamma == -1; }
+
+		static inline void store(uint8_t *dest, __m128 value, int srgbMask) {
+			/* Round to nearest value and clamp. The operand order of
+			   _mm_max_ps() maps NaNs to zero just like std::max() */
+			__m128 scaled = _mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f));
+			scaled = _mm_min_ps(_mm_max_ps(scaled, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+			__m128i result = _mm_cvttps_epi32(scaled);
+			result = _mm_packs_epi32(result, result);
+			result = _mm_packus_epi16(result, result);
+			int32_t packed = _mm_cvtsi128_si32(result);
+			memcpy(dest, &packed, sizeof(int32_t));
+
+			if (srgbMask) {
+				MM_ALIGN16 float clamped[4];
+				_mm_store_ps(clamped, _mm_min_ps(_mm_max_ps(value,
+					_mm_setzero_ps()), _mm_set1_ps(1.0f)));
+				for (int i=0; i<4; ++i) {
+					if (srgbMask & (1 << i))
+						dest[i] = encodeSRGB8(clamped[i]);
+				}
+			}
+		}
+	};
+
+	/**
+	 * \brief Convert a contiguous sequence of components
+	 *
+	 * \c colorMask specifies the lanes holding color values, which are
+	 * scaled and gamma-corrected. The others contain alpha values.
+	 */
+	template <typename DestFmt> void convertComponentsSSE(const float *source,
+			DestFmt *dest, size_t size, Float multiplier, int colorMask, bool srgb) {
+		const __m128 mult = mux_ps(_mm_castsi128_ps(_mm_set_epi32(
+			(colorMask & 8) ? -1 : 0, (colorMask & 4) ? -1 : 0,
+			(colorMask & 2) ? -1 : 0, (colorMask & 1) ? -1 : 0)),
+			_mm_set1_ps(multiplier), _mm_set1_ps(1.0f));
+		const int srgbMask = srgb ? colorMask : 0;
+
+		size_t i = 0;
+		for (; i + 4 <= size; i += 4)
+			SSEStore<DestFmt>::store(dest + i, _mm_mul_ps(
+				_mm_loadu_ps(source + i), mult), srgbMask);
+
+		if (i < size) {
+			MM_ALIGN16 float tmpSource[4] = { 0, 0, 0, 0 };
+			DestFmt tmpDest[4];
+			memcpy(tmpSource, source + i, (size - i) * sizeof(float));
+			SSEStore<DestFmt>::store(tmpDest, _mm_mul_ps(
+				_mm_load_ps(tmpSource), mult), srgbMask);
+			for (size_t j=i; j<size; ++j)
+				dest[j] = tmpDest[j - i];
+		}
+	}
+
+	/**
+	 * \brief Convert \ref Bitmap::ESpectrumAlphaWeight data with three
+	 * spectral samples into RGB or RGBA values by dividing by the weight
+	 */
+	template <typename DestFmt> void convertWeightedSSE(const float *source,
+			DestFmt *dest, size_t count, Float multiplier, bool alpha, bool srgb) {
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		const __m128 mult = alpha ? _mm_set_ps(1.0f, multiplier, multiplier, multiplier)
+			: _mm_set1_ps(multiplier);
+		const int srgbMask = srgb ? (alpha ? 0x7 : 0xF) : 0;
+		const size_t channels = alpha ? 4 : 3;
+		MM_ALIGN16 float tmpSource[20];
+		DestFmt tmpDest[16];
+
+		for (size_t i=0; i<count; i += 4) {
+			const float *src = source + 5 * i;
+			DestFmt *dst = dest + channels * i;
+			size_t n = std::min(count - i, (size_t) 4);
+			if (n < 4) {
+				/* Pad the last few pixels with zero weights */
+				memset(tmpSource, 0, sizeof(tmpSource));
+				memcpy(tmpSource, src, 5 * n * sizeof(float));
+				src = tmpSource;
+				dst = tmpDest;
+			}
+
+			/* Like the generic implementation, keep zero weights as they are */
+			__m128 weight = _mm_set_ps(src[19], src[14], src[9], src[4]);
+			__m128 isZero = _mm_cmpeq_ps(weight, zero);
+			__m128 invWeight = mux_ps(isZero, weight,
+				_mm_div_ps(one, mux_ps(isZero, one, weight)));
+
+			__m128 v0 = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(src),      splat_ps(invWeight, 0)), mult);
+			__m128 v1 = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(src + 5),  splat_ps(invWeight, 1)), mult);
+			__m128 v2 = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(src + 10), splat_ps(invWeight, 2)), mult);
+			__m128 v3 = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(src + 15), splat_ps(invWeight, 3)), mult);
+
+			if (alpha) {
+				SSEStore<DestFmt>::store(dst,      v0, srgbMask);
+				SSEStore<DestFmt>::store(dst + 4,  v1, srgbMask);
+				SSEStore<DestFmt>::store(dst + 8,  v2, srgbMask);
+				SSEStore<DestFmt>::store(dst + 12, v3, srgbMask);
+			} else {
+				/* Drop the alpha values: (r0 g0 b0 r1) (g1 b1 r2 g2) (b2 r3 g3 b3) */
+				__m128 t0 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(0, 0, 2, 2));
+				__m128 t2 = _mm_shuffle_ps(v2, v3, _MM_SHUFFLE(0, 0, 2, 2));
+				SSEStore<DestFmt>::store(dst,     _mm_shuffle_ps(v0, t0, _MM_SHUFFLE(2, 0, 1, 0)), srgbMask);
+				SSEStore<DestFmt>::store(dst + 4, _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1, 0, 2, 1)), srgbMask);
+				SSEStore<DestFmt>::store(dst + 8, _mm_shuffle_ps(t2, v3, _MM_SHUFFLE(2, 1, 2, 0)), srgbMask);
+			}
+
+			if (n < 4) {
+				for (size_t j=0; j<channels * n; ++j)
+					dest[channels * i + j] = tmpDest[j];
+			}
+		}
+	}
+
+	/// Conversions from other component formats have no SSE2 implementation
+	template <typename SourceFmt, typename DestFmt> inline bool convertSSE(
+			Bitmap::EPixelFormat, Float, const SourceFmt *, Bitmap::EPixelFormat,
+			DestFmt *, size_t, Float, Float, int) {
+		return false;
+	}
+
+	/**
+	 * \brief Try to convert float32 data using SSE2
+	 *
+	 * \return \c false if there is no SSE2 implementation for the
+	 * requested conversion, in which case nothing was done
+	 */
+	template <typename DestFmt> bool convertSSE(Bitmap::EPixelFormat sourceFormat,
+			Float sourceGamma, const float *source, Bitmap::EPixelFormat destFormat,
+			DestFmt *dest, size_t count, Float multiplier, Float invDestGamma,
+			int channelCount) {
+		if (sourceGamma != 1 || !SSEStore<DestFmt>::supportsGamma(invDestGamma))
+			return false;
+
+		const bool srgb = invDestGamma == -1;
+		int channels = 0, colorMask = 0xF;
+		if (sourceFormat == destFormat) {
+			switch (sourceFormat) {
+				case Bitmap::ELuminance:      channels = 1; break;
+				case Bitmap::ELuminanceAlpha: channels = 2; colorMask = 0x5; break;
+				case Bitmap::ERGB:
+				case Bitmap::EXYZ:            channels = 3; break;
+				case Bitmap::ERGBA:
+				case Bitmap::EXYZA:           channels = 4; colorMask = 0x7; break;
+				case Bitmap::ESpectrum:       channels = SPECTRUM_SAMPLES; break;
+				case Bitmap::EMultiChannel:   channels = channelCount; break;
+				default: break;
+			}
+		}
+
+#if SPECTRUM_SAMPLES == 3
+		/* In RGB mode, spectra are simply converted component-wise */
+		if ((sourceFormat == Bitmap::ESpectrumAlpha && destFormat == Bitmap::ESpectrumAlpha) ||
+			(sourceFormat == Bitmap::ESpectrumAlpha && destFormat == Bitmap::ERGBA)) {
+			channels = 4; colorMask = 0x7;
+		} else if (sourceFormat == Bitmap::ESpectrum && destFormat == Bitmap::ERGB) {
+			channels = 3;
+		} else if (sourceFormat == Bitmap::ESpectrumAlphaWeight &&
+				(destFormat == Bitmap::ERGB || destFormat == Bitmap::ERGBA)) {
+			convertWeightedSSE(source, dest, count, multiplier,
+				destFormat == Bitmap::ERGBA, srgb);
+			return true;
+		}
+#endif
+
+		if (channels == 0)
+			return false;
+
+		convertComponentsSSE(source, dest, count * channels,
+			multiplier, colorMask, srgb);
+		return true;
+	}
+#endif
 }
 
 template <typename T> struct FormatConverterImpl : public FormatConverter {
@@ -146,6 +480,12 @@ template <typename T> struct FormatConverterImpl : public FormatConverter {
 		const SourceFormat *source = reinterpret_cast<const SourceFormat *>(_source);
 		DestFormat *dest = reinterpret_cast<DestFormat *>(_dest);
 		const Float invDestGamma = 1.0f / destGamma;
+
+		#if defined(MTS_SSE)
+			if (detail::convertSSE(sourceFormat, sourceGamma, source, destFormat,
+					dest, count, multiplier, invDestGamma, channelCount))
+				return;
+		#endif
 		const size_t maxValue = (size_t) std::numeric_limits<SourceFormat>::max();
 
 		DestFormat *precomp = NULL;
@@ -1090,26 +1430,6 @@ template <typename T> struct FormatConverterImpl : public FormatConverter {
 	}
 
 private:
-	static Float undoGamma(Float value, Float gamma) {
-		if (gamma == -1) {
-			if (value <= (Float) 0.04045)
-				return value * (Float) (1.0 / 12.92);
-			else
-				return std::pow((Float) ((value + (Float) 0.055) * (Float) (1.0 / 1.055)), (Float) 2.4);
-		} else {
-			return std::pow(value, gamma);
-		}
-	}
-
-	static Float applyGamma(Float value, Float invGamma) {
-		if (invGamma == -1) {
-			return (value <= (Float) 0.0031308) ? ((Float) 12.92 * value)
-				: ((Float) 1.055 * std::pow(value, (Float) (1.0/2.4)) - (Float) 0.055);
-		} else {
-			return std::pow(value, invGamma);
-		}
-	}
-
 	/// Convert ITU-R Rec. BT.709 linear RGB to a luminance value
 	inline static Float RGBToLuminance(const Color3 &value) {
 		return value[0] * (Float) 0.212671 + value[1] * (Float) 0.715160 + value[2] * (Float) 0.072169;
@@ -1145,12 +1465,12 @@ private:
 			value *= static_cast<Float>(1.0f/std::numeric_limits<SourceFmt>::max());
 
 		if (sourceGamma != 1)
-			value = undoGamma(value, sourceGamma);
+			value = detail::undoGamma(value, sourceGamma);
 
 		value *= multiplier;
 
 		if (invDestGamma != 1)
-			value = applyGamma(value, invDestGamma);
+			value = detail::applyGamma(value, invDestGamma);
 
 		if (format_traits<DestFmt>::is_float)
 			return detail::safe_cast<DestFmt> (value);
@@ -1205,6 +1525,9 @@ private:
 FormatConverter::ConverterMap FormatConverter::m_converters;
 
 void FormatConverter::staticInitialization() {
+#if defined(MTS_SSE)
+	detail::initSRGBEncodingTable();
+#endif
 	mpl::for_each<ConverterImplementations>(RegisterConverter(m_converters));
 }
 
@@ -35,7 +35,7 @@ struct MemoryMappedFile::MemoryMappedFilePrivate {
 			if (result != 1)
 				Log(EError, "Could not write to \"%s\"!", filename.string().c_str());
 			data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-			if (data == NULL)
+			if (data == MAP_FAILED)
 				Log(EError, "Could not map \"%s\" to memory!", filename.string().c_str());
 			if (close(fd) != 0)
 				Log(EError, "close(): unable to close file!");
@@ -78,7 +78,7 @@ struct MemoryMappedFile::MemoryMappedFilePrivate {
 				Log(EError, "Could not write to \"%s\"!", filename.string().c_str());
 
 			data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-			if (data == NULL)
+			if (data == MAP_FAILED)
 				Log(EError, "Could not map \"%s\" to memory!", filename.string().c_str());
 
 			if (close(fd) != 0)
@@ -126,7 +126,7 @@ struct MemoryMappedFile::MemoryMappedFilePrivate {
 			if (fd == -1)
 				Log(EError, "Could not open \"%s\"!", filename.string().c_str());
 			data = mmap(NULL, size, PROT_READ | (readOnly ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
-			if (data == NULL)
+			if (data == MAP_FAILED)
 				Log(EError, "Could not map \"%s\" to memory!", filename.string().c_str());
 			if (close(fd) != 0)
 				Log(EError, "close(): unable to close file!");
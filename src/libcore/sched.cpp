@@ -56,12 +56,16 @@ Scheduler::Scheduler() {
 	m_workAvailable = new ConditionVariable(m_mutex);
 	m_resourceCounter = 0;
 	m_processCounter = 0;
+	m_queuedTasks = 0;
+	m_idleWorkers = 0;
 	m_running = false;
 }
 
 Scheduler::~Scheduler() {
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->decRef();
+	for (size_t i=0; i<m_taskQueues.size(); ++i)
+		delete m_taskQueues[i];
 }
 
 void Scheduler::registerWorker(Worker *worker) {
@@ -255,16 +259,22 @@ bool Scheduler::schedule(ParallelProcess *process) {
 
 	if (m_processes.find(process) != m_processes.end()) {
 		ProcessRecord *rec = m_processes[process];
-		if (rec->morework && !rec->active) {
-			/* Paused process - reactivate */
+		LockGuard genLock(rec->genMutex);
+		if (rec->morework && !rec->generate && !rec->cancelled) {
+			/* Paused process - reactivate. It may still be in the
+			   queue if the worker that paused it hasn't yet had a
+			   chance to remove it. */
 #if defined(DEBUG_SCHED)
 			Log(rec->logLevel, "Waking inactive process %i..", rec->id);
 #endif
-			rec->active = true;
-			m_localQueue.push_back(rec->id);
-			if (!process->isLocal())
-				m_remoteQueue.push_back(rec->id);
-			m_workAvailable->broadcast();
+			rec->generate = true;
+			if (!rec->active) {
+				rec->active = true;
+				m_localQueue.push_back(rec->id);
+				if (!process->isLocal())
+					m_remoteQueue.push_back(rec->id);
+				m_workAvailable->broadcast();
+			}
 			return true;
 		}
 		/* The process is still active */
@@ -356,10 +366,8 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	}
 
 	ProcessRecord *rec = (*it).second;
-	if (reduceInflight) {
-		--rec->inflight;
+	if (reduceInflight && atomicAdd(&rec->inflight, -1) == 0)
 		rec->cond->signal();
-	}
 
 	if (rec->cancelled) {
 #if defined(DEBUG_SCHED)
@@ -384,6 +392,14 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	m_remoteQueue.erase(std::remove(m_remoteQueue.begin(), m_remoteQueue.end(), rec->id),
 		m_remoteQueue.end());
 
+	/* Stop any further calls to generateWork() (this waits for a
+	   running one to finish) and drop work units that are still queued */
+	{
+		LockGuard genLock(rec->genMutex);
+		rec->generate = false;
+	}
+	atomicAdd(&rec->inflight, -removeTasks(rec->id));
+
 	/* Ensure that the process won't be considered 'done' when the
 	   last in-flight work unit is returned */
 	rec->morework = true;
@@ -426,8 +442,18 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 
 Scheduler::EStatus Scheduler::acquireWork(Item &item,
 		bool local, bool onlyTry, bool keepLock) {
+	if (local && !keepLock)
+		return acquireLocalWork(item, onlyTry);
+
+	/* The previous work unit has been submitted -- recycle it */
+	if (item.workUnit) {
+		item.freeUnits.push_back(item.workUnit);
+		item.workUnit = NULL;
+	}
+
 	UniqueLock lock(m_mutex);
 	std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
+	std::vector<ref<WorkUnit> > units;
 	while (true) {
 		if (onlyTry && queue.size() == 0) {
 			return ENone;
@@ -444,55 +470,250 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 
 		/* Try to create a work unit from the parallel
 		   process currently on top of the queue */
-		ParallelProcess::EStatus wStatus;
-		try {
-			int id = queue.front();
-			if (item.id != id) {
-				/* First work unit from this parallel process - establish
-				   connections to referenced resources and prepare the
-				   work processor */
-				setProcessByID(item, id);
-			}
+		if (generateWork(lock, item, queue, 1, units) > 0)
+			break;
+	}
 
-			wStatus = item.proc->generateWork(item.workUnit, item.workerIndex);
-		} catch (const std::exception &ex) {
-			Log(EWarn, "Caught an exception - canceling process %i: %s",
-				item.id, ex.what());
-			cancel(item.proc);
+	item.workUnit = units[0];
+	item.stop = false;
+
+	if (!keepLock)
+		lock.unlock();
+	else
+		lock.release(); /* Avoid the automatic unlocking upon destruction */
+
+	boost::this_thread::yield();
+	return EOK;
+}
+
+Scheduler::EStatus Scheduler::acquireLocalWork(Item &item, bool onlyTry) {
+	/* The previous work unit has been processed -- recycle it */
+	if (item.workUnit) {
+		item.freeUnits.push_back(item.workUnit);
+		item.workUnit = NULL;
+	}
+
+	std::vector<ref<WorkUnit> > units;
+	Task task;
+
+	while (true) {
+		if (!m_running)
+			return EStop;
+
+		/* Take a work unit from this worker's queue or steal one */
+		if (popTask(item.workerIndex, task))
+			break;
+
+		UniqueLock lock(m_mutex);
+		if (!m_running)
+			return EStop;
+
+		if (!m_localQueue.empty()) {
+			/* Generate a batch of work units, which are queued in the
+			   current worker's queue (where others can steal them) */
+			units.clear();
+			size_t count = generateWork(lock, item, m_localQueue,
+				MTS_SCHED_BATCH_SIZE, units);
+			if (count == 0)
+				continue;
+
+			TaskQueue *taskQueue = m_taskQueues[item.workerIndex];
+			LockGuard queueLock(taskQueue->mutex);
+			for (size_t i=0; i<count; ++i) {
+				task.id = item.id;
+				task.workUnit = units[i];
+				taskQueue->tasks.push_back(task);
+			}
+			atomicAdd(&m_queuedTasks, (int32_t) count);
+			if (count > 1 && m_idleWorkers > 0)
+				m_workAvailable->broadcast();
 			continue;
 		}
 
-		if (wStatus == ParallelProcess::ESuccess) {
+		/* Work units are only queued while holding the scheduler lock,
+		   hence this second attempt can't miss any of them */
+		if (popTask(item.workerIndex, task))
 			break;
-		} else if (wStatus == ParallelProcess::EFailure) {
+
+		if (onlyTry)
+			return ENone;
+
+		/* Wait until work is available and return false
+		   if stop() is called */
+		++m_idleWorkers;
+		m_workAvailable->wait();
+		--m_idleWorkers;
+	}
+
+	if (item.id != task.id) {
+		/* Stolen work unit of another process - establish connections to
+		   referenced resources and prepare the work processor */
+		LockGuard lock(m_mutex);
+		setProcessByID(item, task.id);
+	}
+
+	item.workUnit = task.workUnit;
+	item.stop = false;
+	return EOK;
+}
+
+size_t Scheduler::generateWork(UniqueLock &lock, Item &item,
+		std::deque<int> &queue, size_t count, std::vector<ref<WorkUnit> > &units) {
+	int id = queue.front();
+	ParallelProcess *proc = m_idToProcess[id];
+	ProcessRecord *rec = m_processes[proc];
+
+	try {
+		if (item.id != id) {
+			/* First work unit from this parallel process - establish
+			   connections to referenced resources and prepare the
+			   work processor */
+			setProcessByID(item, id);
+		}
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Caught an exception - canceling process %i: %s",
+			id, ex.what());
+		cancel(proc);
+		return 0;
+	}
+
+	/* Count this worker as in-flight while the lock is released, so that
+	   the process record cannot disappear in the meantime */
+	atomicAdd(&rec->inflight, 1);
+	lock.unlock();
+
+	ParallelProcess::EStatus wStatus = ParallelProcess::ESuccess;
+	bool exhausted = false, failed = false;
+	std::string reason;
+
+	try {
+		LockGuard genLock(rec->genMutex);
+		while (rec->generate && units.size() < count) {
+			ref<WorkUnit> workUnit;
+			if (!item.freeUnits.empty()) {
+				workUnit = item.freeUnits.back();
+				item.freeUnits.pop_back();
+			} else {
+				workUnit = item.wp->createWorkUnit();
+			}
+
+			wStatus = proc->generateWork(workUnit, item.workerIndex);
+
+			if (wStatus != ParallelProcess::ESuccess) {
+				item.freeUnits.push_back(workUnit);
+				rec->generate = false;
+				exhausted = true;
+				break;
+			}
+			units.push_back(workUnit);
+		}
+	} catch (const std::exception &ex) {
+		reason = ex.what();
+		failed = true;
+	}
+
+	lock.lock();
+
+	if (failed || rec->cancelled) {
+		/* Discard the new work units */
+		item.freeUnits.insert(item.freeUnits.end(), units.begin(), units.end());
+		units.clear();
+	}
+
+	if (failed) {
+		Log(EWarn, "Caught an exception - canceling process %i: %s",
+			id, reason.c_str());
+		if (atomicAdd(&rec->inflight, -1) == 0)
+			rec->cond->signal();
+		lock.unlock();
+		cancel(proc);
+		lock.lock();
+		return 0;
+	}
+
+	if (exhausted && !rec->cancelled) {
+		LockGuard genLock(rec->genMutex);
+		/* Only deactivate the process if schedule() hasn't woken it up in the meantime */
+		if (!rec->generate) {
+			if (wStatus == ParallelProcess::EFailure) {
 #if defined(DEBUG_SCHED)
-			if (item.rec->morework)
-				Log(item.rec->logLevel, "Process %i has finished generating work", item.rec->id);
+				if (rec->morework)
+					Log(rec->logLevel, "Process %i has finished generating work", rec->id);
 #endif
-			item.rec->morework = false;
-			item.rec->active = false;
-			queue.pop_front();
-			if (item.rec->inflight == 0)
-				signalProcessTermination(item.proc, item.rec);
-		} else if (wStatus == ParallelProcess::EPause) {
+				rec->morework = false;
+			} else {
 #if defined(DEBUG_SCHED)
-			Log(item.rec->logLevel, "Pausing process %i", item.rec->id);
+				Log(rec->logLevel, "Pausing process %i", rec->id);
 #endif
-			item.rec->active = false;
-			queue.pop_front();
+			}
+			rec->active = false;
+			m_localQueue.erase(std::remove(m_localQueue.begin(), m_localQueue.end(), id),
+				m_localQueue.end());
+			m_remoteQueue.erase(std::remove(m_remoteQueue.begin(), m_remoteQueue.end(), id),
+				m_remoteQueue.end());
 		}
 	}
 
-	item.rec->inflight++;
-	item.stop = false;
+	/* Replace this worker by the generated work units */
+	if (atomicAdd(&rec->inflight, (int32_t) units.size() - 1) == 0) {
+		rec->cond->signal();
+		if (!rec->morework && !rec->cancelled)
+			signalProcessTermination(proc, rec);
+	}
 
-	if (!keepLock)
-		lock.unlock();
-	else
-		lock.release(); /* Avoid the automatic unlocking upon destruction */
+	return units.size();
+}
 
-	boost::this_thread::yield();
-	return EOK;
+bool Scheduler::popTask(int workerIndex, Task &task) {
+	if (m_queuedTasks == 0)
+		return false;
+
+	size_t queueCount = m_taskQueues.size();
+	for (size_t i=0; i<queueCount; ++i) {
+		TaskQueue *taskQueue = m_taskQueues[(workerIndex + i) % queueCount];
+		if (!taskQueue)
+			continue;
+
+		LockGuard lock(taskQueue->mutex);
+		if (taskQueue->tasks.empty())
+			continue;
+
+		if (i == 0) {
+			/* Process our own work units in the order of generation */
+			task = taskQueue->tasks.front();
+			taskQueue->tasks.pop_front();
+		} else {
+			/* Steal from the other end */
+			task = taskQueue->tasks.back();
+			taskQueue->tasks.pop_back();
+		}
+		atomicAdd(&m_queuedTasks, -1);
+		return true;
+	}
+	return false;
+}
+
+int32_t Scheduler::removeTasks(int id) {
+	int32_t removed = 0;
+	for (size_t i=0; i<m_taskQueues.size(); ++i) {
+		TaskQueue *taskQueue = m_taskQueues[i];
+		if (!taskQueue)
+			continue;
+
+		LockGuard lock(taskQueue->mutex);
+		for (std::deque<Task>::iterator it = taskQueue->tasks.begin();
+				it != taskQueue->tasks.end();) {
+			if (it->id == id) {
+				it = taskQueue->tasks.erase(it);
+				++removed;
+			} else {
+				++it;
+			}
+		}
+	}
+	if (removed > 0)
+		atomicAdd(&m_queuedTasks, -removed);
+	return removed;
 }
 
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
@@ -529,6 +750,28 @@ void Scheduler::start() {
 	if (m_workers.size() == 0)
 		Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+	/* Create a work unit queue for every local worker. Work units that
+	   were left over by pause() are handed to the first one */
+	std::deque<Task> leftover;
+	for (size_t i=0; i<m_taskQueues.size(); ++i) {
+		if (!m_taskQueues[i])
+			continue;
+		leftover.insert(leftover.end(), m_taskQueues[i]->tasks.begin(),
+			m_taskQueues[i]->tasks.end());
+		delete m_taskQueues[i];
+	}
+	m_taskQueues.resize(m_workers.size());
+	for (size_t i=0; i<m_workers.size(); ++i) {
+		m_taskQueues[i] = NULL;
+		if (m_workers[i]->isRemoteWorker())
+			continue;
+		m_taskQueues[i] = new TaskQueue();
+		m_taskQueues[i]->tasks.swap(leftover);
+	}
+	if (!leftover.empty())
+		Log(EWarn, "There are no local workers to process " SIZE_T_FMT
+			" queued work units!", leftover.size());
+
 	int coreIndex = 0;
 	for (size_t i=0; i<m_workers.size(); ++i) {
 		m_workers[i]->start(this, (int) i, coreIndex);
@@ -571,6 +814,11 @@ void Scheduler::stop() {
 	m_idToProcess.clear();
 	m_localQueue.clear();
 	m_remoteQueue.clear();
+	for (size_t i=0; i<m_taskQueues.size(); ++i) {
+		if (m_taskQueues[i])
+			m_taskQueues[i]->tasks.clear();
+	}
+	m_queuedTasks = 0;
 	for (std::map<int, ResourceRecord *>::iterator
 		it = m_resources.begin(); it != m_resources.end(); ++it) {
 		ResourceRecord *rec = (*it).second;
@@ -621,6 +869,7 @@ void Worker::clear() {
 	m_schedItem.wp = NULL;
 	m_schedItem.workUnit = NULL;
 	m_schedItem.workResult = NULL;
+	m_schedItem.freeUnits.clear();
 	m_schedItem.id = -1;
 }
 
@@ -26,7 +26,11 @@ ZStream::ZStream(Stream *childStream, EStreamType streamType, int level)
 	m_deflateStream.zfree = Z_NULL;
 	m_deflateStream.opaque = Z_NULL;
 
-	int windowBits = 15 + (streamType == EGZipStream ? 16 : 0);
+	int windowBits = 15;
+	if (streamType == EGZipStream)
+		windowBits += 16;
+	else if (streamType == ERawDeflateStream)
+		windowBits = -windowBits;
 
 	int retval = deflateInit2(&m_deflateStream, level,
 		Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
@@ -363,7 +363,7 @@ void VPLShaderManager::setVPL(const VPL &vpl) {
 		}
 
 		if (m_nearClip >= m_farClip) {
-			BSphere bsphere(m_scene->getKDTree()->getAABB().getBSphere());
+			BSphere bsphere(m_scene->getGeometryAABB().getBSphere());
 			Float minDist = 0;
 
 			if ((vpl.type == ESurfaceVPL || vpl.type == EPointEmitterVPL) &&
@@ -384,7 +384,7 @@ void VPLShaderManager::setVPL(const VPL &vpl) {
 	} else {
 		m_shadowMapType = ShadowMapGenerator::EDirectional;
 		m_shadowMapTransform = m_shadowGen->directionalFindGoodFrame(
-			m_scene->getKDTree()->getAABB(), vpl.its.shFrame.n);
+			m_scene->getGeometryAABB(), vpl.its.shFrame.n);
 	}
 
 	bool is2D =
@@ -59,6 +59,18 @@ void BSDF::configure() {
 		m_combinedType |= m_components[i];
 }
 
+void BSDF::evalBatch(const BSDFSamplingRecord *bRecs, Spectrum *result,
+		size_t count, EMeasure measure) const {
+	for (size_t i=0; i<count; ++i)
+		result[i] = eval(bRecs[i], measure);
+}
+
+void BSDF::sampleBatch(BSDFSamplingRecord *bRecs, Float *pdf,
+		const Point2 *sample, Spectrum *result, size_t count) const {
+	for (size_t i=0; i<count; ++i)
+		result[i] = this->sample(bRecs[i], pdf[i], sample[i]);
+}
+
 Float BSDF::getEta() const {
 	return 1.0f;
 }
@@ -114,6 +114,13 @@ void Emitter::serialize(Stream *stream, InstanceManager *manager) const {
 	stream->writeFloat(m_samplingWeight);
 }
 
+void Emitter::getEmissionBounds(Vector &axis, Float &cosThetaO,
+		Float &cosThetaE) const {
+	axis = Vector(0, 0, 1);
+	cosThetaO = -1;
+	cosThetaE = 0;
+}
+
 Spectrum Emitter::sampleRay(Ray &ray,
 		const Point2 &spatialSample,
 		const Point2 &directionalSample,
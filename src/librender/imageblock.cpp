@@ -42,6 +42,41 @@ ImageBlock::~ImageBlock() {
 		delete[] m_weightsX;
 }
 
+void ImageBlock::put(const ImageBlock *block,
+		std::vector<ref<Mutex> > &bandMutexes, int firstBand) {
+	const Vector2i offset = block->getOffset() - m_offset
+		- Vector2i(block->getBorderSize() - m_borderSize);
+	const int bandCount = (int) bandMutexes.size();
+	const int height = m_bitmap->getHeight();
+
+	for (int i=0; i<bandCount; ++i) {
+		int band = (firstBand + i) % bandCount;
+		int y = band * MTS_IMAGEBLOCK_BAND_SIZE;
+		LockGuard lock(bandMutexes[band]);
+		m_bitmap->accumulate(block->getBitmap(), Point2i(0, y - offset.y),
+			Point2i(offset.x, y), Vector2i(block->getBitmap()->getWidth(),
+			std::min(MTS_IMAGEBLOCK_BAND_SIZE, height - y)));
+	}
+}
+
+void ImageBlock::createBandMutexes(std::vector<ref<Mutex> > &bandMutexes) const {
+	int bandCount = (m_bitmap->getHeight() + MTS_IMAGEBLOCK_BAND_SIZE - 1)
+		/ MTS_IMAGEBLOCK_BAND_SIZE;
+	bandMutexes.resize(bandCount);
+	for (int i=0; i<bandCount; ++i)
+		bandMutexes[i] = new Mutex();
+}
+
+void ImageBlock::lockBands(std::vector<ref<Mutex> > &bandMutexes) {
+	for (size_t i=0; i<bandMutexes.size(); ++i)
+		bandMutexes[i]->lock();
+}
+
+void ImageBlock::unlockBands(std::vector<ref<Mutex> > &bandMutexes) {
+	for (size_t i=0; i<bandMutexes.size(); ++i)
+		bandMutexes[i]->unlock();
+}
+
 void ImageBlock::load(Stream *stream) {
 	m_offset = Point2i(stream);
 	m_size = Vector2i(stream);
@@ -60,6 +95,18 @@ void ImageBlock::save(Stream *stream) const {
 		(size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount());
 }
 
+void ImageBlock::warnInvalid(const Float *value) const {
+	const int channels = m_bitmap->getChannelCount();
+	std::ostringstream oss;
+	oss << "Invalid sample value : [";
+	for (int i=0; i<channels; ++i) {
+		oss << value[i];
+		if (i+1 < channels)
+			oss << ", ";
+	}
+	oss << "]";
+	Log(EWarn, "%s", oss.str().c_str());
+}
 
 std::string ImageBlock::toString() const {
 	std::ostringstream oss;
@@ -17,6 +17,7 @@
 */
 
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/renderproc.h>
 
@@ -43,13 +44,41 @@ void Integrator::configureSampler(const Scene *scene, Sampler *sampler) {
 const Integrator *Integrator::getSubIntegrator(int idx) const { return NULL; }
 
 SamplingIntegrator::SamplingIntegrator(const Properties &props)
- : Integrator(props) { }
+ : Integrator(props) {
+	/* Render in multiple passes over the full image? */
+	m_progressive = props.getBoolean("progressive", false);
+	/* Stopping criteria of the progressive mode */
+	m_maxPasses = props.getInteger("maxPasses", -1);
+	m_timeBudget = props.getFloat("timeBudget", 0.0f);
+	m_targetError = props.getFloat("targetError", 0.0f);
+	/* Write the partially rendered image every 'writeInterval' seconds */
+	m_writeInterval = props.getFloat("writeInterval", 0.0f);
+	m_cancelled = false;
+
+	if (m_maxPasses <= 0 && m_maxPasses != -1)
+		Log(EError, "Maximum number of passes must either be set to \"-1\" or \"1\" or higher!");
+	if (m_timeBudget < 0 || m_targetError < 0 || m_writeInterval < 0)
+		Log(EError, "The parameters 'timeBudget', 'targetError' and "
+			"'writeInterval' must be nonnegative!");
+}
 
 SamplingIntegrator::SamplingIntegrator(Stream *stream, InstanceManager *manager)
- : Integrator(stream, manager) { }
+ : Integrator(stream, manager) {
+	m_progressive = stream->readBool();
+	m_maxPasses = stream->readInt();
+	m_timeBudget = stream->readFloat();
+	m_targetError = stream->readFloat();
+	m_writeInterval = stream->readFloat();
+	m_cancelled = false;
+}
 
 void SamplingIntegrator::serialize(Stream *stream, InstanceManager *manager) const {
 	Integrator::serialize(stream, manager);
+	stream->writeBool(m_progressive);
+	stream->writeInt(m_maxPasses);
+	stream->writeFloat(m_timeBudget);
+	stream->writeFloat(m_targetError);
+	stream->writeFloat(m_writeInterval);
 }
 
 Spectrum SamplingIntegrator::E(const Scene *scene, const Intersection &its,
@@ -88,6 +117,7 @@ Spectrum SamplingIntegrator::E(const Scene *scene, const Intersection &its,
 }
 
 void SamplingIntegrator::cancel() {
+	m_cancelled = true;
 	if (m_process)
 		Scheduler::getInstance()->cancel(m_process);
 }
@@ -95,6 +125,10 @@ void SamplingIntegrator::cancel() {
 bool SamplingIntegrator::render(Scene *scene,
 		RenderQueue *queue, const RenderJob *job,
 		int sceneResID, int sensorResID, int samplerResID) {
+	if (m_progressive)
+		return renderProgressive(scene, queue, job,
+			sceneResID, sensorResID, samplerResID);
+
 	ref<Scheduler> sched = Scheduler::getInstance();
 	ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
 	ref<Film> film = sensor->getFilm();
@@ -128,6 +162,195 @@ bool SamplingIntegrator::render(Scene *scene,
 	return proc->getReturnStatus() == ParallelProcess::ESuccess;
 }
 
+/**
+ * \brief Periodically develops the film of a running render job
+ *
+ * Blocks that finish while the film is being developed wait until it has
+ * been written, but the workers continue to render new blocks meanwhile.
+ */
+class FilmWriterThread : public Thread {
+public:
+	FilmWriterThread(Scene *scene, RenderQueue *queue,
+		const RenderJob *job, Float interval) : Thread("write"),
+		m_scene(scene), m_queue(queue), m_job(job), m_mutex(new Mutex()),
+		m_flag(new WaitFlag()), m_interval(interval) { }
+
+	/// Set the process whose results are merged into the film (or \c NULL)
+	void setProcess(BlockedRenderProcess *process) {
+		LockGuard lock(m_mutex);
+		m_process = process;
+	}
+
+	void run() {
+		while (!m_flag->wait((int) (m_interval * 1000))) {
+			Log(EInfo, "Writing the partially rendered image ..");
+			LockGuard lock(m_mutex);
+			if (m_process)
+				m_process->lockFilm();
+			m_scene->flush(m_queue, m_job);
+			if (m_process)
+				m_process->unlockFilm();
+		}
+	}
+
+	void quit() {
+		m_flag->set(true);
+		join();
+	}
+protected:
+	virtual ~FilmWriterThread() { }
+private:
+	ref<Scene> m_scene;
+	ref<RenderQueue> m_queue;
+	const RenderJob *m_job;
+	ref<BlockedRenderProcess> m_process;
+	ref<Mutex> m_mutex;
+	ref<WaitFlag> m_flag;
+	Float m_interval;
+};
+
+bool SamplingIntegrator::renderProgressive(Scene *scene,
+		RenderQueue *queue, const RenderJob *job,
+		int sceneResID, int sensorResID, int samplerResID) {
+	ref<Scheduler> sched = Scheduler::getInstance();
+	ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+	ref<Film> film = sensor->getFilm();
+	const Vector2i &size = film->getCropSize();
+	size_t pixelCount = (size_t) size.x * (size_t) size.y;
+
+	size_t nCores = sched->getCoreCount();
+	const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+	size_t sampleCount = sampler->getSampleCount();
+
+	/* Every pass calls generate() for the same pixels again, hence the
+	   sampler must not produce the same samples as in the previous passes */
+	if (sampler->isDeterministic())
+		Log(EError, "The progressive mode requires a randomized sampler (such as "
+			"\"independent\" or \"ldsampler\"), but the \"%s\" sampler produces "
+			"the same samples in every pass!", sampler->getClass()->getName().c_str());
+
+	Log(EInfo, "Starting progressive render job (%ix%i, " SIZE_T_FMT " %s per pass, "
+		SIZE_T_FMT " %s, " SSE_STR ") ..", size.x, size.y, sampleCount,
+		sampleCount == 1 ? "sample" : "samples", nCores, nCores == 1 ? "core" : "cores");
+
+	if (m_maxPasses == -1 && m_timeBudget == 0 && m_targetError == 0)
+		Log(EWarn, "No stopping criterion was specified -- rendering until cancelled.");
+
+	/* Luminance of the developed film, and running statistics of
+	   the images that were rendered by the individual passes */
+	ref<Bitmap> developed;
+	std::vector<Float> previous, mean, m2;
+	if (m_targetError > 0) {
+		developed = new Bitmap(Bitmap::ELuminance, Bitmap::EFloat, size);
+		previous.resize(pixelCount, 0.0f);
+		mean.resize(pixelCount, 0.0f);
+		m2.resize(pixelCount, 0.0f);
+	}
+
+	ref<FilmWriterThread> writer;
+	if (m_writeInterval > 0) {
+		writer = new FilmWriterThread(scene, queue, job, m_writeInterval);
+		writer->start();
+	}
+
+	ref<Timer> timer = new Timer();
+	int integratorResID = sched->registerResource(this);
+	bool success = true;
+	int pass = 0;
+
+	m_cancelled = false;
+	while (!m_cancelled) {
+		if (m_maxPasses != -1 && pass >= m_maxPasses)
+			break;
+
+		/* Don't start a pass that is expected to exceed the time budget */
+		Float elapsed = timer->getSeconds();
+		if (m_timeBudget > 0 && pass > 0 && elapsed * (pass + 1) / pass > m_timeBudget) {
+			Log(EInfo, "The time budget has been used up.");
+			break;
+		}
+
+		ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job,
+			queue, scene->getBlockSize());
+		proc->bindResource("integrator", integratorResID);
+		proc->bindResource("scene", sceneResID);
+		proc->bindResource("sensor", sensorResID);
+		proc->bindResource("sampler", samplerResID);
+		scene->bindUsedResources(proc);
+		bindUsedResources(proc);
+		if (writer)
+			writer->setProcess(proc);
+		sched->schedule(proc);
+
+		m_process = proc;
+		sched->wait(proc);
+		m_process = NULL;
+		if (writer)
+			writer->setProcess(NULL);
+
+		if (proc->getReturnStatus() != ParallelProcess::ESuccess) {
+			success = false;
+			break;
+		}
+
+		++pass;
+		if (m_targetError == 0) {
+			Log(EInfo, "Pass %i done after %s", pass,
+				timeString(timer->getSeconds()).c_str());
+			continue;
+		}
+
+		/* The developed image is the average of all passes so far. Recover
+		   the image of the last pass and update its per-pixel statistics */
+		film->develop(Point2i(0), size, Point2i(0), developed);
+		const Float *data = developed->getFloatData();
+		Float avgLuminance = 0;
+		for (size_t i=0; i<pixelCount; ++i) {
+			Float value = data[i] * pass - previous[i] * (pass - 1);
+			Float delta = value - mean[i];
+			mean[i] += delta / pass;
+			m2[i] += delta * (value - mean[i]);
+			previous[i] = data[i];
+			avgLuminance += data[i];
+		}
+		avgLuminance /= pixelCount;
+
+		if (pass == 1) {
+			Log(EInfo, "Pass 1 done after %s", timeString(timer->getSeconds()).c_str());
+			continue;
+		}
+
+		/* Root mean square of the relative standard error of the pixels.
+		   Dark pixels are measured relative to the average luminance */
+		Float error = 0;
+		for (size_t i=0; i<pixelCount; ++i) {
+			Float variance = m2[i] / ((pass - 1) * pass);
+			Float reference = std::max(data[i], avgLuminance * 0.01f);
+			if (reference > 0)
+				error += variance / (reference * reference);
+		}
+		error = std::sqrt(error / pixelCount);
+
+		Log(EInfo, "Pass %i done after %s, relative error: %.2f%%", pass,
+			timeString(timer->getSeconds()).c_str(), error * 100);
+
+		if (error <= m_targetError) {
+			Log(EInfo, "The target error has been reached.");
+			break;
+		}
+	}
+
+	if (writer)
+		writer->quit();
+	sched->unregisterResource(integratorResID);
+
+	Log(EInfo, "Rendered %i %s (" SIZE_T_FMT " samples per pixel) in %s",
+		pass, pass == 1 ? "pass" : "passes", pass * sampleCount,
+		timeString(timer->getSeconds()).c_str());
+
+	return success && !m_cancelled;
+}
+
 void SamplingIntegrator::bindUsedResources(ParallelProcess *) const {
 	/* Do nothing by default */
 }
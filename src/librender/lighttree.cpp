@@ -0,0 +1,388 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+const uint32_t LightTree::NoNode;
+
+/// cos(max(0, a - b)) given the sines and cosines of a and b
+static inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	if (cosA > cosB)
+		return 1.0f;
+	return cosA * cosB + sinA * sinB;
+}
+
+/// sin(max(0, a - b)) given the sines and cosines of a and b
+static inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	if (cosA > cosB)
+		return 0.0f;
+	return sinA * cosB - cosA * sinB;
+}
+
+void LightTree::LightBounds::expandBy(const LightBounds &bounds) {
+	if (bounds.phi == 0)
+		return;
+	if (phi == 0) {
+		*this = bounds;
+		return;
+	}
+
+	aabb.expandBy(bounds.aabb);
+	phi += bounds.phi;
+	cosThetaE = std::min(cosThetaE, bounds.cosThetaE);
+
+	/* Find the smallest cone that contains both normal cones */
+	Float thetaA = math::safe_acos(cosThetaO),
+	      thetaB = math::safe_acos(bounds.cosThetaO),
+	      thetaD = unitAngle(axis, bounds.axis);
+
+	if (std::min(thetaD + thetaB, (Float) M_PI) <= thetaA)
+		return;
+
+	if (std::min(thetaD + thetaA, (Float) M_PI) <= thetaB) {
+		axis = bounds.axis;
+		cosThetaO = bounds.cosThetaO;
+		return;
+	}
+
+	Float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+	Vector rotAxis = cross(axis, bounds.axis);
+	Float length = rotAxis.length();
+	if (thetaO >= M_PI || length == 0) {
+		cosThetaO = -1;
+		return;
+	}
+
+	/* Rotate the axis towards the other cone */
+	Float sinThetaR, cosThetaR;
+	math::sincos(thetaO - thetaA, &sinThetaR, &cosThetaR);
+	axis = normalize(axis * cosThetaR + cross(rotAxis / length, axis) * sinThetaR);
+	cosThetaO = std::cos(thetaO);
+}
+
+Float LightTree::LightBounds::importance(const Point &p, const Normal &n) const {
+	if (phi == 0)
+		return 0.0f;
+
+	/* Bounding sphere of the emitters */
+	Point center = aabb.getCenter();
+	Float radius2 = 0.25f * (aabb.max - aabb.min).lengthSquared();
+
+	Vector wi = p - center;
+	Float dist2 = wi.lengthSquared();
+	if (dist2 > 0)
+		wi /= std::sqrt(dist2);
+
+	/* Half-angle of the cone subtended by the bounding sphere */
+	Float sinThetaB = 0, cosThetaB = -1;
+	if (dist2 > radius2) {
+		Float sin2ThetaB = radius2 / dist2;
+		sinThetaB = std::sqrt(sin2ThetaB);
+		cosThetaB = math::safe_sqrt(1 - sin2ThetaB);
+	}
+
+	/* Smallest possible angle between the emission directions and
+	   the direction towards the reference point */
+	Float cosThetaW = dot(axis, wi),
+	      sinThetaW = math::safe_sqrt(1 - cosThetaW * cosThetaW),
+	      sinThetaO = math::safe_sqrt(1 - cosThetaO * cosThetaO);
+	Float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO),
+	      sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	Float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= cosThetaE)
+		return 0.0f;
+
+	/* Don't let the estimate blow up close to the emitters */
+	dist2 = std::max(std::max(dist2, radius2), (Float) (Epsilon * Epsilon));
+	Float result = phi * cosThetaP / dist2;
+
+	if (!n.isZero()) {
+		/* Account for foreshortening at the reference point */
+		Float cosThetaI = absDot(wi, n),
+		      sinThetaI = math::safe_sqrt(1 - cosThetaI * cosThetaI);
+		result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+
+	return std::max(result, (Float) 0.0f);
+}
+
+LightTree::LightTree(const ref_vector<Emitter> &emitters) : m_leafCount(0) {
+	ref<Timer> timer = new Timer();
+	std::vector<BuildItem> items;
+
+	for (size_t i=0; i<emitters.size(); ++i) {
+		const Emitter *emitter = emitters[i].get();
+
+		if (emitter->isEnvironmentEmitter() ||
+			(emitter->getType() & Emitter::EDeltaDirection)) {
+			m_emitterNodes[emitter] = NoNode;
+			m_infinite.push_back((uint32_t) i);
+			continue;
+		}
+
+		AABB aabb = emitter->getAABB();
+		if (!aabb.isValid()) {
+			m_emitterNodes[emitter] = NoNode;
+			m_infinite.push_back((uint32_t) i);
+			continue;
+		}
+
+		/* Estimate the emitted power. Emitters without any are never chosen */
+		PositionSamplingRecord pRec(0.0f);
+		Float phi = emitter->samplePosition(pRec, Point2(0.5f)).getLuminance()
+			* emitter->getSamplingWeight();
+		if (!(phi > 0))
+			continue;
+
+		BuildItem item;
+		item.bounds.aabb = aabb;
+		item.bounds.phi = phi;
+		emitter->getEmissionBounds(item.bounds.axis,
+			item.bounds.cosThetaO, item.bounds.cosThetaE);
+		item.centroid = aabb.getCenter();
+		item.emitter = (uint32_t) i;
+		items.push_back(item);
+	}
+
+	m_leafCount = items.size();
+	if (!items.empty()) {
+		m_nodes.reserve(2 * items.size() - 1);
+		m_parents.reserve(2 * items.size() - 1);
+		build(items, 0, items.size(), NoNode);
+		for (size_t i=0; i<m_nodes.size(); ++i) {
+			if (m_nodes[i].leaf)
+				m_emitterNodes[emitters[m_nodes[i].index].get()] = (uint32_t) i;
+		}
+	}
+
+	/* Treat the emitters without a finite extent like one more child of the root */
+	if (m_infinite.empty())
+		m_infiniteProb = 0.0f;
+	else if (items.empty())
+		m_infiniteProb = 1.0f;
+	else
+		m_infiniteProb = m_infinite.size() / (Float) (m_infinite.size() + 1);
+
+	Log(EDebug, "Built a light hierarchy over %i emitters (%i nodes, %i emitters "
+		"without a finite extent) in %i ms", (int) m_leafCount, (int) m_nodes.size(),
+		(int) m_infinite.size(), timer->getMilliseconds());
+}
+
+Float LightTree::evalCost(const LightBounds &bounds, const AABB &parentAABB, int axis) {
+	if (bounds.phi == 0)
+		return 0.0f;
+
+	/* Solid angle measure of the emission cones */
+	Float thetaO = math::safe_acos(bounds.cosThetaO),
+	      thetaE = math::safe_acos(bounds.cosThetaE),
+	      thetaW = std::min(thetaO + thetaE, (Float) M_PI),
+	      sinThetaO = math::safe_sqrt(1 - bounds.cosThetaO * bounds.cosThetaO);
+	Float measure = 2 * M_PI * (1 - bounds.cosThetaO) + 0.5f * M_PI *
+		(2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW)
+		 - 2 * thetaO * sinThetaO + bounds.cosThetaO);
+
+	/* Penalize splits along short axes of the parent */
+	Vector extents = parentAABB.getExtents();
+	Float kr = extents[parentAABB.getLargestAxis()] / extents[axis];
+
+	return bounds.phi * measure * kr * bounds.aabb.getSurfaceArea();
+}
+
+uint32_t LightTree::build(std::vector<BuildItem> &items, size_t start,
+		size_t end, uint32_t parent) {
+	uint32_t nodeIndex = (uint32_t) m_nodes.size();
+	m_nodes.push_back(Node());
+	m_parents.push_back(parent);
+
+	if (end - start == 1) {
+		Node &node = m_nodes[nodeIndex];
+		node.bounds = items[start].bounds;
+		node.index = items[start].emitter;
+		node.leaf = true;
+		return nodeIndex;
+	}
+
+	LightBounds bounds;
+	AABB centroidAABB;
+	for (size_t i=start; i<end; ++i) {
+		bounds.expandBy(items[i].bounds);
+		centroidAABB.expandBy(items[i].centroid);
+	}
+
+	/* Bucketed search for the split with the lowest cost */
+	Float bestCost = std::numeric_limits<Float>::infinity();
+	int bestAxis = -1, bestSplit = -1;
+	for (int axis=0; axis<3; ++axis) {
+		Float extent = centroidAABB.max[axis] - centroidAABB.min[axis];
+		if (extent <= 0)
+			continue;
+
+		Float scale = MTS_LIGHTTREE_BUCKETS / extent;
+		LightBounds buckets[MTS_LIGHTTREE_BUCKETS], above[MTS_LIGHTTREE_BUCKETS];
+		for (size_t i=start; i<end; ++i) {
+			int bucket = std::min((int) ((items[i].centroid[axis] -
+				centroidAABB.min[axis]) * scale), MTS_LIGHTTREE_BUCKETS - 1);
+			buckets[std::max(bucket, 0)].expandBy(items[i].bounds);
+		}
+
+		above[MTS_LIGHTTREE_BUCKETS - 1] = buckets[MTS_LIGHTTREE_BUCKETS - 1];
+		for (int i=MTS_LIGHTTREE_BUCKETS - 2; i>=0; --i) {
+			above[i] = above[i + 1];
+			above[i].expandBy(buckets[i]);
+		}
+
+		LightBounds below;
+		for (int split=0; split<MTS_LIGHTTREE_BUCKETS - 1; ++split) {
+			below.expandBy(buckets[split]);
+			if (below.phi == 0 || above[split + 1].phi == 0)
+				continue;
+			Float cost = evalCost(below, bounds.aabb, axis)
+				+ evalCost(above[split + 1], bounds.aabb, axis);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	size_t mid = start;
+	if (bestAxis != -1) {
+		Float scale = MTS_LIGHTTREE_BUCKETS /
+			(centroidAABB.max[bestAxis] - centroidAABB.min[bestAxis]);
+		size_t right = end;
+		while (mid < right) {
+			int bucket = (int) ((items[mid].centroid[bestAxis] -
+				centroidAABB.min[bestAxis]) * scale);
+			if (bucket <= bestSplit)
+				++mid;
+			else
+				std::swap(items[mid], items[--right]);
+		}
+	}
+
+	/* Fall back to an even split (e.g. for coincident emitters) */
+	if (mid == start || mid == end)
+		mid = (start + end) / 2;
+
+	build(items, start, mid, nodeIndex);
+	uint32_t rightChild = build(items, mid, end, nodeIndex);
+
+	Node &node = m_nodes[nodeIndex];
+	node.bounds = bounds;
+	node.index = rightChild;
+	node.leaf = false;
+	return nodeIndex;
+}
+
+int LightTree::sample(const Point &ref, const Normal &refN,
+		Float &sample, Float &pdf) const {
+	if (sample < m_infiniteProb) {
+		/* Uniformly choose an emitter without a finite extent */
+		size_t count = m_infinite.size();
+		sample *= count / m_infiniteProb;
+		size_t index = std::min((size_t) sample, count - 1);
+		sample = std::min(sample - index, ONE_MINUS_EPS);
+		pdf = m_infiniteProb / count;
+		return (int) m_infinite[index];
+	}
+
+	if (m_nodes.empty()) {
+		pdf = 0.0f;
+		return -1;
+	}
+
+	sample = std::min((sample - m_infiniteProb) / (1 - m_infiniteProb), ONE_MINUS_EPS);
+	pdf = 1 - m_infiniteProb;
+
+	uint32_t nodeIndex = 0;
+	while (true) {
+		const Node &node = m_nodes[nodeIndex];
+		if (node.leaf) {
+			if (node.bounds.importance(ref, refN) > 0)
+				return (int) node.index;
+			pdf = 0.0f;
+			return -1;
+		}
+
+		Float importance0 = m_nodes[nodeIndex + 1].bounds.importance(ref, refN),
+		      importance1 = m_nodes[node.index].bounds.importance(ref, refN);
+		if (importance0 == 0 && importance1 == 0) {
+			pdf = 0.0f;
+			return -1;
+		}
+
+		Float prob0 = importance0 / (importance0 + importance1);
+		if (sample < prob0) {
+			sample = std::min(sample / prob0, ONE_MINUS_EPS);
+			pdf *= prob0;
+			nodeIndex = nodeIndex + 1;
+		} else {
+			sample = std::min((sample - prob0) / (1 - prob0), ONE_MINUS_EPS);
+			pdf *= 1 - prob0;
+			nodeIndex = node.index;
+		}
+	}
+}
+
+Float LightTree::pdf(const Point &ref, const Normal &refN,
+		const Emitter *emitter) const {
+	boost::unordered_map<const Emitter *, uint32_t>::const_iterator it
+		= m_emitterNodes.find(emitter);
+	if (it == m_emitterNodes.end())
+		return 0.0f;
+	else if (it->second == NoNode)
+		return m_infiniteProb / m_infinite.size();
+
+	uint32_t nodeIndex = it->second;
+	if (m_nodes[nodeIndex].bounds.importance(ref, refN) == 0)
+		return 0.0f;
+
+	/* Walk up to the root, multiplying the probabilities of the choices */
+	Float pdf = 1 - m_infiniteProb;
+	for (uint32_t parent = m_parents[nodeIndex]; parent != NoNode;
+			nodeIndex = parent, parent = m_parents[parent]) {
+		Float importance0 = m_nodes[parent + 1].bounds.importance(ref, refN),
+		      importance1 = m_nodes[m_nodes[parent].index].bounds.importance(ref, refN);
+		if (importance0 == 0 && importance1 == 0)
+			return 0.0f;
+
+		Float prob0 = importance0 / (importance0 + importance1);
+		pdf *= (nodeIndex == parent + 1) ? prob0 : (1 - prob0);
+	}
+
+	return pdf;
+}
+
+std::string LightTree::toString() const {
+	std::ostringstream oss;
+	oss << "LightTree[" << endl
+		<< "  emitterCount = " << m_leafCount << "," << endl
+		<< "  infiniteEmitterCount = " << m_infinite.size() << "," << endl
+		<< "  nodeCount = " << m_nodes.size() << "," << endl
+		<< "  memory = " << memString(m_nodes.size() *
+				(sizeof(Node) + sizeof(uint32_t))) << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(LightTree, false, Object)
+MTS_NAMESPACE_END
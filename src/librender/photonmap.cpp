@@ -26,6 +26,7 @@ MTS_NAMESPACE_BEGIN
 PhotonMap::PhotonMap(size_t photonCount)
 		: m_kdtree(0, PhotonTree::ESlidingMidpoint), m_scale(1.0f) {
 	m_kdtree.reserve(photonCount);
+	m_positions[0] = m_positions[1] = m_positions[2] = NULL;
 	Assert(Photon::m_precompTableReady);
 }
 
@@ -39,6 +40,8 @@ PhotonMap::PhotonMap(Stream *stream, InstanceManager *manager)
 	m_kdtree.setAABB(AABB(stream));
 	for (size_t i=0; i<m_kdtree.size(); ++i)
 		m_kdtree[i] = Photon(stream);
+	m_positions[0] = m_positions[1] = m_positions[2] = NULL;
+	copyPositions();
 }
 
 void PhotonMap::serialize(Stream *stream, InstanceManager *manager) const {
@@ -53,6 +56,79 @@ void PhotonMap::serialize(Stream *stream, InstanceManager *manager) const {
 }
 
 PhotonMap::~PhotonMap() {
+	for (int i=0; i<3; ++i) {
+		if (m_positions[i])
+			freeAligned(m_positions[i]);
+	}
+}
+
+void PhotonMap::build(bool recomputeAABB) {
+	m_kdtree.build(recomputeAABB);
+	copyPositions();
+}
+
+void PhotonMap::copyPositions() {
+	/* Leave room for reading a full SSE vector past the last photon */
+	size_t size = m_kdtree.size(), padded = size + 3;
+	for (int i=0; i<3; ++i) {
+		if (m_positions[i])
+			freeAligned(m_positions[i]);
+		m_positions[i] = static_cast<Float *>(allocAligned(padded * sizeof(Float)));
+		for (size_t j=0; j<size; ++j)
+			m_positions[i][j] = m_kdtree[j].getPosition()[i];
+		for (size_t j=size; j<padded; ++j)
+			m_positions[i][j] = 0.0f;
+	}
+}
+
+/// k-nearest neighbor search on top of \ref PhotonMap::traverse()
+struct NearestNeighborQuery {
+	typedef PhotonMap::SearchResult SearchResult;
+
+	inline NearestNeighborQuery(SearchResult *results, size_t k,
+		Float sqrSearchRadius) : results(results), k(k), resultCount(0),
+		sqrSearchRadius(sqrSearchRadius), isHeap(false) { }
+
+	inline void operator()(PhotonMap::IndexType index, Float distSquared) {
+		/* The radius may have been reduced by another photon of the same group */
+		if (distSquared >= sqrSearchRadius)
+			return;
+
+		/* Switch to a max-heap when the available search
+		   result space is exhausted */
+		if (resultCount < k) {
+			results[resultCount++] = SearchResult(distSquared, index);
+			return;
+		}
+
+		if (!isHeap) {
+			std::make_heap(results, results + resultCount,
+				PhotonMap::PhotonTree::SearchResultComparator());
+			isHeap = true;
+		}
+
+		/* Add the new photon, remove the one that is farthest away */
+		SearchResult *end = results + resultCount + 1;
+		results[resultCount] = SearchResult(distSquared, index);
+		std::push_heap(results, end, PhotonMap::PhotonTree::SearchResultComparator());
+		std::pop_heap(results, end, PhotonMap::PhotonTree::SearchResultComparator());
+
+		/* Reduce the search radius accordingly */
+		sqrSearchRadius = results[0].distSquared;
+	}
+
+	SearchResult *results;
+	size_t k, resultCount;
+	Float sqrSearchRadius;
+	bool isHeap;
+};
+
+size_t PhotonMap::nnSearch(const Point &p, Float &sqrSearchRadius,
+		size_t k, SearchResult *results) const {
+	NearestNeighborQuery query(results, k, sqrSearchRadius);
+	traverse(p, query.sqrSearchRadius, query);
+	sqrSearchRadius = query.sqrSearchRadius;
+	return query.resultCount;
 }
 
 std::string PhotonMap::toString() const {
@@ -187,7 +263,7 @@ struct RawRadianceQuery {
 size_t PhotonMap::estimateRadianceRaw(const Intersection &its,
 		Float searchRadius, Spectrum &result, int maxDepth) const {
 	RawRadianceQuery query(its, maxDepth);
-	size_t count = m_kdtree.executeQuery(its.p, searchRadius, query);
+	size_t count = executeQuery(its.p, searchRadius, query);
 	result = query.result;
 	return count;
 }
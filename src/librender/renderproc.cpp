@@ -145,15 +145,70 @@ ref<WorkProcessor> BlockedRenderProcess::createWorkProcessor() const {
 //  process   ü   
 void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelled) {
 	const ImageBlock *block = static_cast<const ImageBlock *>(result);
-	UniqueLock lock(m_resultMutex);
+
 	/// ü film block  Ѵ (block index blockȿ Ǿִ .)
-	m_film->put(block);
+	if (m_film->supportsConcurrentPut()) {
+		/* Only blocks that overlap the same tiles are merged one after the other */
+		lockTiles(block);
+		m_film->put(block);
+		unlockTiles(block);
+	} else {
+		LockGuard lock(m_resultMutex);
+		m_film->put(block);
+	}
 
+	UniqueLock lock(m_resultMutex);
 	m_progress->update(++m_resultCount);
 	lock.unlock();
 	m_queue->signalWorkEnd(m_parent, block, cancelled);
 }
 
+void BlockedRenderProcess::getTileRange(const ImageBlock *block,
+		Point2i &min, Point2i &max) const {
+	const int borderSize = block->getBorderSize();
+	const Vector2i start = block->getOffset() - m_offset - Vector2i(borderSize);
+	const Vector2i end = start + block->getSize() + Vector2i(2 * borderSize - 1);
+
+	for (int i=0; i<2; ++i) {
+		min[i] = math::clamp(math::floorToInt(start[i] / (Float) m_blockSize), 0, m_numBlocks[i] - 1);
+		max[i] = math::clamp(math::floorToInt(end[i] / (Float) m_blockSize), 0, m_numBlocks[i] - 1);
+	}
+}
+
+void BlockedRenderProcess::lockTiles(const ImageBlock *block) {
+	Point2i min, max;
+	getTileRange(block, min, max);
+	for (int y=min.y; y<=max.y; ++y)
+		for (int x=min.x; x<=max.x; ++x)
+			m_tileMutexes[y * m_numBlocks.x + x]->lock();
+}
+
+void BlockedRenderProcess::unlockTiles(const ImageBlock *block) {
+	Point2i min, max;
+	getTileRange(block, min, max);
+	for (int y=max.y; y>=min.y; --y)
+		for (int x=max.x; x>=min.x; --x)
+			m_tileMutexes[y * m_numBlocks.x + x]->unlock();
+}
+
+void BlockedRenderProcess::lockFilm() {
+	if (m_film->supportsConcurrentPut()) {
+		for (size_t i=0; i<m_tileMutexes.size(); ++i)
+			m_tileMutexes[i]->lock();
+	} else {
+		m_resultMutex->lock();
+	}
+}
+
+void BlockedRenderProcess::unlockFilm() {
+	if (m_film->supportsConcurrentPut()) {
+		for (size_t i=m_tileMutexes.size(); i>0; --i)
+			m_tileMutexes[i-1]->unlock();
+	} else {
+		m_resultMutex->unlock();
+	}
+}
+
 // Takes a pre-allocated \ref WorkUnit instance of
 // the appropriate sub - type and size and
 // fills it with the appropriate content.
@@ -183,6 +238,9 @@ void BlockedRenderProcess::bindResource(const std::string &name, int id) {
 			Log(EError, "The block size must be larger than the image reconstruction filter radius!");
 
 		BlockedImageProcess::init(offset, size, m_blockSize);
+		m_tileMutexes.resize(m_numBlocksTotal);
+		for (size_t i=0; i<m_tileMutexes.size(); ++i)
+			m_tileMutexes[i] = new Mutex();
 		if (m_progress)
 			delete m_progress;
 		m_progress = new ProgressReporter("Rendering", m_numBlocksTotal, m_parent);
@@ -64,6 +64,10 @@ ref<Sampler> Sampler::clone() {
 	return NULL;
 }
 
+bool Sampler::isDeterministic() const {
+	return false;
+}
+
 void Sampler::setSampleIndex(size_t sampleIndex) {
 	m_sampleIndex = sampleIndex;
 	m_dimension1DArray = m_dimension2DArray = 0;
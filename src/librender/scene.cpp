@@ -30,7 +30,8 @@ MTS_NAMESPACE_BEGIN
 // ===========================================================================
 
 Scene::Scene()
- : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE) {
+ : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE),
+   m_emitterSampling(EAutoEmitterSampling) {
 	m_kdtree = new ShapeKDTree();
 	m_sourceFile = new fs::path();
 	m_destinationFile = new fs::path();
@@ -76,12 +77,57 @@ Scene::Scene(const Properties &props)
 	   in succession before a leaf node will be created.*/
 	if (props.hasProperty("kdMaxBadRefines"))
 		m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+	/* kd-tree construction: Directory, in which built trees are cached. They
+	   are memory-mapped instead of being rebuilt when the geometry and the
+	   construction parameters are unchanged. */
+	if (props.hasProperty("kdCacheDir"))
+		m_kdtree->setCacheDirectory(props.getString("kdCacheDir"));
+	/* Acceleration data structure used for ray intersection queries:
+	   'kdtree' (the default) or 'bvh'. The BVH is much faster to build
+	   and uses less memory, while the kd-tree usually traces rays faster. */
+	std::string accel = props.getString("accel", "kdtree");
+	if (accel == "bvh") {
+		m_bvh = new ShapeBVH();
+		/* BVH construction: Maximum number of primitives per leaf node */
+		if (props.hasProperty("bvhLeafSize"))
+			m_bvh->setLeafSize(props.getInteger("bvhLeafSize"));
+		/* BVH construction: Number of bins of the SAH split search */
+		if (props.hasProperty("bvhBinCount"))
+			m_bvh->setBinCount(props.getInteger("bvhBinCount"));
+		/* BVH construction: use multiple processors? */
+		if (props.hasProperty("bvhParallelBuild"))
+			m_bvh->setParallelBuild(props.getBoolean("bvhParallelBuild"));
+		/* BVH animation: relative SAH cost increase, at which updateGeometry()
+		   rebuilds the BVH instead of refitting it */
+		if (props.hasProperty("bvhRebuildThreshold"))
+			m_bvh->setRebuildThreshold(props.getFloat("bvhRebuildThreshold"));
+	} else if (accel != "kdtree") {
+		Log(EError, "Unknown acceleration data structure \"%s\" (must be "
+			"\"kdtree\" or \"bvh\")", accel.c_str());
+	}
+	/* Strategy for choosing emitters in direct illumination sampling:
+	   'power' chooses them proportional to their sampling weight, 'tree'
+	   uses a light hierarchy, which accounts for their position and
+	   orientation relative to the shading point. 'auto' (the default)
+	   only builds the hierarchy when the scene contains many emitters. */
+	std::string emitterSampling = props.getString("emitterSampling", "auto");
+	if (emitterSampling == "power") {
+		m_emitterSampling = EPowerEmitterSampling;
+	} else if (emitterSampling == "tree") {
+		m_emitterSampling = ETreeEmitterSampling;
+	} else if (emitterSampling == "auto") {
+		m_emitterSampling = EAutoEmitterSampling;
+	} else {
+		Log(EError, "Unknown emitter sampling strategy \"%s\" (must be "
+			"\"power\", \"tree\" or \"auto\")", emitterSampling.c_str());
+	}
 	m_sourceFile = new fs::path();
 	m_destinationFile = new fs::path();
 }
 
 Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 	m_kdtree = scene->m_kdtree;
+	m_bvh = scene->m_bvh;
 	m_blockSize = scene->m_blockSize;
 	m_aabb = scene->m_aabb;
 	m_environmentEmitter = scene->m_environmentEmitter;
@@ -90,6 +136,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 	m_sourceFile = new fs::path(*scene->m_sourceFile);
 	m_destinationFile = new fs::path(*scene->m_destinationFile);
 	m_emitterPDF = scene->m_emitterPDF;
+	m_lightTree = scene->m_lightTree;
+	m_emitterSampling = scene->m_emitterSampling;
 	m_shapes = scene->m_shapes;
 	m_sensors = scene->m_sensors;
 	m_meshes = scene->m_meshes;
@@ -116,6 +164,15 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
 	m_kdtree->setParallelBuild(stream->readBool());
 	m_kdtree->setRetract(stream->readBool());
 	m_kdtree->setMaxBadRefines(stream->readUInt());
+	m_kdtree->setCacheDirectory(stream->readString());
+	if (stream->readBool()) {
+		m_bvh = new ShapeBVH();
+		m_bvh->setLeafSize(stream->readInt());
+		m_bvh->setBinCount(stream->readInt());
+		m_bvh->setParallelBuild(stream->readBool());
+		m_bvh->setRebuildThreshold(stream->readFloat());
+	}
+	m_emitterSampling = (EEmitterSampling) stream->readInt();
 	m_blockSize = stream->readUInt();
 	m_degenerateSensor = stream->readBool();
 	m_degenerateEmitters = stream->readBool();
@@ -182,6 +239,15 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
 	stream->writeBool(m_kdtree->getParallelBuild());
 	stream->writeBool(m_kdtree->getRetract());
 	stream->writeUInt(m_kdtree->getMaxBadRefines());
+	stream->writeString(m_kdtree->getCacheDirectory().string());
+	stream->writeBool(m_bvh.get() != NULL);
+	if (m_bvh.get()) {
+		stream->writeInt(m_bvh->getLeafSize());
+		stream->writeInt(m_bvh->getBinCount());
+		stream->writeBool(m_bvh->getParallelBuild());
+		stream->writeFloat(m_bvh->getRebuildThreshold());
+	}
+	stream->writeInt(m_emitterSampling);
 	stream->writeUInt(m_blockSize);
 	stream->writeBool(m_degenerateSensor);
 	stream->writeBool(m_degenerateEmitters);
@@ -317,10 +383,40 @@ void Scene::configure() {
 
 void Scene::invalidate() {
 	m_kdtree = new ShapeKDTree();
+	if (m_bvh) {
+		ref<ShapeBVH> bvh = new ShapeBVH();
+		bvh->setLeafSize(m_bvh->getLeafSize());
+		bvh->setBinCount(m_bvh->getBinCount());
+		bvh->setParallelBuild(m_bvh->getParallelBuild());
+		bvh->setRebuildThreshold(m_bvh->getRebuildThreshold());
+		m_bvh = bvh;
+	}
+}
+
+void Scene::updateGeometry() {
+	if (!m_bvh || !m_bvh->isBuilt())
+		Log(EError, "updateGeometry(): only supported by initialized "
+			"scenes that use a BVH (accel=\"bvh\")");
+
+	/* Bounding boxes and surface areas of the meshes */
+	for (size_t i=0; i<m_meshes.size(); ++i) {
+		TriMesh *mesh = m_meshes[i];
+		mesh->updateGeometry();
+		/* Area emitters recompute their power from the new surface area */
+		if (mesh->isEmitter())
+			mesh->getEmitter()->configure();
+	}
+
+	m_bvh->update();
+	m_aabb = getGeometryAABB();
+
+	/* The light hierarchy depends on the bounds and power of the emitters */
+	if (m_lightTree.get())
+		m_lightTree = new LightTree(m_emitters);
 }
 
 void Scene::initialize() {
-	if (!m_kdtree->isBuilt()) {
+	if (m_bvh ? !m_bvh->isBuilt() : !m_kdtree->isBuilt()) {
 		/* Expand all geometry */
 		ref_vector<Shape> temp;
 		temp.reserve(m_shapes.size());
@@ -341,10 +437,13 @@ void Scene::initialize() {
 				SIZE_T_FMT ".", primitiveCount, effPrimitiveCount);
 		}
 
-		/* Build the kd-tree */
-		m_kdtree->build();
+		/* Build the acceleration data structure */
+		if (m_bvh)
+			m_bvh->build();
+		else
+			m_kdtree->build();
 
-		m_aabb = m_kdtree->getAABB();
+		m_aabb = getGeometryAABB();
 	}
 
 	/* Make sure that there are no duplicates */
@@ -378,13 +477,22 @@ void Scene::initialize() {
 			m_emitterPDF.append(it->get()->getSamplingWeight());
 
 		m_emitterPDF.normalize();
+		if (m_emitterPDF.size() > MTS_PMF_ALIAS_THRESHOLD)
+			m_emitterPDF.buildAliasTable();
+
+		/* Optionally build a light hierarchy for direct illumination sampling */
+		m_lightTree = NULL;
+		if (m_emitterSampling == ETreeEmitterSampling ||
+			(m_emitterSampling == EAutoEmitterSampling &&
+			 m_emitters.size() >= MTS_LIGHTTREE_AUTO_THRESHOLD))
+			m_lightTree = new LightTree(m_emitters);
 	}
 
 	initializeBidirectional();
 }
 
 void Scene::initializeBidirectional() {
-	m_aabb = m_kdtree->getAABB();
+	m_aabb = getGeometryAABB();
 	m_degenerateEmitters = true;
 	m_specialShapes.clear();
 
@@ -586,7 +694,10 @@ void Scene::addShape(Shape *shape) {
 		if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
 			m_meshes.push_back(static_cast<TriMesh *>(shape));
 
-		m_kdtree->addShape(shape);
+		if (m_bvh)
+			m_bvh->addShape(shape);
+		else
+			m_kdtree->addShape(shape);
 		m_shapes.push_back(shape);
 	}
 }
@@ -599,6 +710,7 @@ std::string Scene::toString() const {
 		<< "  sampler = " << indent(m_sampler.toString()) << "," << endl
 		<< "  integrator = " << indent(m_integrator.toString()) << "," << endl
 		<< "  kdtree = " << indent(m_kdtree.toString()) << "," << endl
+		<< "  bvh = " << indent(m_bvh.toString()) << "," << endl
 		<< "  environmentEmitter = " << indent(m_environmentEmitter.toString()) << "," << endl
 		<< "  shapes = " << indent(containerToString(m_shapes.begin(), m_shapes.end())) << "," << endl
 		<< "  emitters = " << indent(containerToString(m_emitters.begin(), m_emitters.end())) << "," << endl
@@ -825,21 +937,34 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
 //                Emission and direct illumination sampling
 // ===========================================================================
 
+const Emitter *Scene::sampleEmitterDiscrete(const DirectSamplingRecord &dRec,
+		Float &sample, Float &pdf) const {
+	if (m_lightTree.get()) {
+		int index = m_lightTree->sample(dRec.ref, dRec.refN, sample, pdf);
+		return index >= 0 ? m_emitters[index].get() : NULL;
+	}
+
+	return m_emitters[m_emitterPDF.sampleReuse(sample, pdf)].get();
+}
+
 Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
 		const Point2 &_sample, bool testVisibility) const {
 	Point2 sample(_sample);
 
 	/* Randomly pick an emitter */
 	Float emPdf;
-	size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-	const Emitter *emitter = m_emitters[index].get();
+	const Emitter *emitter = sampleEmitterDiscrete(dRec, sample.x, emPdf);
+	if (!emitter) {
+		dRec.pdf = 0.0f;
+		return Spectrum(0.0f);
+	}
 	Spectrum value = emitter->sampleDirect(dRec, sample);
 
 	if (dRec.pdf != 0) {
 		if (testVisibility) {
 			Ray ray(dRec.ref, dRec.d, Epsilon,
 					dRec.dist*(1-ShadowEpsilon), dRec.time);
-			if (m_kdtree->rayIntersect(ray))
+			if (rayIntersect(ray))
 				return Spectrum(0.0f);
 		}
 		dRec.object = emitter;
@@ -857,8 +982,11 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
 	/* Randomly pick an emitter */
 	Float emPdf;
-	size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-	const Emitter *emitter = m_emitters[index].get();
+	const Emitter *emitter = sampleEmitterDiscrete(dRec, sample.x, emPdf);
+	if (!emitter) {
+		dRec.pdf = 0.0f;
+		return Spectrum(0.0f);
+	}
 	Spectrum value = emitter->sampleDirect(dRec, sample);
 
 	if (dRec.pdf != 0) {
@@ -880,8 +1008,11 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
 	/* Randomly pick an emitter */
 	Float emPdf;
-	size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-	const Emitter *emitter = m_emitters[index].get();
+	const Emitter *emitter = sampleEmitterDiscrete(dRec, sample.x, emPdf);
+	if (!emitter) {
+		dRec.pdf = 0.0f;
+		return Spectrum(0.0f);
+	}
 	Spectrum value = emitter->sampleDirect(dRec, sample);
 
 	if (dRec.pdf != 0) {
@@ -905,7 +1036,7 @@ Spectrum Scene::sampleSensorDirect(DirectSamplingRecord &dRec,
 		if (testVisibility) {
 			Ray ray(dRec.ref, dRec.d, Epsilon,
 					dRec.dist*(1-ShadowEpsilon), dRec.time);
-			if (m_kdtree->rayIntersect(ray))
+			if (rayIntersect(ray))
 				return Spectrum(0.0f);
 		}
 		dRec.object = m_sensor.get();
@@ -948,7 +1079,9 @@ Spectrum Scene::sampleAttenuatedSensorDirect(DirectSamplingRecord &dRec,
 
 Float Scene::pdfEmitterDirect(const DirectSamplingRecord &dRec) const {
 	const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
-	return emitter->pdfDirect(dRec) * pdfEmitterDiscrete(emitter);
+	Float emPdf = m_lightTree.get() ? m_lightTree->pdf(dRec.ref, dRec.refN, emitter)
+		: pdfEmitterDiscrete(emitter);
+	return emPdf == 0 ? 0.0f : emitter->pdfDirect(dRec) * emPdf;
 }
 
 Float Scene::pdfSensorDirect(const DirectSamplingRecord &dRec) const {
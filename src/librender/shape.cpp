@@ -250,5 +250,10 @@ ref<TriMesh> Shape::createTriMesh() {
 	return NULL;
 }
 
+void Shape::getNormalCone(Vector &axis, Float &cosTheta) const {
+	axis = Vector(0, 0, 1);
+	cosTheta = -1;
+}
+
 MTS_IMPLEMENT_CLASS(Shape, true, ConfigurableObject)
 MTS_NAMESPACE_END
@@ -0,0 +1,813 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/shapebvh.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/thread.h>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter raysTraced("BVH", "Normal rays traced");
+static StatsCounter shadowRaysTraced("BVH", "Shadow rays traced");
+
+/// Round a bound down to the next single precision value
+static inline float roundDown(Float value) {
+	float result = (float) value;
+#if !defined(SINGLE_PRECISION)
+	if ((Float) result > value)
+		result = nextafterf(result, -std::numeric_limits<float>::infinity());
+#endif
+	return result;
+}
+
+/// Round a bound up to the next single precision value
+static inline float roundUp(Float value) {
+	float result = (float) value;
+#if !defined(SINGLE_PRECISION)
+	if ((Float) result < value)
+		result = nextafterf(result, std::numeric_limits<float>::infinity());
+#endif
+	return result;
+}
+
+/// Compute the union of the bounds of all children of a node
+static AABB getNodeBounds(const ShapeBVH::Node &node) {
+	AABB aabb;
+	for (int i=0; i<MTS_BVH_WIDTH; ++i) {
+		if (node.count[i] == 0 && node.child[i] == 0)
+			continue; /* Unused slot */
+		aabb.expandBy(Point(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]));
+		aabb.expandBy(Point(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]));
+	}
+	return aabb;
+}
+
+// ===========================================================================
+//                           Tree construction
+// ===========================================================================
+
+/**
+ * \brief Top-down binned SAH builder
+ *
+ * The builder reorders a shared array of primitive indices in place.
+ * Subtrees cover disjoint index ranges, which is what allows them to
+ * be built concurrently.
+ */
+class ShapeBVH::BVHBuilder {
+public:
+	/// Contiguous range of primitive indices together with its bounds
+	struct Range {
+		uint32_t begin, end;
+		AABB bounds;
+		AABB centroidBounds;
+
+		inline uint32_t size() const { return end - begin; }
+	};
+
+	/// Subtree that is built separately by one of the builder threads
+	struct Task {
+		uint32_t node;
+		int slot;
+		int depth;
+		Range range;
+		std::vector<Node> nodes;
+	};
+
+	/// Is a primitive's centroid on the left side of a binned split?
+	struct SplitPredicate {
+		const AABB *primBounds;
+		int axis, binCount, splitBin;
+		Float min, scale;
+
+		SplitPredicate(const AABB *primBounds, int axis, int binCount,
+			int splitBin, Float min, Float scale) : primBounds(primBounds),
+			axis(axis), binCount(binCount), splitBin(splitBin), min(min), scale(scale) { }
+
+		inline bool operator()(uint32_t idx) const {
+			Float center = primBounds[idx].getCenter()[axis];
+			return std::min(binCount - 1, (int) ((center - min) * scale)) <= splitBin;
+		}
+	};
+
+	/// Order primitives by their centroid along an axis
+	struct CentroidOrder {
+		const AABB *primBounds;
+		int axis;
+
+		CentroidOrder(const AABB *primBounds, int axis)
+			: primBounds(primBounds), axis(axis) { }
+
+		inline bool operator()(uint32_t a, uint32_t b) const {
+			return primBounds[a].getCenter()[axis] < primBounds[b].getCenter()[axis];
+		}
+	};
+
+	/// Order tasks by decreasing size
+	struct TaskOrder {
+		inline bool operator()(const Task *a, const Task *b) const {
+			return a->range.size() > b->range.size();
+		}
+	};
+
+	BVHBuilder(const AABB *primBounds, uint32_t *indices, int leafSize, int binCount)
+		: m_primBounds(primBounds), m_indices(indices),
+		  m_leafSize(leafSize), m_binCount(binCount) { }
+
+	/// Compute the bounds of a range
+	void computeBounds(Range &range) const {
+		range.bounds.reset();
+		range.centroidBounds.reset();
+		for (uint32_t i=range.begin; i<range.end; ++i) {
+			const AABB &aabb = m_primBounds[m_indices[i]];
+			range.bounds.expandBy(aabb);
+			range.centroidBounds.expandBy(aabb.getCenter());
+		}
+	}
+
+	/**
+	 * \brief Split a range into two nonempty halves
+	 *
+	 * Uses the binned SAH over all three axes. Below a certain depth and
+	 * when all centroids coincide, the split is made at the object median
+	 * instead, which bounds the depth of the tree.
+	 */
+	void split(const Range &range, int depth, Range &left, Range &right) const {
+		Assert(range.size() >= 2);
+		const AABB &cb = range.centroidBounds;
+		int axis = cb.getLargestAxis();
+		Float extent = cb.max[axis] - cb.min[axis];
+		uint32_t *indices = m_indices;
+		uint32_t mid = range.begin;
+
+		if (extent > 0 && depth < MTS_BVH_MAXDEPTH / 2) {
+			const int binCount = m_binCount;
+			std::vector<AABB> binBounds(3 * binCount);
+			std::vector<uint32_t> binCounts(3 * binCount, 0);
+			Vector scale;
+
+			for (int dim=0; dim<3; ++dim) {
+				Float dimExtent = cb.max[dim] - cb.min[dim];
+				scale[dim] = dimExtent > 0 ? binCount / dimExtent : 0;
+			}
+
+			for (uint32_t i=range.begin; i<range.end; ++i) {
+				const AABB &aabb = m_primBounds[indices[i]];
+				Point center = aabb.getCenter();
+				for (int dim=0; dim<3; ++dim) {
+					int bin = std::min(binCount - 1,
+						(int) ((center[dim] - cb.min[dim]) * scale[dim]));
+					binBounds[dim * binCount + bin].expandBy(aabb);
+					binCounts[dim * binCount + bin]++;
+				}
+			}
+
+			/* Sweep over the bins to find the split with the lowest cost */
+			std::vector<Float> rightCost(binCount);
+			Float bestCost = std::numeric_limits<Float>::infinity();
+			int bestAxis = -1, bestBin = -1;
+			for (int dim=0; dim<3; ++dim) {
+				if (scale[dim] == 0)
+					continue;
+				const AABB *bounds = &binBounds[dim * binCount];
+				const uint32_t *counts = &binCounts[dim * binCount];
+
+				AABB aabb;
+				uint32_t count = 0;
+				for (int i=binCount-1; i>0; --i) {
+					aabb.expandBy(bounds[i]);
+					count += counts[i];
+					rightCost[i] = count > 0 ? count * aabb.getSurfaceArea() : 0;
+				}
+
+				aabb.reset();
+				count = 0;
+				for (int i=0; i<binCount-1; ++i) {
+					aabb.expandBy(bounds[i]);
+					count += counts[i];
+					Float cost = (count > 0 ? count * aabb.getSurfaceArea() : 0)
+						+ rightCost[i+1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = dim;
+						bestBin = i;
+					}
+				}
+			}
+
+			if (bestAxis != -1) {
+				SplitPredicate pred(m_primBounds, bestAxis, binCount,
+					bestBin, cb.min[bestAxis], scale[bestAxis]);
+				mid = (uint32_t) (std::partition(indices + range.begin,
+					indices + range.end, pred) - indices);
+			}
+		}
+
+		if (mid == range.begin || mid == range.end) {
+			/* Fall back to an object median split */
+			mid = range.begin + range.size() / 2;
+			std::nth_element(indices + range.begin, indices + mid,
+				indices + range.end, CentroidOrder(m_primBounds, axis));
+		}
+
+		left.begin = range.begin; left.end = mid;
+		right.begin = mid; right.end = range.end;
+		computeBounds(left);
+		computeBounds(right);
+	}
+
+	/**
+	 * \brief Recursively build the subtree for a range and append its nodes
+	 *
+	 * When \c tasks is given, subtrees with fewer than \c taskSize primitives
+	 * are not built right away but deferred to the builder threads.
+	 *
+	 * \return The index of the subtree's root within \c nodes
+	 */
+	uint32_t build(std::vector<Node> &nodes, const Range &range, int depth,
+			std::vector<Task *> *tasks, uint32_t taskSize) const {
+		Range children[MTS_BVH_WIDTH];
+		int childCount = 1;
+		children[0] = range;
+
+		/* Repeatedly split the child with the largest surface area */
+		while (childCount < MTS_BVH_WIDTH) {
+			int best = -1;
+			Float bestArea = -1;
+			for (int i=0; i<childCount; ++i) {
+				if (children[i].size() <= (uint32_t) m_leafSize)
+					continue;
+				Float area = children[i].bounds.getSurfaceArea();
+				if (area > bestArea) {
+					bestArea = area;
+					best = i;
+				}
+			}
+			if (best == -1)
+				break;
+			Range left, right;
+			split(children[best], depth, left, right);
+			children[best] = left;
+			children[childCount++] = right;
+		}
+
+		uint32_t index = (uint32_t) nodes.size();
+		nodes.push_back(Node());
+		initNode(nodes[index]);
+
+		for (int i=0; i<childCount; ++i) {
+			const Range &child = children[i];
+			uint32_t childIndex = 0, count = 0;
+			if (child.size() <= (uint32_t) m_leafSize) {
+				childIndex = child.begin;
+				count = child.size();
+			} else if (tasks && child.size() < taskSize) {
+				Task *task = new Task();
+				task->node = index;
+				task->slot = i;
+				task->depth = depth + 1;
+				task->range = child;
+				tasks->push_back(task);
+			} else {
+				childIndex = build(nodes, child, depth + 1, tasks, taskSize);
+			}
+
+			Node &node = nodes[index];
+			for (int dim=0; dim<3; ++dim) {
+				node.bounds[dim][i] = roundDown(child.bounds.min[dim]);
+				node.bounds[dim+3][i] = roundUp(child.bounds.max[dim]);
+			}
+			node.child[i] = childIndex;
+			node.count[i] = count;
+		}
+
+		return index;
+	}
+
+	/// Initialize a node without any children
+	static void initNode(Node &node) {
+		for (int i=0; i<MTS_BVH_WIDTH; ++i) {
+			for (int dim=0; dim<3; ++dim) {
+				node.bounds[dim][i] = std::numeric_limits<float>::infinity();
+				node.bounds[dim+3][i] = -std::numeric_limits<float>::infinity();
+			}
+			node.child[i] = node.count[i] = 0;
+		}
+	}
+
+	/// Builder thread, which processes deferred subtrees until none are left
+	class BuildThread : public Thread {
+	public:
+		BuildThread(int id, const BVHBuilder *builder,
+			std::vector<Task *> &tasks, volatile int32_t *nextTask)
+			: Thread(formatString("bvh%i", id)), m_builder(builder),
+			  m_tasks(tasks), m_nextTask(nextTask) {
+			setCritical(true);
+		}
+
+		void run() {
+			while (true) {
+				int32_t idx = atomicAdd(m_nextTask, 1) - 1;
+				if (idx >= (int32_t) m_tasks.size())
+					break;
+				Task *task = m_tasks[idx];
+				m_builder->build(task->nodes, task->range, task->depth, NULL, 0);
+			}
+		}
+
+	protected:
+		virtual ~BuildThread() { }
+
+	private:
+		const BVHBuilder *m_builder;
+		std::vector<Task *> &m_tasks;
+		volatile int32_t *m_nextTask;
+	};
+
+private:
+	const AABB *m_primBounds;
+	uint32_t *m_indices;
+	int m_leafSize;
+	int m_binCount;
+};
+
+ShapeBVH::ShapeBVH() : m_nodes(NULL), m_primitives(NULL), m_nodeCount(0),
+	m_primitiveCount(0), m_buildCost(0), m_rebuildThreshold(MTS_BVH_REBUILD_THRESHOLD),
+	m_leafSize(4), m_binCount(16), m_parallelBuild(true) {
+}
+
+ShapeBVH::~ShapeBVH() {
+	clear();
+	for (size_t i=0; i<m_shapes.size(); ++i)
+		m_shapes[i]->decRef();
+}
+
+void ShapeBVH::clear() {
+	if (m_nodes)
+		freeAligned(m_nodes);
+	if (m_primitives)
+		freeAligned(m_primitives);
+	m_nodes = NULL;
+	m_primitives = NULL;
+	m_nodeCount = 0;
+}
+
+void ShapeBVH::addShape(const Shape *shape) {
+	Assert(!isBuilt());
+	if (shape->isCompound())
+		Log(EError, "Cannot add compound shapes to a BVH - expand them first!");
+	if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+		m_primitiveCount += static_cast<const TriMesh *>(shape)->getTriangleCount();
+	else
+		m_primitiveCount += 1;
+	shape->incRef();
+	m_shapes.push_back(shape);
+}
+
+ShapeBVH::Node *ShapeBVH::buildNodes(const AABB *primBounds, uint32_t primCount,
+		uint32_t *order, int leafSize, int binCount, bool parallel,
+		size_t &nodeCount) {
+	if (leafSize < 1 || binCount < 2)
+		SLog(EError, "Invalid BVH construction parameters!");
+
+	for (uint32_t i=0; i<primCount; ++i)
+		order[i] = i;
+
+	BVHBuilder builder(primBounds, order, leafSize, binCount);
+	BVHBuilder::Range range;
+	range.begin = 0;
+	range.end = primCount;
+	builder.computeBounds(range);
+
+	/* Build the upper levels and collect the remaining subtrees */
+	std::vector<Node> nodes;
+	std::vector<BVHBuilder::Task *> tasks;
+	int coreCount = parallel ? getCoreCount() : 1;
+	if (primCount == 0) {
+		nodes.push_back(Node());
+		BVHBuilder::initNode(nodes[0]);
+	} else if (coreCount > 1) {
+		uint32_t taskSize = std::max(primCount / (uint32_t) (16 * coreCount),
+			(uint32_t) 4096);
+		builder.build(nodes, range, 0, &tasks, taskSize);
+	} else {
+		builder.build(nodes, range, 0, NULL, 0);
+	}
+
+	if (!tasks.empty()) {
+		/* Process the largest subtrees first for better load balancing */
+		std::sort(tasks.begin(), tasks.end(), BVHBuilder::TaskOrder());
+
+		volatile int32_t nextTask = 0;
+		ref_vector<BVHBuilder::BuildThread> threads;
+		for (int i=0; i<coreCount; ++i) {
+			threads.push_back(new BVHBuilder::BuildThread(i, &builder, tasks, &nextTask));
+			threads[i]->start();
+		}
+		for (int i=0; i<coreCount; ++i)
+			threads[i]->join();
+	}
+
+	/* Concatenate the node lists */
+	nodeCount = nodes.size();
+	for (size_t i=0; i<tasks.size(); ++i)
+		nodeCount += tasks[i]->nodes.size();
+
+	Node *result = static_cast<Node *>(allocAligned(nodeCount * sizeof(Node)));
+	memcpy(result, &nodes[0], nodes.size() * sizeof(Node));
+	size_t offset = nodes.size();
+	for (size_t i=0; i<tasks.size(); ++i) {
+		BVHBuilder::Task *task = tasks[i];
+		Node *target = result + offset;
+		memcpy(target, &task->nodes[0], task->nodes.size() * sizeof(Node));
+
+		/* Rebase the inner children. Unused slots have a zero child index
+		   (the subtree root is never anyone's child) and must keep it */
+		for (size_t j=0; j<task->nodes.size(); ++j)
+			for (int k=0; k<MTS_BVH_WIDTH; ++k)
+				if (target[j].count[k] == 0 && target[j].child[k] != 0)
+					target[j].child[k] += (uint32_t) offset;
+		result[task->node].child[task->slot] = (uint32_t) offset;
+		offset += task->nodes.size();
+		delete task;
+	}
+
+	return result;
+}
+
+Float ShapeBVH::refitNodes(Node *nodes, size_t nodeCount,
+		const AABB *leafBounds, AABB &aabb) {
+	/* Children always come after their parents, hence a backwards
+	   sweep over the nodes visits them in a valid order */
+	for (size_t i=nodeCount; i-- > 0; ) {
+		Node &node = nodes[i];
+		for (int j=0; j<MTS_BVH_WIDTH; ++j) {
+			AABB bounds;
+			if (node.count[j] > 0) {
+				for (uint32_t k=0; k<node.count[j]; ++k)
+					bounds.expandBy(leafBounds[node.child[j] + k]);
+			} else if (node.child[j] != 0) {
+				bounds = getNodeBounds(nodes[node.child[j]]);
+			} else {
+				/* Unused slot */
+				continue;
+			}
+			for (int dim=0; dim<3; ++dim) {
+				node.bounds[dim][j] = roundDown(bounds.min[dim]);
+				node.bounds[dim+3][j] = roundUp(bounds.max[dim]);
+			}
+		}
+	}
+
+	aabb = getNodeBounds(nodes[0]);
+
+	return computeCost(nodes, nodeCount);
+}
+
+Float ShapeBVH::computeCost(const Node *nodes, size_t nodeCount) {
+	/* Every node and primitive is weighted by the surface area of its
+	   bounds, which is proportional to the probability that a random
+	   ray visits it. The root node is always visited. */
+	Float cost = 0;
+	for (size_t i=0; i<nodeCount; ++i) {
+		const Node &node = nodes[i];
+		for (int j=0; j<MTS_BVH_WIDTH; ++j) {
+			if (node.count[j] == 0 && node.child[j] == 0)
+				continue;
+			Float dx = std::max(0.0f, node.bounds[3][j] - node.bounds[0][j]),
+			      dy = std::max(0.0f, node.bounds[4][j] - node.bounds[1][j]),
+			      dz = std::max(0.0f, node.bounds[5][j] - node.bounds[2][j]),
+			      area = 2 * (dx*dy + dy*dz + dz*dx);
+			cost += area * (node.count[j] > 0 ? (Float) node.count[j] : (Float) 1);
+		}
+	}
+
+	AABB aabb = getNodeBounds(nodes[0]);
+	Float rootArea = aabb.isValid() ? aabb.getSurfaceArea() : (Float) 0;
+
+	return rootArea > 0 ? 1 + cost / rootArea : 1;
+}
+
+void ShapeBVH::build() {
+	Assert(!isBuilt());
+	if (m_primitiveCount > (size_t) std::numeric_limits<uint32_t>::max())
+		Log(EError, "The BVH supports at most 2^32-1 primitives!");
+
+	const uint32_t primCount = (uint32_t) m_primitiveCount;
+	Log(EDebug, "Constructing a BVH (%i primitives) ..", primCount);
+	ref<Timer> timer = new Timer();
+
+	/* Enumerate the primitives and compute their bounds */
+	std::vector<Primitive> primitives(primCount);
+	std::vector<AABB> primBounds(primCount);
+	std::vector<uint32_t> order(primCount);
+	uint32_t idx = 0;
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			const Triangle *triangles = mesh->getTriangles();
+			const Point *positions = mesh->getVertexPositions();
+			for (uint32_t j=0; j<(uint32_t) mesh->getTriangleCount(); ++j) {
+				primitives[idx].shapeIndex = (uint32_t) i;
+				primitives[idx].primIndex = j;
+				primBounds[idx++] = triangles[j].getAABB(positions);
+			}
+		} else {
+			primitives[idx].shapeIndex = (uint32_t) i;
+			primitives[idx].primIndex = KNoTriangleFlag;
+			primBounds[idx++] = shape->getAABB();
+		}
+	}
+
+	m_nodes = buildNodes(primCount > 0 ? &primBounds[0] : NULL, primCount,
+		primCount > 0 ? &order[0] : NULL, m_leafSize, m_binCount,
+		m_parallelBuild, m_nodeCount);
+
+	/* Store the primitives in leaf order */
+	m_primitives = static_cast<Primitive *>(allocAligned(
+		std::max(primCount, (uint32_t) 1) * sizeof(Primitive)));
+	m_aabb.reset();
+	for (uint32_t i=0; i<primCount; ++i) {
+		m_primitives[i] = primitives[order[i]];
+		m_aabb.expandBy(primBounds[order[i]]);
+	}
+	m_buildCost = computeCost(m_nodes, m_nodeCount);
+
+	Log(EDebug, "Finished -- took %i ms (%i nodes, %s, SAH cost %.2f).", timer->getMilliseconds(),
+		(int) m_nodeCount, memString(m_nodeCount * sizeof(Node)
+		+ primCount * sizeof(Primitive)).c_str(), m_buildCost);
+}
+
+Float ShapeBVH::refit() {
+	Assert(isBuilt());
+
+	/* Recompute the primitive bounds in leaf order */
+	std::vector<AABB> leafBounds(m_primitiveCount);
+	for (size_t i=0; i<m_primitiveCount; ++i) {
+		const Primitive &prim = m_primitives[i];
+		const Shape *shape = m_shapes[prim.shapeIndex];
+		if (prim.primIndex != KNoTriangleFlag) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			if (EXPECT_NOT_TAKEN(prim.primIndex >= mesh->getTriangleCount()))
+				Log(EError, "refit(): the triangle count of a mesh has changed -- "
+					"the BVH must be rebuilt from scratch!");
+			leafBounds[i] = mesh->getTriangles()[prim.primIndex].getAABB(
+				mesh->getVertexPositions());
+		} else {
+			leafBounds[i] = shape->getAABB();
+		}
+	}
+
+	Float cost = refitNodes(m_nodes, m_nodeCount,
+		m_primitiveCount > 0 ? &leafBounds[0] : NULL, m_aabb);
+
+	return m_buildCost > 0 ? cost / m_buildCost : 1;
+}
+
+bool ShapeBVH::update() {
+	if (!isBuilt()) {
+		build();
+		return true;
+	}
+
+	ref<Timer> timer = new Timer();
+	Float ratio = refit();
+	if (ratio <= m_rebuildThreshold) {
+		Log(EDebug, "Refitted the BVH in %i ms (SAH cost ratio %.2f).",
+			timer->getMilliseconds(), ratio);
+		return false;
+	}
+
+	Log(EDebug, "The SAH cost of the refitted BVH grew by a factor of "
+		"%.2f -- rebuilding it.", ratio);
+	clear();
+	build();
+	return true;
+}
+
+// ===========================================================================
+//                            Ray traversal
+// ===========================================================================
+
+template <bool shadowRay> bool ShapeBVH::intersectLeaf(const Ray &ray,
+		uint32_t start, uint32_t count, Float mint, Float &maxt, void *temp) const {
+	IntersectionCache *cache = static_cast<IntersectionCache *>(temp);
+	bool foundIntersection = false;
+
+	for (uint32_t i=start; i<start+count; ++i) {
+		const Primitive &prim = m_primitives[i];
+		const Shape *shape = m_shapes[prim.shapeIndex];
+
+		if (EXPECT_TAKEN(prim.primIndex != KNoTriangleFlag)) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			Float u, v, t;
+			if (mesh->getTriangles()[prim.primIndex].rayIntersect(
+					mesh->getVertexPositions(), ray, u, v, t) && t >= mint && t <= maxt) {
+				if (shadowRay)
+					return true;
+				maxt = t;
+				cache->shapeIndex = prim.shapeIndex;
+				cache->primIndex = prim.primIndex;
+				cache->u = u;
+				cache->v = v;
+				foundIntersection = true;
+			}
+		} else if (shadowRay) {
+			if (shape->rayIntersect(ray, mint, maxt))
+				return true;
+		} else {
+			Float t;
+			if (shape->rayIntersect(ray, mint, maxt, t,
+					reinterpret_cast<uint8_t *>(temp) + 2*sizeof(uint32_t))) {
+				maxt = t;
+				cache->shapeIndex = prim.shapeIndex;
+				cache->primIndex = KNoTriangleFlag;
+				foundIntersection = true;
+			}
+		}
+	}
+
+	return foundIntersection;
+}
+
+template <bool shadowRay> struct ShapeBVH::LeafIntersector {
+	const ShapeBVH *bvh;
+	const Ray &ray;
+	void *temp;
+
+	LeafIntersector(const ShapeBVH *bvh, const Ray &ray, void *temp)
+		: bvh(bvh), ray(ray), temp(temp) { }
+
+	inline bool operator()(uint32_t start, uint32_t count, Float mint, Float &maxt) const {
+		return bvh->intersectLeaf<shadowRay>(ray, start, count, mint, maxt, temp);
+	}
+};
+
+template <bool shadowRay> bool ShapeBVH::rayIntersectInternal(const Ray &ray,
+		Float mint, Float maxt, Float &t, void *temp) const {
+	LeafIntersector<shadowRay> leaf(this, ray, temp);
+	if (!traverse<shadowRay>(m_nodes, ray, mint, maxt, leaf))
+		return false;
+	t = maxt;
+	return true;
+}
+
+void ShapeBVH::fillIntersectionRecord(const Ray &ray,
+		const void *temp, Intersection &its) const {
+	const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+	const Shape *shape = m_shapes[cache->shapeIndex];
+	if (cache->primIndex != KNoTriangleFlag) {
+		static_cast<const TriMesh *>(shape)->fillTriangleIntersection<true>(
+			ray, cache->primIndex, cache->u, cache->v, its);
+	} else {
+		shape->fillIntersectionRecord(ray,
+			reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(uint32_t), its);
+	}
+
+	computeShadingFrame(its.shFrame.n, its.dpdu, its.shFrame);
+	its.wi = its.toLocal(-ray.d);
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Intersection &its) const {
+	uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+	its.t = std::numeric_limits<Float>::infinity();
+	Float mint, maxt;
+
+	++raysTraced;
+	if (m_aabb.rayIntersect(ray, mint, maxt)) {
+		/* Use an adaptive ray epsilon */
+		Float rayMinT = ray.mint;
+		if (rayMinT == Epsilon)
+			rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+				std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+		if (rayMinT > mint) mint = rayMinT;
+		if (ray.maxt < maxt) maxt = ray.maxt;
+
+		/* The bounds have zero extent when the scene is planar */
+		if (EXPECT_TAKEN(maxt >= mint)) {
+			if (rayIntersectInternal<false>(ray, mint, maxt, its.t, temp)) {
+				fillIntersectionRecord(ray, temp, its);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+		Normal &n, Point2 &uv) const {
+	uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+	Float mint, maxt;
+
+	t = std::numeric_limits<Float>::infinity();
+
+	++shadowRaysTraced;
+	if (m_aabb.rayIntersect(ray, mint, maxt)) {
+		/* Use an adaptive ray epsilon */
+		Float rayMinT = ray.mint;
+		if (rayMinT == Epsilon)
+			rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+				std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+		if (rayMinT > mint) mint = rayMinT;
+		if (ray.maxt < maxt) maxt = ray.maxt;
+
+		if (EXPECT_TAKEN(maxt >= mint)) {
+			if (rayIntersectInternal<false>(ray, mint, maxt, t, temp)) {
+				const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+				shape = m_shapes[cache->shapeIndex];
+
+				if (cache->primIndex != KNoTriangleFlag) {
+					const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
+					const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
+					const Point *vertexPositions = trimesh->getVertexPositions();
+					const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
+					const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+					const Point &p0 = vertexPositions[idx0];
+					const Point &p1 = vertexPositions[idx1];
+					const Point &p2 = vertexPositions[idx2];
+					n = normalize(cross(p1-p0, p2-p0));
+
+					if (EXPECT_TAKEN(vertexTexcoords)) {
+						const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
+						const Point2 &t0 = vertexTexcoords[idx0];
+						const Point2 &t1 = vertexTexcoords[idx1];
+						const Point2 &t2 = vertexTexcoords[idx2];
+						uv = t0 * b.x + t1 * b.y + t2 * b.z;
+					} else {
+						uv = Point2(0.0f);
+					}
+				} else {
+					Intersection its;
+					its.t = t;
+					shape->fillIntersectionRecord(ray,
+						reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(uint32_t), its);
+					n = its.geoFrame.n;
+					uv = its.uv;
+					if (its.shape)
+						shape = its.shape;
+				}
+
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray) const {
+	Float mint, maxt, t = std::numeric_limits<Float>::infinity();
+
+	++shadowRaysTraced;
+	if (m_aabb.rayIntersect(ray, mint, maxt)) {
+		/* Use an adaptive ray epsilon */
+		Float rayMinT = ray.mint;
+		if (rayMinT == Epsilon)
+			rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+				std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+		if (rayMinT > mint) mint = rayMinT;
+		if (ray.maxt < maxt) maxt = ray.maxt;
+
+		if (EXPECT_TAKEN(maxt >= mint))
+			if (rayIntersectInternal<true>(ray, mint, maxt, t, NULL))
+				return true;
+	}
+	return false;
+}
+
+std::string ShapeBVH::toString() const {
+	std::ostringstream oss;
+	oss << "ShapeBVH[" << endl
+		<< "  shapes = " << m_shapes.size() << "," << endl
+		<< "  primitiveCount = " << m_primitiveCount << "," << endl
+		<< "  nodeCount = " << m_nodeCount << "," << endl
+		<< "  leafSize = " << m_leafSize << "," << endl
+		<< "  binCount = " << m_binCount << "," << endl
+		<< "  rebuildThreshold = " << m_rebuildThreshold << "," << endl
+		<< "  aabb = " << m_aabb.toString() << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(ShapeBVH, false, Object)
+MTS_NAMESPACE_END
@@ -18,6 +18,8 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
 
 #if defined(MTS_SSE)
 #include <mitsuba/core/sse.h>
@@ -35,6 +37,14 @@ ShapeKDTree::ShapeKDTree() {
 }
 
 ShapeKDTree::~ShapeKDTree() {
+	if (m_cacheFile) {
+		/* The tree lives in a memory-mapped cache file -- don't free it */
+		m_nodes = NULL;
+		m_indices = NULL;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		m_triAccel = NULL;
+#endif
+	}
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	if (m_triAccel)
 		freeAligned(m_triAccel);
@@ -65,10 +75,40 @@ void ShapeKDTree::addShape(const Shape *shape) {
 	m_shapes.push_back(shape);
 }
 
+void ShapeKDTree::setCacheDirectory(const fs::path &path) {
+	m_cacheDirectory = path.string();
+}
+
+fs::path ShapeKDTree::getCacheDirectory() const {
+	return fs::path(m_cacheDirectory);
+}
+
 void ShapeKDTree::build() {
 	for (size_t i=1; i<m_shapeMap.size(); ++i)
 		m_shapeMap[i] += m_shapeMap[i-1];
 
+	/* With clipping, the tree also depends on the exact geometry of
+	   shapes other than triangle meshes, which isn't part of the hash */
+	bool cacheable = !m_cacheDirectory.empty() && getPrimitiveCount() > 0;
+	for (size_t i=0; cacheable && getClip() && i<m_shapes.size(); ++i) {
+		if (!m_triangleFlag[i]) {
+			Log(EInfo, "Not using the kd-tree cache, since the scene contains "
+				"shapes other than triangle meshes (e.g. a \"%s\")",
+				m_shapes[i]->getClass()->getName().c_str());
+			cacheable = false;
+		}
+	}
+
+	fs::path cachePath;
+	uint64_t hash = 0;
+	if (cacheable) {
+		hash = computeHash();
+		cachePath = fs::path(m_cacheDirectory) / formatString("%016llx.kdtree",
+			(unsigned long long) hash);
+		if (fs::exists(cachePath) && loadFromCache(cachePath, hash))
+			return;
+	}
+
 	SAHKDTree3D<ShapeKDTree>::buildInternal();
 
 #if !defined(MTS_KD_CONSERVE_MEMORY)
@@ -107,6 +147,261 @@ void ShapeKDTree::build() {
 	Log(m_logLevel, "");
 	KDAssert(idx == primCount);
 #endif
+
+	if (!cachePath.empty())
+		saveToCache(cachePath, hash);
+}
+
+// ===========================================================================
+//                        Persistent kd-tree cache
+// ===========================================================================
+
+/// Identifies kd-tree cache files ("MTSK")
+#define MTS_KD_CACHE_MAGIC 0x4B53544D
+/// Version of the cache file format
+#define MTS_KD_CACHE_VERSION 1
+
+/**
+ * \brief Header of a kd-tree cache file
+ *
+ * It is followed by the node array (including the unused entry before the
+ * root, see \ref KDNode::getSibling()), the index list and the \c TriAccel
+ * array, each starting at a multiple of 64 bytes.
+ */
+struct KDCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint32_t primCount;
+	uint32_t nodeCount;
+	uint32_t indexCount;
+	uint32_t floatSize;
+	uint64_t nodeOffset;
+	uint64_t indexOffset;
+	uint64_t triAccelOffset;
+	uint64_t fileSize;
+	Float aabb[2][3];
+	Float tightAABB[2][3];
+};
+
+static inline uint64_t alignCacheOffset(uint64_t offset) {
+	return (offset + 63) & ~((uint64_t) 63);
+}
+
+/**
+ * \brief Simple incremental 64-bit hash function
+ *
+ * Consumes the data in 8-byte words and is thus fast enough to
+ * process the vertex data of very large meshes.
+ */
+class GeometryHash {
+public:
+	GeometryHash() : m_hash(0xcbf29ce484222325ULL) { }
+
+	void update(const void *data, size_t size) {
+		const uint8_t *ptr = static_cast<const uint8_t *>(data);
+		while (size >= 8) {
+			uint64_t word;
+			memcpy(&word, ptr, 8);
+			mix(word);
+			ptr += 8; size -= 8;
+		}
+		if (size > 0) {
+			uint64_t word = 0;
+			memcpy(&word, ptr, size);
+			mix(word ^ ((uint64_t) size << 56));
+		}
+	}
+
+	template <typename T> inline void update(const T &value) {
+		update(&value, sizeof(T));
+	}
+
+	inline uint64_t get() const {
+		uint64_t h = m_hash;
+		h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+private:
+	inline void mix(uint64_t word) {
+		word *= 0x87c37b91114253d5ULL;
+		word = (word << 31) | (word >> 33);
+		word *= 0x4cf5ad432745937fULL;
+		m_hash ^= word;
+		m_hash = ((m_hash << 27) | (m_hash >> 37)) * 5 + 0x52dce729;
+	}
+
+	uint64_t m_hash;
+};
+
+uint64_t ShapeKDTree::computeHash() const {
+	ref<Timer> timer = new Timer();
+	GeometryHash hash;
+
+	/* File format and construction parameters */
+	hash.update((uint32_t) MTS_KD_CACHE_VERSION);
+	hash.update((uint32_t) sizeof(Float));
+#if defined(MTS_KD_CONSERVE_MEMORY)
+	hash.update((uint32_t) 0);
+#else
+	hash.update((uint32_t) sizeof(TriAccel));
+#endif
+	hash.update(m_traversalCost);
+	hash.update(m_queryCost);
+	hash.update(m_emptySpaceBonus);
+	hash.update((uint8_t) m_clip);
+	hash.update((uint8_t) m_retract);
+	hash.update(m_maxDepth);
+	hash.update(m_stopPrims);
+	hash.update(m_maxBadRefines);
+	hash.update(m_exactPrimThreshold);
+	hash.update(m_minMaxBins);
+
+	/* Geometry. Without clipping, only the type and bounds of shapes
+	   other than triangle meshes are visible to the tree construction */
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (m_triangleFlag[i]) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			hash.update((uint64_t) mesh->getTriangleCount());
+			hash.update((uint64_t) mesh->getVertexCount());
+			hash.update(mesh->getTriangles(), mesh->getTriangleCount() * sizeof(Triangle));
+			hash.update(mesh->getVertexPositions(), mesh->getVertexCount() * sizeof(Point));
+		} else {
+			const std::string &name = shape->getClass()->getName();
+			AABB aabb = shape->getAABB();
+			hash.update((uint64_t) 0);
+			hash.update(name.c_str(), name.length());
+			hash.update(aabb.min);
+			hash.update(aabb.max);
+		}
+	}
+
+	Log(EDebug, "Computed the kd-tree cache key in %i ms", timer->getMilliseconds());
+	return hash.get();
+}
+
+bool ShapeKDTree::loadFromCache(const fs::path &path, uint64_t hash) {
+	ref<MemoryMappedFile> file;
+	try {
+		file = new MemoryMappedFile(path, true);
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Could not map the kd-tree cache file \"%s\": %s",
+			path.string().c_str(), ex.what());
+		return false;
+	}
+
+	const uint8_t *data = static_cast<const uint8_t *>(file->getData());
+	const KDCacheHeader *header = reinterpret_cast<const KDCacheHeader *>(data);
+	uint64_t indexEnd = 0;
+	if (file->getSize() >= sizeof(KDCacheHeader))
+		indexEnd = header->indexOffset + (uint64_t) header->indexCount * sizeof(IndexType);
+
+	if (file->getSize() < sizeof(KDCacheHeader)
+		|| header->magic != MTS_KD_CACHE_MAGIC
+		|| header->version != MTS_KD_CACHE_VERSION
+		|| header->hash != hash
+		|| header->floatSize != sizeof(Float)
+		|| header->primCount != getPrimitiveCount()
+		|| header->fileSize != file->getSize()
+		|| header->nodeOffset + ((uint64_t) header->nodeCount + 1) * sizeof(KDNode) > header->indexOffset
+		|| indexEnd > header->fileSize
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		|| header->triAccelOffset < indexEnd
+		|| header->triAccelOffset + (uint64_t) header->primCount * sizeof(TriAccel) > header->fileSize
+#endif
+		) {
+		Log(EWarn, "Ignoring the invalid kd-tree cache file \"%s\"",
+			path.string().c_str());
+		return false;
+	}
+
+	/* Map the tree without copying it. The +1 shift of the node
+	   pointer matches the one of the regular build */
+	m_nodes = reinterpret_cast<KDNode *>(const_cast<uint8_t *>(
+		data + header->nodeOffset)) + 1;
+	m_indices = reinterpret_cast<IndexType *>(const_cast<uint8_t *>(
+		data + header->indexOffset));
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	m_triAccel = reinterpret_cast<TriAccel *>(const_cast<uint8_t *>(
+		data + header->triAccelOffset));
+#endif
+	m_nodeCount = header->nodeCount;
+	m_indexCount = header->indexCount;
+	for (int i=0; i<3; ++i) {
+		m_aabb.min[i] = header->aabb[0][i];
+		m_aabb.max[i] = header->aabb[1][i];
+		m_tightAABB.min[i] = header->tightAABB[0][i];
+		m_tightAABB.max[i] = header->tightAABB[1][i];
+	}
+	m_cacheFile = file;
+
+	Log(EInfo, "Loaded the kd-tree from the cache file \"%s\" (%s)",
+		path.filename().string().c_str(), memString(file->getSize()).c_str());
+	return true;
+}
+
+void ShapeKDTree::saveToCache(const fs::path &path, uint64_t hash) const {
+	KDCacheHeader header;
+	memset(&header, 0, sizeof(KDCacheHeader));
+	header.magic = MTS_KD_CACHE_MAGIC;
+	header.version = MTS_KD_CACHE_VERSION;
+	header.hash = hash;
+	header.primCount = getPrimitiveCount();
+	header.nodeCount = m_nodeCount;
+	header.indexCount = m_indexCount;
+	header.floatSize = sizeof(Float);
+	header.nodeOffset = alignCacheOffset(sizeof(KDCacheHeader));
+	header.indexOffset = alignCacheOffset(header.nodeOffset
+		+ ((uint64_t) m_nodeCount + 1) * sizeof(KDNode));
+	header.triAccelOffset = alignCacheOffset(header.indexOffset
+		+ (uint64_t) m_indexCount * sizeof(IndexType));
+#if defined(MTS_KD_CONSERVE_MEMORY)
+	header.fileSize = header.triAccelOffset;
+#else
+	header.fileSize = header.triAccelOffset
+		+ (uint64_t) header.primCount * sizeof(TriAccel);
+#endif
+	for (int i=0; i<3; ++i) {
+		header.aabb[0][i] = m_aabb.min[i];
+		header.aabb[1][i] = m_aabb.max[i];
+		header.tightAABB[0][i] = m_tightAABB.min[i];
+		header.tightAABB[1][i] = m_tightAABB.max[i];
+	}
+
+	/* Write to a temporary file first, so that concurrent
+	   processes never see a partially written tree */
+	fs::path tempPath = path.parent_path() /
+		fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+	try {
+		fs::create_directories(path.parent_path());
+		{
+			ref<MemoryMappedFile> file = new MemoryMappedFile(
+				tempPath, (size_t) header.fileSize);
+			uint8_t *data = static_cast<uint8_t *>(file->getData());
+			memset(data, 0, (size_t) header.fileSize);
+			memcpy(data, &header, sizeof(KDCacheHeader));
+			memcpy(data + header.nodeOffset, m_nodes - 1,
+				((size_t) m_nodeCount + 1) * sizeof(KDNode));
+			memcpy(data + header.indexOffset, m_indices,
+				(size_t) m_indexCount * sizeof(IndexType));
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+			memcpy(data + header.triAccelOffset, m_triAccel,
+				(size_t) header.primCount * sizeof(TriAccel));
+#endif
+		}
+		fs::rename(tempPath, path);
+		Log(EDebug, "Stored the kd-tree in the cache file \"%s\"",
+			path.string().c_str());
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Could not write the kd-tree cache file \"%s\": %s",
+			path.string().c_str(), ex.what());
+		boost::system::error_code ec;
+		fs::remove(tempPath, ec);
+	}
 }
 
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
@@ -381,6 +676,87 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 	}
 }
 
+int ShapeKDTree::rayIntersectPacket(const Ray *rays, Intersection *its) const {
+	RayPacket4 MM_ALIGN16 packet;
+	int result = 0;
+
+	if (!packet.load(rays)) {
+		for (int i=0; i<4; ++i) {
+			if (rayIntersect(rays[i], its[i]))
+				result |= 1 << i;
+		}
+		return result;
+	}
+
+	RayInterval4 MM_ALIGN16 interval(rays);
+	for (int i=0; i<4; ++i) {
+		/* Use an adaptive ray epsilon */
+		const Ray &ray = rays[i];
+		if (ray.mint == Epsilon)
+			interval.mint.f[i] *= std::max(std::max(std::max(std::abs(ray.o.x),
+				std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+	}
+
+	Intersection4 MM_ALIGN16 its4;
+	uint8_t MM_ALIGN16 temp[4 * MTS_KD_INTERSECTION_TEMP];
+
+	raysTraced += 4;
+	rayIntersectPacket(packet, interval, its4, temp);
+
+	for (int i=0; i<4; ++i) {
+		its[i].t = its4.t.f[i];
+		if (its[i].t == std::numeric_limits<Float>::infinity())
+			continue;
+
+		uint8_t *rayTemp = temp + i * MTS_KD_INTERSECTION_TEMP;
+		IntersectionCache *cache = reinterpret_cast<IntersectionCache *>(rayTemp);
+		cache->shapeIndex = its4.shapeIndex.ui[i];
+		cache->primIndex = its4.primIndex.ui[i];
+		if (cache->primIndex != KNoTriangleFlag) {
+			/* For other shapes, this space holds shape-specific data */
+			cache->u = its4.u.f[i];
+			cache->v = its4.v.f[i];
+		}
+		fillIntersectionRecord<true>(rays[i], rayTemp, its[i]);
+		result |= 1 << i;
+	}
+	return result;
+}
+
+int ShapeKDTree::rayIntersectPacket(const Ray *rays) const {
+	RayPacket4 MM_ALIGN16 packet;
+	int result = 0;
+
+	if (!packet.load(rays)) {
+		for (int i=0; i<4; ++i) {
+			if (rayIntersect(rays[i]))
+				result |= 1 << i;
+		}
+		return result;
+	}
+
+	RayInterval4 MM_ALIGN16 interval(rays);
+	for (int i=0; i<4; ++i) {
+		/* Use an adaptive ray epsilon */
+		const Ray &ray = rays[i];
+		if (ray.mint == Epsilon)
+			interval.mint.f[i] *= std::max(std::max(std::abs(ray.o.x),
+				std::abs(ray.o.y)), std::abs(ray.o.z));
+	}
+
+	Intersection4 MM_ALIGN16 its4;
+	uint8_t MM_ALIGN16 temp[4 * MTS_KD_INTERSECTION_TEMP];
+
+	shadowRaysTraced += 4;
+	rayIntersectPacket(packet, interval, its4, temp);
+
+	for (int i=0; i<4; ++i) {
+		if (its4.t.f[i] != std::numeric_limits<Float>::infinity())
+			result |= 1 << i;
+	}
+	return result;
+}
+
 #endif
 
 MTS_IMPLEMENT_CLASS(ShapeKDTree, false, KDTreeBase)
@@ -0,0 +1,181 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/texcache.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/tls.h>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter tileHits("Texture tile cache", "Tile cache hits", EPercentage);
+static StatsCounter tileReads("Texture tile cache", "Tiles read from disk");
+static StatsCounter tileBytesRead("Texture tile cache", "Tile data read from disk", EByteCount);
+static StatsCounter tileEvictions("Texture tile cache", "Evicted tiles");
+
+static ThreadLocal<TileLookupCache> __localCache;
+
+/// Default memory budget of the tile cache (512 MiB)
+#define MTS_TEXCACHE_DEFAULT_CAPACITY (512 * 1024 * 1024)
+
+ref<TextureTileCache> TextureTileCache::m_instance = new TextureTileCache();
+
+TextureTile::TextureTile(size_t size) : m_size(size) {
+	m_data = static_cast<uint8_t *>(allocAligned(size));
+}
+
+TextureTile::~TextureTile() {
+	freeAligned(m_data);
+}
+
+TileLookupCache::TileLookupCache() {
+	/* File identifiers start at one, hence no key matches this */
+	for (int i=0; i<MTS_TEXCACHE_LOCAL_SLOTS; ++i)
+		m_slots[i].key = 0;
+}
+
+void TileLookupCache::fetch(Slot &slot, uint64_t key) {
+	slot.tile = TextureTileCache::getInstance()->getTile(
+		(uint32_t) (key >> 32), (uint32_t) key);
+	slot.key = key;
+}
+
+TextureTileCache::TextureTileCache() : m_capacity(MTS_TEXCACHE_DEFAULT_CAPACITY),
+	m_usage(0), m_fileCounter(0) {
+	m_mutex = new Mutex();
+}
+
+TextureTileCache *TextureTileCache::getInstance() {
+	return m_instance;
+}
+
+TileLookupCache *TextureTileCache::getLocalCache() {
+	TileLookupCache *cache = __localCache.get();
+	if (EXPECT_NOT_TAKEN(cache == NULL)) {
+		cache = new TileLookupCache();
+		__localCache.set(cache);
+	}
+	return cache;
+}
+
+void TextureTileCache::setCapacity(size_t capacity) {
+	LockGuard lock(m_mutex);
+	m_capacity = capacity;
+	evict();
+}
+
+uint32_t TextureTileCache::registerFile(const fs::path &path,
+		size_t offset, size_t tileSize) {
+	File file;
+	file.stream = new FileStream(path, FileStream::EReadOnly);
+	file.mutex = new Mutex();
+	file.offset = offset;
+	file.tileSize = tileSize;
+
+	LockGuard lock(m_mutex);
+	uint32_t id = ++m_fileCounter;
+	m_files[id] = file;
+	return id;
+}
+
+void TextureTileCache::unregisterFile(uint32_t id) {
+	LockGuard lock(m_mutex);
+	for (std::list<uint64_t>::iterator it = m_lru.begin(); it != m_lru.end();) {
+		if ((uint32_t) (*it >> 32) != id) {
+			++it;
+			continue;
+		}
+		TileMap::iterator entry = m_tiles.find(*it);
+		m_usage -= entry->second.tile->getSize();
+		m_tiles.erase(entry);
+		it = m_lru.erase(it);
+	}
+	m_files.erase(id);
+}
+
+ref<TextureTile> TextureTileCache::getTile(uint32_t id, uint32_t index) {
+	uint64_t key = ((uint64_t) id << 32) | index;
+	tileHits.incrementBase();
+
+	UniqueLock lock(m_mutex);
+	TileMap::iterator it = m_tiles.find(key);
+	if (it != m_tiles.end()) {
+		/* Move the tile to the front of the LRU list */
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+		++tileHits;
+		return it->second.tile;
+	}
+
+	FileMap::iterator fit = m_files.find(id);
+	if (fit == m_files.end())
+		Log(EError, "getTile(): file %i is not registered!", id);
+	File file = fit->second;
+	lock.unlock();
+
+	/* Read the tile without blocking requests for other tiles */
+	ref<TextureTile> tile = new TextureTile(file.tileSize);
+	{
+		LockGuard fileLock(file.mutex);
+		file.stream->seek(file.offset + (size_t) index * file.tileSize);
+		file.stream->read(tile->getData(), file.tileSize);
+	}
+	++tileReads;
+	tileBytesRead += file.tileSize;
+
+	lock.lock();
+	it = m_tiles.find(key);
+	if (it != m_tiles.end()) {
+		/* Another thread was faster */
+		return it->second.tile;
+	}
+
+	m_lru.push_front(key);
+	Entry &entry = m_tiles[key];
+	entry.tile = tile;
+	entry.lruPos = m_lru.begin();
+	m_usage += file.tileSize;
+	evict();
+
+	return tile;
+}
+
+void TextureTileCache::evict() {
+	/* Always keep the most recently used tile */
+	while (m_usage > m_capacity && m_lru.size() > 1) {
+		TileMap::iterator it = m_tiles.find(m_lru.back());
+		m_usage -= it->second.tile->getSize();
+		m_tiles.erase(it);
+		m_lru.pop_back();
+		++tileEvictions;
+	}
+}
+
+std::string TextureTileCache::toString() const {
+	std::ostringstream oss;
+	oss << "TextureTileCache[" << endl
+		<< "  capacity = " << memString(m_capacity) << "," << endl
+		<< "  usage = " << memString(m_usage) << "," << endl
+		<< "  files = " << m_files.size() << "," << endl
+		<< "  tiles = " << m_tiles.size() << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(TextureTile, false, Object)
+MTS_IMPLEMENT_CLASS(TileLookupCache, false, Object)
+MTS_IMPLEMENT_CLASS(TextureTileCache, false, Object)
+MTS_NAMESPACE_END
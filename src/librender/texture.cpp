@@ -50,6 +50,12 @@ bool Texture::isMonochromatic() const { NotImplementedError("isMonochromatic");
 bool Texture::usesRayDifferentials() const { NotImplementedError("usesRayDifferentials"); }
 ref<Bitmap> Texture::getBitmap(const Vector2i &) const { NotImplementedError("getBitmap"); }
 
+void Texture::evalBatch(const Intersection * const *its, Spectrum *result,
+		size_t count, bool filter) const {
+	for (size_t i=0; i<count; ++i)
+		result[i] = eval(*its[i], filter);
+}
+
 ref<Texture> Texture::expand() {
 	return this;
 }
@@ -120,6 +126,54 @@ Spectrum Texture2D::eval(const Intersection &its, bool filter) const {
 	}
 }
 
+void Texture2D::evalBatch(const Intersection * const *its, Spectrum *result,
+		size_t count, bool filter) const {
+	Point2 uv[MTS_SHADING_BATCH_SIZE];
+	Vector2 d0[MTS_SHADING_BATCH_SIZE], d1[MTS_SHADING_BATCH_SIZE];
+	Spectrum values[MTS_SHADING_BATCH_SIZE];
+	size_t index[MTS_SHADING_BATCH_SIZE];
+
+	for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+		size_t size = std::min(count - start, (size_t) MTS_SHADING_BATCH_SIZE);
+		size_t filtered = 0, unfiltered = 0;
+
+		/* Place filtered lookups at the front and unfiltered ones at the back */
+		for (size_t i=0; i<size; ++i) {
+			const Intersection &it = *its[start + i];
+			Point2 p = Point2(it.uv.x * m_uvScale.x, it.uv.y * m_uvScale.y) + m_uvOffset;
+			if (it.hasUVPartials && filter) {
+				d0[filtered] = Vector2(it.dudx * m_uvScale.x, it.dvdx * m_uvScale.y);
+				d1[filtered] = Vector2(it.dudy * m_uvScale.x, it.dvdy * m_uvScale.y);
+				uv[filtered] = p;
+				index[filtered++] = i;
+			} else {
+				size_t j = size - ++unfiltered;
+				uv[j] = p;
+				index[j] = i;
+			}
+		}
+
+		if (filtered > 0)
+			evalBatch(uv, d0, d1, values, filtered);
+		if (unfiltered > 0)
+			evalBatch(uv + filtered, NULL, NULL, values + filtered, unfiltered);
+
+		for (size_t i=0; i<size; ++i)
+			result[start + index[i]] = values[i];
+	}
+}
+
+void Texture2D::evalBatch(const Point2 *uv, const Vector2 *d0,
+		const Vector2 *d1, Spectrum *result, size_t count) const {
+	if (d0) {
+		for (size_t i=0; i<count; ++i)
+			result[i] = eval(uv[i], d0[i], d1[i]);
+	} else {
+		for (size_t i=0; i<count; ++i)
+			result[i] = eval(uv[i]);
+	}
+}
+
 void Texture2D::evalGradient(const Intersection &its, Spectrum *gradient) const {
 	Point2 uv = Point2(its.uv.x * m_uvScale.x, its.uv.y * m_uvScale.y) + m_uvOffset;
 
@@ -35,6 +35,13 @@
 #define MTS_FILEFORMAT_VERSION_V3 0x0003
 #define MTS_FILEFORMAT_VERSION_V4 0x0004
 
+/// Identifies mapped mesh files ("MTSM")
+#define MTS_MAPPED_MESH_MAGIC 0x4D53544D
+/// Version of the mapped mesh file format
+#define MTS_MAPPED_MESH_VERSION 1
+/// Alignment of the arrays in a mapped mesh file
+#define MTS_MAPPED_MESH_ALIGNMENT 4096
+
 MTS_NAMESPACE_BEGIN
 
 TriMesh::TriMesh(const std::string &name, size_t triangleCount,
@@ -179,6 +186,9 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
 		Log(EError, "Tried to unserialize a shape from a stream, "
 			"which was not previously set to little endian byte order!");
 
+	if (isMapped())
+		copyMappedData();
+
 	const short version = readHeader(stream);
 
 	if (index != 0) {
@@ -336,18 +346,233 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 	}
 }
 
+/**
+ * \brief Header of a mapped mesh file
+ *
+ * It is followed by the name of the mesh and by the vertex positions,
+ * normals, texture coordinates, colors and triangles, each starting on
+ * a page boundary. Absent arrays have an offset of zero.
+ */
+struct MappedMeshHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t nameLength;
+	uint64_t vertexCount;
+	uint64_t triangleCount;
+	uint64_t positionOffset;
+	uint64_t normalOffset;
+	uint64_t texcoordOffset;
+	uint64_t colorOffset;
+	uint64_t triangleOffset;
+	uint64_t fileSize;
+	Float aabb[2][3];
+};
+
+static inline uint64_t alignMappedOffset(uint64_t offset) {
+	return (offset + MTS_MAPPED_MESH_ALIGNMENT - 1)
+		& ~((uint64_t) MTS_MAPPED_MESH_ALIGNMENT - 1);
+}
+
+void TriMesh::writeMapped(const fs::path &path) const {
+	MappedMeshHeader header;
+	memset(&header, 0, sizeof(MappedMeshHeader));
+	header.magic = MTS_MAPPED_MESH_MAGIC;
+	header.version = MTS_MAPPED_MESH_VERSION;
+#if defined(SINGLE_PRECISION)
+	header.flags = ESinglePrecision;
+#else
+	header.flags = EDoublePrecision;
+#endif
+	if (m_faceNormals)
+		header.flags |= EFaceNormals;
+	header.nameLength = (uint32_t) m_name.length();
+	header.vertexCount = m_vertexCount;
+	header.triangleCount = m_triangleCount;
+
+	uint64_t offset = sizeof(MappedMeshHeader) + header.nameLength;
+	offset = header.positionOffset = alignMappedOffset(offset);
+	offset += header.vertexCount * sizeof(Point);
+	if (m_normals) {
+		header.flags |= EHasNormals;
+		offset = header.normalOffset = alignMappedOffset(offset);
+		offset += header.vertexCount * sizeof(Normal);
+	}
+	if (m_texcoords) {
+		header.flags |= EHasTexcoords;
+		offset = header.texcoordOffset = alignMappedOffset(offset);
+		offset += header.vertexCount * sizeof(Point2);
+	}
+	if (m_colors) {
+		header.flags |= EHasColors;
+		offset = header.colorOffset = alignMappedOffset(offset);
+		offset += header.vertexCount * sizeof(Color3);
+	}
+	offset = header.triangleOffset = alignMappedOffset(offset);
+	header.fileSize = offset + header.triangleCount * sizeof(Triangle);
+
+	AABB aabb(m_aabb);
+	if (!aabb.isValid()) {
+		for (size_t i=0; i<m_vertexCount; i++)
+			aabb.expandBy(m_positions[i]);
+	}
+	for (int i=0; i<3; ++i) {
+		header.aabb[0][i] = aabb.min[i];
+		header.aabb[1][i] = aabb.max[i];
+	}
+
+	/* Write to a temporary file first, so that concurrent
+	   processes never map a partially written mesh */
+	fs::path tempPath = path.parent_path() /
+		fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+	try {
+		{
+			ref<MemoryMappedFile> file = new MemoryMappedFile(
+				tempPath, (size_t) header.fileSize);
+			uint8_t *data = static_cast<uint8_t *>(file->getData());
+			memset(data, 0, (size_t) header.fileSize);
+			memcpy(data, &header, sizeof(MappedMeshHeader));
+			memcpy(data + sizeof(MappedMeshHeader), m_name.c_str(), header.nameLength);
+			memcpy(data + header.positionOffset, m_positions,
+				m_vertexCount * sizeof(Point));
+			if (m_normals)
+				memcpy(data + header.normalOffset, m_normals,
+					m_vertexCount * sizeof(Normal));
+			if (m_texcoords)
+				memcpy(data + header.texcoordOffset, m_texcoords,
+					m_vertexCount * sizeof(Point2));
+			if (m_colors)
+				memcpy(data + header.colorOffset, m_colors,
+					m_vertexCount * sizeof(Color3));
+			memcpy(data + header.triangleOffset, m_triangles,
+				m_triangleCount * sizeof(Triangle));
+		}
+		fs::rename(tempPath, path);
+	} catch (...) {
+		boost::system::error_code ec;
+		fs::remove(tempPath, ec);
+		throw;
+	}
+}
+
+bool TriMesh::loadMapped(const fs::path &path) {
+	ref<MemoryMappedFile> file;
+	try {
+		file = new MemoryMappedFile(path, true);
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Could not map the mesh file \"%s\": %s",
+			path.string().c_str(), ex.what());
+		return false;
+	}
+
+#if defined(SINGLE_PRECISION)
+	const uint32_t precision = ESinglePrecision;
+#else
+	const uint32_t precision = EDoublePrecision;
+#endif
+
+	const uint8_t *data = static_cast<const uint8_t *>(file->getData());
+	const MappedMeshHeader *header = reinterpret_cast<const MappedMeshHeader *>(data);
+
+	if (file->getSize() < sizeof(MappedMeshHeader)
+		|| header->magic != MTS_MAPPED_MESH_MAGIC
+		|| header->version != MTS_MAPPED_MESH_VERSION
+		|| (header->flags & (ESinglePrecision | EDoublePrecision)) != precision
+		|| header->fileSize != file->getSize()
+		|| sizeof(MappedMeshHeader) + header->nameLength > header->positionOffset
+		|| header->positionOffset + header->vertexCount * sizeof(Point) > header->fileSize
+		|| ((header->flags & EHasNormals) && header->normalOffset
+			+ header->vertexCount * sizeof(Normal) > header->fileSize)
+		|| ((header->flags & EHasTexcoords) && header->texcoordOffset
+			+ header->vertexCount * sizeof(Point2) > header->fileSize)
+		|| ((header->flags & EHasColors) && header->colorOffset
+			+ header->vertexCount * sizeof(Color3) > header->fileSize)
+		|| header->triangleOffset + header->triangleCount * sizeof(Triangle) > header->fileSize) {
+		Log(EWarn, "Ignoring the invalid mesh file \"%s\"",
+			path.string().c_str());
+		return false;
+	}
+
+	if (m_positions && !isMappedData(m_positions))
+		delete[] m_positions;
+	if (m_normals && !isMappedData(m_normals))
+		delete[] m_normals;
+	if (m_texcoords && !isMappedData(m_texcoords))
+		delete[] m_texcoords;
+	if (m_tangents)
+		delete[] m_tangents;
+	if (m_colors && !isMappedData(m_colors))
+		delete[] m_colors;
+	if (m_triangles && !isMappedData(m_triangles))
+		delete[] m_triangles;
+	m_tangents = NULL;
+
+	uint8_t *ptr = const_cast<uint8_t *>(data);
+	m_name = std::string(reinterpret_cast<const char *>(
+		data + sizeof(MappedMeshHeader)), header->nameLength);
+	m_vertexCount = (size_t) header->vertexCount;
+	m_triangleCount = (size_t) header->triangleCount;
+	m_positions = reinterpret_cast<Point *>(ptr + header->positionOffset);
+	m_normals = (header->flags & EHasNormals) ?
+		reinterpret_cast<Normal *>(ptr + header->normalOffset) : NULL;
+	m_texcoords = (header->flags & EHasTexcoords) ?
+		reinterpret_cast<Point2 *>(ptr + header->texcoordOffset) : NULL;
+	m_colors = (header->flags & EHasColors) ?
+		reinterpret_cast<Color3 *>(ptr + header->colorOffset) : NULL;
+	m_triangles = reinterpret_cast<Triangle *>(ptr + header->triangleOffset);
+	m_faceNormals = header->flags & EFaceNormals;
+	m_flipNormals = false;
+	for (int i=0; i<3; ++i) {
+		m_aabb.min[i] = header->aabb[0][i];
+		m_aabb.max[i] = header->aabb[1][i];
+	}
+	m_surfaceArea = m_invSurfaceArea = -1;
+	m_mappedFile = file;
+	return true;
+}
+
+bool TriMesh::isMappedData(const void *ptr) const {
+	if (!m_mappedFile || !ptr)
+		return false;
+	const uint8_t *start = static_cast<const uint8_t *>(m_mappedFile->getData());
+	const uint8_t *value = static_cast<const uint8_t *>(ptr);
+	return value >= start && value < start + m_mappedFile->getSize();
+}
+
+/// Replace a mapped array by a private copy
+template <typename T> static T *copyMappedArray(const T *ptr, size_t count) {
+	T *result = new T[count];
+	memcpy(result, ptr, count * sizeof(T));
+	return result;
+}
+
+void TriMesh::copyMappedData() {
+	if (isMappedData(m_positions))
+		m_positions = copyMappedArray(m_positions, m_vertexCount);
+	if (isMappedData(m_normals))
+		m_normals = copyMappedArray(m_normals, m_vertexCount);
+	if (isMappedData(m_texcoords))
+		m_texcoords = copyMappedArray(m_texcoords, m_vertexCount);
+	if (isMappedData(m_colors))
+		m_colors = copyMappedArray(m_colors, m_vertexCount);
+	if (isMappedData(m_triangles))
+		m_triangles = copyMappedArray(m_triangles, m_triangleCount);
+	m_mappedFile = NULL;
+}
+
 TriMesh::~TriMesh() {
-	if (m_positions)
+	/* Arrays that reference the mapped file are released with it */
+	if (m_positions && !isMappedData(m_positions))
 		delete[] m_positions;
-	if (m_normals)
+	if (m_normals && !isMappedData(m_normals))
 		delete[] m_normals;
-	if (m_texcoords)
+	if (m_texcoords && !isMappedData(m_texcoords))
 		delete[] m_texcoords;
 	if (m_tangents)
 		delete[] m_tangents;
-	if (m_colors)
+	if (m_colors && !isMappedData(m_colors))
 		delete[] m_colors;
-	if (m_triangles)
+	if (m_triangles && !isMappedData(m_triangles))
 		delete[] m_triangles;
 }
 
@@ -355,6 +580,52 @@ AABB TriMesh::getAABB() const {
 	return m_aabb;
 }
 
+void TriMesh::getNormalCone(Vector &axis, Float &cosTheta) const {
+	axis = Vector(0, 0, 1);
+	cosTheta = -1;
+
+	/* Center the cone on the area-weighted average normal */
+	Vector sum(0.0f);
+	for (size_t i=0; i<m_triangleCount; ++i) {
+		const Triangle &tri = m_triangles[i];
+		const Point &p0 = m_positions[tri.idx[0]];
+		sum += cross(m_positions[tri.idx[1]] - p0,
+			m_positions[tri.idx[2]] - p0);
+	}
+
+	Float length = sum.length();
+	if (length == 0)
+		return;
+	Vector center = sum / length;
+
+	Float minCos = 1;
+	if (m_normals) {
+		for (size_t i=0; i<m_vertexCount; ++i) {
+			Float normLength = m_normals[i].length();
+			if (normLength != 0)
+				minCos = std::min(minCos, dot(center, m_normals[i]) / normLength);
+		}
+	} else {
+		for (size_t i=0; i<m_triangleCount; ++i) {
+			const Triangle &tri = m_triangles[i];
+			const Point &p0 = m_positions[tri.idx[0]];
+			Vector n = cross(m_positions[tri.idx[1]] - p0,
+				m_positions[tri.idx[2]] - p0);
+			Float normLength = n.length();
+			if (normLength != 0)
+				minCos = std::min(minCos, dot(center, n) / normLength);
+		}
+	}
+
+	/* Interpolated shading normals are only bounded by cones that
+	   are narrower than a hemisphere */
+	if (minCos <= 0)
+		return;
+
+	axis = center;
+	cosTheta = minCos;
+}
+
 Float TriMesh::pdfPosition(const PositionSamplingRecord &pRec) const {
 	return m_invSurfaceArea;
 }
@@ -397,11 +668,24 @@ void TriMesh::prepareSamplingTable() {
 		m_areaDistr.reserve(m_triangleCount);
 		for (size_t i=0; i<m_triangleCount; i++)
 			m_areaDistr.append(m_triangles[i].surfaceArea(m_positions));
-		m_surfaceArea = m_areaDistr.normalize();
-		m_invSurfaceArea = 1.0f / m_surfaceArea;
+		Float surfaceArea = m_areaDistr.normalize();
+		if (m_triangleCount > MTS_PMF_ALIAS_THRESHOLD)
+			m_areaDistr.buildAliasTable();
+		m_invSurfaceArea = 1.0f / surfaceArea;
+		m_surfaceArea = surfaceArea;
 	}
 }
 
+void TriMesh::updateGeometry() {
+	LockGuard guard(m_mutex);
+	m_aabb.reset();
+	for (size_t i=0; i<m_vertexCount; i++)
+		m_aabb.expandBy(m_positions[i]);
+
+	m_areaDistr.clear();
+	m_surfaceArea = m_invSurfaceArea = -1;
+}
+
 Float TriMesh::getSurfaceArea() const {
 	if (EXPECT_NOT_TAKEN(m_surfaceArea < 0))
 		const_cast<TriMesh *>(this)->prepareSamplingTable();
@@ -471,6 +755,9 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 	const Float dpThresh = std::cos(degToRad(maxAngle));
 	size_t degenerateTriangles = 0;
 
+	if (isMapped())
+		copyMappedData();
+
 	if (m_normals) {
 		delete[] m_normals;
 		m_normals = NULL;
@@ -607,6 +894,11 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 
 void TriMesh::computeNormals(bool force) {
 	int invalidNormals = 0;
+
+	/* Mapped arrays are read-only */
+	if (isMapped() && (force || m_flipNormals || (m_faceNormals && m_normals)))
+		copyMappedData();
+
 	if (m_faceNormals) {
 		if (m_normals) {
 			delete[] m_normals;
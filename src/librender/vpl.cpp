@@ -125,7 +125,7 @@ size_t generateVPLs(const Scene *scene, Random *random,
 		} else {
 			/* Hack to get the proper information for directional VPLs */
 			DirectSamplingRecord diRec(
-				scene->getKDTree()->getAABB().getCenter(), pRec.time);
+				scene->getGeometryAABB().getCenter(), pRec.time);
 
 			Spectrum weight2 = emitter->sampleDirect(diRec, sampler->next2D())
 				/ scene->pdfEmitterDiscrete(emitter);
@@ -143,7 +143,7 @@ size_t generateVPLs(const Scene *scene, Random *random,
 
 			Point2 offset = warp::squareToUniformDiskConcentric(sampler->next2D());
 			Vector perpOffset = Frame(diRec.d).toWorld(Vector(offset.x, offset.y, 0));
-			BSphere geoBSphere = scene->getKDTree()->getAABB().getBSphere();
+			BSphere geoBSphere = scene->getGeometryAABB().getBSphere();
 			pRec.p = geoBSphere.center + (perpOffset - dRec.d) * geoBSphere.radius;
 			weight = weight2 * M_PI * geoBSphere.radius * geoBSphere.radius;
 		}
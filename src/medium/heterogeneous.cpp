@@ -30,6 +30,9 @@ MTS_NAMESPACE_BEGIN
  */
 #define HETVOL_EARLY_EXIT 1
 
+/// Maximum resolution of the majorant grid along each axis
+#define HETVOL_MAX_MAJORANT_RES 128
+
 /// Generate a few statistics related to the implementation?
 // #define HETVOL_STATISTICS 1
 
@@ -81,6 +84,11 @@ static StatsCounter earlyExits("Heterogeneous volume",
  *         Provided for convenience when accomodating data based on different units,
  *         or to simply tweak the density of the medium. \default{1}
  *     }
+ *     \parameter{majorantResolution}{\Integer}{
+ *         Resolution of the coarse grid of local density bounds
+ *         along each axis (see below). \default{chosen so that a cell
+ *         spans about 8 voxels of the \code{density} volume, at most 128}
+ *     }
  *     \parameter{\Unnamed}{\Phase}{
  *          A nested phase function that describes the directional
  *          scattering properties of the medium. When none is specified,
@@ -119,6 +127,17 @@ static StatsCounter earlyExits("Heterogeneous volume",
  * scattering models that support this, such as a the Micro-flake or
  * Kajiya-Kay phase functions.
  *
+ * When the medium is configured, it partitions the bounding box of the
+ * \code{density} volume into a coarse grid and records the minimum and
+ * maximum density within each cell. Woodcock tracking walks through this
+ * grid and uses the maximum of each cell as a local majorant, which
+ * avoids most null collisions in sparse media (e.g. clouds with a few
+ * dense regions). The deterministic integration of the density also
+ * skips empty cells and integrates constant cells analytically. The
+ * grid is supported by the \pluginref{gridvolume}, \code{hgridvolume}
+ * and \pluginref{volcache} data sources; other sources fall back to
+ * their global maximum.
+ *
  * \vspace{4mm}
  *
  * \begin{xml}[label=lst:hetvolume,caption=A simple heterogeneous medium backed by a grid volume]
@@ -184,6 +203,9 @@ public:
 		: Medium(props) {
 		m_stepSize = props.getFloat("stepSize", 0);
 		m_scale = props.getFloat("scale", 1);
+		m_majorantResolution = props.getInteger("majorantResolution", 0);
+		if (m_majorantResolution < 0)
+			Log(EError, "The 'majorantResolution' parameter must be nonnegative!");
 		if (props.hasProperty("sigmaS") || props.hasProperty("sigmaA"))
 			Log(EError, "The 'sigmaS' and 'sigmaA' properties are only supported by "
 				"homogeneous media. Please use nested volume instances to supply "
@@ -210,6 +232,7 @@ public:
 		m_albedo = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_orientation = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_stepSize = stream->readFloat();
+		m_majorantResolution = stream->readInt();
 		configure();
 	}
 
@@ -222,6 +245,7 @@ public:
 		manager->serialize(stream, m_albedo.get());
 		manager->serialize(stream, m_orientation.get());
 		stream->writeFloat(m_stepSize);
+		stream->writeInt(m_majorantResolution);
 	}
 
 	void configure() {
@@ -234,12 +258,7 @@ public:
 		m_anisotropicMedium =
 			m_phaseFunction->needsDirectionallyVaryingCoefficients();
 
-		/* Assumes that the density medium does not
-		   contain values greater than one! */
-		m_maxDensity = m_scale * m_density->getMaximumFloatValue();
-		if (m_anisotropicMedium)
-			m_maxDensity *= m_phaseFunction->sigmaDirMax();
-		m_invMaxDensity = 1.0f/m_maxDensity;
+		buildMajorantGrid();
 
 		if (m_stepSize == 0) {
 			m_stepSize = std::min(
@@ -281,16 +300,14 @@ public:
 	}
 
 	/*
-	 * This function uses Simpson quadrature to compute following
-	 * integral:
+	 * This function computes the following integral:
 	 *
 	 *    \int_{ray.mint}^{ray.maxt} density(ray(x)) dx
 	 *
-	 * The integration proceeds by splitting the function into
-	 * approximately \c (ray.maxt-ray.mint)/m_stepSize segments,
-	 * each of which are then approximated by a quadratic polynomial.
-	 * The step size must be chosen so that this approximation is
-	 * valid given the behavior of the integrand.
+	 * The ray is traced through the majorant grid: cells that are
+	 * empty are skipped, and cells with a constant density are
+	 * integrated analytically. The remaining intervals are handled
+	 * by \ref integrateDensitySegment().
 	 *
 	 * \param ray
 	 *    Ray segment to be used for the integration
@@ -307,6 +324,61 @@ public:
 
 		mint = std::max(mint, ray.mint);
 		maxt = std::min(maxt, ray.maxt);
+		if (!(mint < maxt))
+			return 0.0f;
+
+		MajorantGridWalk walk(this, ray, mint, maxt);
+		Float t0, t1, start = 0, end = 0, integratedDensity = 0;
+		bool open = false;
+		int index;
+
+		while (walk.next(t0, t1, index)) {
+			const MajorantCell &cell = m_majorantGrid[index];
+			if (cell.minorant == cell.majorant) {
+				if (open) {
+					integratedDensity += integrateDensitySegment(ray, start, end);
+					open = false;
+				}
+				integratedDensity += cell.majorant * (t1 - t0);
+				continue;
+			}
+			if (!open) {
+				start = t0;
+				open = true;
+			}
+			end = t1;
+		}
+		if (open)
+			integratedDensity += integrateDensitySegment(ray, start, end);
+
+		return integratedDensity;
+	}
+
+	/*
+	 * This function uses Simpson quadrature to compute following
+	 * integral:
+	 *
+	 *    \int_{mint}^{maxt} density(ray(x)) dx
+	 *
+	 * The integration proceeds by splitting the function into
+	 * approximately \c (maxt-mint)/m_stepSize segments,
+	 * each of which are then approximated by a quadratic polynomial.
+	 * The step size must be chosen so that this approximation is
+	 * valid given the behavior of the integrand.
+	 *
+	 * \param ray
+	 *    Ray to be used for the integration
+	 *
+	 * \param mint
+	 *    Start of the integration interval (must lie in the density volume)
+	 *
+	 * \param maxt
+	 *    End of the integration interval (must lie in the density volume)
+	 *
+	 * \return
+	 *    The integrated density
+	 */
+	Float integrateDensitySegment(const Ray &ray, Float mint, Float maxt) const {
 		Float length = maxt-mint, maxComp = 0;
 
 		Point p = ray(mint), pLast = ray(maxt);
@@ -563,24 +635,9 @@ public:
 			Float result = 0;
 
 			for (int i=0; i<nSamples; ++i) {
-				Float t = mint;
-				while (true) {
-					t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-					if (t >= maxt) {
-						result += 1;
-						break;
-					}
-
-					Point p = ray(t);
-					Float density = lookupDensity(p, ray.d) * m_scale;
-
-					#if defined(HETVOL_STATISTICS)
-						++avgRayMarchingStepsTransmittance;
-					#endif
-
-					if (density * m_invMaxDensity > sampler->next1D())
-						break;
-				}
+				Float t, density;
+				if (!deltaTrack(ray, mint, maxt, sampler, t, density, false))
+					result += 1;
 			}
 			return Spectrum(result/nSamples);
 		}
@@ -629,32 +686,21 @@ public:
 			mint = std::max(mint, ray.mint);
 			maxt = std::min(maxt, ray.maxt);
 
-			Float t = mint, densityAtT = 0;
-			while (true) {
-				t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-				if (t >= maxt)
-					break;
-
+			Float t, densityAtT;
+			if (deltaTrack(ray, mint, maxt, sampler, t, densityAtT, true)) {
 				Point p = ray(t);
-				densityAtT = lookupDensity(p, ray.d) * m_scale;
-				#if defined(HETVOL_STATISTICS)
-					++avgRayMarchingStepsSampling;
-				#endif
-				if (densityAtT * m_invMaxDensity > sampler->next1D()) {
-					mRec.t = t;
-					mRec.p = p;
-					Spectrum albedo = m_albedo->lookupSpectrum(p);
-					mRec.sigmaS = albedo * densityAtT;
-					mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
-					mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
-					if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
-						mRec.transmittance = Spectrum(0.0f);
-					mRec.orientation = m_orientation != NULL
-						? m_orientation->lookupVector(p) : Vector(0.0f);
-					mRec.medium = this;
-					success = true;
-					break;
-				}
+				mRec.t = t;
+				mRec.p = p;
+				Spectrum albedo = m_albedo->lookupSpectrum(p);
+				mRec.sigmaS = albedo * densityAtT;
+				mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
+				mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
+				if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
+					mRec.transmittance = Spectrum(0.0f);
+				mRec.orientation = m_orientation != NULL
+					? m_orientation->lookupVector(p) : Vector(0.0f);
+				mRec.medium = this;
+				success = true;
 			}
 		}
 		mRec.medium = this;
@@ -697,13 +743,195 @@ public:
 			<< "  albedo = " << indent(m_albedo.toString()) << "," << endl
 			<< "  orientation = " << indent(m_orientation.toString()) << "," << endl
 			<< "  stepSize = " << m_stepSize << "," << endl
-			<< "  scale = " << m_scale << endl
+			<< "  scale = " << m_scale << "," << endl
+			<< "  majorantRes = " << m_majorantRes.toString() << endl
 			<< "]";
 		return oss.str();
 	}
 
 	MTS_DECLARE_CLASS()
 protected:
+	/// Lower and upper bound of the (scaled) density within a grid cell
+	struct MajorantCell {
+		Float minorant, majorant;
+	};
+
+	/// Incremental 3D-DDA traversal of the cells of the majorant grid
+	struct MajorantGridWalk {
+		MajorantGridWalk(const HeterogeneousMedium *medium, const Ray &ray,
+				Float mint, Float maxt) : res(medium->m_majorantRes),
+				t(mint), maxt(maxt) {
+			const Point &gridMin = medium->m_densityAABB.min;
+			const Vector &cellSize = medium->m_cellSize;
+			Point p = ray(mint);
+
+			for (int i=0; i<3; ++i) {
+				cell[i] = std::max(0, std::min(res[i] - 1,
+					math::floorToInt((p[i] - gridMin[i]) / cellSize[i])));
+
+				if (ray.d[i] > 0) {
+					step[i] = 1; end[i] = res[i];
+					tNext[i] = mint + (gridMin[i] + (cell[i] + 1) * cellSize[i] - p[i]) / ray.d[i];
+					tDelta[i] = cellSize[i] / ray.d[i];
+				} else if (ray.d[i] < 0) {
+					step[i] = -1; end[i] = -1;
+					tNext[i] = mint + (gridMin[i] + cell[i] * cellSize[i] - p[i]) / ray.d[i];
+					tDelta[i] = -cellSize[i] / ray.d[i];
+				} else {
+					step[i] = 0; end[i] = -1;
+					tNext[i] = tDelta[i] = std::numeric_limits<Float>::infinity();
+				}
+			}
+		}
+
+		/**
+		 * \brief Advance to the next cell along the ray
+		 *
+		 * \return \c false when the end of the ray segment has been reached.
+		 * Otherwise, the parameter interval \c [t0, t1] covered by the cell
+		 * and the cell index are returned.
+		 */
+		inline bool next(Float &t0, Float &t1, int &index) {
+			if (t >= maxt)
+				return false;
+
+			int axis = (tNext[0] < tNext[1])
+				? (tNext[0] < tNext[2] ? 0 : 2)
+				: (tNext[1] < tNext[2] ? 1 : 2);
+
+			t0 = t;
+			t1 = std::max(t0, std::min(tNext[axis], maxt));
+			index = (cell.z * res.y + cell.y) * res.x + cell.x;
+
+			t = t1;
+			cell[axis] += step[axis];
+			tNext[axis] += tDelta[axis];
+			if (cell[axis] == end[axis])
+				t = maxt;
+			return true;
+		}
+
+		Vector3i res, cell, step, end;
+		Vector tNext, tDelta;
+		Float t, maxt;
+	};
+
+	/// Compute the bounds of the density within each cell of the majorant grid
+	void buildMajorantGrid() {
+		Vector extents = m_densityAABB.getExtents();
+		Float stepSize = m_density->getStepSize();
+
+		for (int i=0; i<3; ++i) {
+			int res = m_majorantResolution;
+			if (res == 0)
+				res = std::isfinite(stepSize)
+					? (int) std::min((Float) HETVOL_MAX_MAJORANT_RES,
+						std::ceil(extents[i] / (16 * stepSize))) : 1;
+			m_majorantRes[i] = std::max(1, std::min(res, HETVOL_MAX_MAJORANT_RES));
+			m_cellSize[i] = extents[i] / m_majorantRes[i];
+		}
+
+		/* The density is scaled by the phase function in anisotropic media,
+		   which is only known to lie within [0, sigmaDirMax()] */
+		Float dirMax = m_anisotropicMedium ? m_phaseFunction->sigmaDirMax() : 1.0f;
+		size_t nCells = (size_t) m_majorantRes.x * m_majorantRes.y * m_majorantRes.z,
+			   nEmpty = 0;
+		m_majorantGrid.resize(nCells);
+		m_maxDensity = 0.0f;
+
+		/* Slightly enlarge the cells to account for round-off errors in the traversal */
+		Vector eps = m_cellSize * 1e-3f;
+		int index = 0;
+		for (int z=0; z<m_majorantRes.z; ++z) {
+			for (int y=0; y<m_majorantRes.y; ++y) {
+				for (int x=0; x<m_majorantRes.x; ++x) {
+					Point cellMin = m_densityAABB.min + Vector(
+						x * m_cellSize.x, y * m_cellSize.y, z * m_cellSize.z);
+					AABB cellAABB(cellMin - eps, cellMin + m_cellSize + eps);
+
+					Float min, max;
+					m_density->getFloatRange(cellAABB, min, max);
+
+					MajorantCell &cell = m_majorantGrid[index++];
+					cell.majorant = std::max(max, (Float) 0.0f) * m_scale * dirMax;
+					cell.minorant = m_anisotropicMedium ? 0.0f
+						: std::min(std::max(min, (Float) 0.0f) * m_scale, cell.majorant);
+					m_maxDensity = std::max(m_maxDensity, cell.majorant);
+					if (cell.majorant == 0)
+						++nEmpty;
+				}
+			}
+		}
+
+		Log(EDebug, "Built a %ix%ix%i majorant grid (%.1f%% empty, max. density = %f)",
+			m_majorantRes.x, m_majorantRes.y, m_majorantRes.z,
+			100.0f * nEmpty / (Float) nCells, m_maxDensity);
+	}
+
+	/**
+	 * \brief Woodcock tracking along the ray segment \c [mint, maxt]
+	 * using the local majorants of the cells traversed by the ray
+	 *
+	 * \param t
+	 *    Set to the position of the first real collision
+	 * \param density
+	 *    Set to the density at the collision
+	 * \param needDensity
+	 *    When set to \c false, collisions that are certain given
+	 *    the minorant of a cell are accepted without looking up the
+	 *    density. \c density is undefined in this case.
+	 * \return
+	 *    \c true if a real collision occurred within the segment
+	 */
+	bool deltaTrack(const Ray &ray, Float mint, Float maxt, Sampler *sampler,
+			Float &t, Float &density, bool needDensity) const {
+		if (!(mint < maxt))
+			return false;
+
+		MajorantGridWalk walk(this, ray, mint, maxt);
+		Float t0, t1, tau = -math::fastlog(1-sampler->next1D());
+		int index;
+
+		while (walk.next(t0, t1, index)) {
+			const MajorantCell &cell = m_majorantGrid[index];
+			if (cell.majorant == 0)
+				continue;
+
+			while (true) {
+				Float dt = tau / cell.majorant;
+				if (t0 + dt >= t1) {
+					/* Carry the remaining optical depth over to the next cell */
+					tau = std::max((Float) 0.0f, tau - (t1 - t0) * cell.majorant);
+					break;
+				}
+
+				t0 += dt;
+				Float threshold = sampler->next1D() * cell.majorant;
+				if (!needDensity && threshold < cell.minorant) {
+					t = t0;
+					return true;
+				}
+
+				density = lookupDensity(ray(t0), ray.d) * m_scale;
+
+				#if defined(HETVOL_STATISTICS)
+					if (needDensity)
+						++avgRayMarchingStepsSampling;
+					else
+						++avgRayMarchingStepsTransmittance;
+				#endif
+
+				if (density > threshold) {
+					t = t0;
+					return true;
+				}
+				tau = -math::fastlog(1-sampler->next1D());
+			}
+		}
+
+		return false;
+	}
+
 	inline Float lookupDensity(const Point &p, const Vector &d) const {
 		Float density = m_density->lookupFloat(p);
 		if (m_anisotropicMedium && density != 0) {
@@ -725,7 +953,10 @@ protected:
 	Float m_stepSize;
 	AABB m_densityAABB;
 	Float m_maxDensity;
-	Float m_invMaxDensity;
+	int m_majorantResolution;
+	Vector3i m_majorantRes;
+	Vector m_cellSize;
+	std::vector<MajorantCell> m_majorantGrid;
 };
 
 MTS_IMPLEMENT_CLASS_S(HeterogeneousMedium, false, Medium)
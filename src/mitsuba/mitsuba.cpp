@@ -34,6 +34,7 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/scenehandler.h>
+#include <mitsuba/render/texcache.h>
 #include <fstream>
 #include <stdexcept>
 #include <boost/algorithm/string.hpp>
@@ -79,6 +80,8 @@ void help() {
 	cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
 	cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
 	cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
+	cout <<  "   -m size     Memory budget in MiB of the cache that holds the tiles of" << endl;
+	cout <<  "               tiled textures (default: 512)" << endl << endl;
 	cout <<  "   -v          Be more verbose (can be specified twice)" << endl << endl;
 	cout <<  "   -L level    Explicitly specify the log level (trace/debug/info/warn/error)" << endl << endl;
 	cout <<  "   -w          Treat warnings as errors" << endl << endl;
@@ -151,7 +154,7 @@ int mitsuba_app(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:qhzvtwx")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:m:p:L:qhzvtwx")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -237,6 +240,13 @@ int mitsuba_app(int argc, char **argv) {
 					if (blockSize < 2 || blockSize > 128)
 						SLog(EError, "Invalid block size (should be in the range 2-128)");
 					break;
+				case 'm': {
+						long size = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || size <= 0)
+							SLog(EError, "Could not parse the texture cache size!");
+						TextureTileCache::getInstance()->setCapacity((size_t) size * 1024 * 1024);
+					}
+					break;
 				case 'z':
 					progressBars = false;
 					break;
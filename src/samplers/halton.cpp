@@ -328,6 +328,10 @@ public:
 		setSampleIndex(0);
 	}
 
+	bool isDeterministic() const {
+		return true;
+	}
+
 	void advance() {
 		m_sampleIndex++;
 		m_dimension = 0;
@@ -222,6 +222,10 @@ public:
 		setSampleIndex(0);
 	}
 
+	bool isDeterministic() const {
+		return true;
+	}
+
 	void advance() {
 		m_sampleIndex++;
 		m_dimension = 0;
@@ -197,6 +197,10 @@ public:
 		}
 	}
 
+	bool isDeterministic() const {
+		return true;
+	}
+
 	void advance() {
 		setSampleIndex(m_sampleIndex + 1);
 	}
@@ -18,11 +18,13 @@
 
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree4.h>
+#include <mitsuba/render/shapebvh.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
 
 #define SHAPE_PER_SEGMENT 1
 #define NO_CLIPPING_SUPPORT 1
@@ -100,7 +102,8 @@ public:
 	}
 
 
-	void build() {
+	/// Validate the key frames and prepare the primitive enumeration
+	void prepare() {
 		if (m_meshes.size() < 2)
 			Log(EError, "The deformable shape requires at least two sub-shapes!");
 
@@ -136,6 +139,10 @@ public:
 		m_shapeMap[0] = 0;
 		for (size_t i=0; i<m_meshes[0].size(); ++i)
 			m_shapeMap[i+1] = m_shapeMap[i] + (SizeType) m_meshes[0][i]->getTriangleCount();
+	}
+
+	void build() {
+		prepare();
 
 		this->setClip(false);
 		buildInternal();
@@ -385,6 +392,227 @@ protected:
 	Float m_traceTime;
 };
 
+/**
+ * \brief Refitted BVHs over the time intervals between the key frames
+ *
+ * Instead of a single 4D kd-tree over all frames, this stores one
+ * \ref ShapeBVH hierarchy per interval between two key frames, whose
+ * bounds contain the triangles at both ends of the interval (and hence
+ * also the linearly interpolated triangles in between). Since all frames
+ * share the same topology, consecutive intervals reuse the hierarchy of
+ * their predecessor and merely refit its bounds. A new hierarchy is only
+ * built when the SAH cost of the refitted one exceeds the cost right
+ * after its construction by more than a given factor.
+ */
+class SpaceTimeBVH : public Object {
+public:
+	typedef SpaceTimeKDTree::IndexType IndexType;
+
+	SpaceTimeBVH(const SpaceTimeKDTree *kdtree, Float rebuildThreshold)
+			: m_kdtree(kdtree) {
+		const std::vector<std::vector<const TriMesh *> > &meshes = kdtree->getMeshes();
+		const std::vector<Float> &times = kdtree->getTimes();
+		size_t segmentCount = times.size() - 1;
+		uint32_t primCount = (uint32_t) kdtree->getPrimitiveCount();
+		ref<Timer> timer = new Timer();
+
+		/* Enumerate the triangles of all meshes */
+		std::vector<Primitive> primitives(primCount);
+		uint32_t idx = 0;
+		for (size_t i=0; i<meshes[0].size(); ++i) {
+			for (uint32_t j=0; j<(uint32_t) meshes[0][i]->getTriangleCount(); ++j) {
+				primitives[idx].shapeIndex = (IndexType) i;
+				primitives[idx++].primIndex = j;
+			}
+		}
+
+		std::vector<AABB> primBounds(primCount), leafBounds(primCount);
+		std::vector<uint32_t> order(primCount);
+		Float topologyCost = 0;
+		m_segments.resize(segmentCount);
+		m_aabb.reset();
+
+		for (size_t seg=0; seg<segmentCount; ++seg) {
+			Segment &segment = m_segments[seg];
+
+			/* Bounds of the triangles at both ends of the interval */
+			for (uint32_t i=0; i<primCount; ++i) {
+				const Primitive &prim = primitives[i];
+				const Triangle &tri = meshes[0][prim.shapeIndex]->getTriangles()[prim.primIndex];
+				AABB &aabb = primBounds[i];
+				aabb = tri.getAABB(meshes[seg][prim.shapeIndex]->getVertexPositions());
+				aabb.expandBy(tri.getAABB(meshes[seg+1][prim.shapeIndex]->getVertexPositions()));
+			}
+
+			if (seg > 0) {
+				/* Try to refit the hierarchy of the previous interval */
+				const Segment &prev = m_segments[seg-1];
+				segment.nodeCount = prev.nodeCount;
+				segment.topology = prev.topology;
+				segment.nodes = static_cast<ShapeBVH::Node *>(
+					allocAligned(prev.nodeCount * sizeof(ShapeBVH::Node)));
+				memcpy(segment.nodes, prev.nodes, prev.nodeCount * sizeof(ShapeBVH::Node));
+
+				for (uint32_t i=0; i<primCount; ++i)
+					leafBounds[i] = primBounds[order[i]];
+				Float cost = ShapeBVH::refitNodes(segment.nodes, segment.nodeCount,
+					&leafBounds[0], segment.aabb);
+
+				if (cost <= rebuildThreshold * topologyCost) {
+					m_aabb.expandBy(segment.aabb);
+					continue;
+				}
+				freeAligned(segment.nodes);
+			}
+
+			/* Build a new hierarchy */
+			segment.nodes = ShapeBVH::buildNodes(&primBounds[0], primCount,
+				&order[0], 4, 16, true, segment.nodeCount);
+			segment.topology = (uint32_t) m_leafPrimitives.size();
+			segment.aabb.reset();
+			for (uint32_t i=0; i<primCount; ++i)
+				segment.aabb.expandBy(primBounds[i]);
+			topologyCost = ShapeBVH::computeCost(segment.nodes, segment.nodeCount);
+
+			m_leafPrimitives.push_back(std::vector<Primitive>(primCount));
+			std::vector<Primitive> &leafPrims = m_leafPrimitives.back();
+			for (uint32_t i=0; i<primCount; ++i)
+				leafPrims[i] = primitives[order[i]];
+			m_aabb.expandBy(segment.aabb);
+		}
+
+		size_t nodeCount = 0;
+		for (size_t seg=0; seg<segmentCount; ++seg)
+			nodeCount += m_segments[seg].nodeCount;
+		Log(EInfo, "Built BVHs for " SIZE_T_FMT " time intervals in %i ms (" SIZE_T_FMT
+			" hierarchies, the others were refitted, %s)", segmentCount, timer->getMilliseconds(),
+			m_leafPrimitives.size(), memString(nodeCount * sizeof(ShapeBVH::Node)
+			+ m_leafPrimitives.size() * primCount * sizeof(Primitive)).c_str());
+	}
+
+	/// Intersect a ray with the triangles at the ray's time
+	inline bool rayIntersect(const Ray &ray, Float _mint, Float _maxt,
+			Float &t, void *temp) const {
+		Float mint, maxt;
+		if (!m_aabb.rayIntersect(ray, mint, maxt))
+			return false;
+		if (_mint > mint) mint = _mint;
+		if (_maxt < maxt) maxt = _maxt;
+		if (EXPECT_NOT_TAKEN(maxt <= mint))
+			return false;
+
+		LeafIntersector<false> leaf(this, ray,
+			static_cast<SpaceTimeKDTree::IntersectionCache *>(temp));
+		if (!ShapeBVH::traverse<false>(m_segments[leaf.segment].nodes,
+				ray, mint, maxt, leaf))
+			return false;
+		t = maxt;
+		return true;
+	}
+
+	/// Intersect a ray with the triangles at the ray's time (visibility query version)
+	inline bool rayIntersect(const Ray &ray, Float _mint, Float _maxt) const {
+		Float mint, maxt;
+		if (!m_aabb.rayIntersect(ray, mint, maxt))
+			return false;
+		if (_mint > mint) mint = _mint;
+		if (_maxt < maxt) maxt = _maxt;
+		if (EXPECT_NOT_TAKEN(maxt <= mint))
+			return false;
+
+		LeafIntersector<true> leaf(this, ray, NULL);
+		return ShapeBVH::traverse<true>(m_segments[leaf.segment].nodes,
+			ray, mint, maxt, leaf);
+	}
+
+	/// Return an AABB with the spatial extents
+	inline const AABB &getAABB() const { return m_aabb; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Triangle referenced by the leaves of a hierarchy
+	struct Primitive {
+		IndexType shapeIndex;
+		IndexType primIndex;
+	};
+
+	/// Hierarchy over the time interval between two key frames
+	struct Segment {
+		ShapeBVH::Node *nodes;
+		size_t nodeCount;
+		/// Index into \ref m_leafPrimitives
+		uint32_t topology;
+		AABB aabb;
+	};
+
+	/// Intersects the linearly interpolated triangles of a leaf
+	template <bool shadowRay> struct LeafIntersector {
+		const SpaceTimeBVH *bvh;
+		const Ray &ray;
+		SpaceTimeKDTree::IntersectionCache *cache;
+		const Primitive *primitives;
+		IndexType segment;
+		Float alpha;
+
+		LeafIntersector(const SpaceTimeBVH *bvh, const Ray &ray,
+				SpaceTimeKDTree::IntersectionCache *cache)
+				: bvh(bvh), ray(ray), cache(cache) {
+			const std::vector<Float> &times = bvh->m_kdtree->getTimes();
+			segment = std::min(bvh->m_kdtree->findFrame(ray.time),
+				(IndexType) bvh->m_segments.size() - 1);
+			alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
+				(ray.time - times[segment]) / (times[segment + 1] - times[segment])));
+			primitives = &bvh->m_leafPrimitives[bvh->m_segments[segment].topology][0];
+		}
+
+		inline bool operator()(uint32_t start, uint32_t count, Float mint, Float &maxt) const {
+			bool foundIntersection = false;
+			for (uint32_t i=start; i<start+count; ++i) {
+				const Primitive &prim = primitives[i];
+				const TriMesh *mesh0 = bvh->m_kdtree->getMesh(segment, prim.shapeIndex),
+				              *mesh1 = bvh->m_kdtree->getMesh(segment + 1, prim.shapeIndex);
+				const Triangle &tri = mesh0->getTriangles()[prim.primIndex];
+				const Point *pos0 = mesh0->getVertexPositions(),
+				            *pos1 = mesh1->getVertexPositions();
+
+				/* Compute interpolated positions */
+				Point p[3];
+				for (int j=0; j<3; ++j)
+					p[j] = (1 - alpha) * pos0[tri.idx[j]] + alpha * pos1[tri.idx[j]];
+
+				Float u, v, t;
+				if (!Triangle::rayIntersect(p[0], p[1], p[2], ray, u, v, t)
+						|| t < mint || t > maxt)
+					continue;
+
+				if (shadowRay)
+					return true;
+
+				maxt = t;
+				cache->frameIndex = segment;
+				cache->alpha = alpha;
+				cache->shapeIndex = prim.shapeIndex;
+				cache->primIndex = prim.primIndex;
+				cache->u = u;
+				cache->v = v;
+				foundIntersection = true;
+			}
+			return foundIntersection;
+		}
+	};
+
+	/// Virtual destructor
+	virtual ~SpaceTimeBVH() {
+		for (size_t i=0; i<m_segments.size(); ++i)
+			freeAligned(m_segments[i].nodes);
+	}
+private:
+	ref<const SpaceTimeKDTree> m_kdtree;
+	std::vector<Segment> m_segments;
+	std::vector<std::vector<Primitive> > m_leafPrimitives;
+	AABB m_aabb;
+};
+
 class Deformable : public Shape {
 public:
 	Deformable(const Properties &props) : Shape(props) {
@@ -400,28 +628,54 @@ public:
 			times[i] = value;
 		}
 		m_kdtree = new SpaceTimeKDTree(times);
+
+		/* Acceleration data structure: 'kdtree' (the default) builds a single
+		   4D kd-tree over all frames. 'bvh' refits one hierarchy from frame
+		   to frame and is much faster to build for long animations. */
+		std::string accel = props.getString("accel", "kdtree");
+		if (accel != "kdtree" && accel != "bvh")
+			Log(EError, "Unknown acceleration data structure \"%s\" (must be "
+				"\"kdtree\" or \"bvh\")", accel.c_str());
+		m_useBVH = accel == "bvh";
+
+		/* BVH mode: relative SAH cost increase, at which a time interval
+		   gets its own hierarchy instead of refitting the previous one */
+		m_rebuildThreshold = props.getFloat("rebuildThreshold", MTS_BVH_REBUILD_THRESHOLD);
 	}
 
 	Deformable(Stream *stream, InstanceManager *manager)
 		: Shape(stream, manager) {
 		m_kdtree = new SpaceTimeKDTree(stream, manager);
+		m_useBVH = stream->readBool();
+		m_rebuildThreshold = stream->readFloat();
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Shape::serialize(stream, manager);
 		m_kdtree->serialize(stream, manager);
+		stream->writeBool(m_useBVH);
+		stream->writeFloat(m_rebuildThreshold);
 	}
 
 	void configure() {
-		m_kdtree->build();
+		if (m_useBVH) {
+			m_kdtree->prepare();
+			m_bvh = new SpaceTimeBVH(m_kdtree, m_rebuildThreshold);
+		} else {
+			m_kdtree->build();
+		}
 	}
 
 	bool rayIntersect(const Ray &ray, Float mint,
 			Float maxt, Float &t, void *temp) const {
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray, mint, maxt, t, temp);
 		return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
 	}
 
 	bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray, mint, maxt);
 		return m_kdtree->rayIntersect(ray, mint, maxt);
 	}
 
@@ -508,7 +762,6 @@ public:
 		its.shape = m_kdtree->getMesh(0, cache->shapeIndex);
 		its.hasUVPartials = false;
 		its.primIndex = cache->primIndex;
-		its.other = cache->shapeIndex;
 		its.instance = this;
 		its.time = ray.time;
 	}
@@ -522,7 +775,7 @@ public:
 			(its.time - times[frameIndex])
 			/ (times[frameIndex + 1] - times[frameIndex])));
 
-		uint32_t primIndex = its.primIndex, shapeIndex = its.other;
+		uint32_t primIndex = its.primIndex, shapeIndex = getShapeIndex(its);
 		const TriMesh *trimesh0 = m_kdtree->getMesh(frameIndex,   shapeIndex);
 		const TriMesh *trimesh1 = m_kdtree->getMesh(frameIndex+1, shapeIndex);
 		const Point *vertexPositions0 = trimesh0->getVertexPositions();
@@ -614,7 +867,7 @@ public:
 		const std::vector<Float> &times = m_kdtree->getTimes();
 
 		cache.primIndex = its.primIndex;
-		cache.shapeIndex = its.other;
+		cache.shapeIndex = getShapeIndex(its);
 		cache.frameIndex = m_kdtree->findFrame(its.time);
 		cache.alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
 			(its.time - times[cache.frameIndex])
@@ -651,6 +904,8 @@ public:
 
 
 	AABB getAABB() const {
+		if (m_bvh.get())
+			return m_bvh->getAABB();
 		return m_kdtree->getSpatialAABB();
 	}
 
@@ -678,17 +933,28 @@ public:
 		oss << "Deformable[" << endl
 			<< "   primitiveCount = " << m_kdtree->getPrimitiveCount() << "," << endl
 			<< "   timeCount = " << m_kdtree->getTimeCount() << "," << endl
-			<< "   aabb = " << indent(m_kdtree->getSpatialAABB().toString()) << endl
+			<< "   accel = " << (m_useBVH ? "bvh" : "kdtree") << "," << endl
+			<< "   aabb = " << indent(getAABB().toString()) << endl
 			<< "]";
 		return oss.str();
 	}
 
 	MTS_DECLARE_CLASS()
+private:
+	/// Recover the index of the intersected sub-mesh from an intersection record
+	inline uint32_t getShapeIndex(const Intersection &its) const {
+		const std::vector<const TriMesh *> &meshes = m_kdtree->getMeshes()[0];
+		return (uint32_t) (std::find(meshes.begin(), meshes.end(), its.shape) - meshes.begin());
+	}
 private:
 	ref<SpaceTimeKDTree> m_kdtree;
+	ref<SpaceTimeBVH> m_bvh;
+	Float m_rebuildThreshold;
+	bool m_useBVH;
 };
 
 MTS_IMPLEMENT_CLASS_S(SpaceTimeKDTree, false, KDTreeBase)
+MTS_IMPLEMENT_CLASS(SpaceTimeBVH, false, Object)
 MTS_IMPLEMENT_CLASS_S(Deformable, false, Shape)
 MTS_EXPORT_PLUGIN(Deformable, "Deformable shape");
 MTS_NAMESPACE_END
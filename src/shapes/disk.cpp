@@ -136,6 +136,15 @@ public:
 		return M_PI * dpdu.length() * dpdv.length();
 	}
 
+	void getNormalCone(Vector &axis, Float &cosTheta) const {
+		if (!m_objectToWorld->isStatic()) {
+			Shape::getNormalCone(axis, cosTheta);
+			return;
+		}
+		axis = normalize(m_objectToWorld->eval(0)(Normal(0, 0, 1)));
+		cosTheta = 1;
+	}
+
 	inline bool rayIntersect(const Ray &_ray, Float mint, Float maxt, Float &t, void *temp) const {
 		Ray ray;
 		m_objectToWorld->eval(ray.time).inverse().transformAffine(_ray, ray);
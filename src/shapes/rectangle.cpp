@@ -122,6 +122,11 @@ public:
 		return m_dpdu.length() * m_dpdv.length();
 	}
 
+	void getNormalCone(Vector &axis, Float &cosTheta) const {
+		axis = m_frame.n;
+		cosTheta = 1;
+	}
+
 	inline bool rayIntersect(const Ray &_ray, Float mint, Float maxt, Float &t, void *temp) const {
 		Ray ray;
 		m_worldToObject.transformAffine(_ray, ray);
@@ -61,6 +61,11 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  *	      Specifies an optional linear object-to-world transformation.
  *        \default{none (i.e. object space $=$ world space)}
  *     }
+ *     \parameter{cacheDir}{\String}{
+ *       When specified, the mesh is additionally stored in an uncompressed
+ *       file within this directory, which later loads map into memory
+ *       (see below). \default{none}
+ *     }
  * }
  * The serialized mesh format represents the most space and time-efficient way
  * of getting geometry information into Mitsuba. It stores indexed triangle meshes
@@ -142,6 +147,18 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  * \bottomrule
  * \end{longtable}
  * \end{center}
+ *
+ * \paragraph{Mapped meshes:} Decompressing and transforming very large
+ * meshes can take a significant amount of time, and every rendering process
+ * ends up with its own copy of the data. When the \code{cacheDir} parameter
+ * is set, the plugin writes the fully processed mesh (i.e. with the
+ * \code{toWorld} transformation, \code{flipNormals}, \code{faceNormals}
+ * and \code{maxSmoothAngle} already applied) into an uncompressed file,
+ * whose arrays start on page boundaries. Subsequent loads simply map this
+ * file into memory, which is nearly instantaneous, and the operating system
+ * shares the mapped pages among all processes that render the same
+ * geometry. The name of the file encodes the source file, its modification
+ * time and the above parameters, hence outdated files are never used.
  */
 class SerializedMesh : public TriMesh {
 public:
@@ -159,6 +176,22 @@ public:
 		std::string name = (props.getID() != "unnamed") ? props.getID()
 			: formatString("%s@%i", filePath.stem().string().c_str(), shapeIndex);
 
+		/* Try to map a previously processed version of the mesh */
+		fs::path mappedPath;
+		if (props.hasProperty("cacheDir")) {
+			mappedPath = getMappedPath(props, filePath, objectToWorld, shapeIndex);
+			ref<Timer> timer = new Timer();
+			if (fs::exists(mappedPath) && loadMapped(mappedPath)) {
+				Log(EDebug, "Mapped shape %i of \"%s\" (" SIZE_T_FMT " triangles, "
+					SIZE_T_FMT " vertices, %i ms)", shapeIndex,
+					filePath.filename().string().c_str(), m_triangleCount,
+					m_vertexCount, timer->getMilliseconds());
+				if (m_name.empty())
+					m_name = name;
+				return;
+			}
+		}
+
 		/* Load the geometry */
 		Log(EInfo, "Loading shape %i from \"%s\" ..", shapeIndex, filePath.filename().string().c_str());
 		ref<Timer> timer = new Timer();
@@ -207,6 +240,21 @@ public:
 				"can't be specified at the same time!");
 			rebuildTopology(props.getFloat("maxSmoothAngle"));
 		}
+
+		if (!mappedPath.empty()) {
+			/* Also apply 'faceNormals' and 'flipNormals', so that
+			   the mapped data never has to be modified */
+			computeNormals();
+			try {
+				fs::create_directories(mappedPath.parent_path());
+				writeMapped(mappedPath);
+				Log(EDebug, "Stored the processed mesh in \"%s\"",
+					mappedPath.string().c_str());
+			} catch (const std::exception &ex) {
+				Log(EWarn, "Could not write the mesh file \"%s\": %s",
+					mappedPath.string().c_str(), ex.what());
+			}
+		}
 	}
 
 	SerializedMesh(Stream *stream, InstanceManager *manager)
@@ -215,6 +263,43 @@ public:
 	MTS_DECLARE_CLASS()
 
 private:
+	/**
+	 * \brief Determine the name of the mapped mesh file, which identifies
+	 * the source mesh and all parameters that affect the processed data
+	 */
+	static fs::path getMappedPath(const Properties &props,
+			const fs::path &filePath, const Transform &objectToWorld,
+			int shapeIndex) {
+		/* 64-bit FNV-1a hash */
+		std::ostringstream oss;
+		oss << fs::absolute(filePath).string() << ";"
+			<< fs::file_size(filePath) << ";"
+			<< (long long) fs::last_write_time(filePath) << ";"
+			<< shapeIndex << ";" << sizeof(Float) << ";"
+			<< props.getBoolean("faceNormals", false) << ";"
+			<< props.getBoolean("flipNormals", false) << ";";
+		if (props.hasProperty("maxSmoothAngle"))
+			oss << props.getFloat("maxSmoothAngle");
+		std::string key = oss.str();
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (size_t i=0; i<key.length(); ++i)
+			hash = (hash ^ (uint8_t) key[i]) * 0x100000001b3ULL;
+		const Matrix4x4 &m = objectToWorld.getMatrix();
+		for (int i=0; i<4; ++i) {
+			for (int j=0; j<4; ++j) {
+				const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&m.m[i][j]);
+				for (size_t k=0; k<sizeof(Float); ++k)
+					hash = (hash ^ bytes[k]) * 0x100000001b3ULL;
+			}
+		}
+
+		fs::path cacheDir = Thread::getThread()->getFileResolver()->resolve(
+			props.getString("cacheDir"));
+		return cacheDir / formatString("%s_%i_%016llx.mesh",
+			filePath.stem().string().c_str(), shapeIndex,
+			(unsigned long long) hash);
+	}
+
 
 	/**
 	 * Helper class for loading serialized meshes from the same file
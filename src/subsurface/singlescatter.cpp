@@ -1667,6 +1667,9 @@ public:
 				MTS_CLASS(SamplingIntegrator)))
 			Log(EError, "The single scattering pluging requires "
 						"a sampling-based surface integrator!");
+		if (!m_fastSingleScatter && scene->getBVH())
+			Log(EError, "Setting fastSingleScatter=false requires the scene "
+						"to use a kd-tree (accel=\"kdtree\")!");
 		return true;
 	}
 
@@ -20,6 +20,8 @@
 #include <mitsuba/core/kdtree.h>
 #include <mitsuba/render/testcase.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/shapebvh.h>
+#include <mitsuba/render/trimesh.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -29,6 +31,9 @@ public:
 	MTS_DECLARE_TEST(test01_sutherlandHodgman)
 	MTS_DECLARE_TEST(test02_bunnyBenchmark)
 	MTS_DECLARE_TEST(test03_pointKDTree)
+	MTS_DECLARE_TEST(test04_parallelPointKDTree)
+	MTS_DECLARE_TEST(test05_refitParallelBVH)
+	MTS_DECLARE_TEST(test06_updateParallelBVH)
 	MTS_END_TESTCASE()
 
 	void test01_sutherlandHodgman() {
@@ -214,6 +219,145 @@ public:
 		Log(EInfo, "Normal node size = " SIZE_T_FMT " bytes", sizeof(KDTree2::NodeType));
 		Log(EInfo, "Left-balanced node size = " SIZE_T_FMT " bytes", sizeof(KDTree2Left::NodeType));
 	}
+
+	void test04_parallelPointKDTree() {
+		typedef PointKDTree< SimpleKDNode<Point2, Float> > KDTree2;
+
+		/* Use distinct coordinates, so that the serial and the
+		   parallel construction must produce the same tree */
+		size_t nPoints = 4 * MTS_KD_PARALLEL_PARTITION_THRESHOLD;
+		ref<Random> random = new Random();
+		std::vector<uint32_t> perm0(nPoints), perm1(nPoints);
+		for (size_t i=0; i<nPoints; ++i)
+			perm0[i] = perm1[i] = (uint32_t) i;
+		random->shuffle(perm0.begin(), perm0.end());
+		random->shuffle(perm1.begin(), perm1.end());
+
+		for (int heuristic=0; heuristic<3; ++heuristic) {
+			KDTree2 serial(nPoints, (KDTree2::EHeuristic) heuristic),
+				parallel(nPoints, (KDTree2::EHeuristic) heuristic);
+
+			for (size_t i=0; i<nPoints; ++i) {
+				Point2 p(perm0[i] / (Float) nPoints, perm1[i] / (Float) nPoints);
+				serial[i].setPosition(p); serial[i].setData((Float) i);
+				parallel[i].setPosition(p); parallel[i].setData((Float) i);
+			}
+
+			ref<Timer> timer = new Timer();
+			serial.setParallelBuild(false);
+			serial.build(true);
+			int serialTime = timer->getMilliseconds();
+			timer->reset();
+			parallel.build(true);
+			Log(EInfo, "Heuristic %i: serial construction = %i ms, parallel construction = %i ms",
+				heuristic, serialTime, timer->getMilliseconds());
+
+			assertEquals((int) serial.getDepth(), (int) parallel.getDepth());
+			for (size_t i=0; i<nPoints; ++i) {
+				assertTrue(serial[i].getData() == parallel[i].getData());
+				assertTrue(serial[i].isLeaf() == parallel[i].isLeaf());
+				if (!serial[i].isLeaf()) {
+					assertTrue(serial[i].getAxis() == parallel[i].getAxis());
+					assertTrue(serial[i].getRightIndex((uint32_t) i)
+						== parallel[i].getRightIndex((uint32_t) i));
+				}
+			}
+		}
+	}
+
+	/// Create a mesh of small, unconnected triangles within the unit cube
+	ref<TriMesh> createScatteredMesh(size_t nTriangles, Random *random) {
+		ref<TriMesh> mesh = new TriMesh("scatter", nTriangles, 3*nTriangles);
+		Triangle *triangles = mesh->getTriangles();
+		for (uint32_t i=0; i<(uint32_t) nTriangles; ++i)
+			for (int j=0; j<3; ++j)
+				triangles[i].idx[j] = 3*i+j;
+		scatterTriangles(mesh, random);
+		mesh->addChild(PluginManager::getInstance()->createObject(Properties("diffuse")));
+		mesh->configure();
+		return mesh;
+	}
+
+	/// Place the triangles of a mesh at random positions within the unit cube
+	void scatterTriangles(TriMesh *mesh, Random *random) {
+		Point *positions = mesh->getVertexPositions();
+		for (size_t i=0; i<mesh->getTriangleCount(); ++i) {
+			Point center(random->nextFloat(), random->nextFloat(), random->nextFloat());
+			for (int j=0; j<3; ++j)
+				positions[3*i+j] = center + Vector(random->nextFloat(),
+					random->nextFloat(), random->nextFloat()) * 0.02f;
+		}
+		mesh->updateGeometry();
+	}
+
+	/// Compare random ray queries against a brute force search
+	void checkBVHRays(const ShapeBVH *bvh, const TriMesh *mesh,
+			Random *random, size_t nRays) {
+		const Triangle *triangles = mesh->getTriangles();
+		const Point *positions = mesh->getVertexPositions();
+		for (size_t i=0; i<nRays; ++i) {
+			Point o = Point(0.5f) + warp::squareToUniformSphere(
+				Point2(random->nextFloat(), random->nextFloat())) * 2.0f;
+			Point target(random->nextFloat(), random->nextFloat(), random->nextFloat());
+			Ray ray(o, normalize(target - o), 0.0f);
+
+			Float tRef = std::numeric_limits<Float>::infinity();
+			for (size_t j=0; j<mesh->getTriangleCount(); ++j) {
+				Float u, v, t;
+				if (triangles[j].rayIntersect(positions, ray, u, v, t) && t > 0 && t < tRef)
+					tRef = t;
+			}
+			bool hitRef = tRef != std::numeric_limits<Float>::infinity();
+
+			Intersection its;
+			assertTrue(bvh->rayIntersect(ray, its) == hitRef);
+			assertTrue(bvh->rayIntersect(ray) == hitRef);
+			if (hitRef)
+				assertEqualsEpsilon(its.t, tRef, 1e-5f);
+		}
+	}
+
+	void test05_refitParallelBVH() {
+		/* Large enough to be split into subtrees that are built in parallel */
+		size_t nTriangles = 20000, nRays = 2000;
+		ref<Random> random = new Random();
+		ref<TriMesh> mesh = createScatteredMesh(nTriangles, random);
+
+		ref<ShapeBVH> bvh = new ShapeBVH();
+		bvh->setParallelBuild(true);
+		bvh->addShape(mesh);
+		bvh->build();
+
+		/* Move all triangles elsewhere, which invalidates every node */
+		scatterTriangles(mesh, random);
+		Log(EInfo, "Refitted BVH: SAH cost ratio = %.2f", bvh->refit());
+		checkBVHRays(bvh, mesh, random, nRays);
+	}
+
+	void test06_updateParallelBVH() {
+		size_t nTriangles = 20000, nRays = 1000;
+		ref<Random> random = new Random();
+		ref<TriMesh> mesh = createScatteredMesh(nTriangles, random);
+
+		ref<ShapeBVH> bvh = new ShapeBVH();
+		bvh->setParallelBuild(true);
+		bvh->addShape(mesh);
+		bvh->build();
+
+		/* Slight motion must only refit the tree */
+		Point *positions = mesh->getVertexPositions();
+		for (size_t i=0; i<mesh->getVertexCount(); ++i)
+			positions[i] += Vector(random->nextFloat(), random->nextFloat(),
+				random->nextFloat()) * 1e-3f;
+		mesh->updateGeometry();
+		assertFalse(bvh->update());
+		checkBVHRays(bvh, mesh, random, nRays);
+
+		/* Scattering the triangles degrades it enough to trigger a rebuild */
+		scatterTriangles(mesh, random);
+		assertTrue(bvh->update());
+		checkBVHRays(bvh, mesh, random, nRays);
+	}
 };
 
 MTS_EXPORT_TESTCASE(TestKDTree, "Testcase for kd-tree related code")
@@ -0,0 +1,202 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/photonmap.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/warp.h>
+
+/* The gather point grid of the SPPM integrator is part of its plugin */
+#include "../integrators/photonmapper/sppm_proc.cpp"
+
+MTS_NAMESPACE_BEGIN
+
+class TestPhotonMap : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_queryConsistency)
+	MTS_DECLARE_TEST(test02_queryBenchmark)
+	MTS_DECLARE_TEST(test03_gatherPointGridBoundaries)
+	MTS_END_TESTCASE()
+
+	typedef PhotonMap::PhotonTree PhotonTree;
+	typedef PhotonMap::SearchResult SearchResult;
+
+	/// Sums up the photon power within the search radius
+	struct PowerQuery {
+		inline PowerQuery() : power(0.0f) { }
+		inline void operator()(const Photon &photon) { power += photon.getPower(); }
+		Spectrum power;
+	};
+
+	/**
+	 * Create a photon map resembling a caustic: most photons are
+	 * concentrated in a small region of a plane
+	 */
+	void makePhotons(PhotonMap *photonMap, PhotonTree &reference,
+			Random *random, size_t nPhotons) {
+		for (size_t i=0; i<nPhotons; ++i) {
+			Point p(random->nextFloat() * 2 - 1, random->nextFloat() * 2 - 1, 0.0f);
+			if (i % 4 != 0)
+				p = Point(p.x * 0.1f, p.y * 0.1f, 0.0f);
+			Photon photon(p, Normal(0.0f, 0.0f, 1.0f), Vector(0.0f, 0.0f, -1.0f),
+				Spectrum(random->nextFloat()), 1);
+			photonMap->push_back(photon);
+			reference.push_back(photon);
+		}
+		photonMap->build();
+		reference.build();
+	}
+
+	void test01_queryConsistency() {
+		ref<Random> random = new Random();
+		size_t nPhotons = 200000;
+		ref<PhotonMap> photonMap = new PhotonMap(nPhotons);
+		PhotonTree reference(0, PhotonTree::ESlidingMidpoint);
+		makePhotons(photonMap, reference, random, nPhotons);
+
+		const size_t k = 50;
+		SearchResult results1[k+1], results2[k+1];
+
+		for (int i=0; i<1000; ++i) {
+			Point p(random->nextFloat() * 0.4f - 0.2f, random->nextFloat() * 0.4f - 0.2f,
+				random->nextFloat() * 0.01f);
+
+			/* k-nearest neighbor queries must find the same photons */
+			Float radius1 = (i % 2 == 0) ? std::numeric_limits<Float>::infinity() : 1e-4f,
+				  radius2 = radius1;
+			size_t count1 = photonMap->nnSearch(p, radius1, k, results1);
+			size_t count2 = reference.nnSearch(p, radius2, k, results2);
+			assertEquals((int) count1, (int) count2);
+			assertEquals(radius1, radius2);
+			std::sort(results1, results1 + count1, PhotonTree::SearchResultComparator());
+			std::sort(results2, results2 + count2, PhotonTree::SearchResultComparator());
+			for (size_t j=0; j<count1; ++j)
+				assertEquals(results1[j].distSquared, results2[j].distSquared);
+
+			/* Range queries must find the same number of photons and power */
+			PowerQuery query1, query2;
+			count1 = photonMap->executeQuery(p, 0.01f, query1);
+			count2 = reference.executeQuery(p, 0.01f, query2);
+			assertEquals((int) count1, (int) count2);
+			assertEqualsEpsilon(query1.power, query2.power, 1e-3f);
+		}
+	}
+
+	void test02_queryBenchmark() {
+		ref<Random> random = new Random();
+		ref<Timer> timer = new Timer();
+		size_t nPhotons = 1000000, nQueries = 50000;
+		ref<PhotonMap> photonMap = new PhotonMap(nPhotons);
+		PhotonTree reference(0, PhotonTree::ESlidingMidpoint);
+		makePhotons(photonMap, reference, random, nPhotons);
+
+		std::vector<Point> queries(nQueries);
+		for (size_t i=0; i<nQueries; ++i)
+			queries[i] = Point(random->nextFloat() * 0.2f - 0.1f,
+				random->nextFloat() * 0.2f - 0.1f, 0.0f);
+
+		Log(EInfo, "Photon map query benchmark (" SIZE_T_FMT " photons, "
+			SIZE_T_FMT " queries):", nPhotons, nQueries);
+
+		const size_t k = 100;
+		SearchResult results[k+1];
+		size_t checksum[2] = { 0, 0 };
+		int timings[2];
+
+		timer->reset();
+		for (size_t i=0; i<nQueries; ++i)
+			checksum[0] += reference.nnSearch(queries[i], k, results);
+		timings[0] = timer->getMilliseconds();
+		timer->reset();
+		for (size_t i=0; i<nQueries; ++i)
+			checksum[1] += photonMap->nnSearch(queries[i], k, results);
+		timings[1] = timer->getMilliseconds();
+		assertTrue(checksum[0] == checksum[1]);
+		Log(EInfo, "  " SIZE_T_FMT "-nn search: kd-tree = %i ms, SoA photon map = %i ms",
+			k, timings[0], timings[1]);
+
+		checksum[0] = checksum[1] = 0;
+		timer->reset();
+		for (size_t i=0; i<nQueries; ++i) {
+			PowerQuery query;
+			checksum[0] += reference.executeQuery(queries[i], 0.0025f, query);
+		}
+		timings[0] = timer->getMilliseconds();
+		timer->reset();
+		for (size_t i=0; i<nQueries; ++i) {
+			PowerQuery query;
+			checksum[1] += photonMap->executeQuery(queries[i], 0.0025f, query);
+		}
+		timings[1] = timer->getMilliseconds();
+		assertTrue(checksum[0] == checksum[1]);
+		Log(EInfo, "  Range search: kd-tree = %i ms, SoA photon map = %i ms "
+			"(%.1f photons per query)", timings[0], timings[1],
+			checksum[1] / (Float) nQueries);
+	}
+
+	void test03_gatherPointGridBoundaries() {
+		/* Put the gather points at the cell centers, so that their bounds
+		   lie on cell boundaries. Rounding then makes some of them overlap
+		   three cells along each axis (27 in total) */
+		const Float radius = 0.1f;
+		const int n = 12;
+		std::vector<std::vector<GatherPoint> > gatherBlocks(1);
+		std::vector<GatherPoint> &gatherPoints = gatherBlocks[0];
+		gatherPoints.resize(n*n*n);
+		for (int i=0; i<n*n*n; ++i) {
+			GatherPoint &gp = gatherPoints[i];
+			gp.its.p = Point(10.7f) + Vector((Float) (i % n),
+				(Float) ((i / n) % n), (Float) (i / (n*n))) * (2 * radius);
+			gp.its.shFrame = Frame(Normal(0.0f, 0.0f, 1.0f));
+			gp.radius = radius;
+			gp.depth = 0;
+		}
+		ref<GatherPointGrid> grid = new GatherPointGrid(gatherBlocks, -1);
+		assertEquals((int) grid->getGatherPointCount(), n*n*n);
+
+		/* Deposit photons just inside the gather point bounds. They face
+		   away from the gather points, hence they are counted but don't
+		   contribute any flux */
+		ref<Random> random = new Random();
+		std::vector<int> expected(gatherPoints.size(), 0);
+		for (int i=0; i<20000; ++i) {
+			const GatherPoint &gp = gatherPoints[random->nextSize(gatherPoints.size())];
+			Intersection its;
+			its.p = gp.its.p + warp::squareToUniformSphere(Point2(random->nextFloat(),
+				random->nextFloat())) * (radius * (1 - 1e-3f * random->nextFloat()));
+			its.geoFrame = its.shFrame = Frame(Normal(0.0f, 0.0f, -1.0f));
+			its.wi = Vector(0.0f, 0.0f, 1.0f);
+			grid->deposit(its, Spectrum(1.0f), 1);
+
+			for (size_t j=0; j<gatherPoints.size(); ++j)
+				if ((gatherPoints[j].its.p - its.p).lengthSquared() < radius * radius)
+					++expected[j];
+		}
+
+		/* Every gather point must see each photon within its radius once */
+		for (size_t i=0; i<gatherPoints.size(); ++i) {
+			assertEquals(expected[i], (int) gatherPoints[i].passPhotons);
+			assertTrue(gatherPoints[i].passFlux.isZero());
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestPhotonMap, "Testcase for photon map queries")
+MTS_NAMESPACE_END
@@ -0,0 +1,127 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/core/pmf.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestDiscreteDistribution : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_aliasSampling)
+	MTS_DECLARE_TEST(test02_aliasSampleReuse)
+	MTS_DECLARE_TEST(test03_benchmark)
+	MTS_END_TESTCASE()
+
+	/// Create a random distribution, which contains a few entries with zero probability
+	void makeDistribution(DiscreteDistribution &distr, Random *random, size_t size) {
+		distr.clear();
+		distr.reserve(size);
+		for (size_t i=0; i<size; ++i)
+			distr.append(i % 7 == 3 ? 0.0f : std::pow(random->nextFloat(), 4));
+		distr.normalize();
+	}
+
+	void test01_aliasSampling() {
+		ref<Random> random = new Random();
+		DiscreteDistribution distr;
+		makeDistribution(distr, random, 1000);
+		distr.buildAliasTable();
+		assertTrue(distr.hasAliasTable());
+
+		/* With a regular grid of sample values, the alias method
+		   reproduces the probabilities up to the grid resolution */
+		const size_t nSamples = 1000 * 1000;
+		std::vector<size_t> histogram(distr.size(), 0);
+		for (size_t i=0; i<nSamples; ++i) {
+			Float pdf;
+			size_t index = distr.sample((i + 0.5f) / nSamples, pdf);
+			assertEquals(pdf, distr[index]);
+			histogram[index]++;
+		}
+
+		for (size_t i=0; i<distr.size(); ++i) {
+			if (distr[i] == 0)
+				assertEquals((int) histogram[i], 0);
+			else
+				assertEqualsEpsilon(histogram[i] / (Float) nSamples, distr[i], 1e-4f);
+		}
+
+		/* Appending an entry discards the table */
+		distr.append(1.0f);
+		assertFalse(distr.hasAliasTable());
+	}
+
+	void test02_aliasSampleReuse() {
+		ref<Random> random = new Random();
+		DiscreteDistribution distr;
+		makeDistribution(distr, random, 100);
+		distr.buildAliasTable();
+
+		/* The reused sample must be uniformly distributed on [0, 1) */
+		const size_t nSamples = 1000000, nBins = 10;
+		std::vector<size_t> histogram(nBins, 0);
+		for (size_t i=0; i<nSamples; ++i) {
+			Float sample = random->nextFloat(), pdf;
+			size_t index = distr.sampleReuse(sample, pdf);
+			assertTrue(distr[index] > 0);
+			assertTrue(sample >= 0 && sample < 1);
+			histogram[std::min((size_t) (sample * nBins), nBins - 1)]++;
+		}
+
+		for (size_t i=0; i<nBins; ++i)
+			assertEqualsEpsilon(histogram[i] / (Float) nSamples, 1.0f / nBins, 5e-3f);
+	}
+
+	void test03_benchmark() {
+		ref<Random> random = new Random();
+		ref<Timer> timer = new Timer();
+		const size_t nSamples = 10000000;
+
+		Log(EInfo, "Discrete distribution sampling benchmark:");
+		for (size_t size = 16; size <= (1 << 20); size *= 16) {
+			DiscreteDistribution distr;
+			makeDistribution(distr, random, size);
+
+			std::vector<Float> samples(1 << 16);
+			for (size_t i=0; i<samples.size(); ++i)
+				samples[i] = random->nextFloat();
+
+			int timings[2];
+			size_t checksum = 0;
+			for (int mode=0; mode<2; ++mode) {
+				if (mode == 1)
+					distr.buildAliasTable();
+				timer->reset();
+				for (size_t i=0; i<nSamples; ++i)
+					checksum += distr.sample(samples[i & (samples.size() - 1)]);
+				timings[mode] = timer->getMilliseconds();
+			}
+
+			Log(EInfo, "  " SIZE_T_FMT " entries: CDF = %i ms, alias table = %i ms "
+				"(" SIZE_T_FMT " samples, checksum " SIZE_T_FMT ")", size,
+				timings[0], timings[1], nSamples, checksum);
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestDiscreteDistribution, "Testcase for discrete distribution sampling")
+MTS_NAMESPACE_END
@@ -0,0 +1,209 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/core/sched.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Work unit storing the index of a task
+class IndexWorkUnit : public WorkUnit {
+public:
+	inline IndexWorkUnit() : m_index(0) { }
+
+	void set(const WorkUnit *wu) {
+		m_index = static_cast<const IndexWorkUnit *>(wu)->m_index;
+	}
+	void load(Stream *stream) { m_index = stream->readInt(); }
+	void save(Stream *stream) const { stream->writeInt(m_index); }
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "IndexWorkUnit[index=" << m_index << "]";
+		return oss.str();
+	}
+
+	inline int getIndex() const { return m_index; }
+	inline void setIndex(int index) { m_index = index; }
+
+	MTS_DECLARE_CLASS()
+private:
+	int m_index;
+};
+
+/// Work result storing the index of a task and the value computed for it
+class IndexWorkResult : public WorkResult {
+public:
+	inline IndexWorkResult() : m_index(0), m_value(0) { }
+
+	void load(Stream *stream) {
+		m_index = stream->readInt();
+		m_value = stream->readInt();
+	}
+	void save(Stream *stream) const {
+		stream->writeInt(m_index);
+		stream->writeInt(m_value);
+	}
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "IndexWorkResult[index=" << m_index
+			<< ", value=" << m_value << "]";
+		return oss.str();
+	}
+
+	inline int getIndex() const { return m_index; }
+	inline int getValue() const { return m_value; }
+	inline void set(int index, int value) { m_index = index; m_value = value; }
+
+	MTS_DECLARE_CLASS()
+private:
+	int m_index, m_value;
+};
+
+/// Squares the index of every work unit
+class SquareWorkProcessor : public WorkProcessor {
+public:
+	SquareWorkProcessor() : WorkProcessor() { }
+	SquareWorkProcessor(Stream *stream, InstanceManager *manager)
+		: WorkProcessor(stream, manager) { }
+	void serialize(Stream *stream, InstanceManager *manager) const { }
+
+	ref<WorkUnit> createWorkUnit() const { return new IndexWorkUnit(); }
+	ref<WorkResult> createWorkResult() const { return new IndexWorkResult(); }
+	ref<WorkProcessor> clone() const { return new SquareWorkProcessor(); }
+	void prepare() { }
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		int index = static_cast<const IndexWorkUnit *>(workUnit)->getIndex();
+		static_cast<IndexWorkResult *>(workResult)->set(index, index * index);
+	}
+
+	MTS_DECLARE_CLASS()
+};
+
+/// Parallel process that generates a fixed number of work units
+class SquareProcess : public ParallelProcess {
+public:
+	SquareProcess(int count) : m_count(count), m_next(0),
+		m_received(count, 0), m_failures(0) {
+		m_mutex = new Mutex();
+	}
+
+	EStatus generateWork(WorkUnit *unit, int worker) {
+		if (m_next >= m_count)
+			return EFailure;
+		static_cast<IndexWorkUnit *>(unit)->setIndex(m_next++);
+		return ESuccess;
+	}
+
+	void processResult(const WorkResult *result, bool cancelled) {
+		const IndexWorkResult *wr = static_cast<const IndexWorkResult *>(result);
+		LockGuard lock(m_mutex);
+		if (wr->getIndex() < 0 || wr->getIndex() >= m_count
+				|| wr->getValue() != wr->getIndex() * wr->getIndex())
+			++m_failures;
+		else
+			++m_received[wr->getIndex()];
+	}
+
+	ref<WorkProcessor> createWorkProcessor() const {
+		return new SquareWorkProcessor();
+	}
+
+	bool isLocal() const { return true; }
+
+	std::vector<std::string> getRequiredPlugins() {
+		return std::vector<std::string>();
+	}
+
+	/// Was every work unit processed exactly once?
+	bool isComplete() const {
+		if (m_failures > 0)
+			return false;
+		for (int i=0; i<m_count; ++i) {
+			if (m_received[i] != 1)
+				return false;
+		}
+		return true;
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~SquareProcess() { }
+private:
+	int m_count, m_next;
+	std::vector<int> m_received;
+	int m_failures;
+	ref<Mutex> m_mutex;
+};
+
+class TestScheduler : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_singleProcess)
+	MTS_DECLARE_TEST(test02_concurrentProcesses)
+	MTS_DECLARE_TEST(test03_idleWorkers)
+	MTS_END_TESTCASE()
+
+	void test01_singleProcess() {
+		/* Many more work units than batches, so that the workers queue
+		   and steal them */
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<SquareProcess> proc = new SquareProcess(100 * MTS_SCHED_BATCH_SIZE + 3);
+		sched->schedule(proc);
+		sched->wait(proc);
+		assertTrue(proc->getReturnStatus() == ParallelProcess::ESuccess);
+		assertTrue(proc->isComplete());
+	}
+
+	void test02_concurrentProcesses() {
+		/* Queued work units of one process may be stolen by a worker
+		   that last worked on another one */
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref_vector<SquareProcess> procs;
+		for (int i=0; i<8; ++i) {
+			procs.push_back(new SquareProcess(50 + 7*i));
+			sched->schedule(procs[i]);
+		}
+		for (size_t i=0; i<procs.size(); ++i) {
+			sched->wait(procs[i]);
+			assertTrue(procs[i]->getReturnStatus() == ParallelProcess::ESuccess);
+			assertTrue(procs[i]->isComplete());
+		}
+	}
+
+	void test03_idleWorkers() {
+		/* Workers that went to sleep without any queued work units
+		   must wake up for new processes */
+		ref<Scheduler> sched = Scheduler::getInstance();
+		for (int i=0; i<20; ++i) {
+			ref<SquareProcess> proc = new SquareProcess(1 + i);
+			sched->schedule(proc);
+			sched->wait(proc);
+			assertTrue(proc->isComplete());
+			Thread::sleep(5);
+		}
+	}
+};
+
+MTS_IMPLEMENT_CLASS(IndexWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(IndexWorkResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(SquareWorkProcessor, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(SquareProcess, false, ParallelProcess)
+MTS_EXPORT_TESTCASE(TestScheduler, "Testcase for the work unit scheduler")
+MTS_NAMESPACE_END
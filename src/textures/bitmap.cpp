@@ -75,6 +75,11 @@ MTS_NAMESPACE_BEGIN
  *        \emph{filename}\code{.mip} to be created.
  *        \default{automatic---use caching for textures larger than 1M pixels.}
  *     }
+ *     \parameter{tiled}{\Boolean}{
+ *        Store the MIP map cache file using a tiled layout, whose tiles are
+ *        only read from disk when they are needed (see below). This implies
+ *        \code{cache=true}. \default{\code{false}}
+ *     }
  *     \parameter{uoffset, voffset}{\Float}{
  *       Numerical offset that should be applied to UV lookups
  *     }
@@ -155,6 +160,16 @@ MTS_NAMESPACE_BEGIN
  *    Mitsuba is able to work with truly massive textures that would otherwise exhaust the main system memory.
  * \end{enumerate}
  *
+ * When a scene contains a large number of high-resolution textures, even memory-mapping
+ * their caches can exhaust the main memory, since large parts of the mapped files end up
+ * being accessed. Setting the \code{tiled} parameter to \code{true} instead splits every
+ * MIP map level into tiles of $64\times 64$ texels. During rendering, only the tiles that are
+ * touched by texture lookups are read into a texture cache shared by all textures, which
+ * evicts the least recently used tiles when its memory budget is exceeded. The budget
+ * defaults to 512 MiB and can be changed using the \code{-m} parameter of the \code{mitsuba}
+ * executable. The ``Texture tile cache'' statistics printed after rendering show the hit
+ * rate of this cache---a low rate suggests that the budget should be increased.
+ *
  * The texture caches are automatically regenerated when the input texture is modified.
  * Of course, the cache files can be cumbersome when they are not needed anymore. On Linux
  * or Mac OS, they can safely be deleted by executing the following command within a scene directory.
@@ -179,6 +194,8 @@ public:
 	BitmapTexture(const Properties &props) : Texture2D(props) {
 		uint64_t timestamp = 0;
 		bool tryReuseCache = false;
+		bool tiled = props.getBoolean("tiled", false);
+		int logTileSize = tiled ? MTS_MIPMAP_LOG_TILE_SIZE : 0;
 		fs::path cacheFile;
 		ref<Bitmap> bitmap;
 
@@ -207,7 +224,7 @@ public:
 			else
 				cacheFile.replace_extension(formatString(".%s.mip", m_channel.c_str()));
 
-			tryReuseCache = fs::exists(cacheFile) && props.getBoolean("cache", true);
+			tryReuseCache = fs::exists(cacheFile) && (tiled || props.getBoolean("cache", true));
 		}
 
 		std::string filterType = boost::to_lower_copy(props.getString("filterType", "ewa"));
@@ -235,11 +252,11 @@ public:
 			m_maxAnisotropy = 1.0f;
 
 		if (tryReuseCache && MIPMap3::validateCacheFile(cacheFile, timestamp,
-				Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
+				Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma, logTileSize)) {
 			/* Reuse an existing MIP map cache file */
 			m_mipmap3 = new MIPMap3(cacheFile, m_maxAnisotropy);
 		} else if (tryReuseCache && MIPMap1::validateCacheFile(cacheFile, timestamp,
-				Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
+				Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma, logTileSize)) {
 			/* Reuse an existing MIP map cache file */
 			m_mipmap1 = new MIPMap1(cacheFile, m_maxAnisotropy);
 		} else {
@@ -286,8 +303,9 @@ public:
 				MTS_CLASS(ReconstructionFilter), rfilterProps));
 			rfilter->configure();
 
-			/* Potentially create a new MIP map cache file */
-			bool createCache = !cacheFile.empty() && props.getBoolean("cache",
+			/* Potentially create a new MIP map cache file. Tiled cache
+			   files are written after building the MIP map in memory */
+			bool createCache = !cacheFile.empty() && !tiled && props.getBoolean("cache",
 				bitmap->getSize().x * bitmap->getSize().y > 1024*1024);
 
 			if (pixelFormat == Bitmap::ELuminance)
@@ -298,6 +316,25 @@ public:
 				m_mipmap3 = new MIPMap3(bitmap, pixelFormat, Bitmap::EFloat,
 					rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
 					createCache ? cacheFile : fs::path(), timestamp);
+
+			if (tiled && !cacheFile.empty()) {
+				/* Replace the in-memory MIP map by the paged version */
+				Float gamma = bitmap->getGamma();
+				bitmap = NULL;
+				try {
+					if (m_mipmap1.get()) {
+						m_mipmap1->writeTiledCacheFile(cacheFile, timestamp, gamma);
+						m_mipmap1 = new MIPMap1(cacheFile, m_maxAnisotropy);
+					} else {
+						m_mipmap3->writeTiledCacheFile(cacheFile, timestamp, gamma);
+						m_mipmap3 = new MIPMap3(cacheFile, m_maxAnisotropy);
+					}
+				} catch (const std::exception &e) {
+					Log(EWarn, "Unable to create the tiled MIP map cache file \"%s\" -- "
+						"keeping the texture in memory. Error message was: %s",
+						cacheFile.string().c_str(), e.what());
+				}
+			}
 		}
 	}
 
@@ -498,6 +535,55 @@ public:
 		return result;
 	}
 
+	void evalBatch(const Point2 *uv, const Vector2 *d0, const Vector2 *d1,
+			Spectrum *result, size_t count) const {
+		stats::filteredLookups.incrementBase(count);
+
+		if (d0) {
+			stats::filteredLookups += count;
+			if (m_mipmap3.get()) {
+				for (size_t i=0; i<count; ++i) {
+					Color3 value = m_mipmap3->eval(uv[i], d0[i], d1[i]);
+					result[i].fromLinearRGB(value[0], value[1], value[2]);
+				}
+			} else {
+				for (size_t i=0; i<count; ++i)
+					result[i] = Spectrum(m_mipmap1->eval(uv[i], d0[i], d1[i])[0]);
+			}
+			return;
+		}
+
+		/* Unfiltered lookups: same as eval(uv), but with one
+		   tile cache access per batch and vectorized setup */
+		if (m_mipmap3.get()) {
+			Color3 values[MTS_SHADING_BATCH_SIZE];
+			for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+				size_t size = std::min(count - start, (size_t) MTS_SHADING_BATCH_SIZE);
+				if (m_mipmap3->getFilterType() != ENearest) {
+					m_mipmap3->evalBilinearBatch(0, uv + start, values, size);
+				} else {
+					for (size_t i=0; i<size; ++i)
+						values[i] = m_mipmap3->evalBox(0, uv[start + i]);
+				}
+				for (size_t i=0; i<size; ++i)
+					result[start + i].fromLinearRGB(values[i][0], values[i][1], values[i][2]);
+			}
+		} else {
+			Color1 values[MTS_SHADING_BATCH_SIZE];
+			for (size_t start=0; start<count; start += MTS_SHADING_BATCH_SIZE) {
+				size_t size = std::min(count - start, (size_t) MTS_SHADING_BATCH_SIZE);
+				if (m_mipmap1->getFilterType() != ENearest) {
+					m_mipmap1->evalBilinearBatch(0, uv + start, values, size);
+				} else {
+					for (size_t i=0; i<size; ++i)
+						values[i] = m_mipmap1->evalBox(0, uv[start + i]);
+				}
+				for (size_t i=0; i<size; ++i)
+					result[start + i] = Spectrum(values[i][0]);
+			}
+		}
+	}
+
 	Spectrum getAverage() const {
 		Spectrum result;
 		if (m_mipmap3.get()) {
@@ -34,20 +34,23 @@ public:
 		cout << "Synopsis: kd-tree performance benchmark. Traces uniformly distributed rays" << endl;
 		cout << "though the bounding sphere of a scene and reports the resulting number of" << endl;
 		cout << "rays per second. The main intent of this utility is to optimize the kd-tree" << endl;
-		cout << "construction parameters for particular scenes and machines." << endl;
+		cout << "construction parameters for particular scenes and machines, and to compare" << endl;
+		cout << "it against the BVH." << endl;
 		cout << endl;
 		cout << "Usage: mtsutil kdbench [options] <Scene XML file or PLY file>" << endl;
 		cout << "Options/Arguments:" << endl;
 		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -a kdtree/bvh  Select the acceleration data structure (default: kd-tree," << endl;
+		cout << "                  or whatever the scene specifies)" << endl << endl;
 		cout << "   -t value       Specify the SAH traversal cost" << endl << endl;
 		cout << "   -i value       Specify the SAH intersection cost" << endl << endl;
 		cout << "   -e value       Specify the SAH empty space bonus" << endl << endl;
-		cout << "   -b value       Specify the number of min-max bins" << endl << endl;
+		cout << "   -b value       Specify the number of min-max bins (BVH: SAH bins)" << endl << endl;
 		cout << "   -c true/false  Enable/disable primitive clipping (aka. \"perfect splits\")" << endl << endl;
 		cout << "   -p true/false  Enable/disable parallel tree construction" << endl << endl;
 		cout << "   -r true/false  Enable/disable retraction of bad splits" << endl << endl;
 		cout << "   -l value       Specify the primitive count, below which a leaf node" << endl;
-		cout << "                  will always be created" << endl << endl;
+		cout << "                  will always be created (BVH: maximum leaf size)" << endl << endl;
 		cout << "   -d depth       Specify the maximum tree depth" << endl << endl;
 	 	cout << "   -x value       Specify the number of primitives, at which the " << endl;
 		cout << "                  builder will switch from (approximate) Min-Max " << endl;
@@ -71,10 +74,11 @@ public:
 		Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
 		int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
 		bool clip = true, parallel = true, retract = true, fitParameters = false;
+		std::string accel;
 		optind = 1;
 
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
 			switch (optchar) {
 				case 'h': {
 						help();
@@ -84,6 +88,11 @@ public:
 				case 'f':
 					fitParameters = true;
 					break;
+				case 'a':
+					accel = optarg;
+					if (accel != "kdtree" && accel != "bvh")
+						SLog(EError, "Could not parse the acceleration data structure!");
+					break;
 				case 'i':
 					intersectionCost = (Float) strtod(optarg, &end_ptr);
 					if (*end_ptr != '\0')
@@ -153,6 +162,7 @@ public:
 
 		ref<Scene> scene;
 		ref<ShapeKDTree> kdtree;
+		ref<ShapeBVH> bvh;
 
 		std::string lowercase = boost::to_lower_copy(std::string(argv[optind]));
 		if (boost::ends_with(lowercase, ".xml")) {
@@ -165,6 +175,11 @@ public:
 			Thread::getThread()->setFileResolver(frClone);
 			scene = loadScene(argv[optind]);
 			kdtree = scene->getKDTree();
+			if (accel == "bvh" && !scene->getBVH())
+				scene->setBVH(new ShapeBVH());
+			else if (accel == "kdtree")
+				scene->setBVH(NULL);
+			bvh = scene->getBVH();
 		} else if (boost::ends_with(lowercase, ".ply")) {
 			Properties props("ply");
 			props.setString("filename", argv[optind]);
@@ -174,6 +189,10 @@ public:
 			mesh->configure();
 			kdtree = new ShapeKDTree();
 			kdtree->addShape(mesh);
+			if (accel == "bvh") {
+				bvh = new ShapeBVH();
+				bvh->addShape(mesh);
+			}
 		} else {
 			Log(EError, "The supplied scene filename must end in either PLY or XML!");
 		}
@@ -196,6 +215,16 @@ public:
 		kdtree->setRetract(retract);
 		kdtree->setParallelBuild(parallel);
 
+		if (bvh) {
+			if (stopPrims != -1)
+				bvh->setLeafSize(stopPrims);
+			if (minMaxBins != -1)
+				bvh->setBinCount(minMaxBins);
+			bvh->setParallelBuild(parallel);
+			if (fitParameters)
+				Log(EError, "The -f option is only supported by the kd-tree!");
+		}
+
 		/* Show some statistics, and make sure it roughly fits in 80cols */
 		Logger *logger = Thread::getThread()->getLogger();
 		DefaultFormatter *formatter = ((DefaultFormatter *) logger->getFormatter());
@@ -204,10 +233,12 @@ public:
 
 		if (scene)
 			scene->initialize();
+		else if (bvh)
+			bvh->build();
 		else
 			kdtree->build();
 
-		BSphere bsphere(kdtree->getAABB().getBSphere());
+		BSphere bsphere((bvh ? bvh->getAABB() : kdtree->getAABB()).getBSphere());
 		const size_t nRays = 5000000;
 
 		if (!fitParameters) {
@@ -228,7 +259,7 @@ public:
 					Ray r(p1, normalize(p2-p1), 0.0f);
 
 					Intersection its;
-					if (kdtree->rayIntersect(r, its))
+					if (bvh ? bvh->rayIntersect(r, its) : kdtree->rayIntersect(r, its))
 						nIntersections++;
 				}
 
@@ -128,6 +128,10 @@ public:
 		return m_float;
 	}
 
+	void getFloatRange(const AABB &aabb, Float &min, Float &max) const {
+		min = max = m_float;
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "ConstantDataSource[value=";
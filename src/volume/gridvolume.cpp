@@ -584,6 +584,46 @@ public:
 		return 1.0f;
 	}
 
+	void getFloatRange(const AABB &aabb, Float &min, Float &max) const {
+		if (m_channels != 1 || (m_volumeType != EFloat32 && m_volumeType != EUInt8)) {
+			VolumeDataSource::getFloatRange(aabb, min, max);
+			return;
+		}
+
+		AABB gridAABB;
+		for (int i=0; i<8; ++i)
+			gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+
+		/* Determine all voxels that could contribute to a trilinearly
+		   interpolated lookup within 'aabb'. Lookups outside of the
+		   interior of the grid return zero. */
+		Vector3i start, end;
+		bool outside = false;
+		for (int i=0; i<3; ++i) {
+			start[i] = math::floorToInt(gridAABB.min[i]);
+			end[i] = math::floorToInt(gridAABB.max[i]) + 1;
+			if (start[i] < 0 || end[i] >= m_res[i])
+				outside = true;
+			start[i] = std::max(start[i], 0);
+			end[i] = std::min(end[i], m_res[i] - 1);
+		}
+
+		min = outside ? 0.0f : std::numeric_limits<Float>::infinity();
+		max = outside ? 0.0f : -std::numeric_limits<Float>::infinity();
+		for (int z=start.z; z<=end.z; ++z) {
+			for (int y=start.y; y<=end.y; ++y) {
+				size_t index = ((size_t) z*m_res.y + y)*m_res.x + start.x;
+				for (int x=start.x; x<=end.x; ++x, ++index) {
+					Float value = m_volumeType == EFloat32
+						? (Float) ((const float *) m_data)[index]
+						: m_densityMap[m_data[index]];
+					min = std::min(min, value);
+					max = std::max(max, value);
+				}
+			}
+		}
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "GridVolume[" << endl
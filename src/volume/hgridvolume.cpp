@@ -196,6 +196,40 @@ public:
 		return m_maxFloatValue;
 	}
 
+	void getFloatRange(const AABB &aabb, Float &min, Float &max) const {
+		AABB gridAABB;
+		for (int i=0; i<8; ++i)
+			gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+
+		Vector3i start, end;
+		bool outside = false;
+		for (int i=0; i<3; ++i) {
+			start[i] = math::floorToInt(gridAABB.min[i]);
+			end[i] = math::floorToInt(gridAABB.max[i]);
+			if (start[i] < 0 || end[i] >= m_res[i])
+				outside = true;
+			start[i] = std::max(start[i], 0);
+			end[i] = std::min(end[i], m_res[i] - 1);
+		}
+
+		/* Combine the ranges of all blocks overlapping 'aabb'. Lookups
+		   within empty blocks or outside of the grid return zero */
+		min = outside ? 0.0f : std::numeric_limits<Float>::infinity();
+		max = outside ? 0.0f : -std::numeric_limits<Float>::infinity();
+		for (int z=start.z; z<=end.z; ++z) {
+			for (int y=start.y; y<=end.y; ++y) {
+				for (int x=start.x; x<=end.x; ++x) {
+					VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+					Float blockMin = 0.0f, blockMax = 0.0f;
+					if (block != NULL)
+						block->getFloatRange(aabb, blockMin, blockMax);
+					min = std::min(min, blockMin);
+					max = std::max(max, blockMax);
+				}
+			}
+		}
+	}
+
 	MTS_DECLARE_CLASS()
 protected:
 	std::string m_filename, m_prefix, m_postfix;
@@ -321,6 +321,32 @@ public:
 		return m_nested->getMaximumFloatValue();
 	}
 
+	void getFloatRange(const AABB &aabb, Float &min, Float &max) const {
+		/* Determine the range of cache voxels that could be involved in
+		   lookups within 'aabb' and pass the positions, at which they
+		   were sampled from the nested data source, on to it */
+		AABB gridAABB;
+		for (int i=0; i<8; ++i)
+			gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+
+		AABB region;
+		for (int i=0; i<2; ++i) {
+			const Point &p = i == 0 ? gridAABB.min : gridAABB.max;
+			Point q;
+			for (int j=0; j<3; ++j) {
+				int index = std::max(0, std::min(m_cellCount[j],
+					math::floorToInt(p[j]) + i));
+				q[j] = m_aabb.min[j] + index * m_voxelWidth;
+			}
+			region.expandBy(q);
+		}
+		m_nested->getFloatRange(region, min, max);
+
+		/* Lookups outside of the cached region return zero */
+		if (!m_aabb.contains(aabb))
+			min = std::min(min, (Float) 0.0f);
+	}
+
 	MTS_DECLARE_CLASS()
 protected:
 	ref<VolumeDataSource> m_nested;